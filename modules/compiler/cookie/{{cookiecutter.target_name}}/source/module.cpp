@@ -116,11 +116,11 @@ compiler::Result {{cookiecutter.target_name.capitalize()}}Module::createBinary(c
   {
     compiler::Result err = compiler::Result::FAILURE;
     llvm::CrashRecoveryContext CRC;
-    llvm::CrashRecoveryContext::Enable();
+    compiler::utils::enableCrashRecovery();
     bool crashed = !CRC.RunSafely([&] {
       err = compiler::emitCodeGenFile(*finalized_llvm_module, TM, ostream);
     });
-    llvm::CrashRecoveryContext::Disable();
+    compiler::utils::disableCrashRecovery();
     if (crashed) {
       return compiler::Result::FINALIZE_PROGRAM_FAILURE;
     }
@@ -145,7 +145,7 @@ compiler::Result {{cookiecutter.target_name.capitalize()}}Module::createBinary(c
   {
     bool linkSuccess = false;
     llvm::CrashRecoveryContext CRC;
-    llvm::CrashRecoveryContext::Enable();
+    compiler::utils::enableCrashRecovery();
     bool crashed = !CRC.RunSafely([&] {
       auto linkResult = compiler::utils::lldLinkToBinary(
           inputBinary, getTarget().hal_device_info->linker_script,
@@ -165,7 +165,7 @@ compiler::Result {{cookiecutter.target_name.capitalize()}}Module::createBinary(c
       std::memcpy(object_code.data(), (*linkResult)->getBufferStart(), size);
       linkSuccess = true;
     });
-    llvm::CrashRecoveryContext::Disable();
+    compiler::utils::disableCrashRecovery();
     if (crashed || !linkSuccess) {
       return compiler::Result::LINK_PROGRAM_FAILURE;
     }
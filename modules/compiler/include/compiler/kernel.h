@@ -103,6 +103,23 @@ class Kernel {
   createSpecializedKernel(
       const mux_ndrange_options_t &specialization_options) = 0;
 
+  /// @brief Creates a binary like `createSpecializedKernel`, for a single
+  /// enqueue which does not keep the binary once it has run.
+  ///
+  /// As the binary is not reused, a target may return a kernel which is not
+  /// specialized for `specialization_options`, e.g. while it is still being
+  /// optimized for them in the background. Callers which keep the binary, such
+  /// as when recording a command buffer, must use `createSpecializedKernel`.
+  ///
+  /// @param specialization_options Mux execution options to specialize for.
+  ///
+  /// @return See `createSpecializedKernel`.
+  virtual cargo::expected<cargo::dynamic_array<uint8_t>, Result>
+  createSpecializedKernelForEnqueue(
+      const mux_ndrange_options_t &specialization_options) {
+    return createSpecializedKernel(specialization_options);
+  }
+
   /// @brief Returns the sub-group size for this kernel.
   ///
   /// This function queries a kernel for maximum sub-group size that would exist
@@ -107,7 +107,8 @@ struct Options {
         prevec_mode(PreVectorizationMode::DEFAULT),
         vectorization_mode(VectorizationMode::DEFAULT),
         llvm_stats(false),
-        single_precision_constant(false) {}
+        single_precision_constant(false),
+        lazy_finalize(false) {}
 
   /// @brief List of preprocessor macro definition.
   std::vector<std::string> definitions;
@@ -167,6 +168,9 @@ struct Options {
   std::string source_file_in;
   /// @brief Treat double constants as single-precision constants
   bool single_precision_constant;
+  /// @brief Defer the optimization of each kernel until it is first needed,
+  /// on targets supporting deferred compilation.
+  bool lazy_finalize;
   /// @brief List of local sizes that kernel compilation pre-caching has been
   /// requested for.
   ///
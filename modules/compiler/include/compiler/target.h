@@ -28,6 +28,7 @@
 #include <mux/mux.h>
 
 #include <map>
+#include <string>
 
 namespace compiler {
 /// @addtogroup compiler
@@ -82,6 +83,16 @@ class Target {
   /// @brief Returns the compiler info associated with this target.
   virtual const compiler::Info *getCompilerInfo() const = 0;
 
+  /// @brief Returns a string identifying the code this target generates,
+  /// beyond what its device name implies.
+  ///
+  /// Binaries from targets with different identifiers are not interchangeable,
+  /// for example when they are tuned for a CPU chosen at runtime. The
+  /// identifier is part of the key of the persistent program binary cache.
+  ///
+  /// @return The identifier, empty if the device name is enough.
+  virtual std::string getTargetIdentifier() const { return {}; }
+
 };  // class Target
 
 /// @}
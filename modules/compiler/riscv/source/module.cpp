@@ -69,17 +69,17 @@ compiler::Result RiscvModule::createBinary(
   llvm::raw_svector_ostream ostream(objectBinary);
 
   /// Set up an error handler to redirect fatal errors to the build log.
-  const llvm::ScopedFatalErrorHandler error_handler(
+  const compiler::utils::ScopedFatalErrorHandler error_handler(
       BaseModule::llvmFatalErrorHandler, this);
 
   {
     compiler::Result err = compiler::Result::FAILURE;
     llvm::CrashRecoveryContext CRC;
-    llvm::CrashRecoveryContext::Enable();
+    compiler::utils::enableCrashRecovery();
     const bool crashed = !CRC.RunSafely([&] {
       err = compiler::emitCodeGenFile(*finalized_llvm_module, TM, ostream);
     });
-    llvm::CrashRecoveryContext::Disable();
+    compiler::utils::disableCrashRecovery();
     if (crashed) {
       return compiler::Result::FINALIZE_PROGRAM_FAILURE;
     }
@@ -104,7 +104,7 @@ compiler::Result RiscvModule::createBinary(
   {
     bool linkSuccess = false;
     llvm::CrashRecoveryContext CRC;
-    llvm::CrashRecoveryContext::Enable();
+    compiler::utils::enableCrashRecovery();
     const bool crashed = !CRC.RunSafely([&] {
       auto linkResult = compiler::utils::lldLinkToBinary(
           inputBinary, getTarget().riscv_hal_device_info->linker_script,
@@ -124,7 +124,7 @@ compiler::Result RiscvModule::createBinary(
       std::memcpy(object_code.data(), (*linkResult)->getBufferStart(), size);
       linkSuccess = true;
     });
-    llvm::CrashRecoveryContext::Disable();
+    compiler::utils::disableCrashRecovery();
     if (crashed || !linkSuccess) {
       return compiler::Result::LINK_PROGRAM_FAILURE;
     }
@@ -70,6 +70,14 @@ class BaseModule : public Module {
   /// @brief Clear out the stored data.
   void clear() override;
 
+  /// @brief Whether `finalize` left the optimizations added by
+  /// `addKernelOptimizationPasses` to be run on each kernel when it is needed,
+  /// because the module was built with `-cl-lazy-finalize`.
+  ///
+  /// Targets must then run them on the kernels in `createKernel`, and on the
+  /// finalized module before creating a binary from it.
+  bool hasDeferredOptimizations() const { return deferred_optimizations; }
+
   /// @brief Get a reference to the compiler options that will be used by this
   /// module.
   ///
@@ -519,6 +527,9 @@ class BaseModule : public Module {
 
   ModuleState state;
 
+  /// @brief See `hasDeferredOptimizations`.
+  bool deferred_optimizations = false;
+
   std::unique_ptr<llvm::Module> llvm_module;
 
   // Diagnostics state.
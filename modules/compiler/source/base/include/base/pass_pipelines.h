@@ -94,6 +94,17 @@ void addLLVMDefaultPerModulePipeline(llvm::ModulePassManager &PM,
                                      llvm::PassBuilder &PB,
                                      const compiler::Options &options);
 
+/// @brief Adds the optimization passes `BaseModule::finalize` runs over every
+/// kernel: early loop and SLP vectorization, scalar cleanups and inlining.
+///
+/// These dominate the cost of finalizing large programs. With the
+/// `-cl-lazy-finalize` build option, targets supporting deferred compilation
+/// run them on each kernel when it is first needed instead, see
+/// `BaseModule::hasDeferredOptimizations`.
+void addKernelOptimizationPasses(llvm::ModulePassManager &PM,
+                                 llvm::PassBuilder &PB,
+                                 const compiler::Options &options);
+
 /// @brief Invokes the LLVM backend to produce an object binary
 ///
 /// @param M Module to compile
@@ -17,6 +17,8 @@
 #ifndef COMPILER_BASE_TARGET_H
 #define COMPILER_BASE_TARGET_H
 
+#include <cargo/array_view.h>
+#include <cargo/expected.h>
 #include <cargo/optional.h>
 #include <compiler/target.h>
 #include <llvm/IR/DiagnosticInfo.h>
@@ -50,6 +52,18 @@ class BaseTarget : public Target {
 
   virtual llvm::Module *getBuiltins() const = 0;
 
+  /// @brief Load the embedded builtins selected by `init` into an LLVM context.
+  ///
+  /// Functions and metadata are materialized on demand. This allows pipelines
+  /// to run in other LLVM contexts than the target's, e.g. on other threads.
+  ///
+  /// @param[in] llvm_context LLVM context to load the builtins into.
+  ///
+  /// @return Returns the builtins module, which is null if the target has no
+  /// embedded builtins, or `Result::FAILURE` if they could not be loaded.
+  cargo::expected<std::unique_ptr<llvm::Module>, Result> loadBuiltins(
+      llvm::LLVMContext &llvm_context) const;
+
   NotifyCallbackFn getNotifyCallbackFn() const { return callback; }
 
   /// @brief Returns the (non-null) LLVMContext.
@@ -75,6 +89,10 @@ class BaseTarget : public Target {
   compiler::BaseContext &context;
 
   NotifyCallbackFn callback;
+
+  /// @brief Bitcode of the embedded builtins selected by `init`, empty if
+  /// there are none.
+  cargo::array_view<const uint8_t> builtins_bitcode;
 };
 
 /// @brief A utility class for an ahead-of-time compilation target.
@@ -28,8 +28,17 @@
 namespace compiler {
 BaseContext::BaseContext() {
 #if !defined(NDEBUG) || defined(CA_ENABLE_LLVM_OPTIONS_IN_RELEASE)
-  static std::once_flag parseEnvironmentOptionsFlag;
-  std::call_once(parseEnvironmentOptionsFlag, [this]() {
+  // LLVM's command-line options are process-wide, parse them once and keep a
+  // copy of the values we need so that every context, and every compilation
+  // running in parallel, reads them without touching LLVM's global state.
+  struct Options {
+    bool verify_each = false;
+    bool time_passes = false;
+    compiler::utils::DebugLogging debug_passes =
+        compiler::utils::DebugLogging::None;
+  };
+  static const Options options = [] {
+    Options options;
     const char *argv[] = {"ComputeAortaCL"};
     const std::lock_guard<std::mutex> lock(
         compiler::utils::getLLVMGlobalMutex());
@@ -39,21 +48,25 @@ BaseContext::BaseContext() {
         llvm::cl::getRegisteredOptions();
 
     if (const auto *opt = opt_map.lookup("time-passes")) {
-      llvm_time_passes =
+      options.time_passes =
           static_cast<const llvm::cl::opt<bool, true> *>(opt)->getValue();
     }
 
     if (const auto *opt = opt_map.lookup("verify-each")) {
-      llvm_verify_each =
+      options.verify_each =
           static_cast<const llvm::cl::opt<bool> *>(opt)->getValue();
     }
 
     if (const auto *opt = opt_map.lookup("debug-pass-manager")) {
-      llvm_debug_passes =
+      options.debug_passes =
           static_cast<const llvm::cl::opt<compiler::utils::DebugLogging> *>(opt)
               ->getValue();
     }
-  });
+    return options;
+  }();
+  llvm_verify_each = options.verify_each;
+  llvm_time_passes = options.time_passes;
+  llvm_debug_passes = options.debug_passes;
 #endif
 }
 
@@ -16,14 +16,12 @@
 
 #include <base/base_module_pass_machinery.h>
 #include <base/bit_shift_fixup_pass.h>
-#include <base/builtin_simplification_pass.h>
 #include <base/check_for_ext_funcs_pass.h>
 #include <base/check_for_unsupported_types_pass.h>
 #include <base/combine_fpext_fptrunc_pass.h>
 #include <base/fast_math_pass.h>
 #include <base/image_argument_substitution_pass.h>
 #include <base/macros.h>
-#include <base/mem_to_reg_pass.h>
 #include <base/module.h>
 #include <base/pass_pipelines.h>
 #include <base/printf_replacement_pass.h>
@@ -75,17 +73,8 @@
 #include <llvm/Transforms/IPO/AlwaysInliner.h>
 #include <llvm/Transforms/IPO/ForceFunctionAttrs.h>
 #include <llvm/Transforms/IPO/GlobalDCE.h>
-#include <llvm/Transforms/IPO/Inliner.h>
-#include <llvm/Transforms/Scalar/ADCE.h>
-#include <llvm/Transforms/Scalar/BDCE.h>
-#include <llvm/Transforms/Scalar/DCE.h>
-#include <llvm/Transforms/Scalar/LoopRotation.h>
-#include <llvm/Transforms/Scalar/Reassociate.h>
-#include <llvm/Transforms/Scalar/SimplifyCFG.h>
 #include <llvm/Transforms/Utils/Cloning.h>
 #include <llvm/Transforms/Utils/EntryExitInstrumenter.h>
-#include <llvm/Transforms/Vectorize/LoopVectorize.h>
-#include <llvm/Transforms/Vectorize/SLPVectorizer.h>
 #include <multi_llvm/llvm_version.h>
 #include <multi_llvm/multi_llvm.h>
 #include <multi_llvm/triple.h>
@@ -349,6 +338,7 @@ BaseModule::~BaseModule() {}
 void BaseModule::clear() {
   llvm_module.reset();
   kernel_map.clear();
+  deferred_optimizations = false;
 
   state = ModuleState::NONE;
 }
@@ -495,6 +485,10 @@ Result BaseModule::parseOptions(cargo::string_view input_options,
       return Result::OUT_OF_MEMORY;
     }
 
+    if (parser.add_argument({"-cl-lazy-finalize", options.lazy_finalize})) {
+      return Result::OUT_OF_MEMORY;
+    }
+
     std::array<cargo::string_view, 4> cl_vec_choices = {
         {"none", "loop", "slp", "all"}};
     if (parser.add_argument({"-cl-vec=", cl_vec_choices, cl_vec})) {
@@ -1646,11 +1640,19 @@ Result BaseModule::finalize(
   // Lock the context, this is necessary due to analysis/pass managers being
   // owned by the LLVMContext and we are making heavy use of both below.
   const std::lock_guard<compiler::BaseContext> contextLock(context);
-  // Numerous things below touch LLVM's global state, in particular
-  // retriggering command-line option parsing at various points. Ensure we
-  // avoid data races by locking the LLVM global mutex.
-  const std::lock_guard<std::mutex> globalLock(
-      compiler::utils::getLLVMGlobalMutex());
+  // The pipeline below only reads LLVM's command-line options, which were
+  // parsed when the context was created, and crash recovery and the fatal
+  // error handler are set up through compiler::utils so that modules in other
+  // contexts can be finalized in parallel. Pass timing and pass manager
+  // debug output do write to LLVM's global state, serialize finalization
+  // across all contexts when either is enabled.
+  std::unique_lock<std::mutex> globalLock(compiler::utils::getLLVMGlobalMutex(),
+                                          std::defer_lock);
+  if (context.isLLVMTimePassesEnabled() ||
+      context.getLLVMDebugLoggingLevel() !=
+          compiler::utils::DebugLogging::None) {
+    globalLock.lock();
+  }
 
   if (!llvm_module) {
     CPL_ABORT(
@@ -1724,62 +1726,18 @@ Result BaseModule::finalize(
 
   pm.addPass(compiler::utils::ReplaceC11AtomicFuncsPass());
 
-  if (options.prevec_mode != compiler::PreVectorizationMode::NONE) {
-    llvm::FunctionPassManager fpm;
-    if (options.prevec_mode == compiler::PreVectorizationMode::ALL ||
-        options.prevec_mode == compiler::PreVectorizationMode::SLP) {
-      fpm.addPass(llvm::SLPVectorizerPass());
+  // With lazy finalization the optimizations which dominate the cost of
+  // finalizing large programs are run on each kernel when it is first needed
+  // instead, see `hasDeferredOptimizations`.
+  deferred_optimizations =
+      options.lazy_finalize &&
+      target.getCompilerInfo()->supports_deferred_compilation;
+  if (deferred_optimizations) {
+    if (!options.opt_disable) {
+      pm.addPass(llvm::GlobalDCEPass());
     }
-
-    if (options.prevec_mode == compiler::PreVectorizationMode::ALL ||
-        options.prevec_mode == compiler::PreVectorizationMode::LOOP) {
-      // Loop vectorization apparently only works on loops with a single basic
-      // block. Sometimes, Loop Rotation may be able to help us here.
-      fpm.addPass(llvm::createFunctionToLoopPassAdaptor(
-          llvm::LoopRotatePass(/*EnableHeaderDuplication*/ false)));
-      fpm.addPass(llvm::LoopVectorizePass());
-
-      // Loop vectorization also emits a scalar version of the loop, in case it
-      // wasn't a multiple of the vector size, even when the loop count is a
-      // compile-time constant that is a known multiple of the vector size.
-      // In that case we get a redundant compare and branch to clean up.
-      fpm.addPass(llvm::InstCombinePass());
-      fpm.addPass(llvm::SimplifyCFGPass());
-    }
-
-    // SLP vectorization can leave a lot of unused GEPs lying around..
-    fpm.addPass(llvm::DCEPass());
-
-    pm.addPass(llvm::createModuleToFunctionPassAdaptor(std::move(fpm)));
-  }
-
-  if (!options.opt_disable) {
-    {
-      llvm::FunctionPassManager fpm;
-      fpm.addPass(llvm::InstCombinePass());
-      fpm.addPass(llvm::ReassociatePass());
-      fpm.addPass(compiler::MemToRegPass());
-      fpm.addPass(llvm::BDCEPass());
-      fpm.addPass(llvm::ADCEPass());
-      fpm.addPass(llvm::SimplifyCFGPass());
-      pm.addPass(llvm::createModuleToFunctionPassAdaptor(std::move(fpm)));
-    }
-    pm.addPass(compiler::BuiltinSimplificationPass());
-    {
-      llvm::FunctionPassManager fpm;
-      fpm.addPass(llvm::InstCombinePass());
-      fpm.addPass(llvm::ReassociatePass());
-      fpm.addPass(llvm::BDCEPass());
-      fpm.addPass(llvm::ADCEPass());
-      fpm.addPass(llvm::SimplifyCFGPass());
-      pm.addPass(llvm::createModuleToFunctionPassAdaptor(std::move(fpm)));
-    }
-  }
-
-  if (!options.opt_disable) {
-    pm.addPass(llvm::GlobalDCEPass());
-    pm.addPass(pass_mach->getPB().buildInlinerPipeline(
-        llvm::OptimizationLevel::O3, llvm::ThinOrFullLTOPhase::None));
+  } else {
+    addKernelOptimizationPasses(pm, pass_mach->getPB(), options);
   }
 
   pm.addPass(
@@ -1794,7 +1752,7 @@ Result BaseModule::finalize(
 
   const ScopedDiagnosticHandler handler(*this);
   /// Set up an error handler to redirect fatal errors to the build log.
-  const llvm::ScopedFatalErrorHandler error_handler(
+  const compiler::utils::ScopedFatalErrorHandler error_handler(
       BaseModule::llvmFatalErrorHandler, this);
 
   // We need to clone the LLVM module as LLVM does not preserve the source
@@ -1818,10 +1776,10 @@ Result BaseModule::finalize(
   pm.addPass(getLateTargetPasses(*pass_mach));
 
   llvm::CrashRecoveryContext CRC;
-  llvm::CrashRecoveryContext::Enable();
+  compiler::utils::enableCrashRecovery();
   const bool crashed =
       !CRC.RunSafely([&] { pm.run(*clone, pass_mach->getMAM()); });
-  llvm::CrashRecoveryContext::Disable();
+  compiler::utils::disableCrashRecovery();
 
   // Check if we've accumulated any errors
   if (crashed || num_errors) {
@@ -14,6 +14,8 @@
 //
 // SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
 
+#include <base/builtin_simplification_pass.h>
+#include <base/mem_to_reg_pass.h>
 #include <base/pass_pipelines.h>
 #include <compiler/utils/add_kernel_wrapper_pass.h>
 #include <compiler/utils/add_scheduling_parameters_pass.h>
@@ -35,9 +37,20 @@
 #include <llvm/Passes/PassBuilder.h>
 #include <llvm/Support/CodeGen.h>
 #include <llvm/Target/TargetMachine.h>
+#include <llvm/Transforms/IPO/GlobalDCE.h>
 #include <llvm/Transforms/IPO/GlobalOpt.h>
 #include <llvm/Transforms/IPO/Inliner.h>
 #include <llvm/Transforms/IPO/Internalize.h>
+#include <llvm/Transforms/InstCombine/InstCombine.h>
+#include <llvm/Transforms/Scalar/ADCE.h>
+#include <llvm/Transforms/Scalar/BDCE.h>
+#include <llvm/Transforms/Scalar/DCE.h>
+#include <llvm/Transforms/Scalar/LoopPassManager.h>
+#include <llvm/Transforms/Scalar/LoopRotation.h>
+#include <llvm/Transforms/Scalar/Reassociate.h>
+#include <llvm/Transforms/Scalar/SimplifyCFG.h>
+#include <llvm/Transforms/Vectorize/LoopVectorize.h>
+#include <llvm/Transforms/Vectorize/SLPVectorizer.h>
 #include <multi_llvm/multi_llvm.h>
 
 #include <optional>
@@ -130,6 +143,67 @@ void addLLVMDefaultPerModulePipeline(ModulePassManager &PM, PassBuilder &PB,
   }
 }
 
+void addKernelOptimizationPasses(ModulePassManager &PM, PassBuilder &PB,
+                                 const compiler::Options &options) {
+  if (options.prevec_mode != PreVectorizationMode::NONE) {
+    FunctionPassManager fpm;
+    if (options.prevec_mode == PreVectorizationMode::ALL ||
+        options.prevec_mode == PreVectorizationMode::SLP) {
+      fpm.addPass(SLPVectorizerPass());
+    }
+
+    if (options.prevec_mode == PreVectorizationMode::ALL ||
+        options.prevec_mode == PreVectorizationMode::LOOP) {
+      // Loop vectorization apparently only works on loops with a single basic
+      // block. Sometimes, Loop Rotation may be able to help us here.
+      fpm.addPass(createFunctionToLoopPassAdaptor(
+          LoopRotatePass(/*EnableHeaderDuplication*/ false)));
+      fpm.addPass(LoopVectorizePass());
+
+      // Loop vectorization also emits a scalar version of the loop, in case it
+      // wasn't a multiple of the vector size, even when the loop count is a
+      // compile-time constant that is a known multiple of the vector size.
+      // In that case we get a redundant compare and branch to clean up.
+      fpm.addPass(InstCombinePass());
+      fpm.addPass(SimplifyCFGPass());
+    }
+
+    // SLP vectorization can leave a lot of unused GEPs lying around..
+    fpm.addPass(DCEPass());
+
+    PM.addPass(createModuleToFunctionPassAdaptor(std::move(fpm)));
+  }
+
+  if (!options.opt_disable) {
+    {
+      FunctionPassManager fpm;
+      fpm.addPass(InstCombinePass());
+      fpm.addPass(ReassociatePass());
+      fpm.addPass(MemToRegPass());
+      fpm.addPass(BDCEPass());
+      fpm.addPass(ADCEPass());
+      fpm.addPass(SimplifyCFGPass());
+      PM.addPass(createModuleToFunctionPassAdaptor(std::move(fpm)));
+    }
+    PM.addPass(BuiltinSimplificationPass());
+    {
+      FunctionPassManager fpm;
+      fpm.addPass(InstCombinePass());
+      fpm.addPass(ReassociatePass());
+      fpm.addPass(BDCEPass());
+      fpm.addPass(ADCEPass());
+      fpm.addPass(SimplifyCFGPass());
+      PM.addPass(createModuleToFunctionPassAdaptor(std::move(fpm)));
+    }
+  }
+
+  if (!options.opt_disable) {
+    PM.addPass(GlobalDCEPass());
+    PM.addPass(PB.buildInlinerPipeline(OptimizationLevel::O3,
+                                       ThinOrFullLTOPhase::None));
+  }
+}
+
 Result emitCodeGenFile(llvm::Module &M, TargetMachine *TM,
                        raw_pwrite_stream &ostream, bool create_assembly) {
   legacy::PassManager PM;
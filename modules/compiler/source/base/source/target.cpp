@@ -17,9 +17,9 @@
 #include <base/context.h>
 #include <base/target.h>
 #include <compiler/module.h>
-#include <compiler/utils/memory_buffer.h>
 #include <llvm/Bitcode/BitcodeReader.h>
 #include <llvm/IR/Module.h>
+#include <llvm/Support/MemoryBuffer.h>
 #include <multi_llvm/llvm_version.h>
 
 #include "bakery.h"
@@ -78,26 +78,40 @@ Result BaseTarget::init(uint32_t builtins_capabilities) {
     caps |= builtins::file::CAPS_FP64;
   }
 
-  auto builtins_file = builtins::get_bc_file(caps);
-  std::unique_ptr<llvm::Module> builtins_module_from_file = nullptr;
-
-  if (builtins_file.data()) {
-    auto error_or_builtins_module = llvm::getOwningLazyBitcodeModule(
-        std::make_unique<compiler::utils::MemoryBuffer>(builtins_file.data(),
-                                                        builtins_file.size()),
-        getLLVMContext());
-    if (!error_or_builtins_module) {
-      return Result::FAILURE;
-    }
-
-    builtins_module_from_file = std::move(error_or_builtins_module.get());
-    if ("unknown-unknown-unknown" !=
-        builtins_module_from_file->getTargetTriple()) {
-      return Result::FAILURE;
-    }
+  builtins_bitcode = builtins::get_bc_file(caps);
+  auto builtins_module_from_file = loadBuiltins(getLLVMContext());
+  if (!builtins_module_from_file) {
+    return builtins_module_from_file.error();
   }
 
-  return initWithBuiltins(std::move(builtins_module_from_file));
+  return initWithBuiltins(std::move(*builtins_module_from_file));
+}
+
+cargo::expected<std::unique_ptr<llvm::Module>, Result> BaseTarget::loadBuiltins(
+    llvm::LLVMContext &llvm_context) const {
+  if (!builtins_bitcode.data()) {
+    return std::unique_ptr<llvm::Module>{};
+  }
+
+  // The embedded image outlives every target so the module can refer to it
+  // directly.
+  // Metadata, like function bodies, is only loaded once a builtin is used.
+  const llvm::MemoryBufferRef buffer(
+      llvm::StringRef(reinterpret_cast<const char *>(builtins_bitcode.data()),
+                      builtins_bitcode.size()),
+      "builtins");
+  auto error_or_builtins_module = llvm::getLazyBitcodeModule(
+      buffer, llvm_context, /*ShouldLazyLoadMetadata=*/true);
+  if (!error_or_builtins_module) {
+    llvm::consumeError(error_or_builtins_module.takeError());
+    return cargo::make_unexpected(Result::FAILURE);
+  }
+
+  auto builtins_module = std::move(error_or_builtins_module.get());
+  if ("unknown-unknown-unknown" != builtins_module->getTargetTriple()) {
+    return cargo::make_unexpected(Result::FAILURE);
+  }
+  return {std::move(builtins_module)};
 }
 
 const compiler::Info *BaseTarget::getCompilerInfo() const {
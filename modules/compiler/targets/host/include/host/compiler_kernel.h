@@ -25,8 +25,13 @@
 #include <compiler/module.h>
 #include <host/utils/jit_kernel.h>
 
+#include <array>
+#include <atomic>
 #include <map>
+#include <memory>
 #include <unordered_set>
+#include <utility>
+#include <vector>
 
 #include "base/module.h"
 
@@ -35,6 +40,7 @@ class Module;
 }
 
 namespace host {
+class HostModule;
 class HostTarget;
 
 /// @brief An object that represents a kernel who's compilation has been
@@ -50,12 +56,21 @@ struct OptimizedKernel {
   std::unique_ptr<::host::utils::jit_kernel_s> binary_kernel;
 };
 
+/// @brief An immutable list of the `OptimizedKernel`s compiled so far.
+///
+/// Published through `HostKernel::optimized_kernels` so lookups of already
+/// compiled local sizes can read it without taking any lock.
+struct OptimizedKernelSnapshot {
+  std::vector<std::pair<std::array<size_t, 3>, const OptimizedKernel *>>
+      entries;
+};
+
 class HostKernel : public compiler::BaseKernel {
  public:
   HostKernel(HostTarget &target, compiler::Options &build_options,
-             llvm::Module *module, std::string name,
+             const HostModule *program, llvm::Module *module, std::string name,
              std::array<size_t, 3> preferred_local_sizes,
-             size_t local_memory_used);
+             size_t local_memory_used, bool uses_sub_groups);
 
   ~HostKernel();
 
@@ -72,6 +87,11 @@ class HostKernel : public compiler::BaseKernel {
   createSpecializedKernel(
       const mux_ndrange_options_t &specialization_options) override;
 
+  /// @see Kernel::createSpecializedKernelForEnqueue
+  cargo::expected<cargo::dynamic_array<uint8_t>, compiler::Result>
+  createSpecializedKernelForEnqueue(
+      const mux_ndrange_options_t &specialization_options) override;
+
   /// @brief No-op implementation indicating sub-groups are not supported.
   cargo::expected<uint32_t, compiler::Result> querySubGroupSizeForLocalSize(
       size_t local_size_x, size_t local_size_y, size_t local_size_z) override;
@@ -83,23 +103,98 @@ class HostKernel : public compiler::BaseKernel {
   /// @brief No-op implementation indicating sub-groups are not supported.
   cargo::expected<size_t, compiler::Result> queryMaxSubGroupCount() override;
 
+  /// @brief Optimize the kernel for a local size on the background compile
+  /// thread, see `HostTarget::speculate`.
+  ///
+  /// Must be called with the context lock held.
+  ///
+  /// @param local_size Local size to optimize the kernel for.
+  void speculateOptimizedKernel(std::array<size_t, 3> local_size);
+
+  /// @brief Local size key of the generic optimized kernel, which is compiled
+  /// without knowledge of the local size so is valid for any local size.
+  static constexpr std::array<size_t, 3> generic_local_size = {{0, 0, 0}};
+
  private:
+  /// @brief Implementation of `createSpecializedKernel` and
+  /// `createSpecializedKernelForEnqueue`.
+  ///
+  /// @param specialization_options Mux execution options to specialize for.
+  /// @param single_enqueue Whether the generic kernel may be returned while
+  /// the kernel is optimized for the local size in the background.
+  cargo::expected<cargo::dynamic_array<uint8_t>, compiler::Result>
+  specializeKernel(const mux_ndrange_options_t &specialization_options,
+                   bool single_enqueue);
+
   /// @brief Gets an `OptimizedKernel` object for the given local size.
   ///
   /// @param local_size Local size to optimize the kernel for.
   cargo::expected<const OptimizedKernel &, compiler::Result>
   lookupOrCreateOptimizedKernel(std::array<size_t, 3> local_size);
 
+  /// @brief Compile an `OptimizedKernel` object for the given local size.
+  ///
+  /// Must be called with the context lock held.
+  ///
+  /// @param local_size Local size to optimize the kernel for, or
+  /// `generic_local_size`.
+  cargo::expected<const OptimizedKernel &, compiler::Result>
+  createOptimizedKernel(std::array<size_t, 3> local_size);
+
+  /// @brief Lock-free lookup of an already compiled `OptimizedKernel`.
+  ///
+  /// @param local_size Local size the kernel was optimized for.
+  ///
+  /// @return The optimized kernel, or null if it hasn't been compiled yet.
+  const OptimizedKernel *findOptimizedKernel(
+      const std::array<size_t, 3> &local_size) const;
+
+  /// @brief Publish a new snapshot including a newly compiled kernel.
+  ///
+  /// Must be called with the context lock held.
+  ///
+  /// @param local_size Local size the kernel was optimized for.
+  /// @param kernel The kernel in `optimized_kernel_map`.
+  void publishOptimizedKernel(const std::array<size_t, 3> &local_size,
+                              const OptimizedKernel &kernel);
+
   /// @brief LLVM module containing only the kernel function and functions it
   /// calls, not yet optimized for a local size.
   llvm::Module *module;
 
+  /// @brief Module of the program the kernel was created from, identifying it
+  /// in the local sizes recorded by `HostTarget::recordLocalSize`.
+  const HostModule *program;
+
   /// @brief Map of optimized modules to their local sizes.
   ///
   /// By an "optimized module" we mean a copy of this kernel's LLVM module which
   /// has had passes that optimize for a specific local size run on it.
+  ///
+  /// Only modified with the context lock held, and never read without it, the
+  /// lock-free path reads `optimized_kernels` instead.
   std::map<std::array<size_t, 3>, OptimizedKernel> optimized_kernel_map;
 
+  /// @brief The latest snapshot of `optimized_kernel_map`, or null if no
+  /// kernels have been compiled yet.
+  std::atomic<const OptimizedKernelSnapshot *> optimized_kernels;
+
+  /// @brief Every snapshot published to `optimized_kernels`.
+  ///
+  /// Readers may still hold a pointer to a snapshot after a newer one is
+  /// published, so snapshots are only freed along with the kernel. A kernel is
+  /// optimized for few local sizes so this costs little memory.
+  std::vector<std::unique_ptr<const OptimizedKernelSnapshot>>
+      optimized_kernel_snapshots;
+
+  /// @brief Whether the kernel uses sub-group builtins or requires a sub-group
+  /// size.
+  ///
+  /// The sub-group size depends on the local size a kernel was optimized for,
+  /// so such kernels can't run the generic optimized kernel in place of one
+  /// optimized for the local size.
+  bool uses_sub_groups;
+
   /// @brief A set of JITDylibs created to manage JIT resources for kernels.
   std::unordered_set<std::string> kernel_jit_dylibs;
 
@@ -33,6 +33,9 @@ enum Type {
   slice,
   total_slices,
   work_dim,
+  work_group_counter,
+  local_memory,
+  local_memory_end,
   total
 };
 }
@@ -53,6 +56,18 @@ class HostBIMuxInfo : public compiler::utils::BIMuxInfoConcept {
   llvm::Value *initializeSchedulingParamForWrappedKernel(
       const compiler::utils::BuiltinInfo::SchedParamInfo &Info,
       llvm::IRBuilder<> &B, llvm::Function &IntoF, llvm::Function &) override;
+
+  /// @brief Allocates __local memory from the executing thread's arena.
+  ///
+  /// The arena is described by the `local_memory` cursor and the
+  /// `local_memory_end` fields of the scheduling info struct. Each allocation
+  /// bumps the cursor, even when the arena is too small and the allocation
+  /// falls back to the stack, so the runtime can grow the arena to the final
+  /// position of the cursor. The entry hook rewinds the cursor to the start of
+  /// the arena before each work-group.
+  llvm::Value *allocateLocalMemory(llvm::IRBuilder<> &B, llvm::Function &F,
+                                   llvm::Type *Ty, llvm::Value *ArraySize,
+                                   llvm::Align Alignment) override;
 };
 
 }  // namespace host
@@ -60,6 +60,22 @@ class HostPassMachinery final : public compiler::BaseModulePassMachinery {
   llvm::ModulePassManager getKernelFinalizationPasses(
       std::optional<std::string> unique_prefix = std::nullopt);
 
+  /// @brief Returns the part of `getKernelFinalizationPasses` which can run
+  /// on modules holding a subset of the kernels of a binary.
+  ///
+  /// @param[in] unique_prefix (Optional) prefix for the generated function
+  /// names to avoid linker conflicts.
+  /// @return Result ModulePassManager containing passes
+  llvm::ModulePassManager getPerKernelFinalizationPasses(
+      std::optional<std::string> unique_prefix = std::nullopt);
+
+  /// @brief Returns the rest of `getKernelFinalizationPasses`, which must run
+  /// on a module holding every kernel of the binary, e.g. after linking the
+  /// modules `getPerKernelFinalizationPasses` ran on.
+  ///
+  /// @return Result ModulePassManager containing passes
+  llvm::ModulePassManager getBinaryFinalizationPasses();
+
   /// @brief Returns an optimization pass pipeline correponding to
   /// BaseModule::getLateTargetPasses.
   llvm::ModulePassManager getLateTargetPasses();
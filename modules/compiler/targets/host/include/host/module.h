@@ -53,6 +53,9 @@ struct KernelMetadata {
 void initializePassMachineryForFinalize(
     compiler::utils::PassMachinery &passMach, const HostTarget &target);
 
+void initializePassMachineryForFinalize(
+    compiler::utils::PassMachinery &passMach, llvm::TargetMachine *TM);
+
 /// @brief A class that drives the compilation process and stores the compiled
 /// binary.
 class HostModule : public compiler::BaseModule {
@@ -60,6 +63,8 @@ class HostModule : public compiler::BaseModule {
   HostModule(compiler::BaseTarget &target, compiler::BaseContext &context,
              uint32_t &num_errors, std::string &log);
 
+  ~HostModule();
+
   HostModule(const HostModule &) = delete;
   HostModule &operator=(const HostModule &) = delete;
 
@@ -100,6 +105,24 @@ class HostModule : public compiler::BaseModule {
   cargo::expected<cargo::dynamic_array<uint8_t>, compiler::Result>
   hostCompileObject(HostTarget &target, const compiler::Options &build_options,
                     llvm::Module *module);
+
+  /// @brief Runs the per-kernel part of the kernel finalization pipeline on
+  /// groups of kernels in parallel, each on a thread with its own LLVM
+  /// context, and links the results.
+  ///
+  /// @param target Target to compile the module for.
+  /// @param build_options Build options that will affect optimizations
+  /// performed.
+  /// @param module Module to finalize the kernels of, kernel metadata must
+  /// have been transferred to its functions.
+  ///
+  /// @return The linked module, which needs the binary finalization passes
+  /// run on it. A null module if the kernels can't be finalized separately, in
+  /// which case @p module must be finalized as a whole.
+  cargo::expected<std::unique_ptr<llvm::Module>, compiler::Result>
+  finalizeKernelsInParallel(HostTarget &target,
+                            const compiler::Options &build_options,
+                            llvm::Module &module);
 };  // class Module
 }  // namespace host
 
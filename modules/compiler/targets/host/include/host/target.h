@@ -19,6 +19,7 @@
 
 #include <base/context.h>
 #include <base/target.h>
+#include <cargo/thread.h>
 #include <compiler/module.h>
 #include <llvm/ExecutionEngine/ExecutionEngine.h>
 #include <llvm/ExecutionEngine/Orc/LLJIT.h>
@@ -26,8 +27,18 @@
 #include <llvm/Target/TargetMachine.h>
 #include <mux/mux.h>
 
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
 
 namespace llvm {
 class Module;
@@ -35,6 +46,8 @@ class Module;
 
 namespace host {
 struct HostInfo;
+class HostKernel;
+class HostModule;
 
 /// @brief Compiler target class.
 class HostTarget : public compiler::BaseTarget {
@@ -42,6 +55,8 @@ class HostTarget : public compiler::BaseTarget {
   HostTarget(const HostInfo *compiler_info, compiler::Context *context,
              compiler::NotifyCallbackFn callback);
 
+  ~HostTarget();
+
   /// @see BaseTarget::initWithBuiltins
   compiler::Result initWithBuiltins(
       std::unique_ptr<llvm::Module> builtins_module) override;
@@ -58,6 +73,12 @@ class HostTarget : public compiler::BaseTarget {
   /// @see BaseTarget::getBuiltins
   llvm::Module *getBuiltins() const override;
 
+  /// @brief Identifies the triple, CPU and features `target_machine` generates
+  /// code for, which may have been chosen at runtime.
+  ///
+  /// @see Target::getTargetIdentifier
+  std::string getTargetIdentifier() const override;
+
   /// @brief LLVM context.
   llvm::orc::ThreadSafeContext llvm_ts_context;
 
@@ -67,6 +88,10 @@ class HostTarget : public compiler::BaseTarget {
   /// @brief The llvm TargetMachine.
   std::unique_ptr<llvm::TargetMachine> target_machine;
 
+  /// @brief Builder `target_machine` was created with, used to create target
+  /// machines for pipelines running on other threads.
+  std::unique_ptr<llvm::orc::JITTargetMachineBuilder> target_machine_builder;
+
   /// @brief An atomic uint64_t to ensure unique identifiers are used.
   ///
   /// This field is used to ensure that each kernel that is JIT'ed by the
@@ -83,6 +108,153 @@ class HostTarget : public compiler::BaseTarget {
 #ifdef CA_ENABLE_HOST_BUILTINS
   std::unique_ptr<llvm::Module> builtins_host;
 #endif
+
+  /// @brief Queue a speculative compile of a kernel for a local size.
+  ///
+  /// The compile happens on a background thread, started on first use, so
+  /// that the enqueue which first uses the local size doesn't have to wait
+  /// for it. Does nothing if the compile is already queued. The kernel's
+  /// module belongs to the context's `LLVMContext`, so the thread waits for
+  /// and compiles under the context lock like any other compile, one job at a
+  /// time so that other compiles in the context get the lock in between.
+  ///
+  /// @param kernel The kernel to compile.
+  /// @param local_size The local size to optimize the kernel for.
+  void speculate(HostKernel *kernel, const std::array<size_t, 3> &local_size);
+
+  /// @brief Drop any queued speculative compiles of a kernel, and wait for an
+  /// in flight one to finish. Must be called before the kernel is destroyed.
+  ///
+  /// @param kernel The kernel being destroyed.
+  void cancelSpeculation(HostKernel *kernel);
+
+  /// @brief Record that a kernel has been optimized for a local size.
+  ///
+  /// @param program Module of the program the kernel was created from.
+  /// @param name Name of the kernel.
+  /// @param local_size The local size the kernel was optimized for.
+  void recordLocalSize(const HostModule *program, const std::string &name,
+                       const std::array<size_t, 3> &local_size);
+
+  /// @brief Get the local sizes kernels of a given program and name were
+  /// optimized for.
+  ///
+  /// @param program Module of the program the kernel was created from.
+  /// @param name Name of the kernel.
+  ///
+  /// @return Every local size recorded with `recordLocalSize` for `program`
+  /// and `name`.
+  std::vector<std::array<size_t, 3>> getRecordedLocalSizes(
+      const HostModule *program, const std::string &name);
+
+  /// @brief Drop the local sizes recorded for the kernels of a program, called
+  /// when the program's module is destroyed.
+  ///
+  /// @param program Module of the program being destroyed.
+  void forgetLocalSizes(const HostModule *program);
+
+  /// @brief Whether kernels are speculatively compiled in the background, set
+  /// to false with the `CA_HOST_SPECULATIVE_JIT=0` environment variable.
+  bool speculative_jit;
+
+  /// @brief Maximum number of threads kernels are finalized on when creating
+  /// a binary, set with the `CA_HOST_COMPILE_THREADS` environment variable.
+  unsigned compile_threads;
+
+  /// @brief Run tasks on the compile threads and the calling thread.
+  ///
+  /// The compile threads are shared by every module of the target and only
+  /// started when first needed, at most `compile_threads - 1` of them as the
+  /// calling thread runs tasks too.
+  ///
+  /// @param count Number of tasks to run.
+  /// @param task Called once with each index in `[0, count)`.
+  void runCompileTasks(size_t count, const std::function<void(size_t)> &task);
+
+  /// @brief Whether compiling with the given options writes to LLVM's global
+  /// state, i.e. statistics, pass timings or pass manager debug output are
+  /// enabled, so that the compile must hold `getLLVMGlobalMutex()`.
+  ///
+  /// @param options Options the compile uses.
+  bool usesLLVMGlobalState(const compiler::Options &options) const;
+
+ private:
+  /// @brief Tasks queued by a call to `runCompileTasks`.
+  struct CompileBatch {
+    const std::function<void(size_t)> *task;
+    size_t count;
+    /// @brief Index of the next task to start.
+    size_t next;
+    /// @brief Number of tasks which have finished.
+    size_t done;
+  };
+
+  /// @brief Take the next task of a batch, `compile_mutex` must be held.
+  ///
+  /// @param batch Batch with at least one task yet to start.
+  ///
+  /// @return Index of the task to run.
+  size_t takeCompileTask(CompileBatch &batch);
+
+  /// @brief The body of each of `compile_workers`.
+  void runCompileWorker();
+
+  /// @brief Mutex protecting all compile thread state below.
+  std::mutex compile_mutex;
+
+  /// @brief Signalled when a batch is queued, when a batch finishes, and on
+  /// destruction.
+  std::condition_variable compile_condition;
+
+  /// @brief Batches with tasks yet to start.
+  std::deque<CompileBatch *> compile_batches;
+
+  /// @brief Set on destruction to stop `compile_workers`.
+  bool compile_stop = false;
+
+  /// @brief The compile threads started so far.
+  std::vector<cargo::thread> compile_workers;
+
+  /// @brief A queued speculative compile.
+  struct SpeculationJob {
+    HostKernel *kernel;
+    std::array<size_t, 3> local_size;
+  };
+
+  /// @brief The body of `speculation_thread`.
+  void runSpeculation();
+
+  /// @brief Mutex protecting all speculation state below.
+  std::mutex speculation_mutex;
+
+  /// @brief Signalled when a job is queued, when a job finishes, and on
+  /// destruction.
+  std::condition_variable speculation_condition;
+
+  /// @brief Speculative compiles yet to be started.
+  std::deque<SpeculationJob> speculation_jobs;
+
+  /// @brief The job `speculation_thread` is running, if its kernel is not
+  /// null. `cancelSpeculation` sets the kernel to null to abandon the job
+  /// while the thread is still waiting for the context lock.
+  SpeculationJob running_job = {nullptr, {}};
+
+  /// @brief Whether `speculation_thread` holds the context lock for
+  /// `running_job`, after which the job can't be abandoned and must be waited
+  /// for instead.
+  bool running_locked = false;
+
+  /// @brief Set on destruction to stop `speculation_thread`.
+  bool speculation_stop = false;
+
+  /// @brief The background compile thread, only started when first needed.
+  cargo::thread speculation_thread;
+
+  /// @brief Local sizes kernels have been optimized for, by program and kernel
+  /// name.
+  std::map<std::pair<const HostModule *, std::string>,
+           std::vector<std::array<size_t, 3>>>
+      recorded_local_sizes;
 };
 }  // namespace host
 
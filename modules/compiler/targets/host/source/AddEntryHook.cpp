@@ -104,10 +104,20 @@ PreservedAnalyses AddEntryHookPass::run(Module &M, ModuleAnalysisManager &AM) {
     };
     // User-specifiable Work Item Order has been removed.
     const uint32_t vec_dim = 0;
+    const uint32_t middle_dim = 1;
+    const uint32_t outer_dim = 2;
+
+    // The work-groups of all three dimensions are flattened into a single
+    // range which is then sliced, so that every shape of nd-range can be spread
+    // over all slices. Groups in the vectorization dimension are innermost.
+    auto *totalGroups = ir.CreateMul(
+        ir.CreateMul(numGroups[vec_dim], numGroups[middle_dim]),
+        numGroups[outer_dim], "totalGroups");
+
     // the slicing code below works as follows:
     // t = total number of slices
     // s = current slice (from [0..t))
-    // g = num groups in the vectorization dimension (numGroups[vec_dim])
+    // g = total num groups in all dimensions (totalGroups)
     // r = num groups rounded up
     // r = g + t
     // size = r / t
@@ -136,7 +146,7 @@ PreservedAnalyses AddEntryHookPass::run(Module &M, ModuleAnalysisManager &AM) {
 
     // round up the number of groups by the total number of slices
     auto *numGroupsRoundedUp =
-        ir.CreateAdd(numGroups[vec_dim], totalSlices, "numGroupsRoundedUp");
+        ir.CreateAdd(totalGroups, totalSlices, "numGroupsRoundedUp");
 
     // get the size of the slice that each core will run
     auto *sliceSize =
@@ -150,8 +160,31 @@ PreservedAnalyses AddEntryHookPass::run(Module &M, ModuleAnalysisManager &AM) {
 
     // but for the end we need to use a cmp against the original num groups
     auto *clampedSliceEnd =
-        ir.CreateSelect(ir.CreateICmpULT(sliceEnd, numGroups[vec_dim]),
-                        sliceEnd, numGroups[vec_dim], "clampedSliceEnd");
+        ir.CreateSelect(ir.CreateICmpULT(sliceEnd, totalGroups), sliceEnd,
+                        totalGroups, "clampedSliceEnd");
+
+    // gep the work-group counter
+    auto *const counterIdx =
+        ir.getInt32(host::ScheduleInfoStruct::work_group_counter);
+    auto *gepCounter = ir.CreateGEP(ScheduleInfoStructTy, ScheduleInfoParam,
+                                    {i32_0, counterIdx});
+
+    // load the work-group counter, when the runtime provides one the slices
+    // dynamically claim chunks of work-groups instead of a static range
+    auto *counter =
+        ir.CreateLoad(ScheduleInfoStructTy->getTypeAtIndex(counterIdx),
+                      gepCounter, "workGroupCounter");
+    auto *isDynamic = ir.CreateIsNotNull(counter, "isDynamic");
+
+    // gep and load the start of the __local memory arena, every work-group
+    // allocates its __local memory from the start of the arena again
+    auto *const localMemoryIdx =
+        ir.getInt32(host::ScheduleInfoStruct::local_memory);
+    auto *gepLocalMemory = ir.CreateGEP(ScheduleInfoStructTy, ScheduleInfoParam,
+                                        {i32_0, localMemoryIdx});
+    auto *localMemory =
+        ir.CreateLoad(ScheduleInfoStructTy->getTypeAtIndex(localMemoryIdx),
+                      gepLocalMemory, "localMemory");
 
     // an early exit block
     IRBuilder<> earlyExitIR(
@@ -159,66 +192,126 @@ PreservedAnalyses AddEntryHookPass::run(Module &M, ModuleAnalysisManager &AM) {
 
     earlyExitIR.CreateRetVoid();
 
+    // the block claiming the next chunk of work-groups in dynamic mode
+    IRBuilder<> chunkIR(BasicBlock::Create(context, "next-chunk", newFunction));
+
+    // the block checking the static slice in static mode
+    IRBuilder<> sliceIR(
+        BasicBlock::Create(context, "static-slice", newFunction));
+
+    ir.CreateCondBr(isDynamic, chunkIR.GetInsertBlock(),
+                    sliceIR.GetInsertBlock());
+
     // the loop's main basic block
-    const IRBuilder<> loopIR(BasicBlock::Create(context, "loop", newFunction));
+    IRBuilder<> loopIR(BasicBlock::Create(context, "loop", newFunction));
 
     // need to early exit before the loops if we don't have a slice to
     // process
-    ir.CreateCondBr(ir.CreateICmpULT(sliceStart, clampedSliceEnd),
-                    loopIR.GetInsertBlock(), earlyExitIR.GetInsertBlock());
+    sliceIR.CreateCondBr(sliceIR.CreateICmpULT(sliceStart, clampedSliceEnd),
+                         loopIR.GetInsertBlock(), earlyExitIR.GetInsertBlock());
+
+    // the dynamic scheme works as follows, using guided chunk sizes so that
+    // chunks start large to amortize the atomic and shrink towards the end to
+    // balance out irregular work-groups:
+    // c = work-group counter, the number of groups claimed so far
+    // g = total num groups in all dimensions (totalGroups)
+    // t = total number of slices
+    // size = max(1, (g - min(c, g)) / (2 * t))
+    // start = atomic fetch add c, size
+    // end = min(g, start + size)
+    auto *claimed = chunkIR.CreateLoad(compiler::utils::getSizeType(M),
+                                       counter, "claimed");
+    claimed->setAtomic(AtomicOrdering::Monotonic);
+    auto *remaining = chunkIR.CreateSub(
+        totalGroups,
+        chunkIR.CreateSelect(chunkIR.CreateICmpULT(claimed, totalGroups),
+                             claimed, totalGroups),
+        "remaining");
+    auto *guidedSize = chunkIR.CreateUDiv(
+        remaining, chunkIR.CreateShl(totalSlices, 1), "guidedSize");
+    auto *chunkSize = chunkIR.CreateSelect(
+        chunkIR.CreateIsNull(guidedSize),
+        ConstantInt::get(guidedSize->getType(), 1), guidedSize, "chunkSize");
+    auto *chunkStart =
+        chunkIR.CreateAtomicRMW(AtomicRMWInst::Add, counter, chunkSize,
+                                MaybeAlign(), AtomicOrdering::Monotonic);
+    chunkStart->setName("chunkStart");
+    auto *chunkEnd = chunkIR.CreateAdd(chunkStart, chunkSize, "chunkEnd");
+    auto *clampedChunkEnd = chunkIR.CreateSelect(
+        chunkIR.CreateICmpULT(chunkEnd, totalGroups), chunkEnd,
+        totalGroups, "clampedChunkEnd");
+
+    // exit once every chunk has been claimed
+    chunkIR.CreateCondBr(chunkIR.CreateICmpULT(chunkStart, totalGroups),
+                         loopIR.GetInsertBlock(), earlyExitIR.GetInsertBlock());
+
+    // the range of flattened work-groups to execute
+    auto *rangeStart = loopIR.CreatePHI(sliceStart->getType(), 2, "rangeStart");
+    rangeStart->addIncoming(sliceStart, sliceIR.GetInsertBlock());
+    rangeStart->addIncoming(chunkStart, chunkIR.GetInsertBlock());
+    auto *rangeEnd = loopIR.CreatePHI(sliceStart->getType(), 2, "rangeEnd");
+    rangeEnd->addIncoming(clampedSliceEnd, sliceIR.GetInsertBlock());
+    rangeEnd->addIncoming(clampedChunkEnd, chunkIR.GetInsertBlock());
+
+    // decompose the start of the range into a work-group id, only the start
+    // needs dividing as each iteration increments the id with carries
+    auto *startX = loopIR.CreateURem(rangeStart, numGroups[vec_dim], "startX");
+    auto *startYZ =
+        loopIR.CreateUDiv(rangeStart, numGroups[vec_dim], "startYZ");
+    auto *startY = loopIR.CreateURem(startYZ, numGroups[middle_dim], "startY");
+    auto *startZ = loopIR.CreateUDiv(startYZ, numGroups[middle_dim], "startZ");
 
     auto *const groupIdIdx = ir.getInt32(host::MiniWGInfoStruct::group_id);
     auto *dstGroupIdTy = MiniWGInfoStructTy->getTypeAtIndex(groupIdIdx);
 
-    const uint32_t outer_dim = 2;
-    const uint32_t middle_dim = 1;
-
     compiler::utils::CreateLoopOpts opts;
+    opts.IVs = {startX, startY, startZ};
+    opts.loopIVNames = {"groupX", "groupY", "groupZ"};
 
-    // looping through num groups in the outermost dimension
+    // looping through the flattened range of work-groups
     auto exitBlock = compiler::utils::createLoop(
-        loopIR.GetInsertBlock(), nullptr, zero, numGroups[outer_dim], opts,
-        [&](BasicBlock *blockz, Value *z, ArrayRef<Value *>,
-            MutableArrayRef<Value *>) -> BasicBlock * {
-          IRBuilder<> ir(blockz);
+        loopIR.GetInsertBlock(), nullptr, rangeStart, rangeEnd, opts,
+        [&](BasicBlock *block, Value *, ArrayRef<Value *> ivs,
+            MutableArrayRef<Value *> ivsNext) -> BasicBlock * {
+          IRBuilder<> ir(block);
           Value *dstGroupId = ir.CreateGEP(MiniWGInfoStructTy, MiniWGInfoParam,
                                            {i32_0, groupIdIdx});
-          ir.CreateStore(z, ir.CreateGEP(dstGroupIdTy, dstGroupId,
-                                         {i32_0, ir.getInt32(outer_dim)}));
-          // looping through num groups in the middle dimension
-          return compiler::utils::createLoop(
-              blockz, nullptr, zero, numGroups[middle_dim], opts,
-              [&](BasicBlock *blocky, Value *y, ArrayRef<Value *>,
-                  MutableArrayRef<Value *>) -> BasicBlock * {
-                IRBuilder<> ir(blocky);
-                ir.CreateStore(y,
-                               ir.CreateGEP(dstGroupIdTy, dstGroupId,
-                                            {i32_0, ir.getInt32(middle_dim)}));
-
-                // looping through num groups in the x dimension
-                return compiler::utils::createLoop(
-                    blocky, nullptr, sliceStart, clampedSliceEnd, opts,
-                    [&](BasicBlock *blockx, Value *x, ArrayRef<Value *>,
-                        MutableArrayRef<Value *>) -> BasicBlock * {
-                      IRBuilder<> ir(blockx);
-                      ir.CreateStore(
-                          x, ir.CreateGEP(dstGroupIdTy, dstGroupId,
-                                          {i32_0, ir.getInt32(vec_dim)}));
-
-                      compiler::utils::createCallToWrappedFunction(
-                          *function, args, ir.GetInsertBlock(),
-                          ir.GetInsertPoint());
-
-                      return blockx;
-                    });
-              });
+          ir.CreateStore(ivs[2], ir.CreateGEP(dstGroupIdTy, dstGroupId,
+                                              {i32_0, ir.getInt32(outer_dim)}));
+          ir.CreateStore(ivs[1],
+                         ir.CreateGEP(dstGroupIdTy, dstGroupId,
+                                      {i32_0, ir.getInt32(middle_dim)}));
+          ir.CreateStore(ivs[0], ir.CreateGEP(dstGroupIdTy, dstGroupId,
+                                              {i32_0, ir.getInt32(vec_dim)}));
+          // rewind the cursor the wrapped function bumps for each __local
+          // allocation, so the arena only ever holds a single work-group's
+          ir.CreateStore(localMemory, gepLocalMemory);
+
+          compiler::utils::createCallToWrappedFunction(
+              *function, args, ir.GetInsertBlock(), ir.GetInsertPoint());
+
+          // increment the work-group id, carrying into the outer dimensions
+          auto *one = ConstantInt::get(zero->getType(), 1);
+          auto *nextX = ir.CreateAdd(ivs[0], one, "nextX");
+          auto *carryX = ir.CreateICmpEQ(nextX, numGroups[vec_dim], "carryX");
+          ivsNext[0] = ir.CreateSelect(carryX, zero, nextX);
+          auto *nextY = ir.CreateAdd(
+              ivs[1], ir.CreateZExt(carryX, zero->getType()), "nextY");
+          auto *carryY =
+              ir.CreateICmpEQ(nextY, numGroups[middle_dim], "carryY");
+          ivsNext[1] = ir.CreateSelect(carryY, zero, nextY);
+          ivsNext[2] = ir.CreateAdd(
+              ivs[2], ir.CreateZExt(carryY, zero->getType()), "nextZ");
+
+          return ir.GetInsertBlock();
         });
 
     // the last basic block in our function!
     IRBuilder<> exitIR(exitBlock);
 
-    // the only thing we need to do now is exit
-    exitIR.CreateRetVoid();
+    // in dynamic mode go back for another chunk, otherwise we're done
+    exitIR.CreateCondBr(isDynamic, chunkIR.GetInsertBlock(),
+                        earlyExitIR.GetInsertBlock());
 
     Changed = true;
   }
@@ -71,6 +71,9 @@ StructType *HostBIMuxInfo::getScheduleInfoStruct(Module &M) {
   elements[ScheduleInfoStruct::slice] = size_type;
   elements[ScheduleInfoStruct::total_slices] = size_type;
   elements[ScheduleInfoStruct::work_dim] = uint_type;
+  elements[ScheduleInfoStruct::work_group_counter] = size_type->getPointerTo();
+  elements[ScheduleInfoStruct::local_memory] = PointerType::getUnqual(Ctx);
+  elements[ScheduleInfoStruct::local_memory_end] = PointerType::getUnqual(Ctx);
 
   return StructType::create(elements, HostStructName);
 }
@@ -316,3 +319,55 @@ Value *HostBIMuxInfo::initializeSchedulingParamForWrappedKernel(
   assert(false && "unknown param");
   return nullptr;
 }
+
+Value *HostBIMuxInfo::allocateLocalMemory(IRBuilder<> &B, Function &F,
+                                          Type *Ty, Value *ArraySize,
+                                          Align Alignment) {
+  auto SchedParams = getFunctionSchedulingParameters(F);
+  if (SchedParams.size() <= SchedParamIndices::SCHED ||
+      !SchedParams[SchedParamIndices::SCHED].ArgVal) {
+    return compiler::utils::BIMuxInfoConcept::allocateLocalMemory(
+        B, F, Ty, ArraySize, Alignment);
+  }
+
+  auto &M = *F.getParent();
+  auto *const SchedInfo = SchedParams[SchedParamIndices::SCHED].ArgVal;
+  auto *const SchedInfoStructTy = getScheduleInfoStruct(M);
+  auto *const SizeTy = compiler::utils::getSizeType(M);
+  auto *const PtrTy = PointerType::getUnqual(M.getContext());
+
+  const uint64_t TySize = M.getDataLayout().getTypeAllocSize(Ty);
+  Value *const Count = ArraySize ? B.CreateZExtOrTrunc(ArraySize, SizeTy)
+                                 : ConstantInt::get(SizeTy, 1);
+  Value *const Size =
+      1 == TySize ? Count
+                  : B.CreateMul(Count, ConstantInt::get(SizeTy, TySize));
+
+  auto *const CursorPtr = B.CreateStructGEP(
+      SchedInfoStructTy, SchedInfo, ScheduleInfoStruct::local_memory);
+  auto *const EndPtr = B.CreateStructGEP(
+      SchedInfoStructTy, SchedInfo, ScheduleInfoStruct::local_memory_end);
+  auto *const Cursor =
+      B.CreatePtrToInt(B.CreateLoad(PtrTy, CursorPtr), SizeTy, "local.cursor");
+  auto *const End =
+      B.CreatePtrToInt(B.CreateLoad(PtrTy, EndPtr), SizeTy, "local.end");
+
+  const uint64_t Mask = Alignment.value() - 1;
+  auto *const Begin =
+      B.CreateAnd(B.CreateAdd(Cursor, ConstantInt::get(SizeTy, Mask)),
+                  ConstantInt::get(SizeTy, ~Mask), "local.begin");
+  auto *const Next = B.CreateAdd(Begin, Size, "local.next");
+  B.CreateStore(B.CreateIntToPtr(Next, PtrTy), CursorPtr);
+
+  // Only touch the stack when the arena is too small, the alloca is empty
+  // otherwise. Selecting rather than branching keeps the wrapper a single
+  // block, so any allocas which follow remain in the entry block.
+  auto *const Fits = B.CreateICmpULE(Next, End, "local.fits");
+  auto *const FallbackCount =
+      B.CreateSelect(Fits, ConstantInt::get(SizeTy, 0), Count);
+  auto *const Fallback = B.CreateAlloca(Ty, FallbackCount, "local.fallback");
+  Fallback->setAlignment(Alignment);
+
+  return B.CreateSelect(Fits, B.CreateIntToPtr(Begin, PtrTy), Fallback,
+                        "local.memory");
+}
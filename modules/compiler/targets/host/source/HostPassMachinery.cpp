@@ -235,6 +235,14 @@ llvm::ModulePassManager HostPassMachinery::getLateTargetPasses() {
 llvm::ModulePassManager HostPassMachinery::getKernelFinalizationPasses(
     std::optional<std::string> unique_prefix) {
   llvm::ModulePassManager PM;
+  PM.addPass(getPerKernelFinalizationPasses(std::move(unique_prefix)));
+  PM.addPass(getBinaryFinalizationPasses());
+  return PM;
+}
+
+llvm::ModulePassManager HostPassMachinery::getPerKernelFinalizationPasses(
+    std::optional<std::string> unique_prefix) {
+  llvm::ModulePassManager PM;
   const compiler::BasePassPipelineTuner tuner(options);
 
   // Forcibly compute the BuiltinInfoAnalysis so that cached retrievals work.
@@ -310,6 +318,12 @@ llvm::ModulePassManager HostPassMachinery::getKernelFinalizationPasses(
         compiler::utils::RemoveLifetimeIntrinsicsPass()));
   }
 
+  return PM;
+}
+
+llvm::ModulePassManager HostPassMachinery::getBinaryFinalizationPasses() {
+  llvm::ModulePassManager PM;
+
   PM.addPass(compiler::utils::ComputeLocalMemoryUsagePass());
 
   PM.addPass(compiler::utils::AddMetadataPass<
@@ -45,16 +45,33 @@
 namespace host {
 
 HostKernel::HostKernel(HostTarget &target, compiler::Options &build_options,
-                       llvm::Module *module, std::string name,
+                       const HostModule *program, llvm::Module *module,
+                       std::string name,
                        std::array<size_t, 3> preferred_local_sizes,
-                       size_t local_memory_used)
+                       size_t local_memory_used, bool uses_sub_groups)
     : BaseKernel(name, preferred_local_sizes[0], preferred_local_sizes[1],
                  preferred_local_sizes[2], local_memory_used),
       module(module),
+      program(program),
+      optimized_kernels(nullptr),
+      uses_sub_groups(uses_sub_groups),
       target(target),
-      build_options(build_options) {}
+      build_options(build_options) {
+  // Compile the kernel for the local sizes it is most likely to be enqueued
+  // with in the background, starting with the generic kernel which can stand
+  // in for any other until it is ready.
+  if (target.speculative_jit) {
+    target.speculate(this, generic_local_size);
+    target.speculate(this, preferred_local_sizes);
+    for (const auto &local_size :
+         target.getRecordedLocalSizes(program, name)) {
+      target.speculate(this, local_size);
+    }
+  }
+}
 
 HostKernel::~HostKernel() {
+  target.cancelSpeculation(this);
   if (target.orc_engine) {
     auto &es = target.orc_engine->getExecutionSession();
     for (const auto &name : kernel_jit_dylibs) {
@@ -94,6 +111,18 @@ cargo::expected<uint32_t, compiler::Result> HostKernel::getDynamicWorkWidth(
 cargo::expected<cargo::dynamic_array<uint8_t>, compiler::Result>
 HostKernel::createSpecializedKernel(
     const mux_ndrange_options_t &specialization_options) {
+  return specializeKernel(specialization_options, /* single_enqueue */ false);
+}
+
+cargo::expected<cargo::dynamic_array<uint8_t>, compiler::Result>
+HostKernel::createSpecializedKernelForEnqueue(
+    const mux_ndrange_options_t &specialization_options) {
+  return specializeKernel(specialization_options, /* single_enqueue */ true);
+}
+
+cargo::expected<cargo::dynamic_array<uint8_t>, compiler::Result>
+HostKernel::specializeKernel(
+    const mux_ndrange_options_t &specialization_options, bool single_enqueue) {
   if (!specialization_options.descriptors &&
       specialization_options.descriptors_length > 0) {
     return cargo::make_unexpected(compiler::Result::INVALID_VALUE);
@@ -136,9 +165,25 @@ HostKernel::createSpecializedKernel(
   std::copy(std::begin(specialization_options.local_size),
             std::end(specialization_options.local_size),
             std::begin(local_size));
-  auto optimized_kernel = lookupOrCreateOptimizedKernel(local_size);
+  // Rather than stall a single enqueue while the kernel is optimized for a new
+  // local size, run the generic kernel and optimize in the background. Binaries
+  // which are kept, e.g. by a command buffer, would run the generic kernel
+  // forever, and kernels using sub-groups must always run the kernel optimized
+  // for their local size.
+  const OptimizedKernel *optimized_kernel = findOptimizedKernel(local_size);
+  if (!optimized_kernel && single_enqueue && target.speculative_jit &&
+      !uses_sub_groups) {
+    optimized_kernel = findOptimizedKernel(generic_local_size);
+    if (optimized_kernel) {
+      target.speculate(this, local_size);
+    }
+  }
   if (!optimized_kernel) {
-    return cargo::make_unexpected(optimized_kernel.error());
+    auto created = lookupOrCreateOptimizedKernel(local_size);
+    if (!created) {
+      return cargo::make_unexpected(created.error());
+    }
+    optimized_kernel = &*created;
   }
 
   cargo::dynamic_array<uint8_t> binary_out;
@@ -223,156 +268,284 @@ cargo::expected<size_t, compiler::Result> HostKernel::queryMaxSubGroupCount() {
   return static_cast<size_t>(info.max_sub_group_count);
 }
 
+const OptimizedKernel *HostKernel::findOptimizedKernel(
+    const std::array<size_t, 3> &local_size) const {
+  const auto *snapshot = optimized_kernels.load(std::memory_order_acquire);
+  if (nullptr == snapshot) {
+    return nullptr;
+  }
+  for (const auto &entry : snapshot->entries) {
+    if (entry.first == local_size) {
+      return entry.second;
+    }
+  }
+  return nullptr;
+}
+
+void HostKernel::publishOptimizedKernel(const std::array<size_t, 3> &local_size,
+                                        const OptimizedKernel &kernel) {
+  std::unique_ptr<OptimizedKernelSnapshot> snapshot(
+      new OptimizedKernelSnapshot);
+  // Writers are serialized by the context lock, so the latest snapshot can't
+  // change under us.
+  const auto *previous = optimized_kernels.load(std::memory_order_relaxed);
+  if (previous) {
+    snapshot->entries.reserve(previous->entries.size() + 1);
+    snapshot->entries = previous->entries;
+  }
+  snapshot->entries.emplace_back(local_size, &kernel);
+  // Release so that readers of the snapshot also see the kernel it points to.
+  optimized_kernels.store(snapshot.get(), std::memory_order_release);
+  optimized_kernel_snapshots.emplace_back(std::move(snapshot));
+}
+
 cargo::expected<const OptimizedKernel &, compiler::Result>
 HostKernel::lookupOrCreateOptimizedKernel(std::array<size_t, 3> local_size) {
-  if (0 < optimized_kernel_map.count(local_size)) {
-    return optimized_kernel_map[local_size];
+  // Enqueues of an already compiled local size must not contend on a lock.
+  if (const auto *optimized_kernel = findOptimizedKernel(local_size)) {
+    return *optimized_kernel;
   }
 
-  {
-    const std::lock_guard<compiler::Context> guard(target.getContext());
+  const std::lock_guard<compiler::Context> guard(target.getContext());
 
-    std::unique_ptr<llvm::Module> optimized_module(llvm::CloneModule(*module));
-    if (nullptr == optimized_module) {
-      return cargo::make_unexpected(compiler::Result::OUT_OF_MEMORY);
-    }
+  // Another thread may have compiled this local size while we waited.
+  if (const auto *optimized_kernel = findOptimizedKernel(local_size)) {
+    return *optimized_kernel;
+  }
+  return createOptimizedKernel(local_size);
+}
 
-    // max length of a uint64_t is 20 digits, 64 just to be comfortable with the
-    // prefix of '__mux_host_'
-    const unsigned unique_name_data_length = 64;
-    char unique_name_data[unique_name_data_length];
-    if (snprintf(unique_name_data, unique_name_data_length,
-                 "__mux_host_%" PRIu64, target.unique_identifier++) < 0) {
-      return cargo::make_unexpected(compiler::Result::FAILURE);
-    }
-    std::string unique_name(unique_name_data);
-
-    auto device_info = target.getCompilerInfo()->device_info;
-
-    // FIXME: Ideally we'd be able to call/reuse HostModule::createPassMachinery
-    // but we only have access to the HostTarget
-    auto *const TM = target.target_machine.get();
-    auto builtinInfoCallback = [&](const llvm::Module &) {
-      return compiler::utils::BuiltinInfo(
-          std::make_unique<HostBIMuxInfo>(),
-          compiler::utils::createCLBuiltinInfo(target.getBuiltins()));
-    };
-    auto deviceInfo = compiler::initDeviceInfoFromMux(device_info);
-    HostPassMachinery pass_mach(module->getContext(), TM, deviceInfo,
-                                builtinInfoCallback,
-                                target.getContext().isLLVMVerifyEachEnabled(),
-                                target.getContext().getLLVMDebugLoggingLevel(),
-                                target.getContext().isLLVMTimePassesEnabled());
-    pass_mach.setCompilerOptions(build_options);
-    host::initializePassMachineryForFinalize(pass_mach, target);
-
-    llvm::ModulePassManager pm;
-    // Set up the kernel metadata which informs later passes which kernel we're
-    // interested in optimizing. We've already done this when initially
-    // creating the kernel, but now we have more accurate local size data.
-    compiler::utils::EncodeKernelMetadataPassOptions pass_opts;
-    pass_opts.KernelName = name;
+void HostKernel::speculateOptimizedKernel(std::array<size_t, 3> local_size) {
+  if (!findOptimizedKernel(local_size)) {
+    // Failures are reported again if the local size is used for an enqueue.
+    (void)createOptimizedKernel(local_size);
+  }
+}
+
+cargo::expected<const OptimizedKernel &, compiler::Result>
+HostKernel::createOptimizedKernel(std::array<size_t, 3> local_size) {
+  std::unique_ptr<llvm::Module> optimized_module(llvm::CloneModule(*module));
+  if (nullptr == optimized_module) {
+    return cargo::make_unexpected(compiler::Result::OUT_OF_MEMORY);
+  }
+
+  // max length of a uint64_t is 20 digits, 64 just to be comfortable with the
+  // prefix of '__mux_host_'
+  const unsigned unique_name_data_length = 64;
+  char unique_name_data[unique_name_data_length];
+  if (snprintf(unique_name_data, unique_name_data_length,
+               "__mux_host_%" PRIu64, target.unique_identifier++) < 0) {
+    return cargo::make_unexpected(compiler::Result::FAILURE);
+  }
+  std::string unique_name(unique_name_data);
+
+  auto device_info = target.getCompilerInfo()->device_info;
+
+  // FIXME: Ideally we'd be able to call/reuse HostModule::createPassMachinery
+  // but we only have access to the HostTarget
+  auto *const TM = target.target_machine.get();
+  auto builtinInfoCallback = [&](const llvm::Module &) {
+    return compiler::utils::BuiltinInfo(
+        std::make_unique<HostBIMuxInfo>(),
+        compiler::utils::createCLBuiltinInfo(target.getBuiltins()));
+  };
+  auto deviceInfo = compiler::initDeviceInfoFromMux(device_info);
+  HostPassMachinery pass_mach(module->getContext(), TM, deviceInfo,
+                              builtinInfoCallback,
+                              target.getContext().isLLVMVerifyEachEnabled(),
+                              target.getContext().getLLVMDebugLoggingLevel(),
+                              target.getContext().isLLVMTimePassesEnabled());
+  pass_mach.setCompilerOptions(build_options);
+  host::initializePassMachineryForFinalize(pass_mach, target);
+
+  llvm::ModulePassManager pm;
+  // Set up the kernel metadata which informs later passes which kernel we're
+  // interested in optimizing. We've already done this when initially
+  // creating the kernel, but now we have more accurate local size data. The
+  // generic kernel is compiled without it, like an offline compiled kernel.
+  compiler::utils::EncodeKernelMetadataPassOptions pass_opts;
+  pass_opts.KernelName = name;
+  if (local_size != generic_local_size) {
     pass_opts.LocalSizes = {static_cast<uint64_t>(local_size[0]),
                             static_cast<uint64_t>(local_size[1]),
                             static_cast<uint64_t>(local_size[2])};
-    pm.addPass(compiler::utils::EncodeKernelMetadataPass(pass_opts));
+  }
+  pm.addPass(compiler::utils::EncodeKernelMetadataPass(pass_opts));
 
-    pm.addPass(pass_mach.getKernelFinalizationPasses(unique_name));
+  pm.addPass(pass_mach.getKernelFinalizationPasses(unique_name));
 
-    {
-      // Using the CrashRecoveryContext and statistics touches LLVM's global
-      // state.
-      const std::lock_guard<std::mutex> globalLock(
-          compiler::utils::getLLVMGlobalMutex());
-      llvm::CrashRecoveryContext CRC;
-      llvm::CrashRecoveryContext::Enable();
-      const bool crashed = !CRC.RunSafely(
-          [&] { pm.run(*optimized_module, pass_mach.getMAM()); });
-      llvm::CrashRecoveryContext::Disable();
-      if (crashed) {
-        return cargo::make_unexpected(
-            compiler::Result::FINALIZE_PROGRAM_FAILURE);
-      }
+  {
+    // As in HostModule::hostCompileObject, only statistics, pass timings and
+    // debug output need kernels of other contexts to be serialized.
+    std::unique_lock<std::mutex> globalLock(
+        compiler::utils::getLLVMGlobalMutex(), std::defer_lock);
+    if (target.usesLLVMGlobalState(build_options)) {
+      globalLock.lock();
+    }
+    llvm::CrashRecoveryContext CRC;
+    compiler::utils::enableCrashRecovery();
+    const bool crashed = !CRC.RunSafely(
+        [&] { pm.run(*optimized_module, pass_mach.getMAM()); });
+    compiler::utils::disableCrashRecovery();
+    if (crashed) {
+      return cargo::make_unexpected(compiler::Result::FINALIZE_PROGRAM_FAILURE);
+    }
 
-      if (llvm::AreStatisticsEnabled()) {
-        llvm::PrintStatistics();
-      }
+    if (llvm::AreStatisticsEnabled()) {
+      llvm::PrintStatistics();
     }
+  }
 
-    // Retrieve the vectorization width and amount of local memory used.
-    auto default_work_width = FixedOrScalableQuantity<uint32_t>::getOne();
-    handler::VectorizeInfoMetadata fn_metadata(
-        unique_name, unique_name,
-        /* local_memory_usage */ 0,
-        /* sub_group_size */ FixedOrScalableQuantity<uint32_t>(),
-        /* min_work_item_factor= */ default_work_width,
-        /* pref_work_item_factor */ default_work_width);
-    if (auto *f = optimized_module->getFunction(unique_name)) {
-      fn_metadata =
-          pass_mach.getFAM()
-              .getResult<compiler::utils::VectorizeMetadataAnalysis>(*f);
+  // Retrieve the vectorization width and amount of local memory used.
+  auto default_work_width = FixedOrScalableQuantity<uint32_t>::getOne();
+  handler::VectorizeInfoMetadata fn_metadata(
+      unique_name, unique_name,
+      /* local_memory_usage */ 0,
+      /* sub_group_size */ FixedOrScalableQuantity<uint32_t>(),
+      /* min_work_item_factor= */ default_work_width,
+      /* pref_work_item_factor */ default_work_width);
+  if (auto *f = optimized_module->getFunction(unique_name)) {
+    fn_metadata =
+        pass_mach.getFAM()
+            .getResult<compiler::utils::VectorizeMetadataAnalysis>(*f);
+  }
+
+  // Host doesn't support scalable values.
+  if (fn_metadata.min_work_item_factor.isScalable() ||
+      fn_metadata.pref_work_item_factor.isScalable() ||
+      fn_metadata.sub_group_size.isScalable()) {
+    return cargo::make_unexpected(compiler::Result::FINALIZE_PROGRAM_FAILURE);
+  }
+
+  // Note that we grab a handle to the module here, which we use to reference
+  // the module going forward. This is despite us passing ownership of the
+  // module off to the JITDylib. As long as the JITDylib outlives all uses of
+  // the optimized kernels, this should be okay; the JIT has the same lifetime
+  // as this HostKernel.
+  llvm::Module *optimized_module_ptr = optimized_module.get();
+
+  // Create a unique JITDylib for this instance of the kernel, so that its
+  // symbols don't clash with any other kernel's symbols.
+  auto jd = target.orc_engine->createJITDylib(unique_name + ".dylib");
+  if (auto err = jd.takeError()) {
+    if (auto callback = target.getNotifyCallbackFn()) {
+      callback(llvm::toString(std::move(err)).c_str(), /*data*/ nullptr,
+               /*data_size*/ 0);
+    } else {
+      llvm::consumeError(std::move(err));
     }
+    return cargo::make_unexpected(compiler::Result::FINALIZE_PROGRAM_FAILURE);
+  }
+  // Register this JITDylib so we can clear up its resources later.
+  kernel_jit_dylibs.insert(jd->getName());
 
-    // Host doesn't support scalable values.
-    if (fn_metadata.min_work_item_factor.isScalable() ||
-        fn_metadata.pref_work_item_factor.isScalable() ||
-        fn_metadata.sub_group_size.isScalable()) {
-      return cargo::make_unexpected(compiler::Result::FINALIZE_PROGRAM_FAILURE);
+  llvm::orc::SymbolMap symbols;
+  llvm::orc::MangleAndInterner mangle(target.orc_engine->getExecutionSession(),
+                                      target.orc_engine->getDataLayout());
+
+  for (const auto &reloc : host::utils::getRelocations()) {
+#if LLVM_VERSION_GREATER_EQUAL(17, 0)
+    symbols[mangle(reloc.first)] = {llvm::orc::ExecutorAddr(reloc.second),
+                                    llvm::JITSymbolFlags::Exported};
+#else
+    symbols[mangle(reloc.first)] = llvm::JITEvaluatedSymbol(
+        reloc.second, llvm::JITSymbolFlags::Exported);
+#endif
+  }
+
+  // Define our runtime library symbols required for the JIT to successfully
+  // link.
+  if (auto err = jd->define(llvm::orc::absoluteSymbols(std::move(symbols)))) {
+    if (auto callback = target.getNotifyCallbackFn()) {
+      callback(llvm::toString(std::move(err)).c_str(), /*data*/ nullptr,
+               /*data_size*/ 0);
+    } else {
+      llvm::consumeError(std::move(err));
     }
+    return cargo::make_unexpected(compiler::Result::FINALIZE_PROGRAM_FAILURE);
+  }
 
-    // Note that we grab a handle to the module here, which we use to reference
-    // the module going forward. This is despite us passing ownership of the
-    // module off to the JITDylib. As long as the JITDylib outlives all uses of
-    // the optimized kernels, this should be okay; the JIT has the same lifetime
-    // as this HostKernel.
-    llvm::Module *optimized_module_ptr = optimized_module.get();
-
-    // Create a unique JITDylib for this instance of the kernel, so that its
-    // symbols don't clash with any other kernel's symbols.
-    auto jd = target.orc_engine->createJITDylib(unique_name + ".dylib");
-    if (auto err = jd.takeError()) {
-      if (auto callback = target.getNotifyCallbackFn()) {
-        callback(llvm::toString(std::move(err)).c_str(), /*data*/ nullptr,
-                 /*data_size*/ 0);
-      } else {
-        llvm::consumeError(std::move(err));
-      }
-      return cargo::make_unexpected(compiler::Result::FINALIZE_PROGRAM_FAILURE);
+  // Add the module.
+  if (auto err = target.orc_engine->addIRModule(
+          *jd, llvm::orc::ThreadSafeModule(std::move(optimized_module),
+                                           target.llvm_ts_context))) {
+    if (auto callback = target.getNotifyCallbackFn()) {
+      callback(llvm::toString(std::move(err)).c_str(), /*data*/ nullptr,
+               /*data_size*/ 0);
+    } else {
+      llvm::consumeError(std::move(err));
+    }
+    return cargo::make_unexpected(compiler::Result::FINALIZE_PROGRAM_FAILURE);
+  }
+
+  // Retrieve the kernel address.
+  uint64_t hook;
+  {
+    // The lookup compiles the kernel with the JIT's own target machine. The
+    // JIT belongs to the target, which the context lock already guards, so
+    // like the pipeline above the lookup only needs the global lock when
+    // code generation writes to LLVM's global state.
+    std::unique_lock<std::mutex> globalLock(
+        compiler::utils::getLLVMGlobalMutex(), std::defer_lock);
+    if (target.usesLLVMGlobalState(build_options)) {
+      globalLock.lock();
     }
-    // Register this JITDylib so we can clear up its resources later.
-    kernel_jit_dylibs.insert(jd->getName());
 
-    llvm::orc::SymbolMap symbols;
-    llvm::orc::MangleAndInterner mangle(
-        target.orc_engine->getExecutionSession(),
-        target.orc_engine->getDataLayout());
+    // We cannot safely look up any symbol inside a CrashRecoveryContext
+    // because the CRC handles errors by a longjmp back to safety, skipping
+    // over destructors of objects that do need to be destroyed. We do so
+    // anyway because the effect is less bad than crashing right away.
+    std::promise<uint64_t> promise;
+    llvm::Error err = llvm::Error::success();
+    llvm::cantFail(std::move(err));
 
-    for (const auto &reloc : host::utils::getRelocations()) {
+    auto &es = target.orc_engine->getExecutionSession();
+    auto so = makeJITDylibSearchOrder(
+        &*jd, llvm::orc::JITDylibLookupFlags::MatchAllSymbols);
+    auto name = target.orc_engine->mangleAndIntern(unique_name);
+    llvm::orc::SymbolLookupSet names({name});
+    llvm::orc::SymbolsResolvedCallback notifyComplete =
+        [&](llvm::Expected<llvm::orc::SymbolMap> r) {
+          if (r) {
+            assert(r->size() == 1 && "Unexpected number of results");
+            assert(r->count(name) && "Missing result for symbol");
+            auto address = r->begin()->second.getAddress();
 #if LLVM_VERSION_GREATER_EQUAL(17, 0)
-      symbols[mangle(reloc.first)] = {llvm::orc::ExecutorAddr(reloc.second),
-                                      llvm::JITSymbolFlags::Exported};
+            promise.set_value(address.getValue());
 #else
-      symbols[mangle(reloc.first)] = llvm::JITEvaluatedSymbol(
-          reloc.second, llvm::JITSymbolFlags::Exported);
+            promise.set_value(address);
 #endif
+          } else {
+            const llvm::ErrorAsOutParameter _(&err);
+            err = r.takeError();
+            promise.set_value(0);
+          }
+        };
+
+    bool crashed;
+    {
+      llvm::CrashRecoveryContext crc;
+      compiler::utils::enableCrashRecovery();
+      crashed = !crc.RunSafely([&] {
+        es.lookup(llvm::orc::LookupKind::Static, std::move(so),
+                  std::move(names), llvm::orc::SymbolState::Ready,
+                  std::move(notifyComplete),
+                  llvm::orc::NoDependenciesToRegister);
+        hook = promise.get_future().get();
+      });
+      compiler::utils::disableCrashRecovery();
     }
 
-    // Define our runtime library symbols required for the JIT to successfully
-    // link.
-    if (auto err = jd->define(llvm::orc::absoluteSymbols(std::move(symbols)))) {
-      if (auto callback = target.getNotifyCallbackFn()) {
-        callback(llvm::toString(std::move(err)).c_str(), /*data*/ nullptr,
-                 /*data_size*/ 0);
-      } else {
-        llvm::consumeError(std::move(err));
-      }
-      return cargo::make_unexpected(compiler::Result::FINALIZE_PROGRAM_FAILURE);
+    if (crashed) {
+      // If we crashed, remove the dylib now so that the lookup callback
+      // runs right away and does not try to access the promise after it has
+      // already been destroyed. Note that this guarantees err will be set and
+      // we return an error.
+      llvm::cantFail(es.removeJITDylib(*jd));
+      promise.get_future().get();
     }
 
-    // Add the module.
-    if (auto err = target.orc_engine->addIRModule(
-            *jd, llvm::orc::ThreadSafeModule(std::move(optimized_module),
-                                             target.llvm_ts_context))) {
+    if (err) {
       if (auto callback = target.getNotifyCallbackFn()) {
         callback(llvm::toString(std::move(err)).c_str(), /*data*/ nullptr,
                  /*data_size*/ 0);
@@ -381,93 +554,22 @@ HostKernel::lookupOrCreateOptimizedKernel(std::array<size_t, 3> local_size) {
       }
       return cargo::make_unexpected(compiler::Result::FINALIZE_PROGRAM_FAILURE);
     }
+  }
 
-    // Retrieve the kernel address.
-    uint64_t hook;
-    {
-      // Compiling the kernel may touch the global LLVM state
-      const std::lock_guard<std::mutex> globalLock(
-          compiler::utils::getLLVMGlobalMutex());
-
-      // We cannot safely look up any symbol inside a CrashRecoveryContext
-      // because the CRC handles errors by a longjmp back to safety, skipping
-      // over destructors of objects that do need to be destroyed. We do so
-      // anyway because the effect is less bad than crashing right away.
-      std::promise<uint64_t> promise;
-      llvm::Error err = llvm::Error::success();
-      llvm::cantFail(std::move(err));
-
-      auto &es = target.orc_engine->getExecutionSession();
-      auto so = makeJITDylibSearchOrder(
-          &*jd, llvm::orc::JITDylibLookupFlags::MatchAllSymbols);
-      auto name = target.orc_engine->mangleAndIntern(unique_name);
-      llvm::orc::SymbolLookupSet names({name});
-      llvm::orc::SymbolsResolvedCallback notifyComplete =
-          [&](llvm::Expected<llvm::orc::SymbolMap> r) {
-            if (r) {
-              assert(r->size() == 1 && "Unexpected number of results");
-              assert(r->count(name) && "Missing result for symbol");
-              auto address = r->begin()->second.getAddress();
-#if LLVM_VERSION_GREATER_EQUAL(17, 0)
-              promise.set_value(address.getValue());
-#else
-              promise.set_value(address);
-#endif
-            } else {
-              const llvm::ErrorAsOutParameter _(&err);
-              err = r.takeError();
-              promise.set_value(0);
-            }
-          };
-
-      bool crashed;
-      {
-        llvm::CrashRecoveryContext crc;
-        llvm::CrashRecoveryContext::Enable();
-        crashed = !crc.RunSafely([&] {
-          es.lookup(llvm::orc::LookupKind::Static, std::move(so),
-                    std::move(names), llvm::orc::SymbolState::Ready,
-                    std::move(notifyComplete),
-                    llvm::orc::NoDependenciesToRegister);
-          hook = promise.get_future().get();
-        });
-        llvm::CrashRecoveryContext::Disable();
-      }
-
-      if (crashed) {
-        // If we crashed, remove the dylib now so that the lookup callback
-        // runs right away and does not try to access the promise after it has
-        // already been destroyed. Note that this guarantees err will be set and
-        // we return an error.
-        llvm::cantFail(es.removeJITDylib(*jd));
-        promise.get_future().get();
-      }
-
-      if (err) {
-        if (auto callback = target.getNotifyCallbackFn()) {
-          callback(llvm::toString(std::move(err)).c_str(), /*data*/ nullptr,
-                   /*data_size*/ 0);
-        } else {
-          llvm::consumeError(std::move(err));
-        }
-        return cargo::make_unexpected(
-            compiler::Result::FINALIZE_PROGRAM_FAILURE);
-      }
-    }
-
-    const uint32_t min_width = fn_metadata.min_work_item_factor.getFixedValue();
-    const uint32_t pref_width =
-        fn_metadata.pref_work_item_factor.getFixedValue();
-    const uint32_t sub_group_size = fn_metadata.sub_group_size.getFixedValue();
-
-    std::unique_ptr<host::utils::jit_kernel_s> jit_kernel(
-        new host::utils::jit_kernel_s{
-            name, hook, static_cast<uint32_t>(fn_metadata.local_memory_usage),
-            min_width, pref_width, sub_group_size});
-    optimized_kernel_map.emplace(
-        local_size,
-        OptimizedKernel{optimized_module_ptr, std::move(jit_kernel)});
+  const uint32_t min_width = fn_metadata.min_work_item_factor.getFixedValue();
+  const uint32_t pref_width = fn_metadata.pref_work_item_factor.getFixedValue();
+  const uint32_t sub_group_size = fn_metadata.sub_group_size.getFixedValue();
+
+  std::unique_ptr<host::utils::jit_kernel_s> jit_kernel(
+      new host::utils::jit_kernel_s{
+          name, hook, static_cast<uint32_t>(fn_metadata.local_memory_usage),
+          min_width, pref_width, sub_group_size});
+  const auto inserted = optimized_kernel_map.emplace(
+      local_size, OptimizedKernel{optimized_module_ptr, std::move(jit_kernel)});
+  publishOptimizedKernel(local_size, inserted.first->second);
+  if (local_size != generic_local_size) {
+    target.recordLocalSize(program, name, local_size);
   }
-  return optimized_kernel_map[local_size];
+  return inserted.first->second;
 }
 }  // namespace host
@@ -27,6 +27,7 @@
 #include <clang/Serialization/ASTReader.h>
 #include <clang/Serialization/ASTRecordReader.h>
 #include <compiler/limits.h>
+#include <compiler/utils/address_spaces.h>
 #include <compiler/utils/attributes.h>
 #include <compiler/utils/cl_builtin_info.h>
 #include <compiler/utils/compute_local_memory_usage_pass.h>
@@ -36,6 +37,7 @@
 #include <compiler/utils/metadata_analysis.h>
 #include <compiler/utils/pass_machinery.h>
 #include <compiler/utils/reduce_to_function_pass.h>
+#include <compiler/utils/sub_group_analysis.h>
 #include <host/compiler_kernel.h>
 #include <host/device.h>
 #include <host/host_mux_builtin_info.h>
@@ -49,9 +51,12 @@
 #include <llvm/Analysis/TargetTransformInfo.h>
 #include <llvm/Bitcode/BitcodeReader.h>
 #include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/IR/DiagnosticInfo.h>
+#include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/PassManager.h>
 #include <llvm/Support/CrashRecoveryContext.h>
 #include <llvm/Transforms/IPO/GlobalDCE.h>
+#include <multi_llvm/llvm_version.h>
 #include <multi_llvm/triple.h>
 #include <mux/mux.hpp>
 
@@ -73,6 +78,7 @@
 #include <llvm/Transforms/Utils/Cloning.h>
 #include <multi_llvm/multi_llvm.h>
 
+#include <algorithm>
 #include <cassert>
 #include <cstdlib>
 #include <fstream>
@@ -81,6 +87,7 @@
 #include <mutex>
 #include <sstream>
 #include <unordered_set>
+#include <vector>
 
 #if defined(_MSC_VER) || defined(__MINGW32__) || defined(__MINGW64__)
 #define PATH_SEPARATOR "\\"
@@ -94,6 +101,10 @@ HostModule::HostModule(compiler::BaseTarget &target,
                        std::string &log)
     : BaseModule(target, context, num_errors, log) {}
 
+HostModule::~HostModule() {
+  static_cast<HostTarget &>(target).forgetLocalSizes(this);
+}
+
 const HostTarget &HostModule::getHostTarget() const {
   return *static_cast<HostTarget *>(&target);
 }
@@ -119,6 +130,211 @@ emitBinary(llvm::Module *module, llvm::TargetMachine *target_machine) {
   return {std::move(binary)};
 }
 
+namespace {
+/// @brief A group of kernels finalized together on one thread.
+struct KernelGroup {
+  /// @brief Names of the kernels in the group.
+  std::vector<std::string> names;
+  /// @brief Total number of instructions in the kernels, used to balance the
+  /// groups.
+  size_t size = 0;
+  /// @brief Target machine for the pipeline, target machines can't be shared
+  /// between threads.
+  std::unique_ptr<llvm::TargetMachine> target_machine;
+  /// @brief Bitcode of the group's module once finalized.
+  llvm::SmallVector<char, 0> bitcode;
+  /// @brief Whether the group was finalized successfully.
+  bool finalized = false;
+};
+
+/// @brief Checks whether the kernels of a module can be finalized in separate
+/// modules.
+///
+/// Every group of kernels gets its own copy of the functions and globals it
+/// uses, which isn't possible when kernels share mutable globals, call each
+/// other, or when the module has appending globals such as `llvm.used`.
+bool canFinalizeKernelsSeparately(const llvm::Module &module) {
+  for (const auto &global : module.globals()) {
+    if (!global.isDeclaration() && !global.isConstant() &&
+        global.getAddressSpace() != compiler::utils::AddressSpace::Local) {
+      return false;
+    }
+  }
+  for (const auto &function : module) {
+    if (compiler::utils::isKernelEntryPt(function) && !function.use_empty()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/// @brief Runs the per-kernel finalization passes on a group of kernels, in
+/// an LLVM context owned by the calling thread.
+///
+/// @param target Target to compile the module for.
+/// @param build_options Build options that will affect optimizations
+/// performed.
+/// @param optimize Whether to run the kernel optimizations deferred by lazy
+/// finalization first.
+/// @param bitcode Bitcode of the module holding every kernel.
+/// @param group Group of kernels to finalize, its bitcode is set on success.
+///
+/// @return Returns true on success, false otherwise.
+bool finalizeKernelGroup(HostTarget &target,
+                         const compiler::Options &build_options,
+                         bool optimize, llvm::StringRef bitcode,
+                         KernelGroup &group) {
+  llvm::LLVMContext llvm_context;
+#if LLVM_VERSION_LESS(17, 0)
+  llvm_context.setOpaquePointers(true);
+#endif
+  // Without a handler LLVM exits the process on errors.
+  bool has_error = false;
+  llvm_context.setDiagnosticHandlerCallBack(
+      [](const llvm::DiagnosticInfo &DI, void *has_error) {
+        if (DI.getSeverity() == llvm::DiagnosticSeverity::DS_Error) {
+          *static_cast<bool *>(has_error) = true;
+        }
+      },
+      &has_error);
+
+  auto module = llvm::parseBitcodeFile(
+      llvm::MemoryBufferRef(bitcode, "kernels"), llvm_context);
+  if (!module) {
+    llvm::consumeError(module.takeError());
+    return false;
+  }
+  auto builtins = target.loadBuiltins(llvm_context);
+  if (!builtins) {
+    return false;
+  }
+
+  auto *const TM = group.target_machine.get();
+  auto builtinInfoCallback = [BI = builtins->get()](const llvm::Module &) {
+    return compiler::utils::BuiltinInfo(
+        std::make_unique<HostBIMuxInfo>(),
+        compiler::utils::createCLBuiltinInfo(BI));
+  };
+  HostPassMachinery pass_mach(
+      llvm_context, TM,
+      compiler::initDeviceInfoFromMux(target.getCompilerInfo()->device_info),
+      builtinInfoCallback, target.getContext().isLLVMVerifyEachEnabled(),
+      compiler::utils::DebugLogging::None, /*timePasses*/ false);
+  pass_mach.setCompilerOptions(build_options);
+  host::initializePassMachineryForFinalize(pass_mach, TM);
+
+  const llvm::SmallVector<llvm::StringRef, 8> names(group.names.begin(),
+                                                    group.names.end());
+  llvm::ModulePassManager pm;
+  pm.addPass(compiler::utils::ReduceToFunctionPass(names));
+  if (optimize) {
+    compiler::addKernelOptimizationPasses(pm, pass_mach.getPB(),
+                                          build_options);
+  }
+  pm.addPass(pass_mach.getPerKernelFinalizationPasses());
+
+  llvm::CrashRecoveryContext CRC;
+  compiler::utils::enableCrashRecovery();
+  const bool crashed =
+      !CRC.RunSafely([&] { pm.run(**module, pass_mach.getMAM()); });
+  compiler::utils::disableCrashRecovery();
+  if (crashed || has_error) {
+    return false;
+  }
+
+  llvm::raw_svector_ostream stream(group.bitcode);
+  llvm::WriteBitcodeToFile(**module, stream);
+  return true;
+}
+}  // namespace
+
+cargo::expected<std::unique_ptr<llvm::Module>, compiler::Result>
+HostModule::finalizeKernelsInParallel(HostTarget &target,
+                                      const compiler::Options &build_options,
+                                      llvm::Module &module) {
+  // Pass timings, statistics and debug output are collected in LLVM's global
+  // state, which pipelines on several threads would race on.
+  if (target.usesLLVMGlobalState(build_options) ||
+      !canFinalizeKernelsSeparately(module)) {
+    return std::unique_ptr<llvm::Module>{};
+  }
+
+  llvm::SmallVector<const llvm::Function *, 8> kernels;
+  for (const auto &function : module) {
+    if (compiler::utils::isKernelEntryPt(function) &&
+        !function.isDeclaration()) {
+      kernels.push_back(&function);
+    }
+  }
+  const size_t num_groups =
+      std::min<size_t>(target.compile_threads, kernels.size());
+  if (num_groups < 2) {
+    return std::unique_ptr<llvm::Module>{};
+  }
+
+  // Balance the groups by giving the largest remaining kernel to the smallest
+  // group.
+  std::sort(kernels.begin(), kernels.end(),
+            [](const llvm::Function *lhs, const llvm::Function *rhs) {
+              return lhs->getInstructionCount() > rhs->getInstructionCount();
+            });
+  std::vector<KernelGroup> groups(num_groups);
+  for (const auto *kernel : kernels) {
+    auto smallest = std::min_element(
+        groups.begin(), groups.end(),
+        [](const KernelGroup &lhs, const KernelGroup &rhs) {
+          return lhs.size < rhs.size;
+        });
+    smallest->names.push_back(kernel->getName().str());
+    smallest->size += kernel->getInstructionCount();
+  }
+  for (auto &group : groups) {
+    auto TM = target.target_machine_builder->createTargetMachine();
+    if (!TM) {
+      llvm::consumeError(TM.takeError());
+      return cargo::make_unexpected(compiler::Result::FAILURE);
+    }
+    group.target_machine = std::move(*TM);
+  }
+
+  // Modules can't be moved between LLVM contexts, so every thread parses the
+  // module into its own context and the results come back as bitcode.
+  llvm::SmallVector<char, 0> bitcode;
+  {
+    llvm::raw_svector_ostream stream(bitcode);
+    llvm::WriteBitcodeToFile(module, stream);
+  }
+  const llvm::StringRef bitcode_ref(bitcode.data(), bitcode.size());
+  const bool optimize = hasDeferredOptimizations();
+  target.runCompileTasks(num_groups, [&](size_t i) {
+    groups[i].finalized = finalizeKernelGroup(target, build_options, optimize,
+                                              bitcode_ref, groups[i]);
+  });
+
+  std::unique_ptr<llvm::Module> linked_module;
+  for (auto &group : groups) {
+    if (!group.finalized) {
+      return cargo::make_unexpected(compiler::Result::FINALIZE_PROGRAM_FAILURE);
+    }
+    auto group_module = llvm::parseBitcodeFile(
+        llvm::MemoryBufferRef(
+            llvm::StringRef(group.bitcode.data(), group.bitcode.size()),
+            "kernels"),
+        module.getContext());
+    if (!group_module) {
+      llvm::consumeError(group_module.takeError());
+      return cargo::make_unexpected(compiler::Result::FINALIZE_PROGRAM_FAILURE);
+    }
+    if (!linked_module) {
+      linked_module = std::move(*group_module);
+    } else if (llvm::Linker::linkModules(*linked_module,
+                                         std::move(*group_module))) {
+      return cargo::make_unexpected(compiler::Result::FINALIZE_PROGRAM_FAILURE);
+    }
+  }
+  return {std::move(linked_module)};
+}
+
 cargo::expected<cargo::dynamic_array<uint8_t>, compiler::Result>
 HostModule::hostCompileObject(HostTarget &target,
                               const compiler::Options &build_options,
@@ -138,21 +354,44 @@ HostModule::hostCompileObject(HostTarget &target,
   host_pass_mach.setCompilerOptions(build_options);
   initializePassMachineryForFinalize(host_pass_mach);
 
-  llvm::ModulePassManager pm;
-  pm.addPass(compiler::utils::TransferKernelMetadataPass());
+  compiler::utils::TransferKernelMetadataPass().run(*cloned_module,
+                                                    host_pass_mach.getMAM());
 
-  pm.addPass(host_pass_mach.getKernelFinalizationPasses());
+  // Finalize the kernels on several threads if possible, leaving only the
+  // passes which need every kernel and code generation to run on the linked
+  // module.
+  llvm::ModulePassManager pm;
+  auto linked_module =
+      finalizeKernelsInParallel(target, build_options, *cloned_module);
+  if (!linked_module) {
+    return cargo::make_unexpected(linked_module.error());
+  }
+  if (*linked_module) {
+    cloned_module = std::move(*linked_module);
+    pm.addPass(host_pass_mach.getBinaryFinalizationPasses());
+  } else {
+    if (hasDeferredOptimizations()) {
+      compiler::addKernelOptimizationPasses(pm, host_pass_mach.getPB(),
+                                            build_options);
+    }
+    pm.addPass(host_pass_mach.getKernelFinalizationPasses());
+  }
   {
-    // Using the CrashRecoveryContext and statistics touches LLVM's global
-    // state.
-    const std::lock_guard<std::mutex> globalLock(
-        compiler::utils::getLLVMGlobalMutex());
+    // Crash recovery is set up through compiler::utils and the pipeline only
+    // reads LLVM's command-line options, so objects of other contexts can be
+    // compiled in parallel unless statistics, pass timings or debug output
+    // are written to LLVM's global state.
+    std::unique_lock<std::mutex> globalLock(
+        compiler::utils::getLLVMGlobalMutex(), std::defer_lock);
+    if (target.usesLLVMGlobalState(build_options)) {
+      globalLock.lock();
+    }
 
     llvm::CrashRecoveryContext CRC;
-    llvm::CrashRecoveryContext::Enable();
+    compiler::utils::enableCrashRecovery();
     const bool crashed = !CRC.RunSafely(
         [&] { pm.run(*cloned_module, host_pass_mach.getMAM()); });
-    llvm::CrashRecoveryContext::Disable();
+    compiler::utils::disableCrashRecovery();
     if (crashed) {
       return cargo::make_unexpected(compiler::Result::FINALIZE_PROGRAM_FAILURE);
     }
@@ -218,6 +457,7 @@ llvm::ModulePassManager HostModule::getLateTargetPasses(
 compiler::Kernel *HostModule::createKernel(const std::string &name) {
   std::unique_ptr<llvm::Module> kernel_module;
   handler::GenericMetadata kernel_md(name, name, 0);
+  bool uses_sub_groups = false;
   {
     const std::lock_guard<compiler::Context> guard(context);
     kernel_module = llvm::CloneModule(*finalized_llvm_module);
@@ -228,14 +468,23 @@ compiler::Kernel *HostModule::createKernel(const std::string &name) {
 
     llvm::ModulePassManager pm;
     auto pass_mach = createPassMachinery();
-    pass_mach->initializeStart();
-    pass_mach->initializeFinish();
+    static_cast<HostPassMachinery &>(*pass_mach).setCompilerOptions(options);
+    initializePassMachineryForFinalize(*pass_mach);
 
     // Set up the kernel metadata which informs later passes which kernel we're
     // interested in optimizing.
     const compiler::utils::EncodeKernelMetadataPassOptions pass_opts{name};
     pm.addPass(compiler::utils::EncodeKernelMetadataPass(pass_opts));
     pm.addPass(compiler::utils::ReduceToFunctionPass());
+    // Optimize only the kernel, and the functions it calls, if finalize left
+    // it to us. The result is cached with the kernel by getKernel. This runs
+    // under the context lock like the rest of the cloning, so with
+    // `-cl-lazy-finalize` the first creation of each kernel is serialized
+    // with all other compilation in the same compiler::Context, including
+    // that of other programs.
+    if (hasDeferredOptimizations()) {
+      compiler::addKernelOptimizationPasses(pm, pass_mach->getPB(), options);
+    }
     pm.addPass(compiler::utils::ComputeLocalMemoryUsagePass());
 
     pm.run(*kernel_module, pass_mach->getMAM());
@@ -243,6 +492,13 @@ compiler::Kernel *HostModule::createKernel(const std::string &name) {
     if (auto *f = kernel_module->getFunction(name)) {
       kernel_md = pass_mach->getFAM()
                       .getResult<compiler::utils::GenericMetadataAnalysis>(*f);
+      // Finalize has lowered sub-group builtins to mux builtins, which the
+      // analysis follows through the kernel's call graph.
+      uses_sub_groups =
+          compiler::utils::getReqdSubgroupSize(*f).has_value() ||
+          pass_mach->getMAM()
+              .getResult<compiler::utils::SubgroupAnalysis>(*kernel_module)
+              .usesSubgroups(*f);
     }
   }
   auto device_info = target.getCompilerInfo()->device_info;
@@ -257,9 +513,10 @@ compiler::Kernel *HostModule::createKernel(const std::string &name) {
 
   assert(kernel_md.local_memory_usage <= SIZE_MAX);
   auto kernel = new HostKernel(
-      static_cast<HostTarget &>(target), getOptions(), kernel_module.release(),
+      static_cast<HostTarget &>(target), getOptions(), this,
+      kernel_module.release(),
       kernel_md.kernel_name, local_sizes,
-      static_cast<size_t>(kernel_md.local_memory_usage));
+      static_cast<size_t>(kernel_md.local_memory_usage), uses_sub_groups);
   return kernel;
 }
 
@@ -282,8 +539,11 @@ HostModule::createPassMachinery() {
 
 void initializePassMachineryForFinalize(
     compiler::utils::PassMachinery &passMach, const HostTarget &target) {
-  auto *TM = target.target_machine.get();
+  initializePassMachineryForFinalize(passMach, target.target_machine.get());
+}
 
+void initializePassMachineryForFinalize(
+    compiler::utils::PassMachinery &passMach, llvm::TargetMachine *TM) {
   passMach.initializeStart();
   if (TM) {
     passMach.getFAM().registerPass(
@@ -299,7 +559,7 @@ void initializePassMachineryForFinalize(
   // to adding the pass. Trying to add a TargetLibraryInfoWrapper analysis with
   // disabled functions later will have no affect, due to the analysis already
   // being registered with the pass manager.
-  auto Triple = target.target_machine->getTargetTriple();
+  auto Triple = TM->getTargetTriple();
   auto LibraryInfo = llvm::TargetLibraryInfoImpl(Triple);
   LibraryInfo.disableAllFunctions();
   passMach.getFAM().registerPass(
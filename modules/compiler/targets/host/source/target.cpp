@@ -16,6 +16,7 @@
 
 #include "host/target.h"
 
+#include <llvm/ADT/Statistic.h>
 #include <llvm/Bitcode/BitcodeReader.h>
 #include <llvm/ExecutionEngine/JITLink/EHFrameSupport.h>
 #include <llvm/ExecutionEngine/Orc/EPCEHFrameRegistrar.h>
@@ -33,12 +34,17 @@
 #include <llvm/Target/TargetMachine.h>
 #include <multi_llvm/multi_llvm.h>
 
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
 #if LLVM_VERSION_GREATER_EQUAL(18, 0)
 #include <llvm/TargetParser/Host.h>
 #else
 #include <llvm/Support/Host.h>
 #endif
 
+#include "host/compiler_kernel.h"
 #include "host/device.h"
 #include "host/info.h"
 #include "host/module.h"
@@ -53,7 +59,215 @@ HostTarget::HostTarget(const HostInfo *compiler_info,
                        compiler::Context *context,
                        compiler::NotifyCallbackFn callback)
     : BaseTarget(compiler_info, context, callback),
-      llvm_ts_context(std::make_unique<llvm::LLVMContext>()) {}
+      llvm_ts_context(std::make_unique<llvm::LLVMContext>()),
+      speculative_jit(true),
+      // Finalizing a kernel group is memory hungry and linking the groups is
+      // serial, so more threads than this rarely pay off by default.
+      compile_threads(
+          std::min(4u, std::max(1u, std::thread::hardware_concurrency()))) {
+  if (const char *env = std::getenv("CA_HOST_SPECULATIVE_JIT")) {
+    speculative_jit = 0 != std::strcmp(env, "0");
+  }
+  if (const char *env = std::getenv("CA_HOST_COMPILE_THREADS")) {
+    const auto value = std::strtoul(env, nullptr, 10);
+    if (value > 0) {
+      compile_threads = static_cast<unsigned>(value);
+    }
+  }
+}
+
+HostTarget::~HostTarget() {
+  {
+    const std::lock_guard<std::mutex> lock(speculation_mutex);
+    speculation_stop = true;
+  }
+  speculation_condition.notify_all();
+  if (speculation_thread.joinable()) {
+    speculation_thread.join();
+  }
+  {
+    const std::lock_guard<std::mutex> lock(compile_mutex);
+    compile_stop = true;
+  }
+  compile_condition.notify_all();
+  for (auto &worker : compile_workers) {
+    worker.join();
+  }
+}
+
+void HostTarget::runCompileTasks(size_t count,
+                                 const std::function<void(size_t)> &task) {
+  if (0 == count) {
+    return;
+  }
+  CompileBatch batch = {&task, count, 0, 0};
+  std::unique_lock<std::mutex> lock(compile_mutex);
+  const size_t num_workers = std::min<size_t>(compile_threads - 1, count - 1);
+  while (compile_workers.size() < num_workers) {
+    compile_workers.emplace_back([this] { runCompileWorker(); });
+    compile_workers.back().set_name("host:compile");
+  }
+  if (count > 1) {
+    compile_batches.push_back(&batch);
+    compile_condition.notify_all();
+  }
+  // Run tasks here as well, so the batch completes even while every compile
+  // thread is busy with the batches of other modules.
+  while (batch.next < batch.count) {
+    const size_t index = takeCompileTask(batch);
+    lock.unlock();
+    task(index);
+    lock.lock();
+    batch.done++;
+  }
+  compile_condition.wait(lock, [&] { return batch.done == batch.count; });
+}
+
+bool HostTarget::usesLLVMGlobalState(const compiler::Options &options) const {
+  auto &base_context = getContext();
+  return options.llvm_stats || llvm::AreStatisticsEnabled() ||
+         base_context.isLLVMTimePassesEnabled() ||
+         base_context.getLLVMDebugLoggingLevel() !=
+             compiler::utils::DebugLogging::None;
+}
+
+size_t HostTarget::takeCompileTask(CompileBatch &batch) {
+  const size_t index = batch.next++;
+  if (batch.next == batch.count) {
+    const auto found =
+        std::find(compile_batches.begin(), compile_batches.end(), &batch);
+    if (found != compile_batches.end()) {
+      compile_batches.erase(found);
+    }
+  }
+  return index;
+}
+
+void HostTarget::runCompileWorker() {
+  std::unique_lock<std::mutex> lock(compile_mutex);
+  while (true) {
+    compile_condition.wait(
+        lock, [this] { return compile_stop || !compile_batches.empty(); });
+    if (compile_stop) {
+      return;
+    }
+    CompileBatch &batch = *compile_batches.front();
+    const size_t index = takeCompileTask(batch);
+    lock.unlock();
+    (*batch.task)(index);
+    lock.lock();
+    if (++batch.done == batch.count) {
+      compile_condition.notify_all();
+    }
+  }
+}
+
+void HostTarget::speculate(HostKernel *kernel,
+                           const std::array<size_t, 3> &local_size) {
+  {
+    const std::lock_guard<std::mutex> lock(speculation_mutex);
+    if (speculation_stop) {
+      return;
+    }
+    const auto matches = [&](const SpeculationJob &job) {
+      return job.kernel == kernel && job.local_size == local_size;
+    };
+    if (matches(running_job) ||
+        std::any_of(speculation_jobs.begin(), speculation_jobs.end(),
+                    matches)) {
+      return;
+    }
+    speculation_jobs.push_back({kernel, local_size});
+    if (!speculation_thread.joinable()) {
+      speculation_thread = cargo::thread([this] { runSpeculation(); });
+      speculation_thread.set_name("host:speculate");
+    }
+  }
+  speculation_condition.notify_all();
+}
+
+void HostTarget::cancelSpeculation(HostKernel *kernel) {
+  std::unique_lock<std::mutex> lock(speculation_mutex);
+  speculation_jobs.erase(
+      std::remove_if(speculation_jobs.begin(), speculation_jobs.end(),
+                     [kernel](const SpeculationJob &job) {
+                       return job.kernel == kernel;
+                     }),
+      speculation_jobs.end());
+  if (running_job.kernel == kernel) {
+    if (running_locked) {
+      speculation_condition.wait(
+          lock, [&] { return running_job.kernel != kernel; });
+    } else {
+      // The caller may hold the context lock the job is waiting for.
+      running_job.kernel = nullptr;
+    }
+  }
+}
+
+void HostTarget::recordLocalSize(const HostModule *program,
+                                 const std::string &name,
+                                 const std::array<size_t, 3> &local_size) {
+  const std::lock_guard<std::mutex> lock(speculation_mutex);
+  auto &local_sizes = recorded_local_sizes[{program, name}];
+  if (std::find(local_sizes.begin(), local_sizes.end(), local_size) ==
+      local_sizes.end()) {
+    local_sizes.push_back(local_size);
+  }
+}
+
+std::vector<std::array<size_t, 3>> HostTarget::getRecordedLocalSizes(
+    const HostModule *program, const std::string &name) {
+  const std::lock_guard<std::mutex> lock(speculation_mutex);
+  auto found = recorded_local_sizes.find({program, name});
+  if (found == recorded_local_sizes.end()) {
+    return {};
+  }
+  return found->second;
+}
+
+void HostTarget::forgetLocalSizes(const HostModule *program) {
+  const std::lock_guard<std::mutex> lock(speculation_mutex);
+  auto first = recorded_local_sizes.lower_bound({program, std::string()});
+  auto last = first;
+  while (last != recorded_local_sizes.end() && last->first.first == program) {
+    ++last;
+  }
+  recorded_local_sizes.erase(first, last);
+}
+
+void HostTarget::runSpeculation() {
+  std::unique_lock<std::mutex> lock(speculation_mutex);
+  for (;;) {
+    speculation_condition.wait(
+        lock, [&] { return speculation_stop || !speculation_jobs.empty(); });
+    if (speculation_stop) {
+      return;
+    }
+    running_job = speculation_jobs.front();
+    speculation_jobs.pop_front();
+
+    // Block on the context lock like any other compile. The kernel may be
+    // destroyed meanwhile by a thread holding it, so the job is only known to
+    // still be wanted once we have the lock.
+    lock.unlock();
+    auto &context = getContext();
+    context.lock();
+    lock.lock();
+    if (running_job.kernel) {
+      running_locked = true;
+      const SpeculationJob job = running_job;
+      lock.unlock();
+      job.kernel->speculateOptimizedKernel(job.local_size);
+      lock.lock();
+      running_locked = false;
+    }
+    context.unlock();
+
+    running_job.kernel = nullptr;
+    speculation_condition.notify_all();
+  }
+}
 
 compiler::Result HostTarget::initWithBuiltins(
     std::unique_ptr<llvm::Module> builtins_module) {
@@ -252,10 +466,21 @@ compiler::Result HostTarget::initWithBuiltins(
     return compiler::Result::FAILURE;
   }
   target_machine = std::move(*TM);
+  target_machine_builder =
+      std::make_unique<llvm::orc::JITTargetMachineBuilder>(TMBuilder);
 
   return compiler::Result::SUCCESS;
 }
 
+std::string HostTarget::getTargetIdentifier() const {
+  if (!target_machine) {
+    return {};
+  }
+  return target_machine->getTargetTriple().str() + ";" +
+         target_machine->getTargetCPU().str() + ";" +
+         target_machine->getTargetFeatureString().str();
+}
+
 std::unique_ptr<compiler::Module> HostTarget::createModule(uint32_t &num_errors,
                                                            std::string &log) {
   return std::unique_ptr<HostModule>{
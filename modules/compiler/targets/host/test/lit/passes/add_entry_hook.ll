@@ -24,59 +24,86 @@ target datalayout = "e-p:64:64:64-m:e-i64:64-f80:128-n8:16:32:64-S128"
 ; CHECK: [[NGPSX:%.*]] = call i64 @__mux_get_num_groups(i32 0, ptr %wi-info, ptr %sched-info, ptr %wg-info)
 ; CHECK: [[NGPSY:%.*]] = call i64 @__mux_get_num_groups(i32 1, ptr %wi-info, ptr %sched-info, ptr %wg-info)
 ; CHECK: [[NGPSZ:%.*]] = call i64 @__mux_get_num_groups(i32 2, ptr %wi-info, ptr %sched-info, ptr %wg-info)
+; CHECK: [[NGPSXY:%.*]] = mul i64 [[NGPSX]], [[NGPSY]]
+; CHECK: [[NGPS:%.*]] = mul i64 [[NGPSXY]], [[NGPSZ]]
 ; CHECK: [[T0:%.*]] = getelementptr %Mux_schedule_info_s, ptr %sched-info, i32 0, i32 3
 ; CHECK: [[SLICE:%.*]] = load i64, ptr [[T0]], align 8
 ; CHECK: [[T1:%.*]] = getelementptr %Mux_schedule_info_s, ptr %sched-info, i32 0, i32 4
 ; CHECK: [[TTL_SLICES:%.*]] = load i64, ptr [[T1]], align 8
-; CHECK: [[NGPS_RNDUP:%.*]] = add i64 [[NGPSX]], [[TTL_SLICES]]
+; CHECK: [[NGPS_RNDUP:%.*]] = add i64 [[NGPS]], [[TTL_SLICES]]
 ; CHECK: [[SLICE_SZ:%.*]] = udiv i64 [[NGPS_RNDUP]], [[TTL_SLICES]]
 ; CHECK: [[SLICE_BEG:%.*]] = mul i64 [[SLICE_SZ]], [[SLICE]]
 ; CHECK: [[SLICE_END:%.*]] = add i64 [[SLICE_BEG]], [[SLICE_SZ]]
-; CHECK: [[T2:%.*]] = icmp ult i64 [[SLICE_END]], [[NGPSX]]
-; CHECK: [[CLMPD_SLICE_END:%.*]] = select i1 [[T2]], i64 [[SLICE_END]], i64 [[NGPSX]]
-; CHECK: [[T3:%.*]] = icmp ult i64 [[SLICE_BEG]], [[CLMPD_SLICE_END]]
-; CHECK: br i1 [[T3]], label %[[LOOP:.*]], label %[[EARLY_EXIT:.*]]
-
-; CHECK: [[EARLY_EXIT]]:
+; CHECK: [[T2:%.*]] = icmp ult i64 [[SLICE_END]], [[NGPS]]
+; CHECK: [[CLMPD_SLICE_END:%.*]] = select i1 [[T2]], i64 [[SLICE_END]], i64 [[NGPS]]
+; CHECK: [[T_CTR:%.*]] = getelementptr %Mux_schedule_info_s, ptr %sched-info, i32 0, i32 6
+; CHECK: [[CTR:%.*]] = load ptr, ptr [[T_CTR]], align 8
+; CHECK: [[DYN:%.*]] = icmp ne ptr [[CTR]], null
+; CHECK: [[T_LMEM:%.*]] = getelementptr %Mux_schedule_info_s, ptr %sched-info, i32 0, i32 7
+; CHECK: [[LMEM:%.*]] = load ptr, ptr [[T_LMEM]], align 8
+; CHECK: br i1 [[DYN]], label %[[NEXT_CHUNK:.*]], label %[[STATIC_SLICE:.*]]
+
+; CHECK: [[EARLY_EXIT:.*]]:
 ; CHECK: ret void
 
-; CHECK: [[LOOP]]:
-; CHECK: br label %[[LOOPZ:.*]]
+; CHECK: [[NEXT_CHUNK]]:
+; CHECK: [[CLAIMED:%.*]] = load atomic i64, ptr [[CTR]] monotonic, align 8
+; CHECK: [[T4:%.*]] = icmp ult i64 [[CLAIMED]], [[NGPS]]
+; CHECK: [[T5:%.*]] = select i1 [[T4]], i64 [[CLAIMED]], i64 [[NGPS]]
+; CHECK: [[REMAINING:%.*]] = sub i64 [[NGPS]], [[T5]]
+; CHECK: [[T6:%.*]] = shl i64 [[TTL_SLICES]], 1
+; CHECK: [[GUIDED_SZ:%.*]] = udiv i64 [[REMAINING]], [[T6]]
+; CHECK: [[T7:%.*]] = icmp eq i64 [[GUIDED_SZ]], 0
+; CHECK: [[CHUNK_SZ:%.*]] = select i1 [[T7]], i64 1, i64 [[GUIDED_SZ]]
+; CHECK: [[CHUNK_BEG:%.*]] = atomicrmw add ptr [[CTR]], i64 [[CHUNK_SZ]] monotonic, align 8
+; CHECK: [[CHUNK_END:%.*]] = add i64 [[CHUNK_BEG]], [[CHUNK_SZ]]
+; CHECK: [[T8:%.*]] = icmp ult i64 [[CHUNK_END]], [[NGPS]]
+; CHECK: [[CLMPD_CHUNK_END:%.*]] = select i1 [[T8]], i64 [[CHUNK_END]], i64 [[NGPS]]
+; CHECK: [[T9:%.*]] = icmp ult i64 [[CHUNK_BEG]], [[NGPS]]
+; CHECK: br i1 [[T9]], label %[[LOOP:.*]], label %[[EARLY_EXIT]]
+
+; CHECK: [[STATIC_SLICE]]:
+; CHECK: [[T3:%.*]] = icmp ult i64 [[SLICE_BEG]], [[CLMPD_SLICE_END]]
+; CHECK: br i1 [[T3]], label %[[LOOP]], label %[[EARLY_EXIT]]
 
-; CHECK: [[LOOPZ]]:
-; CHECK: [[PHIZ:%.*]] = phi i64 [ 0, %[[LOOP]] ], [ [[INCZ:%.*]], %[[EXITZ:.*]] ]
+; CHECK: [[LOOP]]:
+; CHECK: [[RANGE_BEG:%.*]] = phi i64 [ [[SLICE_BEG]], %[[STATIC_SLICE]] ], [ [[CHUNK_BEG]], %[[NEXT_CHUNK]] ]
+; CHECK: [[RANGE_END:%.*]] = phi i64 [ [[CLMPD_SLICE_END]], %[[STATIC_SLICE]] ], [ [[CLMPD_CHUNK_END]], %[[NEXT_CHUNK]] ]
+; CHECK: [[BEGX:%.*]] = urem i64 [[RANGE_BEG]], [[NGPSX]]
+; CHECK: [[BEGYZ:%.*]] = udiv i64 [[RANGE_BEG]], [[NGPSX]]
+; CHECK: [[BEGY:%.*]] = urem i64 [[BEGYZ]], [[NGPSY]]
+; CHECK: [[BEGZ:%.*]] = udiv i64 [[BEGYZ]], [[NGPSY]]
+; CHECK: br label %[[LOOPG:.*]]
+
+; CHECK: [[LOOPG]]:
+; CHECK: [[PHIG:%.*]] = phi i64 [ [[RANGE_BEG]], %[[LOOP]] ], [ [[INCG:%.*]], %[[LOOPG]] ]
+; CHECK: [[PHIX:%.*]] = phi i64 [ [[BEGX]], %[[LOOP]] ], [ [[NEXTX:%.*]], %[[LOOPG]] ]
+; CHECK: [[PHIY:%.*]] = phi i64 [ [[BEGY]], %[[LOOP]] ], [ [[NEXTY:%.*]], %[[LOOPG]] ]
+; CHECK: [[PHIZ:%.*]] = phi i64 [ [[BEGZ]], %[[LOOP]] ], [ [[NEXTZ:%.*]], %[[LOOPG]] ]
 ; CHECK: [[GEPGPIDS:%.*]] = getelementptr %MiniWGInfo, ptr %wg-info, i32 0, i32 0
 ; CHECK: [[GEPGPIDZ:%.*]] = getelementptr [3 x i64], ptr [[GEPGPIDS]], i32 0, i32 2
 ; CHECK: store i64 [[PHIZ]], ptr [[GEPGPIDZ]], align 8
-; CHECK: br label %[[LOOPY:.*]]
-
-; CHECK: [[LOOPY]]:
-; CHECK: [[PHIY:%.*]] = phi i64 [ 0, %[[LOOPZ]] ], [ [[INCY:%.*]], %[[EXITY:.*]] ]
 ; CHECK: [[GEPGPIDY:%.*]] = getelementptr [3 x i64], ptr [[GEPGPIDS]], i32 0, i32 1
 ; CHECK: store i64 [[PHIY]], ptr [[GEPGPIDY]], align 8
-; CHECK: br label %[[LOOPX:.*]]
-
-; CHECK: [[LOOPX]]:
-; CHECK: [[PHIX:%.*]] = phi i64 [ [[SLICE_BEG]], %[[LOOPY]] ], [ [[INCX:%.*]], %[[LOOPX]] ]
 ; CHECK: [[GEPGPIDX:%.*]] = getelementptr [3 x i64], ptr [[GEPGPIDS]], i32 0, i32 0
 ; CHECK: store i64 [[PHIX]], ptr [[GEPGPIDX]], align 8
+; CHECK: store ptr [[LMEM]], ptr [[T_LMEM]], align 8
 ; CHECK: call void @foo(i8 signext %x, ptr %wi-info, ptr %sched-info, ptr %wg-info) [[FOO_ATTRS:#.*]]
-; CHECK: [[INCX]] = add i64 [[PHIX]], 1
-; CHECK: [[CMPX:%.*]] = icmp ult i64 [[INCX]], [[CLMPD_SLICE_END]]
-; CHECK: br i1 [[CMPX]], label %[[LOOPX]], label %[[EXITY]]
-
-; CHECK: [[EXITY]]:
-; CHECK: [[INCY]] = add i64 [[PHIY]], 1
-; CHECK: [[CMPY:%.*]] = icmp ult i64 [[INCY]], [[NGPSY]]
-; CHECK: br i1 [[CMPY]], label %[[LOOPY]], label %[[EXITZ]]
-
-; CHECK: [[EXITZ]]:
-; CHECK: [[INCZ]] = add i64 [[PHIZ]], 1
-; CHECK: [[CMPZ:%.*]] = icmp ult i64 [[INCZ]], [[NGPSZ]]
-; CHECK: br i1 [[CMPZ]], label %[[LOOPZ]], label %[[EXIT:.*]]
+; CHECK: [[INCX:%.*]] = add i64 [[PHIX]], 1
+; CHECK: [[CARRYX:%.*]] = icmp eq i64 [[INCX]], [[NGPSX]]
+; CHECK: [[NEXTX]] = select i1 [[CARRYX]], i64 0, i64 [[INCX]]
+; CHECK: [[CARRYXEXT:%.*]] = zext i1 [[CARRYX]] to i64
+; CHECK: [[INCY:%.*]] = add i64 [[PHIY]], [[CARRYXEXT]]
+; CHECK: [[CARRYY:%.*]] = icmp eq i64 [[INCY]], [[NGPSY]]
+; CHECK: [[NEXTY]] = select i1 [[CARRYY]], i64 0, i64 [[INCY]]
+; CHECK: [[CARRYYEXT:%.*]] = zext i1 [[CARRYY]] to i64
+; CHECK: [[NEXTZ]] = add i64 [[PHIZ]], [[CARRYYEXT]]
+; CHECK: [[INCG]] = add i64 [[PHIG]], 1
+; CHECK: [[CMPG:%.*]] = icmp ult i64 [[INCG]], [[RANGE_END]]
+; CHECK: br i1 [[CMPG]], label %[[LOOPG]], label %[[EXIT:.*]]
 
 ; CHECK: [[EXIT]]:
-; CHECK: ret void
+; CHECK: br i1 [[DYN]], label %[[NEXT_CHUNK]], label %[[EARLY_EXIT]]
 define void @foo(i8 signext %x, ptr %wi-info, ptr %sched-info, ptr %wg-info) #0 !test !1 !mux_scheduled_fn !2 {
   ret void
 }
@@ -0,0 +1,67 @@
+; Copyright (C) Codeplay Software Limited
+;
+; Licensed under the Apache License, Version 2.0 (the "License") with LLVM
+; Exceptions; you may not use this file except in compliance with the License.
+; You may obtain a copy of the License at
+;
+;     https://github.com/codeplaysoftware/oneapi-construction-kit/blob/main/LICENSE.txt
+;
+; Unless required by applicable law or agreed to in writing, software
+; distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+; WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+; License for the specific language governing permissions and limitations
+; under the License.
+;
+; SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+
+; RUN: muxc --device "%default_device" --passes "add-sched-params,add-kernel-wrapper<packed>,verify" -S %s | FileCheck %s --check-prefix WRAPPER
+; RUN: muxc --device "%default_device" --passes add-sched-params,replace-module-scope-vars,verify -S %s | FileCheck %s --check-prefix LOCAL-VARS
+
+target triple = "spir64-unknown-unknown"
+target datalayout = "e-p:64:64:64-m:e-i64:64-f80:128-n8:16:32:64-S128"
+
+@bar.tile = internal addrspace(3) global [4 x i32] undef, align 4
+
+; Check that local buffer arguments are bump allocated from the arena described
+; by the scheduling info, falling back to the stack when it is too small.
+; WRAPPER-LABEL: define void @foo.mux-kernel-wrapper(
+; WRAPPER: [[SIZE:%.*]] = load i64, ptr {{%.*}}, align 1
+; WRAPPER: [[CURSOR_PTR:%.*]] = getelementptr inbounds %Mux_schedule_info_s, ptr %sched-info, i32 0, i32 7
+; WRAPPER: [[END_PTR:%.*]] = getelementptr inbounds %Mux_schedule_info_s, ptr %sched-info, i32 0, i32 8
+; WRAPPER: [[CURSOR:%.*]] = load ptr, ptr [[CURSOR_PTR]], align 8
+; WRAPPER: %local.cursor = ptrtoint ptr [[CURSOR]] to i64
+; WRAPPER: [[END:%.*]] = load ptr, ptr [[END_PTR]], align 8
+; WRAPPER: %local.end = ptrtoint ptr [[END]] to i64
+; WRAPPER: [[ADD:%.*]] = add i64 %local.cursor, 127
+; WRAPPER: %local.begin = and i64 [[ADD]], -128
+; WRAPPER: %local.next = add i64 %local.begin, [[SIZE]]
+; WRAPPER: [[NEXT:%.*]] = inttoptr i64 %local.next to ptr
+; WRAPPER: store ptr [[NEXT]], ptr [[CURSOR_PTR]], align 8
+; WRAPPER: %local.fits = icmp ule i64 %local.next, %local.end
+; WRAPPER: [[COUNT:%.*]] = select i1 %local.fits, i64 0, i64 [[SIZE]]
+; WRAPPER: %local.fallback = alloca i8, i64 [[COUNT]], align 128
+; WRAPPER: [[BEGIN:%.*]] = inttoptr i64 %local.begin to ptr
+; WRAPPER: %local.memory = select i1 %local.fits, ptr [[BEGIN]], ptr %local.fallback
+; WRAPPER: %local = addrspacecast ptr %local.memory to ptr addrspace(3)
+define void @foo(ptr addrspace(1) %global, ptr addrspace(3) %local) #0 {
+  ret void
+}
+
+; Check that the struct of local module-scope variables is allocated the same
+; way.
+; LOCAL-VARS-LABEL: define void @bar.mux-local-var-wrapper(
+; LOCAL-VARS: [[CURSOR_PTR:%.*]] = getelementptr inbounds %Mux_schedule_info_s, ptr %sched-info, i32 0, i32 7
+; LOCAL-VARS: %local.begin = and i64 {{%.*}}, -4
+; LOCAL-VARS: %local.next = add i64 %local.begin, 16
+; LOCAL-VARS: %local.fits = icmp ule i64 %local.next, %local.end
+; LOCAL-VARS: [[COUNT:%.*]] = select i1 %local.fits, i64 0, i64 1
+; LOCAL-VARS: %local.fallback = alloca %localVarTypes, i64 [[COUNT]], align 4
+; LOCAL-VARS: %local.memory = select i1 %local.fits, ptr {{%.*}}, ptr %local.fallback
+; LOCAL-VARS: call void {{.*}}, ptr %local.memory)
+define void @bar() #0 {
+  %p = getelementptr inbounds [4 x i32], ptr addrspace(3) @bar.tile, i64 0, i64 1
+  store i32 1, ptr addrspace(3) %p, align 4
+  ret void
+}
+
+attributes #0 = { "mux-kernel"="entry-point" }
@@ -607,6 +607,26 @@ class BuiltinInfo {
       const SchedParamInfo &Info, llvm::IRBuilder<> &B, llvm::Function &IntoF,
       llvm::Function &CalleeF);
 
+  /// @brief Responsible for allocating the __local memory of a kernel.
+  ///
+  /// Used by the passes which materialize __local memory in kernel wrappers,
+  /// i.e. local buffer kernel arguments and local module-scope variables. The
+  /// memory must remain valid until the wrapper returns. There is a default
+  /// implementation: see BIMuxInfoConcept::allocateLocalMemory
+  ///
+  /// @param B An IRBuilder providing the insertion point at which to insert
+  /// allocation instructions. On return the insertion point is where the
+  /// caller should continue to insert instructions.
+  /// @param F The kernel wrapper in which the memory is allocated.
+  /// @param Ty The type of the memory to allocate.
+  /// @param ArraySize The number of elements of @p Ty to allocate, or nullptr
+  /// to allocate a single element.
+  /// @param Alignment The minimum alignment of the memory.
+  /// @return A pointer to the allocated memory in the default address space.
+  llvm::Value *allocateLocalMemory(llvm::IRBuilder<> &B, llvm::Function &F,
+                                   llvm::Type *Ty, llvm::Value *ArraySize,
+                                   llvm::Align Alignment);
+
   /// @brief Returns true if the builtin ID requires extra scheduling
   /// parameters to function.
   ///
@@ -695,6 +715,14 @@ class BIMuxInfoConcept {
       const BuiltinInfo::SchedParamInfo &Info, llvm::IRBuilder<> &B,
       llvm::Function &IntoF, llvm::Function &CalleeF);
 
+  /// @brief See BuiltinInfo::allocateLocalMemory
+  ///
+  /// The default implementation allocates the memory on the stack.
+  virtual llvm::Value *allocateLocalMemory(llvm::IRBuilder<> &B,
+                                           llvm::Function &F, llvm::Type *Ty,
+                                           llvm::Value *ArraySize,
+                                           llvm::Align Alignment);
+
   /// @brief Sets default builtin attributes on the given function.
   static void setDefaultBuiltinAttributes(llvm::Function &F,
                                           bool AlwaysInline = true);
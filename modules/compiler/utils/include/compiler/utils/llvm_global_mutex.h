@@ -22,6 +22,7 @@
 #define COMPILER_UTILS_LLVM_GLOBAL_MUTEX_H_INCLUDED
 
 #include <llvm/Support/CommandLine.h>
+#include <llvm/Support/ErrorHandling.h>
 
 #include <mutex>
 
@@ -37,6 +38,47 @@ namespace utils {
 ///
 /// @return Returns a reference to the global LLVM mutex object.
 std::mutex &getLLVMGlobalMutex();
+
+/// @brief Enable LLVM's crash recovery, safe to call from several threads.
+///
+/// `llvm::CrashRecoveryContext::Enable` and `Disable` change process-wide
+/// state, so a thread disabling crash recovery would disable it for any other
+/// thread still compiling. This keeps a count of the callers and only
+/// disables crash recovery once the last of them is done. Every call must be
+/// paired with a call to `disableCrashRecovery`.
+void enableCrashRecovery();
+
+/// @brief Disable LLVM's crash recovery once all callers of
+/// `enableCrashRecovery` are done with it.
+void disableCrashRecovery();
+
+/// @brief Installs an LLVM fatal error handler for the calling thread,
+/// restoring the previous one on scope exit.
+///
+/// LLVM only has a single process-wide fatal error handler, and
+/// `llvm::ScopedFatalErrorHandler` asserts that no other handler is
+/// installed, so it can't be used by modules being compiled on several threads
+/// at once. While any instance is alive a single handler is installed which
+/// forwards fatal errors to the handler of the thread which raised them.
+class ScopedFatalErrorHandler {
+ public:
+  /// @brief Install @p handler for the calling thread.
+  ///
+  /// @param handler Function to call on a fatal error.
+  /// @param user_data Data passed to @p handler.
+  ScopedFatalErrorHandler(llvm::fatal_error_handler_t handler,
+                          void *user_data = nullptr);
+
+  /// @brief Restore the previous handler of the calling thread.
+  ~ScopedFatalErrorHandler();
+
+  ScopedFatalErrorHandler(const ScopedFatalErrorHandler &) = delete;
+  ScopedFatalErrorHandler &operator=(const ScopedFatalErrorHandler &) = delete;
+
+ private:
+  llvm::fatal_error_handler_t previous_handler;
+  void *previous_user_data;
+};
 }  // namespace utils
 }  // namespace compiler
 
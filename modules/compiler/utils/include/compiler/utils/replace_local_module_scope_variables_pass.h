@@ -28,9 +28,9 @@ namespace utils {
 
 /// @brief __local address space automatic variables are represented in the
 /// LLVM module as global variables with address space 3. This pass identifies
-/// these variables and places them into a struct allocated (via alloca) in a
-/// newly created wrapper function. A pointer to the struct is then passed
-/// via a parameter to the original kernel.
+/// these variables and places them into a struct allocated in a newly created
+/// wrapper function, see BuiltinInfo::allocateLocalMemory. A pointer to the
+/// struct is then passed via a parameter to the original kernel.
 ///
 /// Runs over all kernels with "kernel" metadata.
 class ReplaceLocalModuleScopeVariablesPass final
@@ -238,10 +238,11 @@ PreservedAnalyses compiler::utils::AddKernelWrapperPass::run(
         // arguments
         auto *intermediateTy = getSizeType(M);
         auto *load = ir.CreateAlignedLoad(intermediateTy, gep, llvmAlignment);
-        auto *allocaInst = ir.CreateAlloca(ir.getInt8Ty(), load);
-        allocaInst->setAlignment(llvm::Align(sizeof(uint64_t) * 16));
+        auto *localBuffer =
+            BI.allocateLocalMemory(ir, *newFunction, ir.getInt8Ty(), load,
+                                   llvm::Align(sizeof(uint64_t) * 16));
 
-        params.push_back(ir.CreateAddrSpaceCast(allocaInst, type));
+        params.push_back(ir.CreateAddrSpaceCast(localBuffer, type));
       } else if (arg.hasByValAttr()) {
         params.push_back(gep);
       } else {
@@ -623,6 +623,11 @@ Value *BuiltinInfo::initializeSchedulingParamForWrappedKernel(
                                                             CalleeF);
 }
 
+Value *BuiltinInfo::allocateLocalMemory(IRBuilder<> &B, Function &F, Type *Ty,
+                                        Value *ArraySize, Align Alignment) {
+  return MuxImpl->allocateLocalMemory(B, F, Ty, ArraySize, Alignment);
+}
+
 // This provides an extremely simple mangling scheme matching LLVM's intrinsic
 // mangling system. It is only designed to be used with a specific set of types
 // and is not a general-purpose mangler.
@@ -15,8 +15,65 @@
 // SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
 
 #include <compiler/utils/llvm_global_mutex.h>
+#include <llvm/Support/CrashRecoveryContext.h>
+
+#include <cstddef>
 
 std::mutex &compiler::utils::getLLVMGlobalMutex() {
   static std::mutex mutex;
   return mutex;
 }
+
+namespace {
+std::mutex crash_recovery_mutex;
+size_t crash_recovery_count = 0;
+
+std::mutex fatal_error_handler_mutex;
+size_t fatal_error_handler_count = 0;
+thread_local llvm::fatal_error_handler_t thread_fatal_error_handler = nullptr;
+thread_local void *thread_fatal_error_user_data = nullptr;
+
+void forwardFatalError(void *, const char *reason, bool gen_crash_diag) {
+  if (thread_fatal_error_handler) {
+    thread_fatal_error_handler(thread_fatal_error_user_data, reason,
+                               gen_crash_diag);
+  }
+}
+}  // namespace
+
+void compiler::utils::enableCrashRecovery() {
+  const std::lock_guard<std::mutex> lock(crash_recovery_mutex);
+  if (0 == crash_recovery_count++) {
+    llvm::CrashRecoveryContext::Enable();
+  }
+}
+
+void compiler::utils::disableCrashRecovery() {
+  const std::lock_guard<std::mutex> lock(crash_recovery_mutex);
+  if (0 == --crash_recovery_count) {
+    llvm::CrashRecoveryContext::Disable();
+  }
+}
+
+compiler::utils::ScopedFatalErrorHandler::ScopedFatalErrorHandler(
+    llvm::fatal_error_handler_t handler, void *user_data)
+    : previous_handler(thread_fatal_error_handler),
+      previous_user_data(thread_fatal_error_user_data) {
+  thread_fatal_error_handler = handler;
+  thread_fatal_error_user_data = user_data;
+  const std::lock_guard<std::mutex> lock(fatal_error_handler_mutex);
+  if (0 == fatal_error_handler_count++) {
+    llvm::install_fatal_error_handler(forwardFatalError);
+  }
+}
+
+compiler::utils::ScopedFatalErrorHandler::~ScopedFatalErrorHandler() {
+  {
+    const std::lock_guard<std::mutex> lock(fatal_error_handler_mutex);
+    if (0 == --fatal_error_handler_count) {
+      llvm::remove_fatal_error_handler();
+    }
+  }
+  thread_fatal_error_handler = previous_handler;
+  thread_fatal_error_user_data = previous_user_data;
+}
@@ -1280,6 +1280,14 @@ Value *BIMuxInfoConcept::initializeSchedulingParamForWrappedKernel(
                         /*ArraySize*/ nullptr, Info.ParamName);
 }
 
+Value *BIMuxInfoConcept::allocateLocalMemory(IRBuilder<> &B, Function &,
+                                             Type *Ty, Value *ArraySize,
+                                             Align Alignment) {
+  auto *const Alloca = B.CreateAlloca(Ty, ArraySize);
+  Alloca->setAlignment(Alignment);
+  return Alloca;
+}
+
 std::optional<llvm::ConstantRange> BIMuxInfoConcept::getBuiltinRange(
     llvm::CallInst &CI, BuiltinID ID,
     std::array<std::optional<uint64_t>, 3> MaxLocalSizes,
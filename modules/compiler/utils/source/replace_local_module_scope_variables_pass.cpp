@@ -16,6 +16,7 @@
 
 #include <compiler/utils/address_spaces.h>
 #include <compiler/utils/attributes.h>
+#include <compiler/utils/builtin_info.h>
 #include <compiler/utils/metadata.h>
 #include <compiler/utils/pass_functions.h>
 #include <compiler/utils/replace_local_module_scope_variables_pass.h>
@@ -120,7 +121,7 @@ struct GlobalVarDebugInfoWrapper final {
 }  // namespace
 
 PreservedAnalyses compiler::utils::ReplaceLocalModuleScopeVariablesPass::run(
-    Module &M, ModuleAnalysisManager &) {
+    Module &M, ModuleAnalysisManager &AM) {
   // the element types of the struct of replacement local module-scope
   // variables we are replacing
   SmallVector<Type *, 8> structElementTypes;
@@ -488,7 +489,7 @@ PreservedAnalyses compiler::utils::ReplaceLocalModuleScopeVariablesPass::run(
   }
 
   // lastly, we create a wrapper function with the original kernel signature
-  // of each kernel, which will alloca the struct for the remapped local
+  // of each kernel, which will allocate the struct for the remapped local
   // module-scope variables
   for (const auto &name : names) {
     // the original kernel function
@@ -537,9 +538,12 @@ PreservedAnalyses compiler::utils::ReplaceLocalModuleScopeVariablesPass::run(
     // create an irbuilder and basic block for our new function
     IRBuilder<> ir(BasicBlock::Create(newFunc->getContext(), "", newFunc));
 
-    // stack allocate the local module-scope variables struct
-    auto alloca = ir.CreateAlloca(structTy);
-    alloca->setAlignment(MaybeAlign(maxAlignment).valueOrOne());
+    // allocate the local module-scope variables struct, on the stack unless
+    // the target provides other storage for __local memory
+    auto &BI = AM.getResult<BuiltinInfoAnalysis>(M);
+    auto localVars = BI.allocateLocalMemory(
+        ir, *newFunc, structTy, /*ArraySize*/ nullptr,
+        MaybeAlign(maxAlignment).valueOrOne());
 
     // Generate debug info metadata for the globals we have replaced
     // which previously had debug info attached
@@ -586,8 +590,8 @@ PreservedAnalyses compiler::utils::ReplaceLocalModuleScopeVariablesPass::run(
           DILocation::get(DISubprogram->getContext(), DIGlobal->getLine(),
                           /*Column*/ 0, DISubprogram);
       if (enqueued_kernel_scope) {
-        DIB.insertDeclare(alloca, DILocal, offset_expr, location,
-                          alloca->getParent());
+        DIB.insertDeclare(localVars, DILocal, offset_expr, location,
+                          ir.GetInsertBlock());
       } else {
         // A pointer to our struct is passed as the last argument to each
         // function, use this argument if the global came from another kernel
@@ -605,8 +609,8 @@ PreservedAnalyses compiler::utils::ReplaceLocalModuleScopeVariablesPass::run(
       args.push_back(&arg);
     }
 
-    // add the new alloca for the local module-scope variables struct
-    args.push_back(alloca);
+    // add the local module-scope variables struct
+    args.push_back(localVars);
 
     // call the original function
     auto ci = ir.CreateCall(kernelFunc, args);
@@ -37,7 +37,7 @@ extern "C" {
 /// @brief Mux major version number.
 #define MUX_MAJOR_VERSION 0
 /// @brief Mux minor version number.
-#define MUX_MINOR_VERSION 80
+#define MUX_MINOR_VERSION 82
 /// @brief Mux patch version number.
 #define MUX_PATCH_VERSION 0
 /// @brief Mux combined version number.
@@ -284,7 +284,10 @@ enum mux_allocation_capabilities_e {
   /// @brief Can a Mux device use host memory with explicit synchronization.
   mux_allocation_capabilities_cached_host = 0x1 << 1,
   /// @brief Can a Mux device allocate device-only memory.
-  mux_allocation_capabilities_alloc_device = 0x1 << 2
+  mux_allocation_capabilities_alloc_device = 0x1 << 2,
+  /// @brief Does a Mux device back large allocations with huge pages to reduce
+  /// TLB misses.
+  mux_allocation_capabilities_huge_pages = 0x1 << 3
 };
 
 /// @brief Each of the memory properties which may be requested for an
@@ -2372,6 +2375,9 @@ struct mux_device_info_s {
   /// @brief If `true` the device supports cloning `mux_command_buffers` via the
   /// `muxCloneCommandBuffer` entry point.
   bool can_clone_command_buffers;
+  /// @brief If `true` a `mux_command_buffer_t` may be passed to `muxDispatch`
+  /// again before earlier dispatches of it have completed.
+  bool supports_concurrent_dispatch;
   /// @brief If `true` the device supports creating built-in kernels via the
   /// `muxCreateBuiltInKernel` entry point.
   bool supports_builtin_kernels;
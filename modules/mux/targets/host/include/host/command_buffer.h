@@ -298,6 +298,34 @@ struct command_info_s {
   };
 };
 
+struct command_buffer_s;
+
+/// @brief Execution state of a single dispatch of a command buffer.
+///
+/// The recorded commands are read-only once dispatched, so the same command
+/// buffer can be dispatched again while earlier dispatches are executing,
+/// each dispatch has its own instance of this state.
+struct dispatch_s {
+  explicit dispatch_s(mux_allocator_info_t allocator_info);
+
+  /// @brief Command buffer whose commands are executed.
+  command_buffer_s *command_buffer;
+  /// @brief Fence to signal on completion, may be null.
+  fence_s *fence;
+  /// @brief Number of wait semaphores yet to be signaled before the dispatch
+  /// can execute.
+  uint64_t wait_count;
+  /// @brief Semaphores to signal on completion.
+  mux::small_vector<mux_semaphore_t, 8> signal_semaphores;
+  /// @brief Callback to invoke on completion, may be null.
+  void (*user_function)(mux_command_buffer_t command_buffer, mux_result_t error,
+                        void *const user_data);
+  /// @brief User data passed to `user_function`.
+  void *user_data;
+  /// @brief Whether the dispatch is executing or waiting to execute.
+  bool in_flight;
+};
+
 struct command_buffer_s final : public mux_command_buffer_s {
   explicit command_buffer_s(mux_device_t device,
                             mux_allocator_info_t allocator_info,
@@ -305,14 +333,25 @@ struct command_buffer_s final : public mux_command_buffer_s {
 
   ~command_buffer_s();
 
+  /// @brief Get execution state for a new dispatch of the command buffer.
+  ///
+  /// @note This member function is **not** thread safe, callers must hold a
+  /// lock on the queue's mutex.
+  ///
+  /// @return Returns an idle dispatch state marked in flight, or null if
+  /// allocating a new one failed.
+  dispatch_s *acquireDispatch();
+
   mux::small_vector<host::command_info_s, 16> commands;
   mux::small_vector<std::unique_ptr<host::ndrange_info_s>, 4> ndranges;
   mux::small_vector<host::sync_point_s *, 4> sync_points;
   std::mutex mutex;
-  mux::small_vector<mux_semaphore_t, 8> signal_semaphores;
-  void (*user_function)(mux_command_buffer_t command_buffer, mux_result_t error,
-                        void *const user_data);
-  void *user_data;
+  /// @brief State of the first dispatch, only dispatches made while it is
+  /// still in flight need `extra_dispatches`. Guarded by the queue's mutex.
+  dispatch_s dispatch;
+  /// @brief State of concurrent dispatches, kept for reuse. Guarded by the
+  /// queue's mutex.
+  mux::small_vector<std::unique_ptr<dispatch_s>, 2> extra_dispatches;
   fence_s *fence;
   mux_allocator_info_t allocator_info;
 };
@@ -20,6 +20,8 @@
 #ifndef HOST_DEVICE_H_INCLUDED
 #define HOST_DEVICE_H_INCLUDED
 
+#include <atomic>
+
 #include "host/builtin_kernel.h"
 #include "host/queue.h"
 #include "host/thread_pool.h"
@@ -48,6 +50,15 @@ enum os : uint8_t {
   ANDROID,
 };
 
+/// @brief Enumeration of schemes distributing work-groups over the thread pool.
+enum schedule : uint8_t {
+  /// @brief Each slice executes an equally sized, static, range of groups.
+  SCHEDULE_STATIC,
+  /// @brief Slices claim guided chunks of groups from a shared counter, which
+  /// balances kernels whose work-groups have irregular costs.
+  SCHEDULE_DYNAMIC,
+};
+
 struct device_info_s final : public mux_device_info_s {
   /// @brief Default constructor, delegates to the main constructor.
   ///
@@ -111,6 +122,18 @@ struct device_s final : public mux_device_s {
   /// @brief The thread-pool providing multi-threaded execution.
   thread_pool_s thread_pool;
 
+  /// @brief How nd-range work-groups are distributed over `thread_pool`,
+  /// selected with the `CA_HOST_SCHEDULE` environment variable.
+  host::schedule schedule;
+
+  /// @brief The most __local memory a single work-group has needed on any
+  /// thread, in bytes.
+  ///
+  /// The maximum of the high-water marks of the per-thread
+  /// `local_memory_arena_s`, which is useful when tuning kernels with large
+  /// __local allocations.
+  std::atomic<size_t> local_memory_high_water;
+
   /// @brief Host's single queue for command execution.
   host::queue_s queue;
 };
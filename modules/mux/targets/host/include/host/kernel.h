@@ -27,6 +27,7 @@
 #include <mux/mux.h>
 #include <mux/utils/allocator.h>
 
+#include <atomic>
 #include <memory>
 #include <string>
 
@@ -41,6 +42,53 @@ struct schedule_info_s final {
   size_t slice;
   size_t total_slices;
   uint32_t work_dim;
+  /// @brief Shared count of work-groups claimed so far, or null.
+  ///
+  /// When null each slice executes a static range of work-groups, otherwise
+  /// slices repeatedly claim chunks of work-groups by atomically incrementing
+  /// the counter until all work-groups have been claimed.
+  std::atomic<size_t> *work_group_counter;
+  /// @brief Bump pointer into the executing thread's `local_memory_arena_s`.
+  ///
+  /// The kernel advances the pointer past each __local allocation it makes,
+  /// including those which did not fit and fell back to the stack.
+  uint8_t *local_memory;
+  /// @brief End of the executing thread's `local_memory_arena_s`.
+  uint8_t *local_memory_end;
+};
+
+/// @brief Memory backing the __local memory of kernels executed by a thread.
+///
+/// Every thread which executes kernels owns an arena that it allocates and
+/// first touches itself, so the memory is local to the thread's NUMA node. The
+/// arena is reused by every slice the thread executes and only ever grows.
+struct local_memory_arena_s final {
+  /// @brief Alignment of the arena, and padding allowed per allocation.
+  static constexpr size_t alignment = 128;
+
+  local_memory_arena_s() = default;
+  local_memory_arena_s(const local_memory_arena_s &) = delete;
+  local_memory_arena_s &operator=(const local_memory_arena_s &) = delete;
+  ~local_memory_arena_s();
+
+  /// @brief Get the arena owned by the calling thread.
+  static local_memory_arena_s &get();
+
+  /// @brief Grow the arena to hold at least @p required bytes.
+  ///
+  /// @param[in] required Minimum size of the arena in bytes.
+  ///
+  /// @return Returns true on success, or false if the arena could not be
+  /// grown, in which case it is left unchanged.
+  bool reserve(size_t required);
+
+  /// @brief Start of the arena, null until the first `reserve`.
+  uint8_t *data = nullptr;
+  /// @brief Size of the arena in bytes.
+  size_t size = 0;
+  /// @brief The most __local memory any slice executed by the owning thread
+  /// has asked for.
+  size_t high_water = 0;
 };
 
 struct kernel_variant_s {
@@ -23,6 +23,8 @@
 
 #include <mux/mux.h>
 
+#include <cstddef>
+
 namespace host {
 /// @addtogroup host
 /// @{
@@ -36,8 +38,35 @@ struct memory_s : public mux_memory_s {
 
   memory_s(uint64_t size, uint32_t properties, void *data, bool useHost);
 
+  /// @brief Allocations at least this many bytes in size, and at least one
+  /// huge page, are backed by huge pages when `hugePagesEnabled` returns true.
+  static constexpr size_t huge_page_threshold = 4 << 20;
+
+  /// @brief Query the huge page size, which is also the alignment of huge page
+  /// allocations.
+  ///
+  /// Read from the operating system once, falls back to 2MiB if the system
+  /// doesn't report a huge page size.
+  ///
+  /// @return The huge page size in bytes, always a power of two.
+  static size_t hugePageSize();
+
+  /// @brief Query whether large allocations are backed by huge pages.
+  ///
+  /// Huge pages are only used on Linux when the `CA_HOST_HUGE_PAGES`
+  /// environment variable is set to a non-zero value. Huge page allocations
+  /// are mapped from the operating system rather than allocated with the
+  /// allocator passed to `muxAllocateMemory`.
+  ///
+  /// @return True if huge pages are enabled, false otherwise.
+  static bool hugePagesEnabled();
+
   void *data;
   bool useHost;
+  /// @brief Length of the mapping backing `data` if it was mapped directly
+  /// from the operating system for huge pages, zero if `data` came from the
+  /// allocator.
+  size_t mappedSize;
 };
 
 /// @}
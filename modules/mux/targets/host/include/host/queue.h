@@ -31,6 +31,8 @@ namespace host {
 /// @addtogroup host
 /// @{
 
+struct dispatch_s;
+
 struct queue_s final : public mux_queue_s {
   /// @brief Construct the queue object.
   ///
@@ -41,55 +43,31 @@ struct queue_s final : public mux_queue_s {
   /// @brief Destructor.
   ~queue_s();
 
-  /// @brief Send the command group completed signal.
+  /// @brief Signal a dispatch that one of its wait semaphores completed.
   ///
   /// @note This member function is **not** thread safe, callers must hold a
   /// lock on `mutex`.
   ///
-  /// @param group The completed command group.
+  /// @param dispatch The dispatch waiting on the completed semaphore.
   /// @param terminate Should the queue tell the thread pool to terminate,
   /// `true` will terminate, `false` will not.
-  void signalCompleted(mux_command_buffer_t group, bool terminate);
+  void signalCompleted(dispatch_s *dispatch, bool terminate);
 
-  /// @brief Add a command group to the queue.
+  /// @brief Add a dispatch to the queue, executing it immediately if it has
+  /// no wait semaphores, otherwise once `signalCompleted` has been called for
+  /// each of them.
   ///
   /// @note This member function is **not** thread safe, callers must hold a
   /// lock on `mutex`.
   ///
-  /// @param group The command group to enqueue.
-  /// @param fence The fence to signal when group completes.
-  /// @param numWaits The number of wait semaphores to signal on completion.
-  ///
-  /// @return Returns `mux_error_success` or `mux_error_out_of_memory`.
-  mux_result_t addGroup(mux_command_buffer_t group, mux_fence_t fence,
-                        uint64_t numWaits);
+  /// @param dispatch The dispatch to enqueue.
+  void addDispatch(dispatch_s *dispatch);
 
   /// @brief Atomic counter of the current number of running command groups.
   std::atomic<uint32_t> runningGroups;
 
   /// @brief Mutex for users to lock to ensure ordering.
   std::mutex mutex;
-
-  /// @brief Holds signaling information associated to a command buffer
-  /// dispatch instance.
-  struct signal_info_s {
-    /// @brief How many times this dispatch instance needs to be signaled by
-    /// wait semaphores before it can be executed.
-    uint64_t wait_count;
-    /// @brief A fence object to signal upon completion or termination of the
-    /// command buffer dispatch instance.
-    mux_fence_t fence;
-  };
-  /// @brief List of pairs of command group and wait count.
-  /// BIG IMPORTANT WARNING:
-  /// If one day we want to support simultaneous use then we could end up
-  /// with two copies of the same command  buffer in the vector paired with
-  /// different fences. When it comes to signalling a command buffer we
-  /// currently have no way of knowing which command buffer to signal. Bottom
-  /// line, if we want simultaneous use, we'll need to change how we hold and
-  /// signal fences.
-  mux::small_vector<std::pair<mux_command_buffer_t, signal_info_s>, 8>
-      signalInfos;
 };
 
 /// @}
@@ -31,6 +31,7 @@ namespace host {
 /// @{
 
 struct command_buffer_s;
+struct dispatch_s;
 struct queue_s;
 
 struct semaphore_s final : public mux_semaphore_s {
@@ -41,14 +42,14 @@ struct semaphore_s final : public mux_semaphore_s {
 
   void signal(bool terminate = false);
 
-  mux_result_t addWait(mux_command_buffer_t group);
+  mux_result_t addWait(dispatch_s *dispatch);
 
   void reset();
 
  private:
   bool signalled;
   bool failed;
-  mux::small_vector<mux_command_buffer_t, 8> waitingGroups;
+  mux::small_vector<dispatch_s *, 8> waitingDispatches;
 };
 
 /// @}
@@ -23,6 +23,7 @@
 #include <array>
 #include <atomic>
 #include <condition_variable>
+#include <deque>
 #include <map>
 #include <mutex>
 #include <new>
@@ -53,12 +54,59 @@ struct thread_pool_work_item_s final {
   std::atomic<uint32_t> *count;
 };
 
+/// @brief Bounded lock-free queue of work items owned by one pool thread.
+///
+/// Any thread may push to or pop from any queue, both operations are lock-free.
+/// Each pool thread pops from its own queue first and steals from the queues of
+/// the other pool threads when its own queue is empty. This is an
+/// implementation of Dmitry Vyukov's bounded multi-producer multi-consumer
+/// queue, each slot carries a sequence number which tells producers and
+/// consumers whether the slot is ready to be written or read.
+struct thread_pool_queue_s final {
+  /// @brief Number of work items a queue can hold, must be a power of two.
+  static constexpr size_t capacity = 256;
+
+  thread_pool_queue_s();
+
+  /// @brief Non-blocking function to push a work item onto the queue.
+  /// @param[in] item The work item to push.
+  /// @return True if the item was pushed, false if the queue was full.
+  bool tryPush(const thread_pool_work_item_s &item);
+
+  /// @brief Non-blocking function to pop a work item from the queue.
+  /// @param[out] item The work item that was popped.
+  /// @return True if an item was popped, false if the queue was empty.
+  bool tryPop(thread_pool_work_item_s *const item);
+
+  struct slot_s {
+    /// @brief Sequence number guarding access to `item`.
+    std::atomic<size_t> sequence;
+    /// @brief The work item stored in this slot.
+    thread_pool_work_item_s item;
+  };
+
+  /// @brief Storage for the queue's work items.
+  std::array<slot_s, capacity> slots;
+
+  /// @brief Position of the next slot to be pushed, on its own cache line to
+  /// avoid false sharing with consumers.
+  alignas(64) std::atomic<size_t> push_index;
+
+  /// @brief Position of the next slot to be popped.
+  alignas(64) std::atomic<size_t> pop_index;
+};
+
 struct thread_pool_s final {
   explicit thread_pool_s();
 
   ~thread_pool_s();
 
   /// @brief Blocking function get work to execute.
+  ///
+  /// Must only be called by threads in the pool. The calling thread first
+  /// tries its own queue and then steals from the other queues, spinning for a
+  /// short while before parking until new work is enqueued.
+  ///
   /// @param[out] work The work item to execute.
   /// @return True if there was work to execute, false otherwise.
   bool getWork(thread_pool_work_item_s *const work);
@@ -87,14 +135,14 @@ struct thread_pool_s final {
 
   /// @brief Enqueue a range worth of work on the thread pool.
   ///
-  /// This has the advantage of holding onto `mutex` for the whole duration of
-  /// the loop, meaning we never have to wait to re-aquire it as you would using
-  /// `enqueue` in a loop.
+  /// Consecutive slices are distributed over consecutive thread queues so that
+  /// each thread in the pool starts with its own slice rather than having to
+  /// steal one, pool threads are only woken once the whole range is enqueued.
+  /// See `sliceQueue` for how slices are placed when `numa_aware` is set.
   ///
   /// @param[in] function The function to run in the thread pool.
   /// @param[in] user_data User data to pass to the function.
   /// @param[in] user_data2 A second user data to pass to the function.
-  /// @param[in] user_data3 A third user data to pass to the function.
   /// @param[in,out] signals A list of bools that will be signalled when each
   /// slice of the enqueue range has completed.
   /// @param[in,out] count A number that is incremented immediately, and
@@ -109,43 +157,38 @@ struct thread_pool_s final {
                      std::atomic<uint32_t> *count, size_t slices) {
     const tracer::TraceGuard<tracer::Impl> traceGuard(__func__);
 
-    {
-      std::unique_lock<std::mutex> lock(mutex);
-
-      for (size_t index = 0; index < slices; index++) {
-        // Count gets incremented before signal gets set.
-        *count += 1u;
-        signals[index] = false;
-
-        unsigned next_write_index = (queue_write_index + 1) % queue_max;
-
-        while (queue_read_index == next_write_index) {
-          // We've entirely filled our work buffer! Need to wait until a space
-          // opens so unlock the queue mutex, acquire the wait mutex, notify the
-          // pool that some work needs doing and wait for an item to complete.
-          {
-            std::unique_lock<std::mutex> wait_guard(wait_mutex);
-            lock.unlock();
-            new_work.notify_one();
-            done_work.wait(wait_guard);
-            lock.lock();
-          }
-
-          next_write_index = (queue_write_index + 1) % queue_max;
-        }
-
-        queue[queue_write_index] = {
-            function, user_data,         user_data2, nullptr,
-            index,    &(signals[index]), count,
-        };
-
-        queue_write_index = next_write_index;
-      }
+    const size_t first_queue = next_queue.fetch_add(slices);
+    for (size_t index = 0; index < slices; index++) {
+      // Count gets incremented before signal gets set.
+      *count += 1u;
+      signals[index] = false;
+
+      push({function, user_data, user_data2, nullptr, index,
+            &(signals[index]), count},
+           sliceQueue(index, slices, first_queue));
     }
 
-    new_work.notify_all();
+    notify(/* all */ true);
   }
 
+  /// @brief Enqueue a range worth of work on the thread pool without
+  /// per-slice signals.
+  ///
+  /// Behaves like the overload taking `signals`, for callers which track the
+  /// completion of the range themselves or only through `count`.
+  ///
+  /// @param[in] function The function to run in the thread pool.
+  /// @param[in] user_data User data to pass to the function.
+  /// @param[in] user_data2 A second user data to pass to the function.
+  /// @param[in] user_data3 A third user data to pass to the function.
+  /// @param[in,out] count A number that is incremented immediately, and
+  /// decremented when each slice of the enqueued function has completed.
+  /// @param[in] slices The number of pieces that the work is to be divided into
+  /// when it is enqueued on the thread pool.
+  void enqueue_range(function_t function, void *user_data, void *user_data2,
+                     void *user_data3, std::atomic<uint32_t> *count,
+                     size_t slices);
+
 #ifdef CA_HOST_ENABLE_PAPI_COUNTERS
   /// @brief Register the calling thread's system thread ID in `thread_ids`.
   void registerPid() {
@@ -162,6 +205,44 @@ struct thread_pool_s final {
   std::map<cargo::thread::id, pid_t> thread_ids;
 #endif
 
+  /// @brief Fault in the pages of a new allocation from the pool threads.
+  ///
+  /// When `numa_aware` is set the allocation is split into one chunk per pool
+  /// thread, in the same proportions `sliceQueue` splits an nd-range, and each
+  /// thread writes to its chunk first so that the kernel places those pages on
+  /// the thread's NUMA node. Does nothing for small allocations, when NUMA
+  /// awareness is disabled, when called from a pool thread, or when any pool
+  /// thread is busy, so that allocating never waits for running work.
+  ///
+  /// Pool threads only park after spinning for `spin_count` polls without
+  /// work, so while a queue is dispatching back to back commands allocations
+  /// are rarely first touched. This is intended for buffers allocated up
+  /// front, before the first enqueue or between bursts of work. Touching the
+  /// allocation asynchronously instead isn't possible, the caller may start
+  /// writing to it, or free it, as soon as this returns.
+  ///
+  /// @param[in] data Start of the allocation, its contents are clobbered.
+  /// @param[in] size Size of the allocation in bytes.
+  void firstTouch(void *data, size_t size);
+
+  /// @brief Get the queue a slice of an enqueued range is pushed to.
+  ///
+  /// Normally ranges start at a rotating queue so that back to back ranges are
+  /// spread over the pool. When `numa_aware` is set slice `index` of `slices`
+  /// always goes to the thread owning the same proportion of the pool, which
+  /// is also the thread that `firstTouch` used to place the matching
+  /// proportion of each buffer, so statically scheduled slices run on the NUMA
+  /// node holding the memory they access.
+  ///
+  /// @param[in] index Index of the slice within the range.
+  /// @param[in] slices Number of slices in the range.
+  /// @param[in] first_queue Queue of the first slice when not NUMA aware.
+  ///
+  /// @return The preferred queue index, see `push`.
+  size_t sliceQueue(size_t index, size_t slices, size_t first_queue) const {
+    return numa_aware ? (index * num_threads()) / slices : first_queue + index;
+  }
+
   /// @brief Wait for a signal to complete.
   /// @param[in,out] signal A signal that previously was passed to a call to
   /// enqueue, wait() will wait on the thread that is executing the work to
@@ -173,43 +254,94 @@ struct thread_pool_s final {
   /// enqueue, wait() will wait for the counter to reach zero.
   void wait(std::atomic<uint32_t> *count);
 
+  /// @brief Push a work item onto the queue of a pool thread.
+  ///
+  /// If the preferred queue is full the following queues are tried in turn,
+  /// if every queue is full the item is pushed onto `overflow` instead. Never
+  /// blocks, as pool threads push work while executing work and blocking until
+  /// the queues drain could deadlock. Does not wake any parked pool threads,
+  /// see `notify`.
+  ///
+  /// @param[in] item The work item to push.
+  /// @param[in] preferred Index of the preferred queue, taken modulo the
+  /// number of threads in the pool.
+  void push(const thread_pool_work_item_s &item, size_t preferred);
+
+  /// @brief Wake parked pool threads after work has been pushed.
+  /// @param[in] all Wake all parked threads when true, otherwise wake one.
+  void notify(bool all);
+
+  /// @brief Signal waiters that a work item has completed.
+  void notifyFinished();
+
   /// The maximum number of threads our thread pool supports. Useful for
   /// allocating memory (you know the max size of allocations required).
   static const size_t max_num_threads = 32;
 
-  /// The maximum number of work that can be enqueued.
-  static const size_t queue_max = 4096;
+  /// The number of times an idle thread polls for work, or for a signal it is
+  /// waiting on, before parking on a condition variable. Dispatches of small
+  /// kernels complete within this window so never pay for a futex wake up.
+  static const size_t spin_count = 4096;
 
   /// The number of threads actually initialized in the thread pool.  General
   /// the lower of the number of cores or max_num_threads, but could be lower in
   /// the presence of debug settings.
   size_t initialized_threads;
 
+  /// Allocations smaller than this many bytes are not first touched by the
+  /// pool, they are likely to reuse pages the allocator has already faulted
+  /// in.
+  static const size_t first_touch_threshold = 1 << 20;
+
+  /// Whether pool threads are pinned to NUMA nodes, set with the
+  /// `CA_HOST_NUMA` environment variable on systems with more than one node.
+  bool numa_aware;
+
+  /// The NUMA node each pool thread is pinned to, only meaningful when
+  /// `numa_aware` is set. Threads are assigned to nodes in contiguous blocks.
+  std::array<uint32_t, max_num_threads> thread_node;
+
   /// The pool of threads to use for execution.
   std::array<cargo::thread, max_num_threads> pool;
 
-  /// The buffer to hold the queue of work.
-  std::array<thread_pool_work_item_s, queue_max> queue;
+  /// The per thread queues of work, indexed by pool thread.
+  std::array<thread_pool_queue_s, max_num_threads> queues;
+
+  /// Work which did not fit in any of the `queues`, this slow path is only
+  /// taken when thousands of work items are outstanding.
+  std::deque<thread_pool_work_item_s> overflow;
 
-  /// The read index into the queue.
-  unsigned queue_read_index = 0;
+  /// The number of work items in `overflow`, lets `tryGetWork` skip taking
+  /// `overflow_mutex` in the common case.
+  std::atomic<size_t> overflow_size;
 
-  /// The write index from the queue.
-  unsigned queue_write_index = 0;
+  /// A mutex to use when accessing `overflow`.
+  std::mutex overflow_mutex;
 
-  /// A mutex to use when accessing the thread pool.
-  std::mutex mutex;
+  /// Round-robin index used to pick a queue for work enqueued by threads
+  /// outside the pool.
+  std::atomic<size_t> next_queue;
 
-  /// A mutex to use when decrementing the work counter.
+  /// Incremented whenever work is pushed, parked pool threads wake up when
+  /// this changes.
+  std::atomic<uint64_t> work_epoch;
+
+  /// The number of pool threads parked on `new_work`.
+  std::atomic<uint32_t> sleeping;
+
+  /// The number of threads parked on `finished`.
+  std::atomic<uint32_t> waiting;
+
+  /// A mutex used only to park pool threads on `new_work`.
+  std::mutex park_mutex;
+
+  /// A mutex used only to park waiting threads on `finished`.
   std::mutex wait_mutex;
 
   /// A condition to signal when new work has been added.
   std::condition_variable new_work;
 
   /// A condition to signal when work has been done.
-  std::condition_variable done_work;
-
-  /// A condition to signal when the count reaches zero.
   std::condition_variable finished;
 
   /// A variable to query whether the thread pool is still alive or not.
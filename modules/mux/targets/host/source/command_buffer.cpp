@@ -160,16 +160,55 @@ void populatePackedArgs(
 }  // namespace
 
 namespace host {
+dispatch_s::dispatch_s(mux_allocator_info_t allocator_info)
+    : command_buffer(nullptr),
+      fence(nullptr),
+      wait_count(0),
+      signal_semaphores(allocator_info),
+      user_function(nullptr),
+      user_data(nullptr),
+      in_flight(false) {}
+
 command_buffer_s::command_buffer_s(mux_device_t device,
                                    mux_allocator_info_t allocator_info,
                                    mux_fence_t fence)
     : commands(allocator_info),
       ndranges(allocator_info),
       sync_points(allocator_info),
-      signal_semaphores(allocator_info),
+      dispatch(allocator_info),
+      extra_dispatches(allocator_info),
       fence(static_cast<host::fence_s *>(fence)),
       allocator_info(allocator_info) {
   this->device = device;
+  dispatch.command_buffer = this;
+}
+
+dispatch_s *command_buffer_s::acquireDispatch() {
+  dispatch_s *idle = nullptr;
+  if (!dispatch.in_flight) {
+    idle = &dispatch;
+  } else {
+    for (auto &extra : extra_dispatches) {
+      if (!extra->in_flight) {
+        idle = extra.get();
+        break;
+      }
+    }
+  }
+  if (!idle) {
+    std::unique_ptr<dispatch_s> extra(new (std::nothrow)
+                                          dispatch_s(allocator_info));
+    if (!extra) {
+      return nullptr;
+    }
+    extra->command_buffer = this;
+    idle = extra.get();
+    if (extra_dispatches.push_back(std::move(extra))) {
+      return nullptr;
+    }
+  }
+  idle->in_flight = true;
+  return idle;
 }
 
 command_buffer_s::~command_buffer_s() {
@@ -21,6 +21,7 @@
 #include <host/command_buffer.h>
 #include <host/device.h>
 #include <host/host.h>
+#include <host/memory.h>
 #include <host/queue.h>
 #include <mux/config.h>
 #include <mux/mux.h>
@@ -354,6 +355,9 @@ device_info_s::device_info_s(host::arch arch, host::os os, bool native,
   this->allocation_capabilities = mux_allocation_capabilities_alloc_device |
                                   mux_allocation_capabilities_coherent_host |
                                   mux_allocation_capabilities_cached_host;
+  if (native && host::os::LINUX == os && memory_s::hugePagesEnabled()) {
+    this->allocation_capabilities |= mux_allocation_capabilities_huge_pages;
+  }
 
   this->address_capabilities = mux_address_capabilities_logical;
   switch (arch) {
@@ -523,6 +527,7 @@ device_info_s::device_info_s(host::arch arch, host::os os, bool native,
 #endif
   this->descriptors_updatable = true;
   this->can_clone_command_buffers = true;
+  this->supports_concurrent_dispatch = true;
   this->max_sub_group_count = this->max_concurrent_work_items;
   this->sub_groups_support_ifp = false;
   this->supports_work_group_collectives = true;
@@ -579,8 +584,18 @@ host::device_info_s &device_info_s::getHostInstance() {
 }
 
 device_s::device_s(device_info_s *info, mux_allocator_info_t allocator_info)
-    : queue(allocator_info, this) {
+    : schedule(SCHEDULE_STATIC),
+      local_memory_high_water(0),
+      queue(allocator_info, this) {
   this->info = info;
+
+  // Register the value of the CA_HOST_SCHEDULE environment variable, which
+  // selects the scheme used to distribute work-groups over the thread pool.
+  if (const char *env = std::getenv("CA_HOST_SCHEDULE")) {
+    if (0 == std::strcmp(env, "dynamic")) {
+      schedule = SCHEDULE_DYNAMIC;
+    }
+  }
 }
 
 }  // namespace host
@@ -14,6 +14,7 @@
 //
 // SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
 
+#include <cargo/allocator.h>
 #include <cargo/string_view.h>
 #include <host/device.h>
 #include <host/executable.h>
@@ -22,6 +23,7 @@
 #include <mux/mux.h>
 
 #include <algorithm>
+#include <cstring>
 #include <memory>
 #include <new>
 
@@ -44,6 +46,34 @@ inline void setPreferredSizes(host::kernel_s &hostKernel) {
 }  // namespace
 
 namespace host {
+local_memory_arena_s::~local_memory_arena_s() { cargo::free(data); }
+
+local_memory_arena_s &local_memory_arena_s::get() {
+  static thread_local local_memory_arena_s arena;
+  return arena;
+}
+
+bool local_memory_arena_s::reserve(size_t required) {
+  if (required <= size) {
+    return true;
+  }
+  // Round up to whole pages, arenas are only grown a handful of times.
+  constexpr size_t page_size = 4096;
+  const size_t new_size = (required + page_size - 1) & ~(page_size - 1);
+  auto *const new_data =
+      static_cast<uint8_t *>(cargo::alloc(new_size, alignment));
+  if (nullptr == new_data) {
+    return false;
+  }
+  // Touch every page from the owning thread, under a first-touch policy this
+  // places the arena on the thread's NUMA node.
+  std::memset(new_data, 0, new_size);
+  cargo::free(data);
+  data = new_data;
+  size = new_size;
+  return true;
+}
+
 kernel_variant_s::kernel_variant_s(std::string name, entry_hook_t hook,
                                    size_t local_memory_used,
                                    uint32_t min_work_width,
@@ -19,16 +19,147 @@
 #include <host/memory.h>
 #include <mux/utils/allocator.h>
 
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
+#include <fstream>
+#include <string>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+namespace {
+/// @brief Map a huge page backed allocation from the operating system.
+///
+/// Explicit huge pages are tried first, these are only available if the
+/// system administrator has reserved some. Otherwise an ordinary mapping is
+/// aligned to the huge page size and advised to use transparent huge pages.
+///
+/// @param[in] size Size of the allocation in bytes.
+/// @param[out] mapped_size Length of the returned mapping.
+///
+/// @return The mapping, or null if nothing could be mapped.
+void *mapHugePages(size_t size, size_t *mapped_size) {
+#ifdef __linux__
+  const size_t page = host::memory_s::hugePageSize();
+  const size_t length = (size + page - 1) & ~(page - 1);
+
+#ifdef MAP_HUGETLB
+  void *explicit_pages = mmap(nullptr, length, PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  if (MAP_FAILED != explicit_pages) {
+    *mapped_size = length;
+    return explicit_pages;
+  }
+#endif
+
+  // Over-allocate by a huge page so the mapping can be trimmed to start on a
+  // huge page boundary, transparent huge pages are only used for aligned
+  // regions.
+  void *mapping = mmap(nullptr, length + page, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (MAP_FAILED == mapping) {
+    return nullptr;
+  }
+  auto *const begin = static_cast<char *>(mapping);
+  auto *const aligned = reinterpret_cast<char *>(
+      (reinterpret_cast<uintptr_t>(begin) + page - 1) & ~(page - 1));
+  if (aligned != begin) {
+    munmap(begin, aligned - begin);
+  }
+  const size_t tail = (begin + length + page) - (aligned + length);
+  if (0 != tail) {
+    munmap(aligned + length, tail);
+  }
+
+#ifdef MADV_HUGEPAGE
+  // Advice is only a hint, the mapping is still usable if it is ignored.
+  (void)madvise(aligned, length, MADV_HUGEPAGE);
+#endif
+
+  *mapped_size = length;
+  return aligned;
+#else
+  (void)size;
+  (void)mapped_size;
+  return nullptr;
+#endif
+}
+
+/// @brief Release the storage backing a `host::memory_s`.
+///
+/// @param[in] allocator The allocator the storage came from if not mapped.
+/// @param[in] data The storage to release.
+/// @param[in] mapped_size Length of the mapping if `data` was mapped by
+/// `mapHugePages`, zero otherwise.
+void releaseHostPointer(mux::allocator allocator, void *data,
+                        size_t mapped_size) {
+#ifdef __linux__
+  if (0 != mapped_size) {
+    munmap(data, mapped_size);
+    return;
+  }
+#else
+  (void)mapped_size;
+#endif
+  allocator.free(data);
+}
+}  // namespace
 
 namespace host {
 memory_s::memory_s(uint64_t size, uint32_t properties, void *data, bool useHost)
 
-    : data(data), useHost(useHost) {
+    : data(data), useHost(useHost), mappedSize(0) {
   this->size = size;
   this->properties = properties;
   this->handle = reinterpret_cast<uintptr_t>(data);
 }
+
+size_t memory_s::hugePageSize() {
+  static const size_t size = [] {
+    size_t page = 0;
+#ifdef __linux__
+    // The default huge page size is the size of the explicit huge pages mapped
+    // with MAP_HUGETLB, transparent huge pages report their own size.
+    std::ifstream meminfo("/proc/meminfo");
+    std::string line;
+    while (0 == page && std::getline(meminfo, line)) {
+      unsigned long long kilobytes = 0;
+      if (1 ==
+          std::sscanf(line.c_str(), "Hugepagesize: %llu kB", &kilobytes)) {
+        page = static_cast<size_t>(kilobytes) * 1024;
+      }
+    }
+    if (0 == page) {
+      std::ifstream pmd_size(
+          "/sys/kernel/mm/transparent_hugepage/hpage_pmd_size");
+      unsigned long long bytes = 0;
+      if (pmd_size >> bytes) {
+        page = static_cast<size_t>(bytes);
+      }
+    }
+#endif
+    // Anything which isn't a power of two can't be used as an alignment.
+    if (0 == page || 0 != (page & (page - 1))) {
+      page = 2 << 20;
+    }
+    return page;
+  }();
+  return size;
+}
+
+bool memory_s::hugePagesEnabled() {
+#ifdef __linux__
+  static const bool enabled = [] {
+    const char *env = std::getenv("CA_HOST_HUGE_PAGES");
+    return nullptr != env && 0 != std::strcmp(env, "0");
+  }();
+  return enabled;
+#else
+  return false;
+#endif
+}
 }  // namespace host
 
 mux_result_t hostAllocateMemory(mux_device_t device, size_t size, uint32_t heap,
@@ -37,7 +168,6 @@ mux_result_t hostAllocateMemory(mux_device_t device, size_t size, uint32_t heap,
                                 uint32_t alignment,
                                 mux_allocator_info_t allocator_info,
                                 mux_memory_t *out_memory) {
-  (void)device;
   (void)allocation_type;
 
   mux::allocator allocator(allocator_info);
@@ -60,17 +190,37 @@ mux_result_t hostAllocateMemory(mux_device_t device, size_t size, uint32_t heap,
   // Align all allocations to at least 128 bytes to match the size of the
   // largest 16-wide OpenCL-C vector types.
   const size_t host_align = std::max(128u, alignment);
-  void *host_pointer = allocator.alloc(size, host_align);
+
+  // When enabled large allocations are mapped directly so they can be backed
+  // by huge pages, every huge page mapping is aligned to at least the huge page
+  // size. If mapping fails fall back to the allocator.
+  void *host_pointer = nullptr;
+  size_t mapped_size = 0;
+  if (host::memory_s::hugePagesEnabled() &&
+      size >= host::memory_s::huge_page_threshold &&
+      size >= host::memory_s::hugePageSize() &&
+      host_align <= host::memory_s::hugePageSize()) {
+    host_pointer = mapHugePages(size, &mapped_size);
+  }
+  if (nullptr == host_pointer) {
+    host_pointer = allocator.alloc(size, host_align);
+  }
   if (nullptr == host_pointer) {
     return mux_error_out_of_memory;
   }
 
+  // Spread the pages of large allocations over the NUMA nodes of the pool
+  // threads, matching the way nd-range slices are assigned to threads.
+  static_cast<host::device_s *>(device)->thread_pool.firstTouch(host_pointer,
+                                                                size);
+
   auto memory = allocator.create<host::memory_s>(size, memory_properties,
                                                  host_pointer, false);
   if (nullptr == memory) {
-    allocator.free(host_pointer);
+    releaseHostPointer(allocator, host_pointer, mapped_size);
     return mux_error_out_of_memory;
   }
+  memory->mappedSize = mapped_size;
 
   *out_memory = memory;
 
@@ -107,7 +257,7 @@ void hostFreeMemory(mux_device_t device, mux_memory_t memory,
   auto hostMemory = static_cast<host::memory_s *>(memory);
 
   if (!hostMemory->useHost) {
-    allocator.free(hostMemory->data);
+    releaseHostPointer(allocator, hostMemory->data, hostMemory->mappedSize);
   }
 
   allocator.destroy(hostMemory);
@@ -32,22 +32,39 @@
 #include <libimg/host.h>
 #endif
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cstdint>
 #include <cstring>
 #include <memory>
 #include <new>
+#include <utility>
 #include <vector>
 
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define HOST_STREAMING_STORES
+#endif
+
 namespace {
 
 /// Increasing the slice count helps when thread slicing happens, or if a
 /// kernel exists early, which allows other threads to pickup the extra work.
 constexpr size_t slice_multiplier = 1;
 
-void threadPoolCleanup(void *const v_queue, void *const v_command_buffer,
+/// Maximum number of commands after the last barrier a command in a command
+/// buffer's dependency graph is compared against, see command_graph_s::build.
+constexpr uint32_t max_look_back = 64;
+
+/// Addresses below this are never mapped, so a kernel argument holding one
+/// can't point to memory another command accesses.
+constexpr uintptr_t unmapped_address_limit = 4096;
+
+void threadPoolCleanup(void *const v_queue, void *const v_dispatch,
                        void *const v_fence, size_t terminate) {
   auto queue = static_cast<host::queue_s *>(v_queue);
-  auto command_buffer = static_cast<host::command_buffer_s *>(v_command_buffer);
+  auto dispatch = static_cast<host::dispatch_s *>(v_dispatch);
 
   auto host_fence = static_cast<host::fence_s *>(v_fence);
 
@@ -57,70 +74,250 @@ void threadPoolCleanup(void *const v_queue, void *const v_command_buffer,
     host_fence->result = result;
   }
 
-  if (nullptr != command_buffer->user_function) {
-    command_buffer->user_function(command_buffer, result,
-                                  command_buffer->user_data);
+  if (nullptr != dispatch->user_function) {
+    dispatch->user_function(dispatch->command_buffer, result,
+                            dispatch->user_data);
   }
 
   // Acquire a lock on the queue's mutex.
   const std::lock_guard<std::mutex> lock(queue->mutex);
 
-  for (auto signal_semaphore : command_buffer->signal_semaphores) {
+  for (auto signal_semaphore : dispatch->signal_semaphores) {
     static_cast<host::semaphore_s *>(signal_semaphore)->signal(terminate);
   }
 
-  // and resize the signal_semaphores array
-  command_buffer->signal_semaphores.clear();
+  // and make the dispatch state available to a later dispatch
+  dispatch->signal_semaphores.clear();
+  dispatch->in_flight = false;
+}
+
+/// Buffer transfers of at least this many bytes are split over the thread
+/// pool, smaller transfers complete before the pool threads would wake up.
+constexpr size_t parallel_transfer_threshold = 1 << 20;
+
+/// Buffer transfers of at least this many bytes use non-temporal stores when
+/// available, the destination would not fit in the cache so writing around it
+/// saves reading each destination line in first.
+constexpr size_t streaming_transfer_threshold = 16 << 20;
+
+/// Parallel transfers are split on destination addresses which are multiples
+/// of this many bytes, the smallest page size, so that no two threads write to
+/// the same page. Fills whose pattern can't start on a page boundary are split
+/// on multiples of this many bytes from the start of the destination instead.
+constexpr size_t transfer_granularity = 4096;
+
+#ifdef HOST_STREAMING_STORES
+/// @brief Store memory with non-temporal stores.
+///
+/// @param[in] dst Destination of the stores.
+/// @param[in] src Source of the data to store, at least `size` bytes are read
+/// unless `window` is non-zero.
+/// @param[in] size Number of bytes to store.
+/// @param[in] window If non-zero `src` holds a pattern repeated over twice
+/// this many bytes and `dst` gets the pattern repeated, otherwise zero.
+void streamBytes(uint8_t *dst, const uint8_t *src, size_t size,
+                 size_t window) {
+  auto source = [&](size_t offset) {
+    return src + (window ? offset % window : offset);
+  };
+
+  // Non-temporal stores must be aligned, store the unaligned head normally.
+  const size_t head =
+      std::min(size, (16 - (reinterpret_cast<uintptr_t>(dst) & 15)) & 15);
+  std::memcpy(dst, src, head);
+  size_t offset = head;
+  for (; offset + 64 <= size; offset += 64) {
+    const uint8_t *const from = source(offset);
+    auto *const to = reinterpret_cast<__m128i *>(dst + offset);
+    const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(from));
+    const __m128i b =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(from + 16));
+    const __m128i c =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(from + 32));
+    const __m128i d =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(from + 48));
+    _mm_stream_si128(to, a);
+    _mm_stream_si128(to + 1, b);
+    _mm_stream_si128(to + 2, c);
+    _mm_stream_si128(to + 3, d);
+  }
+  std::memcpy(dst + offset, source(offset), size - offset);
+
+  // Non-temporal stores are weakly ordered, make them visible before the
+  // command is reported as complete.
+  _mm_sfence();
+}
+#endif
+
+/// @brief Copy memory, optionally with non-temporal stores.
+///
+/// @param[in] dst Destination of the copy.
+/// @param[in] src Source of the copy, must not overlap `dst`.
+/// @param[in] size Number of bytes to copy.
+/// @param[in] streaming Whether to bypass the cache when storing to `dst`.
+void copyBytes(uint8_t *dst, const uint8_t *src, size_t size, bool streaming) {
+#ifdef HOST_STREAMING_STORES
+  if (streaming) {
+    streamBytes(dst, src, size, /* window */ 0);
+    return;
+  }
+#else
+  (void)streaming;
+#endif
+  std::memcpy(dst, src, size);
+}
+
+/// @brief Fill memory with a repeating pattern, optionally with non-temporal
+/// stores.
+///
+/// @param[in] dst Destination of the fill, the first byte gets the first byte
+/// of the pattern.
+/// @param[in] size Number of bytes to fill.
+/// @param[in] pattern The pattern to repeat.
+/// @param[in] pattern_size Size of `pattern` in bytes, at most 128.
+/// @param[in] streaming Whether to bypass the cache when storing to `dst`.
+void fillBytes(uint8_t *dst, size_t size, const void *pattern,
+               size_t pattern_size, bool streaming) {
+#ifdef HOST_STREAMING_STORES
+  // Repeat the pattern over twice a window, any 64 bytes starting within the
+  // first window are then a valid continuation of the fill. Only patterns
+  // which evenly divide the window can be streamed this way.
+  constexpr size_t window = 128;
+  if (streaming && 0 == window % pattern_size) {
+    uint8_t block[window * 2];
+    for (size_t i = 0; i < sizeof(block); i += pattern_size) {
+      std::memcpy(block + i, pattern, pattern_size);
+    }
+    streamBytes(dst, block, size, window);
+    return;
+  }
+#else
+  (void)streaming;
+#endif
+
+  size_t filled = std::min(pattern_size, size);
+  std::memcpy(dst, pattern, filled);
+  // Double the filled region until it covers the destination.
+  while (filled < size) {
+    const size_t step = std::min(filled, size - filled);
+    std::memcpy(dst + filled, dst, step);
+    filled += step;
+  }
 }
 
-void commandReadBuffer(host::command_info_s *info) {
+/// @brief A buffer transfer split over the thread pool.
+struct transfer_s {
+  uint8_t *dst = nullptr;
+  /// @brief Source of a copy, or null for a fill.
+  const uint8_t *src = nullptr;
+  size_t size = 0;
+  const void *pattern = nullptr;
+  size_t pattern_size = 0;
+  bool streaming = false;
+  size_t chunks = 1;
+  size_t granularity = 1;
+  /// @brief Offset of the first possible split, the first chunk also covers
+  /// the bytes before it.
+  size_t lead = 0;
+
+  /// @brief Get the offset at which a chunk starts.
+  size_t chunkOffset(size_t chunk) const {
+    if (chunk == 0) {
+      return 0;
+    }
+    if (chunk == chunks) {
+      return size;
+    }
+    return lead +
+           (((size - lead) / granularity) * chunk / chunks) * granularity;
+  }
+
+  /// @brief Transfer one chunk.
+  void run(size_t chunk) const {
+    const size_t begin = chunkOffset(chunk);
+    const size_t end = chunkOffset(chunk + 1);
+    if (src) {
+      copyBytes(dst + begin, src + begin, end - begin, streaming);
+    } else {
+      fillBytes(dst + begin, end - begin, pattern, pattern_size, streaming);
+    }
+  }
+};
+
+/// @brief Execute a buffer transfer, splitting large ones over the thread pool.
+///
+/// Chunks are split on destination pages, see `transfer_granularity`, and on
+/// multiples of the pattern size for fills so each chunk starts at the
+/// beginning of the pattern.
+void transfer(host::queue_s *queue, transfer_s transfer) {
+  auto &thread_pool = static_cast<host::device_s *>(queue->device)->thread_pool;
+  transfer.streaming = streaming_transfer_threshold <= transfer.size;
+  transfer.granularity = transfer.src
+                             ? transfer_granularity
+                             : transfer_granularity * transfer.pattern_size;
+  const size_t page_offset =
+      reinterpret_cast<uintptr_t>(transfer.dst) % transfer_granularity;
+  transfer.lead = page_offset ? transfer_granularity - page_offset : 0;
+  if (!transfer.src && transfer.lead % transfer.pattern_size) {
+    transfer.lead = 0;
+  }
+  transfer.lead = std::min(transfer.lead, transfer.size);
+  transfer.chunks =
+      std::min(thread_pool.num_threads(),
+               (transfer.size - transfer.lead) / transfer.granularity);
+  if (transfer.size < parallel_transfer_threshold || transfer.chunks < 2) {
+    transfer.chunks = 1;
+    transfer.run(0);
+    return;
+  }
+
+  std::atomic<uint32_t> queued(0);
+  thread_pool.enqueue_range(
+      [](void *const in, void *, void *, size_t index) {
+        static_cast<const transfer_s *>(in)->run(index);
+      },
+      &transfer, nullptr, nullptr, &queued, transfer.chunks);
+  thread_pool.wait(&queued);
+}
+
+void commandReadBuffer(host::queue_s *queue, host::command_info_s *info) {
   host::command_info_read_buffer_s *const read = &(info->read_command);
 
   auto buffer = static_cast<host::buffer_s *>(read->buffer);
 
-  std::memcpy(read->host_pointer,
-              static_cast<uint8_t *>(buffer->data) + read->offset, read->size);
+  transfer(queue, {static_cast<uint8_t *>(read->host_pointer),
+                   static_cast<uint8_t *>(buffer->data) + read->offset,
+                   read->size});
 }
 
-void commandWriteBuffer(host::command_info_s *info) {
+void commandWriteBuffer(host::queue_s *queue, host::command_info_s *info) {
   host::command_info_write_buffer_s *const write = &(info->write_command);
 
   auto buffer = static_cast<host::buffer_s *>(write->buffer);
 
-  std::memcpy(static_cast<uint8_t *>(buffer->data) + write->offset,
-              write->host_pointer, write->size);
+  transfer(queue, {static_cast<uint8_t *>(buffer->data) + write->offset,
+                   static_cast<const uint8_t *>(write->host_pointer),
+                   write->size});
 }
 
-void commandFillBuffer(host::command_info_s *info) {
+void commandFillBuffer(host::queue_s *queue, host::command_info_s *info) {
   host::command_info_fill_buffer_s *const fill = &(info->fill_command);
 
   auto buffer = static_cast<host::buffer_s *>(fill->buffer);
 
-  size_t size = fill->pattern_size;
-  uint8_t *const start = static_cast<uint8_t *>(buffer->data) + fill->offset;
-  uint8_t *current = start + size;
-  uint8_t *const end = start + fill->size;
-
-  std::memcpy(start, fill->pattern, size);
-
-  while (current + size < end) {
-    std::memcpy(current, start, size);
-    current += size;
-    size *= 2;
-  }
-
-  std::memcpy(current, start, static_cast<size_t>(end - current));
+  transfer(queue, {static_cast<uint8_t *>(buffer->data) + fill->offset,
+                   nullptr, fill->size, fill->pattern, fill->pattern_size});
 }
 
-void commandCopyBuffer(host::command_info_s *info) {
+void commandCopyBuffer(host::queue_s *queue, host::command_info_s *info) {
   host::command_info_copy_buffer_s *const copy = &(info->copy_command);
 
   auto dst_buffer = static_cast<host::buffer_s *>(copy->dst_buffer);
   auto src_buffer = static_cast<host::buffer_s *>(copy->src_buffer);
 
-  std::memcpy(static_cast<uint8_t *>(dst_buffer->data) + copy->dst_offset,
-              static_cast<uint8_t *>(src_buffer->data) + copy->src_offset,
-              copy->size);
+  transfer(queue, {static_cast<uint8_t *>(dst_buffer->data) + copy->dst_offset,
+                   static_cast<uint8_t *>(src_buffer->data) + copy->src_offset,
+                   copy->size});
 }
 
 void commandReadImage(host::command_info_s *info) {
@@ -230,10 +427,99 @@ void commandCopyBufferToImage(host::command_info_s *info) {
 #endif
 }
 
-void commandNDRange(host::queue_s *queue, host::command_info_s *info) {
-  host::command_info_ndrange_s *const ndrange = &(info->ndrange_command);
+/// @brief State shared by all slices of a single nd-range dispatch.
+struct ndrange_dispatch_s {
+  /// @brief The kernel variant being executed.
+  host::kernel_variant_s *variant;
+  /// @brief Work-group counter for dynamic scheduling, null for static.
+  std::atomic<size_t> *work_group_counter;
+  /// @brief Estimate of the __local memory each slice needs, see
+  /// localMemorySize().
+  size_t local_memory_size;
+};
+
+/// @brief Estimate the __local memory a kernel needs, including padding.
+size_t localMemorySize(const host::kernel_variant_s &variant,
+                       const host::ndrange_info_s &ndrange_info) {
+  constexpr size_t padding = host::local_memory_arena_s::alignment;
+  size_t size = variant.local_memory_used + padding;
+  for (const auto &descriptor : ndrange_info.descriptors) {
+    if (mux_descriptor_info_type_shared_local_buffer == descriptor.type) {
+      size += descriptor.shared_local_buffer_descriptor.size + padding;
+    }
+  }
+  return size;
+}
+
+void executeNDRangeSlice(const ndrange_dispatch_s &dispatch,
+                         host::command_info_ndrange_s *const ndrange,
+                         size_t index) {
+  auto *const ndrange_info = ndrange->ndrange_info;
+  auto host_device = static_cast<host::device_s *>(ndrange->kernel->device);
+
+  for (uint8_t k = 0; k < ndrange_info->dimensions; ++k) {
+    if (ndrange_info->global_size[k] == 0) {
+      return;
+    }
+  }
+
+  host::schedule_info_s schedule_info;
+
+  for (uint8_t k = 0; k < 3; k++) {
+    schedule_info.global_size[k] = ndrange_info->global_size[k];
+    schedule_info.global_offset[k] = ndrange_info->global_offset[k];
+    schedule_info.local_size[k] = ndrange_info->local_size[k];
+  }
+  schedule_info.slice = index;
+  schedule_info.total_slices =
+      (host_device->thread_pool.num_threads() * slice_multiplier);
+  schedule_info.work_dim = static_cast<uint32_t>(ndrange_info->dimensions);
+  schedule_info.work_group_counter = dispatch.work_group_counter;
+
+  // The entry hook rewinds the arena's cursor before each work-group, so the
+  // arena only ever holds a single work-group's __local memory. Kernels fall
+  // back to the stack for __local memory which doesn't fit in the arena but
+  // still advance the cursor, so the arena can be grown to the high-water mark
+  // for the next slice this thread executes.
+  auto &arena = host::local_memory_arena_s::get();
+  const size_t required =
+      std::max(dispatch.local_memory_size, arena.high_water);
+  const bool reserved = arena.reserve(required);
+  if (!reserved) {
+    // The arena is left as it was, so anything which doesn't fit falls back to
+    // the stack. Don't learn from this slice, otherwise every following slice
+    // would retry the same failed allocation.
+    arena.high_water = arena.size;
+  }
+  schedule_info.local_memory = arena.data;
+  schedule_info.local_memory_end = arena.data + arena.size;
+
+  dispatch.variant->hook(ndrange_info->packed_args, &schedule_info);
+
+  const size_t used =
+      reinterpret_cast<uintptr_t>(schedule_info.local_memory) -
+      reinterpret_cast<uintptr_t>(arena.data);
+  if (reserved && used > arena.high_water) {
+    arena.high_water = used;
+    size_t high_water = host_device->local_memory_high_water.load();
+    while (high_water < used &&
+           !host_device->local_memory_high_water.compare_exchange_weak(
+               high_water, used)) {
+    }
+  }
+}
 
+[[nodiscard]] bool getKernelVariant(host::command_info_ndrange_s *ndrange,
+                                    host::kernel_variant_s *variant) {
   auto host_kernel = static_cast<host::kernel_s *>(ndrange->kernel);
+  return mux_success == host_kernel->getKernelVariantForWGSize(
+                            ndrange->ndrange_info->local_size[0],
+                            ndrange->ndrange_info->local_size[1],
+                            ndrange->ndrange_info->local_size[2], variant);
+}
+
+void commandNDRange(host::queue_s *queue, host::command_info_s *info) {
+  host::command_info_ndrange_s *const ndrange = &(info->ndrange_command);
 
   auto host_device = static_cast<host::device_s *>(queue->device);
 
@@ -241,68 +527,32 @@ void commandNDRange(host::queue_s *queue, host::command_info_s *info) {
       host_device->thread_pool.num_threads() * slice_multiplier;
 
   host::kernel_variant_s variant;
-  if (mux_success != host_kernel->getKernelVariantForWGSize(
-                         info->ndrange_command.ndrange_info->local_size[0],
-                         info->ndrange_command.ndrange_info->local_size[1],
-                         info->ndrange_command.ndrange_info->local_size[2],
-                         &variant)) {
+  if (!getKernelVariant(ndrange, &variant)) {
     return;
   }
 
-  constexpr size_t signal_count =
-      host::thread_pool_s::max_num_threads * slice_multiplier;
-  std::array<std::atomic<bool>, signal_count> signals;
   std::atomic<uint32_t> queued(0);
-  host_device->thread_pool.enqueue_range(
-      [](void *const in, void *const info, void *fence, size_t index) {
-        auto *const kernel_variant = static_cast<host::kernel_variant_s *>(in);
-        auto *const ndrange = static_cast<host::command_info_ndrange_s *>(info);
-        auto *const ndrange_info = ndrange->ndrange_info;
-        auto host_device =
-            static_cast<host::device_s *>(ndrange->kernel->device);
-
-        for (uint8_t k = 0; k < ndrange_info->dimensions; ++k) {
-          if (ndrange_info->global_size[k] == 0) {
-            return;
-          }
-        }
 
-        host::schedule_info_s schedule_info;
-
-        for (uint8_t k = 0; k < 3; k++) {
-          schedule_info.global_size[k] = ndrange_info->global_size[k];
-          schedule_info.global_offset[k] = ndrange_info->global_offset[k];
-          schedule_info.local_size[k] = ndrange_info->local_size[k];
-        }
-        schedule_info.slice = index;
-        schedule_info.total_slices =
-            (host_device->thread_pool.num_threads() * slice_multiplier);
-        schedule_info.work_dim =
-            static_cast<uint32_t>(ndrange_info->dimensions);
-
-        kernel_variant->hook(ndrange_info->packed_args, &schedule_info);
+  // In dynamic mode slices claim chunks of work-groups from this counter, see
+  // host::schedule_info_s::work_group_counter.
+  std::atomic<size_t> work_group_counter(0);
+  ndrange_dispatch_s dispatch{
+      &variant,
+      host::SCHEDULE_DYNAMIC == host_device->schedule ? &work_group_counter
+                                                      : nullptr,
+      localMemorySize(variant, *ndrange->ndrange_info)};
+  host_device->thread_pool.enqueue_range(
+      [](void *const in, void *const info, void *, size_t index) {
+        executeNDRangeSlice(*static_cast<ndrange_dispatch_s *>(in),
+                            static_cast<host::command_info_ndrange_s *>(info),
+                            index);
       },
-      &variant, ndrange, signals, &queued, slices);
+      &dispatch, ndrange, nullptr, &queued, slices);
 
   // Ensure all threads to be done with 'queued' by the time it gets destroyed.
+  // The thread pool never accesses a counter again after decrementing it, so
+  // once the wait has observed zero the counter can safely go out of scope.
   host_device->thread_pool.wait(&queued);
-  {
-    std::unique_lock<std::mutex> lock(host_device->thread_pool.wait_mutex);
-    host_device->thread_pool.finished.wait(lock,
-                                           [&queued] { return queued == 0; });
-  }
-
-  // We do need to wait on for 'queued' to be 0 explicitly here, despite the
-  // thread_pool.wait and the fact that each signals[i] was set under the same
-  // lock that is used when changing 'queued'. This was discovered as seeing
-  // that another thread managed to somehow trigger the counter ('queued')
-  // after it being freed (exiting the scope of the `commandNDRange` function).
-  //
-  // It was previously assumed that when the final signal that was signalled
-  // 'queued' was set to 0 under the same lock and thus 'queued' must always be
-  // zero by the time the above thread_pool.wait() returned, therefore further
-  // investigation is required on this to get rid of the inneficiency of the
-  // extra atomic synchronisation used to guarantee the thread-safety here.
   assert(0 == queued);
 }
 
@@ -361,12 +611,61 @@ void commandResetQueryPool(host::command_info_s *info) {
   query_pool->reset(reset_query_pool->index, reset_query_pool->count);
 }
 
-void threadPoolProcessCommands(void *const v_queue,
-                               void *const v_command_buffer,
-                               void *const v_fence, size_t) {
-  auto queue = static_cast<host::queue_s *>(v_queue);
-  auto command_buffer = static_cast<host::command_buffer_s *>(v_command_buffer);
+/// @brief Execute a command which does not involve queries.
+///
+/// @return True if the command was executed, false if its type is unknown.
+[[nodiscard]] bool executeCommand(host::queue_s *queue,
+                                  host::command_buffer_s *command_buffer,
+                                  host::command_info_s *info) {
+  switch (info->type) {
+    default:
+      return false;
+    case host::command_type_read_buffer:
+      commandReadBuffer(queue, info);
+      break;
+    case host::command_type_write_buffer:
+      commandWriteBuffer(queue, info);
+      break;
+    case host::command_type_fill_buffer:
+      commandFillBuffer(queue, info);
+      break;
+    case host::command_type_copy_buffer:
+      commandCopyBuffer(queue, info);
+      break;
+    case host::command_type_read_image:
+      commandReadImage(info);
+      break;
+    case host::command_type_write_image:
+      commandWriteImage(info);
+      break;
+    case host::command_type_fill_image:
+      commandFillImage(info);
+      break;
+    case host::command_type_copy_image:
+      commandCopyImage(info);
+      break;
+    case host::command_type_copy_image_to_buffer:
+      commandCopyImageToBuffer(info);
+      break;
+    case host::command_type_copy_buffer_to_image:
+      commandCopyBufferToImage(info);
+      break;
+    case host::command_type_ndrange:
+      commandNDRange(queue, info);
+      break;
+    case host::command_type_user_callback:
+      commandUserCallback(queue, info, command_buffer);
+      break;
+  }
+  return true;
+}
 
+/// @brief Execute the commands of a command buffer one after the other.
+///
+/// @return True if all commands were executed, false if a command of unknown
+/// type was encountered.
+[[nodiscard]] bool processCommandsInOrder(
+    host::queue_s *queue, host::command_buffer_s *command_buffer) {
   mux_query_duration_result_t duration_query = nullptr;
 
   for (uint64_t i = 0, e = command_buffer->commands.size(); i < e; i++) {
@@ -379,42 +678,9 @@ void threadPoolProcessCommands(void *const v_queue,
 
     switch (info->type) {
       default:
-        return;
-      case host::command_type_read_buffer:
-        commandReadBuffer(info);
-        break;
-      case host::command_type_write_buffer:
-        commandWriteBuffer(info);
-        break;
-      case host::command_type_fill_buffer:
-        commandFillBuffer(info);
-        break;
-      case host::command_type_copy_buffer:
-        commandCopyBuffer(info);
-        break;
-      case host::command_type_read_image:
-        commandReadImage(info);
-        break;
-      case host::command_type_write_image:
-        commandWriteImage(info);
-        break;
-      case host::command_type_fill_image:
-        commandFillImage(info);
-        break;
-      case host::command_type_copy_image:
-        commandCopyImage(info);
-        break;
-      case host::command_type_copy_image_to_buffer:
-        commandCopyImageToBuffer(info);
-        break;
-      case host::command_type_copy_buffer_to_image:
-        commandCopyBufferToImage(info);
-        break;
-      case host::command_type_ndrange:
-        commandNDRange(queue, info);
-        break;
-      case host::command_type_user_callback:
-        commandUserCallback(queue, info, command_buffer);
+        if (!executeCommand(queue, command_buffer, info)) {
+          return false;
+        }
         break;
       case host::command_type_begin_query:
         if (info->end_query_command.pool->type == mux_query_type_duration) {
@@ -448,74 +714,442 @@ void threadPoolProcessCommands(void *const v_queue,
     }
   }
 
-  threadPoolCleanup(v_queue, v_command_buffer, v_fence, false);
+  return true;
+}
+
+/// @brief A range of memory a command reads or writes.
+struct command_access_s {
+  uintptr_t begin;
+  uintptr_t end;
+  bool write;
+
+  /// @brief Whether both accesses touch the same memory and at least one of
+  /// them writes to it, i.e. whether they must not be reordered.
+  bool conflicts(const command_access_s &other) const {
+    return (write || other.write) && begin < other.end && other.begin < end;
+  }
+};
+
+/// @brief A node in the dependency graph of a command buffer.
+struct command_node_s {
+  /// @brief The command this node executes.
+  host::command_info_s *info;
+  /// @brief Whether the memory accessed by the command is unknown, in which
+  /// case it is ordered against every other command.
+  bool barrier;
+  /// @brief The command's accesses in `command_graph_s::accesses`.
+  uint32_t first_access;
+  uint32_t num_accesses;
+  /// @brief The command's successors in `command_graph_s::successors`.
+  uint32_t first_successor;
+  uint32_t num_successors;
+  /// @brief Number of commands which must complete before this one starts.
+  uint32_t num_predecessors;
+  /// @brief Number of predecessors which have not completed yet.
+  std::atomic<uint32_t> pending;
+  /// @brief Number of nd-range slices which have not completed yet.
+  std::atomic<uint32_t> remaining_slices;
+  /// @brief Kernel variant executed by an nd-range command.
+  host::kernel_variant_s variant;
+  /// @brief Work-group counter of an nd-range command, see
+  /// host::schedule_info_s::work_group_counter.
+  std::atomic<size_t> work_group_counter;
+  /// @brief Estimate of the __local memory each slice of an nd-range command
+  /// needs.
+  size_t local_memory_size;
+};
+
+/// @brief Dependency graph used to execute the commands of a command buffer
+/// concurrently.
+///
+/// A command depends on an earlier command only if one of them writes memory
+/// the other accesses, independent commands run concurrently on the thread
+/// pool. Each command is launched by whichever predecessor completes last.
+struct command_graph_s {
+  command_graph_s(host::queue_s *queue, host::command_buffer_s *command_buffer)
+      : queue(queue),
+        command_buffer(command_buffer),
+        device(static_cast<host::device_s *>(queue->device)),
+        nodes(command_buffer->allocator_info),
+        accesses(command_buffer->allocator_info),
+        successors(command_buffer->allocator_info),
+        outstanding(0) {}
+
+  /// @brief Build the graph from the commands of `command_buffer`.
+  ///
+  /// @return Returns `mux_success` on success, `mux_error_out_of_memory` if an
+  /// allocation failed, or `mux_error_feature_unsupported` if the command
+  /// buffer contains commands which must be executed in order.
+  mux_result_t build();
+
+  /// @brief Execute all commands and wait for them to complete.
+  void run();
+
+  /// @brief Record a memory access of the command being added to the graph.
+  [[nodiscard]] cargo::result addAccess(const void *pointer, uint64_t size,
+                                        bool write);
+
+  /// @brief Record the memory accesses of the command of @p node.
+  [[nodiscard]] cargo::result addAccesses(command_node_s &node);
+
+  /// @brief Whether two commands must not be reordered.
+  bool dependsOn(const command_node_s &node,
+                 const command_node_s &predecessor) const;
+
+  /// @brief Enqueue the command of @p node on the thread pool.
+  void launch(command_node_s &node);
+
+  /// @brief Launch the successors of @p node which became ready.
+  void complete(command_node_s &node);
+
+  host::queue_s *queue;
+  host::command_buffer_s *command_buffer;
+  host::device_s *device;
+  mux::dynamic_array<command_node_s> nodes;
+  mux::small_vector<command_access_s, 32> accesses;
+  mux::dynamic_array<uint32_t> successors;
+  /// @brief Number of work items enqueued by the graph which have not
+  /// completed, work items launch successors before completing so this only
+  /// reaches zero once all commands have completed.
+  std::atomic<uint32_t> outstanding;
+};
+
+cargo::result command_graph_s::addAccess(const void *pointer, uint64_t size,
+                                         bool write) {
+  const auto begin = reinterpret_cast<uintptr_t>(pointer);
+  return accesses.push_back(
+      {begin, begin + static_cast<uintptr_t>(size), write});
+}
+
+cargo::result command_graph_s::addAccesses(command_node_s &node) {
+  host::command_info_s *const info = node.info;
+  switch (info->type) {
+    case host::command_type_read_buffer: {
+      const auto &read = info->read_command;
+      auto buffer = static_cast<host::buffer_s *>(read.buffer);
+      if (auto error = addAccess(
+              static_cast<uint8_t *>(buffer->data) + read.offset, read.size,
+              /* write */ false)) {
+        return error;
+      }
+      return addAccess(read.host_pointer, read.size, /* write */ true);
+    }
+    case host::command_type_write_buffer: {
+      const auto &write = info->write_command;
+      auto buffer = static_cast<host::buffer_s *>(write.buffer);
+      if (auto error = addAccess(write.host_pointer, write.size,
+                                 /* write */ false)) {
+        return error;
+      }
+      return addAccess(static_cast<uint8_t *>(buffer->data) + write.offset,
+                       write.size, /* write */ true);
+    }
+    case host::command_type_copy_buffer: {
+      const auto &copy = info->copy_command;
+      auto src_buffer = static_cast<host::buffer_s *>(copy.src_buffer);
+      auto dst_buffer = static_cast<host::buffer_s *>(copy.dst_buffer);
+      if (auto error = addAccess(
+              static_cast<uint8_t *>(src_buffer->data) + copy.src_offset,
+              copy.size, /* write */ false)) {
+        return error;
+      }
+      return addAccess(
+          static_cast<uint8_t *>(dst_buffer->data) + copy.dst_offset,
+          copy.size, /* write */ true);
+    }
+    case host::command_type_fill_buffer: {
+      const auto &fill = info->fill_command;
+      auto buffer = static_cast<host::buffer_s *>(fill.buffer);
+      return addAccess(static_cast<uint8_t *>(buffer->data) + fill.offset,
+                       fill.size, /* write */ true);
+    }
+    case host::command_type_ndrange: {
+      // Kernels may read and write any part of their buffer arguments. A
+      // pointer sized argument may be a USM or buffer device address pointer
+      // to memory we know nothing about, so such kernels act as barriers.
+      const auto &descriptors =
+          info->ndrange_command.ndrange_info->descriptors;
+      for (const auto &descriptor : descriptors) {
+        switch (descriptor.type) {
+          case mux_descriptor_info_type_buffer: {
+            auto buffer = static_cast<host::buffer_s *>(
+                descriptor.buffer_descriptor.buffer);
+            if (auto error = addAccess(buffer->data,
+                                       buffer->memory_requirements.size,
+                                       /* write */ true)) {
+              return error;
+            }
+          } break;
+          case mux_descriptor_info_type_plain_old_data: {
+            // Other sizes are scalars, vectors or structs. Null and the first
+            // page are never mapped, so such values can't alias anything.
+            const auto &pod = descriptor.plain_old_data_descriptor;
+            if (sizeof(void *) == pod.length) {
+              uintptr_t value;
+              std::memcpy(&value, pod.data, sizeof(value));
+              if (value >= unmapped_address_limit) {
+                node.barrier = true;
+              }
+            }
+          } break;
+          case mux_descriptor_info_type_sampler:
+          case mux_descriptor_info_type_shared_local_buffer:
+          case mux_descriptor_info_type_null_buffer:
+            break;
+          default:
+            node.barrier = true;
+            break;
+        }
+      }
+      return cargo::success;
+    }
+    default:
+      // Images are accessed through libimg and user callbacks may touch
+      // anything, order them against everything else.
+      node.barrier = true;
+      return cargo::success;
+  }
+}
+
+bool command_graph_s::dependsOn(const command_node_s &node,
+                                const command_node_s &predecessor) const {
+  if (node.barrier || predecessor.barrier) {
+    return true;
+  }
+  for (uint32_t a = 0; a < node.num_accesses; a++) {
+    const auto &access = accesses[node.first_access + a];
+    for (uint32_t p = 0; p < predecessor.num_accesses; p++) {
+      if (access.conflicts(accesses[predecessor.first_access + p])) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+mux_result_t command_graph_s::build() {
+  auto &commands = command_buffer->commands;
+  for (const auto &command : commands) {
+    switch (command.type) {
+      case host::command_type_begin_query:
+      case host::command_type_end_query:
+      case host::command_type_reset_query_pool:
+      case host::command_type_terminate:
+        // Queries time or count the commands between them.
+        return mux_error_feature_unsupported;
+      default:
+        break;
+    }
+  }
+
+  if (nodes.alloc(commands.size())) {
+    return mux_error_out_of_memory;
+  }
+
+  // Edges from predecessor to successor, in order of successor.
+  mux::small_vector<std::pair<uint32_t, uint32_t>, 32> edges(
+      command_buffer->allocator_info);
+
+  // Index of the last barrier, the first node a command has to look at.
+  uint32_t window_begin = 0;
+
+  for (uint32_t i = 0; i < nodes.size(); i++) {
+    command_node_s &node = nodes[i];
+    node.info = &commands[i];
+    node.barrier = false;
+    node.first_access = static_cast<uint32_t>(accesses.size());
+    if (addAccesses(node)) {
+      return mux_error_out_of_memory;
+    }
+    node.num_accesses =
+        static_cast<uint32_t>(accesses.size()) - node.first_access;
+    node.num_successors = 0;
+    node.num_predecessors = 0;
+
+    // Bound the number of commands each command is compared against, keeping
+    // the graph linear in the number of commands, by turning a command into a
+    // barrier once too many commands follow the last barrier.
+    if (i - window_begin > max_look_back) {
+      node.barrier = true;
+    }
+
+    // Everything before a barrier is already ordered before it, so there is no
+    // need to look any further back.
+    for (uint32_t j = i; j-- > window_begin;) {
+      command_node_s &predecessor = nodes[j];
+      if (dependsOn(node, predecessor)) {
+        if (edges.push_back({j, i})) {
+          return mux_error_out_of_memory;
+        }
+        predecessor.num_successors++;
+        node.num_predecessors++;
+      }
+    }
+    if (node.barrier) {
+      window_begin = i;
+    }
+    node.pending.store(node.num_predecessors, std::memory_order_relaxed);
+  }
+
+  if (successors.alloc(edges.size())) {
+    return mux_error_out_of_memory;
+  }
+  uint32_t first_successor = 0;
+  for (auto &node : nodes) {
+    node.first_successor = first_successor;
+    first_successor += node.num_successors;
+    node.num_successors = 0;
+  }
+  for (const auto &edge : edges) {
+    command_node_s &predecessor = nodes[edge.first];
+    successors[predecessor.first_successor + predecessor.num_successors++] =
+        edge.second;
+  }
+
+  return mux_success;
+}
+
+void command_graph_s::run() {
+  // Nodes without predecessors must be found before any are launched, as a
+  // launched node may complete and launch its successors at any time.
+  for (auto &node : nodes) {
+    if (0 == node.num_predecessors) {
+      launch(node);
+    }
+  }
+
+  device->thread_pool.wait(&outstanding);
+  assert(0 == outstanding);
+}
+
+void command_graph_s::launch(command_node_s &node) {
+  auto &thread_pool = device->thread_pool;
+
+  if (host::command_type_ndrange != node.info->type) {
+    thread_pool.enqueue(
+        [](void *const v_graph, void *const v_node, void *, size_t) {
+          auto *const graph = static_cast<command_graph_s *>(v_graph);
+          auto *const node = static_cast<command_node_s *>(v_node);
+          (void)executeCommand(graph->queue, graph->command_buffer,
+                               node->info);
+          graph->complete(*node);
+        },
+        this, &node, nullptr, 0, nullptr, &outstanding);
+    return;
+  }
+
+  host::command_info_ndrange_s *const ndrange = &(node.info->ndrange_command);
+  if (!getKernelVariant(ndrange, &node.variant)) {
+    complete(node);
+    return;
+  }
+
+  const size_t slices = thread_pool.num_threads() * slice_multiplier;
+  node.local_memory_size =
+      localMemorySize(node.variant, *ndrange->ndrange_info);
+  node.work_group_counter.store(0, std::memory_order_relaxed);
+  node.remaining_slices.store(static_cast<uint32_t>(slices),
+                              std::memory_order_relaxed);
+  thread_pool.enqueue_range(
+      [](void *const v_graph, void *const v_node, void *, size_t index) {
+        auto *const graph = static_cast<command_graph_s *>(v_graph);
+        auto *const node = static_cast<command_node_s *>(v_node);
+        const ndrange_dispatch_s dispatch{
+            &node->variant,
+            host::SCHEDULE_DYNAMIC == graph->device->schedule
+                ? &node->work_group_counter
+                : nullptr,
+            node->local_memory_size};
+        executeNDRangeSlice(dispatch, &(node->info->ndrange_command), index);
+        // The last slice to finish completes the nd-range, acquire the writes
+        // of the other slices so successors observe them.
+        if (1 == node->remaining_slices.fetch_sub(1,
+                                                  std::memory_order_acq_rel)) {
+          graph->complete(*node);
+        }
+      },
+      this, &node, nullptr, &outstanding, slices);
+}
+
+void command_graph_s::complete(command_node_s &node) {
+  for (uint32_t s = 0; s < node.num_successors; s++) {
+    command_node_s &successor = nodes[successors[node.first_successor + s]];
+    if (1 == successor.pending.fetch_sub(1, std::memory_order_acq_rel)) {
+      launch(successor);
+    }
+  }
+}
+
+void threadPoolProcessCommands(void *const v_queue, void *const v_dispatch,
+                               void *const v_fence, size_t) {
+  auto queue = static_cast<host::queue_s *>(v_queue);
+  auto command_buffer =
+      static_cast<host::dispatch_s *>(v_dispatch)->command_buffer;
+
+  // A single command gains nothing from the graph, and if the graph can't be
+  // built the commands are still correct when executed in order.
+  bool in_order = command_buffer->commands.size() < 2;
+  if (!in_order) {
+    command_graph_s graph(queue, command_buffer);
+    in_order = mux_success != graph.build();
+    if (!in_order) {
+      graph.run();
+    }
+  }
+
+  if (in_order && !processCommandsInOrder(queue, command_buffer)) {
+    return;
+  }
+
+  threadPoolCleanup(v_queue, v_dispatch, v_fence, false);
 }
 }  // namespace
 
 namespace host {
 queue_s::queue_s(mux_allocator_info_t allocator, mux_device_t device)
-    : runningGroups(0), signalInfos(allocator) {
+    : runningGroups(0) {
+  (void)allocator;
   this->device = device;
 }
 
 queue_s::~queue_s() {}
 
-void queue_s::signalCompleted(mux_command_buffer_t group, bool terminate) {
-  auto signalInfo = std::find_if(signalInfos.begin(), signalInfos.end(),
-                                 [group](decltype(*signalInfos.begin()) &info) {
-                                   return group == info.first;
-                                 });
-  if (signalInfos.end() != signalInfo) {
-    auto hostDevice = static_cast<device_s *>(group->device);
-    auto hostGroup = static_cast<command_buffer_s *>(group);
-    auto *hostFence = static_cast<fence_s *>(signalInfo->second.fence);
-    auto *threadPoolSignal =
-        hostFence ? &hostFence->thread_pool_signal : nullptr;
-
-    if (terminate) {
-      // and fire off a no-op enqueue to the thread pool because another thread
-      // could already be waiting for the group via the thread pool, so we need
-      // to signal wait complete in the normal way.
-      hostDevice->thread_pool.enqueue(threadPoolCleanup, this, hostGroup,
-                                      hostFence, true, threadPoolSignal,
-                                      &this->runningGroups);
-    } else {
-      // we got a signal, so decrement the wait count
-      (signalInfo->second.wait_count)--;
-
-      // if we were the last signal on the group, run it!
-      if (0 == signalInfo->second.wait_count) {
-        hostDevice->thread_pool.enqueue(threadPoolProcessCommands, this,
-                                        hostGroup, hostFence, false,
-                                        threadPoolSignal, &this->runningGroups);
-
-        // lastly wipe the tracking info for the group
-        signalInfos.erase(signalInfo);
-        return;
-      }
-    }
+void queue_s::signalCompleted(dispatch_s *dispatch, bool terminate) {
+  // The dispatch has already been started or terminated.
+  if (0 == dispatch->wait_count) {
+    return;
+  }
+  auto hostDevice = static_cast<device_s *>(dispatch->command_buffer->device);
+  auto *hostFence = dispatch->fence;
+  auto *threadPoolSignal = hostFence ? &hostFence->thread_pool_signal : nullptr;
+
+  if (terminate) {
+    // and fire off a no-op enqueue to the thread pool because another thread
+    // could already be waiting for the dispatch via the thread pool, so we
+    // need to signal wait complete in the normal way.
+    dispatch->wait_count = 0;
+    hostDevice->thread_pool.enqueue(threadPoolCleanup, this, dispatch,
+                                    hostFence, true, threadPoolSignal,
+                                    &this->runningGroups);
+  } else if (0 == --dispatch->wait_count) {
+    // we were the last signal on the dispatch, run it!
+    hostDevice->thread_pool.enqueue(threadPoolProcessCommands, this, dispatch,
+                                    hostFence, false, threadPoolSignal,
+                                    &this->runningGroups);
   }
 }
 
-mux_result_t queue_s::addGroup(mux_command_buffer_t group, mux_fence_t fence,
-                               uint64_t numWaits) {
-  if (0 == numWaits) {
-    auto *hostDevice = static_cast<device_s *>(group->device);
-    auto *hostGroup = static_cast<command_buffer_s *>(group);
-    auto *hostFence = static_cast<fence_s *>(fence);
+void queue_s::addDispatch(dispatch_s *dispatch) {
+  if (0 == dispatch->wait_count) {
+    auto *hostDevice =
+        static_cast<device_s *>(dispatch->command_buffer->device);
+    auto *hostFence = dispatch->fence;
     auto *hostThreadPoolSignal =
         hostFence ? &hostFence->thread_pool_signal : nullptr;
-    hostDevice->thread_pool.enqueue(threadPoolProcessCommands, this, hostGroup,
+    hostDevice->thread_pool.enqueue(threadPoolProcessCommands, this, dispatch,
                                     hostFence, 0, hostThreadPoolSignal,
                                     &this->runningGroups);
-  } else {
-    const signal_info_s signal_info{numWaits, fence};
-    if (signalInfos.emplace_back(group, signal_info)) {
-      return mux_error_out_of_memory;
-    }
   }
-
-  return mux_success;
 }
 }  // namespace host
 
@@ -541,28 +1175,38 @@ mux_result_t hostDispatch(
 
   const std::lock_guard<std::mutex> guard(hostQueue->mutex);
 
-  // store the semaphores we have to signal into the group
-  if (!hostGroup->signal_semaphores.insert(
-          hostGroup->signal_semaphores.end(), signal_semaphores,
+  // The recorded commands are shared by all dispatches of the command buffer,
+  // only the state of this dispatch is separate.
+  auto dispatch = hostGroup->acquireDispatch();
+  if (nullptr == dispatch) {
+    return mux_error_out_of_memory;
+  }
+
+  // store the semaphores we have to signal into the dispatch
+  if (!dispatch->signal_semaphores.insert(
+          dispatch->signal_semaphores.end(), signal_semaphores,
           signal_semaphores + signal_semaphores_length)) {
+    dispatch->in_flight = false;
     return mux_error_out_of_memory;
   }
 
-  hostGroup->user_function = user_function;
-  hostGroup->user_data = user_data;
+  dispatch->user_function = user_function;
+  dispatch->user_data = user_data;
+  dispatch->fence = hostFence;
+  dispatch->wait_count = wait_semaphores_length;
 
   // The fence is optional, it may be null.
   if (hostFence) {
     hostFence->reset();
   }
 
-  // track the group in the queue...
-  hostQueue->addGroup(command_buffer, hostFence, wait_semaphores_length);
+  // track the dispatch in the queue...
+  hostQueue->addDispatch(dispatch);
 
-  // ...then tell the semaphores in the wait list about the group
+  // ...then tell the semaphores in the wait list about the dispatch
   for (uint64_t i = 0; i < wait_semaphores_length; i++) {
     auto *semaphore = static_cast<host::semaphore_s *>(wait_semaphores[i]);
-    semaphore->addWait(command_buffer);
+    semaphore->addWait(dispatch);
   }
 
   return mux_success;
@@ -583,8 +1227,7 @@ mux_result_t hostWaitAll(mux_queue_t queue) {
 
   // Wait for all work to have left the thread pool, this occurs when the
   // runningGroups atomic reaches zero.
-  std::unique_lock<std::mutex> lock(hostPool.wait_mutex);
-  hostPool.finished.wait(lock, [host] { return 0 == host->runningGroups; });
+  hostPool.wait(&host->runningGroups);
 
   return mux_success;
 }
@@ -22,7 +22,7 @@
 namespace host {
 semaphore_s::semaphore_s(mux_device_t device,
                          mux_allocator_info_t allocator_info)
-    : signalled(false), failed(false), waitingGroups(allocator_info) {
+    : signalled(false), failed(false), waitingDispatches(allocator_info) {
   this->device = device;
 }
 
@@ -36,22 +36,21 @@ void semaphore_s::signal(bool terminate) {
   auto &hostQueue = static_cast<host::device_s *>(device)->queue;
 
   // Run through our waits to signal them.
-  for (size_t i = 0; i < waitingGroups.size(); i++) {
-    auto command_buffer = waitingGroups[i];
-    hostQueue.signalCompleted(command_buffer, terminate);
+  for (size_t i = 0; i < waitingDispatches.size(); i++) {
+    hostQueue.signalCompleted(waitingDispatches[i], terminate);
   }
 }
 
-mux_result_t semaphore_s::addWait(mux_command_buffer_t group) {
+mux_result_t semaphore_s::addWait(dispatch_s *dispatch) {
   // Check if the semaphore has already been signalled.
   if (signalled) {
     // This is only called from hostDispatch which already holds a lock on the
     // queues mutex.
     static_cast<host::device_s *>(this->device)
-        ->queue.signalCompleted(group, failed);
+        ->queue.signalCompleted(dispatch, failed);
   } else {
-    // and save the queue and group onto the list
-    if (cargo::success != waitingGroups.push_back(group)) {
+    // and save the dispatch onto the list
+    if (cargo::success != waitingDispatches.push_back(dispatch)) {
       return mux_error_out_of_memory;
     }
   }
@@ -62,7 +61,7 @@ mux_result_t semaphore_s::addWait(mux_command_buffer_t group) {
 void semaphore_s::reset() {
   signalled = false;
   failed = false;
-  waitingGroups.clear();
+  waitingDispatches.clear();
 }
 
 semaphore_s::~semaphore_s() {}
@@ -17,6 +17,18 @@
 #include <host/thread_pool.h>
 
 #include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <sched.h>
+#include <unistd.h>
+#endif
 
 namespace {
 
@@ -26,46 +38,175 @@ namespace {
 /// reducing this to zero.
 constexpr size_t ca_free_hw_threads = 0;
 
+/// Queue index used to denote a thread which is not part of a pool.
+constexpr size_t not_a_pool_thread = std::numeric_limits<size_t>::max();
+
+/// The pool and queue index owned by the current thread, if it is a pool
+/// thread.
+thread_local const host::thread_pool_s *current_pool = nullptr;
+thread_local size_t current_index = not_a_pool_thread;
+
+/// @brief Get the queue index owned by the calling thread in `pool`.
+size_t currentQueueIndex(const host::thread_pool_s *const pool) {
+  return pool == current_pool ? current_index : not_a_pool_thread;
+}
+
+/// @brief Back off while spinning, yielding occasionally so that spinning
+/// threads don't starve threads which are runnable on the same core.
+void spinPause(size_t iteration) {
+  if (0 == (iteration % 64)) {
+    std::this_thread::yield();
+  }
+}
+
+/// @brief Parse a Linux cpulist, such as "0-3,8,10-11", into a list of ids.
+std::vector<uint32_t> parseCPUList(const char *list) {
+  std::vector<uint32_t> ids;
+  while (nullptr != list && '\0' != *list) {
+    char *end = nullptr;
+    const unsigned long first = std::strtoul(list, &end, 10);
+    if (end == list) {
+      break;
+    }
+    unsigned long last = first;
+    if ('-' == *end) {
+      list = end + 1;
+      last = std::strtoul(list, &end, 10);
+      if (end == list) {
+        break;
+      }
+    }
+    for (unsigned long id = first; id <= last; id++) {
+      ids.push_back(static_cast<uint32_t>(id));
+    }
+    list = (',' == *end) ? end + 1 : "";
+  }
+  return ids;
+}
+
+/// @brief Read a cpulist formatted file from sysfs.
+std::vector<uint32_t> readCPUList(const std::string &path) {
+  std::vector<uint32_t> ids;
+#ifdef __linux__
+  if (FILE *file = std::fopen(path.c_str(), "r")) {
+    char buffer[1024];
+    if (std::fgets(buffer, sizeof(buffer), file)) {
+      ids = parseCPUList(buffer);
+    }
+    std::fclose(file);
+  }
+#else
+  (void)path;
+#endif
+  return ids;
+}
+
+/// @brief Pin the calling thread to the CPUs of a NUMA node.
+void pinToNumaNode(uint32_t node) {
+#ifdef __linux__
+  const std::vector<uint32_t> cpus = readCPUList(
+      "/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+  if (cpus.empty()) {
+    return;
+  }
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (const uint32_t cpu : cpus) {
+    if (cpu < CPU_SETSIZE) {
+      CPU_SET(cpu, &set);
+    }
+  }
+  // Pinning is only an optimization, carry on unpinned if it fails.
+  (void)sched_setaffinity(0, sizeof(set), &set);
+#else
+  (void)node;
+#endif
+}
+
+/// @brief Get the size of a page of memory.
+size_t pageSize() {
+#ifdef __linux__
+  const long size = sysconf(_SC_PAGESIZE);
+  if (0 < size) {
+    return static_cast<size_t>(size);
+  }
+#endif
+  return 4096;
+}
+
+/// @brief Write to each page of the calling pool thread's chunk of an
+/// allocation, see `host::thread_pool_s::firstTouch`.
+///
+/// @param[in] in The thread pool.
+/// @param[in] data Start of the allocation.
+/// @param[in] in_size Pointer to the size of the allocation.
+/// @param[in] index The pool thread the chunk was pushed to.
+void firstTouchChunk(void *const in, void *const data, void *const in_size,
+                     size_t index) {
+  auto *const pool = static_cast<host::thread_pool_s *>(in);
+  const size_t own = currentQueueIndex(pool);
+
+  // Only touch the chunk from the node it was meant for, a page left
+  // untouched is still placed on first use so skipping is always safe.
+  if (not_a_pool_thread == own ||
+      pool->thread_node[own] != pool->thread_node[index]) {
+    return;
+  }
+
+  const size_t size = *static_cast<const size_t *>(in_size);
+  const size_t threads = pool->num_threads();
+  const size_t page = pageSize();
+  auto *const bytes = static_cast<volatile char *>(data);
+  const size_t begin = (size * index) / threads;
+  const size_t end = (size * (index + 1)) / threads;
+
+  // Touch the first byte of the chunk and then the first byte of each page
+  // starting in it, never a byte outside the allocation.
+  const uintptr_t base = reinterpret_cast<uintptr_t>(data);
+  size_t offset = begin;
+  while (offset < end) {
+    bytes[offset] = 0;
+    offset = ((base + offset + page) & ~(page - 1)) - base;
+  }
+}
+
 /// The code to do one iteration of the threadFunc loop.
 void threadFuncBody(host::thread_pool_s *const me,
                     host::thread_pool_work_item_s item) {
   const tracer::TraceGuard<tracer::Impl> traceGuard(__func__);
 
   item.function(item.user_data, item.user_data2, item.user_data3, item.index);
-  // technically our condition variable doesn't need this to be locked, but
-  // in practice we could erroneously wait for work in wait() if we don't
-  // hold this mutex before signalling the work item is complete.
-  bool reached_zero{false};
-  {
-    const std::lock_guard<std::mutex> guard(me->wait_mutex);
-
-    // Signal that we've completed this bit of work.  Count gets decremented
-    // after signal gets set because if a program is waiting on a single
-    // command-group to finish the global count does not matter, but if a user
-    // is waiting on the entire queue to finish we need to ensure that we are
-    // completely done with all command-groups (i.e. set item.signal) before
-    // item.count reaches zero.
-    // Signal is optional, it could be null.
-    if (item.signal) {
-      *(item.signal) = true;
-    }
-    *(item.count) -= 1u;
-    reached_zero = (*item.count == 0);
-  }
 
-  if (reached_zero) {
-    me->finished.notify_all();
+  // Signal that we've completed this bit of work.  Count gets decremented
+  // after signal gets set because if a program is waiting on a single
+  // command-group to finish the global count does not matter, but if a user
+  // is waiting on the entire queue to finish we need to ensure that we are
+  // completely done with all command-groups (i.e. set item.signal) before
+  // item.count reaches zero. Once count has been decremented its storage may
+  // have been released by a waiter, so it must not be accessed again.
+  // Signal is optional, it could be null.
+  if (item.signal) {
+    *(item.signal) = true;
   }
+  const bool reached_zero = 1u == item.count->fetch_sub(1u);
 
-  // signal anything waiting that the work is complete
-  me->done_work.notify_all();
+  if (item.signal || reached_zero) {
+    me->notifyFinished();
+  }
 }
 
 /// The function for each cargo::thread to call.
-void threadFunc(host::thread_pool_s *const me) {
+void threadFunc(host::thread_pool_s *const me, size_t index) {
 #ifdef CA_HOST_ENABLE_PAPI_COUNTERS
   me->registerPid();
 #endif
+  // Pin before getting any work, so that everything this thread first touches
+  // is placed on its node.
+  if (me->numa_aware) {
+    pinToNumaNode(me->thread_node[index]);
+  }
+  current_pool = me;
+  current_index = index;
   host::thread_pool_work_item_s item;
   while (me->getWork(&item)) {
     threadFuncBody(me, item);
@@ -74,7 +215,71 @@ void threadFunc(host::thread_pool_s *const me) {
 }  // namespace
 
 namespace host {
-thread_pool_s::thread_pool_s() : stayAlive(true) {
+thread_pool_queue_s::thread_pool_queue_s() : push_index(0), pop_index(0) {
+  static_assert(0 == (capacity & (capacity - 1)),
+                "Queue capacity must be a power of two");
+  for (size_t i = 0; i < capacity; i++) {
+    slots[i].sequence.store(i, std::memory_order_relaxed);
+  }
+}
+
+bool thread_pool_queue_s::tryPush(const thread_pool_work_item_s &item) {
+  size_t position = push_index.load(std::memory_order_relaxed);
+  for (;;) {
+    slot_s &slot = slots[position & (capacity - 1)];
+    const size_t sequence = slot.sequence.load(std::memory_order_acquire);
+    const auto difference = static_cast<intptr_t>(sequence) -
+                            static_cast<intptr_t>(position);
+    if (0 == difference) {
+      // The slot is free, claim it.
+      if (push_index.compare_exchange_weak(position, position + 1,
+                                           std::memory_order_relaxed)) {
+        slot.item = item;
+        slot.sequence.store(position + 1, std::memory_order_release);
+        return true;
+      }
+    } else if (difference < 0) {
+      // The slot still holds an item from the previous lap, queue is full.
+      return false;
+    } else {
+      // Another producer claimed the slot, try again from the new position.
+      position = push_index.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+bool thread_pool_queue_s::tryPop(thread_pool_work_item_s *const item) {
+  size_t position = pop_index.load(std::memory_order_relaxed);
+  for (;;) {
+    slot_s &slot = slots[position & (capacity - 1)];
+    const size_t sequence = slot.sequence.load(std::memory_order_acquire);
+    const auto difference = static_cast<intptr_t>(sequence) -
+                            static_cast<intptr_t>(position + 1);
+    if (0 == difference) {
+      // The slot holds an item, claim it.
+      if (pop_index.compare_exchange_weak(position, position + 1,
+                                          std::memory_order_relaxed)) {
+        *item = slot.item;
+        slot.sequence.store(position + capacity, std::memory_order_release);
+        return true;
+      }
+    } else if (difference < 0) {
+      // The slot has not been written yet, queue is empty.
+      return false;
+    } else {
+      // Another consumer claimed the slot, try again from the new position.
+      position = pop_index.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+thread_pool_s::thread_pool_s()
+    : overflow_size(0),
+      next_queue(0),
+      work_epoch(0),
+      sleeping(0),
+      waiting(0),
+      stayAlive(true) {
   const tracer::TraceGuard<tracer::Impl> traceGuard(__func__);
 
   auto clamp = [](size_t v, size_t a, size_t b) {
@@ -103,8 +308,27 @@ thread_pool_s::thread_pool_s() : stayAlive(true) {
 
   // Must be set before num_threads() is called.
   initialized_threads = std::min({desired_threads, max_threads, debug_threads});
+
+  // Register the value of the CA_HOST_NUMA environment variable. When enabled
+  // on a system with more than one NUMA node, pool threads are divided into
+  // contiguous blocks which are pinned to consecutive nodes.
+  numa_aware = false;
+  thread_node.fill(0);
+  if (const char *numa = std::getenv("CA_HOST_NUMA")) {
+    if (0 != std::atoi(numa)) {
+      const std::vector<uint32_t> nodes =
+          readCPUList("/sys/devices/system/node/online");
+      if (1 < nodes.size()) {
+        numa_aware = true;
+        for (size_t i = 0, e = num_threads(); i < e; i++) {
+          thread_node[i] = nodes[(i * nodes.size()) / e];
+        }
+      }
+    }
+  }
+
   for (size_t i = 0, e = num_threads(); i < e; i++) {
-    pool[i] = cargo::thread(threadFunc, this);
+    pool[i] = cargo::thread(threadFunc, this, i);
     pool[i].set_name("host:pool:" + std::to_string(i));
   }
 }
@@ -113,7 +337,7 @@ thread_pool_s::~thread_pool_s() {
   const tracer::TraceGuard<tracer::Impl> traceGuard(__func__);
 
   {
-    const std::lock_guard<std::mutex> guard(mutex);
+    const std::lock_guard<std::mutex> guard(park_mutex);
     // kill the thread pool
     stayAlive = false;
   }
@@ -127,49 +351,79 @@ thread_pool_s::~thread_pool_s() {
 }
 
 bool thread_pool_s::getWork(thread_pool_work_item_s *const work) {
-  if (!stayAlive) {
-    return false;
-  }
-
-  std::unique_lock<std::mutex> guard(mutex);
-
-  new_work.wait(guard, [&] {
-    return (queue_read_index != queue_write_index) || !(stayAlive);
-  });
+  while (stayAlive) {
+    if (tryGetWork(work)) {
+      return true;
+    }
 
-  // This tracer is placed later so we get nice gaps in the graph when the
-  // thread pool is just waiting.
-  const tracer::TraceGuard<tracer::Impl> traceGuard(__func__);
+    // Spin for a while before parking, work for small kernels tends to arrive
+    // in quick succession and waking a parked thread is expensive.
+    for (size_t i = 0; i < spin_count && stayAlive; i++) {
+      if (tryGetWork(work)) {
+        return true;
+      }
+      spinPause(i);
+    }
 
-  if (!stayAlive) {
-    return false;
+    // The epoch must be read before the final check for work, any work pushed
+    // after the check changes the epoch and so cannot be missed.
+    const uint64_t epoch = work_epoch;
+    sleeping++;
+    if (tryGetWork(work)) {
+      sleeping--;
+      return true;
+    }
+    {
+      std::unique_lock<std::mutex> guard(park_mutex);
+      new_work.wait(guard,
+                    [&] { return (work_epoch != epoch) || !(stayAlive); });
+    }
+    sleeping--;
   }
 
-  *work = queue[queue_read_index];
-
-  queue_read_index = (queue_read_index + 1) % queue_max;
-
-  return true;
+  return false;
 }
 
 bool thread_pool_s::tryGetWork(thread_pool_work_item_s *const work) {
-  const tracer::TraceGuard<tracer::Impl> traceGuard(__func__);
-
   if (!stayAlive) {
     return false;
   }
 
-  const std::unique_lock<std::mutex> guard(mutex);
-
-  if (queue_read_index == queue_write_index) {
-    return false;
+  const size_t threads = num_threads();
+  const size_t own = currentQueueIndex(this);
+
+  // Pool threads try their own queue first, then steal from their neighbours
+  // in order. Other threads help out starting from an arbitrary queue so that
+  // they don't all contend on the first one. NUMA aware pool threads steal
+  // from the threads on their own node before crossing to another node.
+  const size_t first = not_a_pool_thread == own ? next_queue.load() : own;
+  const bool node_local = numa_aware && not_a_pool_thread != own;
+  for (size_t pass = node_local ? 0 : 1; pass < 2; pass++) {
+    for (size_t i = 0; i < threads; i++) {
+      const size_t queue = (first + i) % threads;
+      if (0 == pass && thread_node[queue] != thread_node[own]) {
+        continue;
+      }
+      if (queues[queue].tryPop(work)) {
+        // This tracer is placed after the pop so we get nice gaps in the graph
+        // when the thread pool is just waiting.
+        const tracer::TraceGuard<tracer::Impl> traceGuard(__func__);
+        return true;
+      }
+    }
   }
 
-  *work = queue[queue_read_index];
-
-  queue_read_index = (queue_read_index + 1) % queue_max;
+  if (0 != overflow_size) {
+    const std::lock_guard<std::mutex> guard(overflow_mutex);
+    if (!overflow.empty()) {
+      *work = overflow.front();
+      overflow.pop_front();
+      overflow_size--;
+      return true;
+    }
+  }
 
-  return true;
+  return false;
 }
 
 size_t thread_pool_s::num_threads() const { return this->initialized_threads; }
@@ -187,33 +441,106 @@ void thread_pool_s::enqueue(function_t function, void *user_data,
     *signal = false;
   }
 
-  {
-    std::unique_lock<std::mutex> lock(mutex);
+  // Work enqueued from a pool thread goes on that thread's own queue, where it
+  // is cache hot, idle threads will steal it if the owner is busy.
+  const size_t own = currentQueueIndex(this);
+  push({function, user_data, user_data2, user_data3, index, signal, count},
+       not_a_pool_thread == own ? next_queue++ : own);
 
-    unsigned next_write_index = (queue_write_index + 1) % queue_max;
+  notify(/* all */ false);
+}
 
-    while (queue_read_index == next_write_index) {
-      // We've entirely filled our work buffer! Need to wait until a space
-      // opens so unlock the queue mutex, acquire the wait mutex, notify the
-      // pool that some work needs doing and wait for an item to complete.
-      {
-        std::unique_lock<std::mutex> wait_lock(wait_mutex);
-        lock.unlock();
-        new_work.notify_one();
-        done_work.wait(wait_lock);
-        lock.lock();
-      }
+void thread_pool_s::enqueue_range(function_t function, void *user_data,
+                                  void *user_data2, void *user_data3,
+                                  std::atomic<uint32_t> *count,
+                                  size_t slices) {
+  const tracer::TraceGuard<tracer::Impl> traceGuard(__func__);
+
+  *count += static_cast<uint32_t>(slices);
+
+  const size_t first_queue = next_queue.fetch_add(slices);
+  for (size_t index = 0; index < slices; index++) {
+    push({function, user_data, user_data2, user_data3, index, nullptr, count},
+         sliceQueue(index, slices, first_queue));
+  }
+
+  notify(/* all */ true);
+}
+
+void thread_pool_s::firstTouch(void *data, size_t size) {
+  // Pool threads must not block waiting on the rest of the pool, and the
+  // allocating thread must not block behind running nd-ranges, so only touch
+  // the allocation when every pool thread is parked. Untouched pages are still
+  // placed on first use, so skipping is always safe.
+  if (!numa_aware || size < first_touch_threshold ||
+      not_a_pool_thread != currentQueueIndex(this) ||
+      sleeping.load(std::memory_order_relaxed) < num_threads()) {
+    return;
+  }
+  const tracer::TraceGuard<tracer::Impl> traceGuard(__func__);
+
+  const size_t threads = num_threads();
+  std::atomic<uint32_t> count(static_cast<uint32_t>(threads));
+  for (size_t index = 0; index < threads; index++) {
+    push({firstTouchChunk, this, data, &size, index, nullptr, &count}, index);
+  }
+  notify(/* all */ true);
 
-      next_write_index = (queue_write_index + 1) % queue_max;
+  // Unlike `wait` the calling thread must not help, it isn't on any node so
+  // would skip every chunk it popped.
+  if (0 != count) {
+    waiting++;
+    {
+      std::unique_lock<std::mutex> guard(wait_mutex);
+      finished.wait(guard, [&count] { return 0 == count; });
     }
+    waiting--;
+  }
+}
+
+void thread_pool_s::push(const thread_pool_work_item_s &item,
+                         size_t preferred) {
+  const size_t threads = num_threads();
+  for (size_t i = 0; i < threads; i++) {
+    if (queues[(preferred + i) % threads].tryPush(item)) {
+      return;
+    }
+  }
+
+  // We've entirely filled every work queue! Spill into the overflow list.
+  const std::lock_guard<std::mutex> guard(overflow_mutex);
+  overflow.push_back(item);
+  overflow_size++;
+}
+
+void thread_pool_s::notify(bool all) {
+  // Any pool thread about to park has either already read the old epoch, in
+  // which case it will see this change, or will find the pushed work when it
+  // checks the queues one last time.
+  work_epoch++;
+  if (0 == sleeping) {
+    return;
+  }
 
-    queue[queue_write_index] = {function, user_data, user_data2, user_data3,
-                                index,    signal,    count};
+  // Acquire the mutex so that the notification can't be lost between a parking
+  // thread checking the epoch and it starting to wait.
+  { const std::lock_guard<std::mutex> guard(park_mutex); }
+  if (all) {
+    new_work.notify_all();
+  } else {
+    new_work.notify_one();
+  }
+}
 
-    queue_write_index = next_write_index;
+void thread_pool_s::notifyFinished() {
+  // Waiters increment `waiting` before checking their condition, so if we see
+  // no waiters any future waiter will see the completed work.
+  if (0 == waiting) {
+    return;
   }
 
-  new_work.notify_one();
+  { const std::lock_guard<std::mutex> guard(wait_mutex); }
+  finished.notify_all();
 }
 
 void thread_pool_s::wait(std::atomic<bool> *signal) {
@@ -231,10 +558,20 @@ void thread_pool_s::wait(std::atomic<bool> *signal) {
       threadFuncBody(this, item);
     }
 
+    // The remaining work is in flight on other threads, short work is likely
+    // to complete before it is worth parking.
+    for (size_t i = 0; (i < spin_count) && (false == *signal); i++) {
+      spinPause(i);
+    }
+
     // Now we check if the signal is done.
     if (false == *signal) {
-      std::unique_lock<std::mutex> guard(wait_mutex);
-      done_work.wait(guard, [signal] { return signal->load(); });
+      waiting++;
+      {
+        std::unique_lock<std::mutex> guard(wait_mutex);
+        finished.wait(guard, [signal] { return signal->load(); });
+      }
+      waiting--;
     }
   }
 }
@@ -254,10 +591,20 @@ void thread_pool_s::wait(std::atomic<uint32_t> *count) {
       threadFuncBody(this, item);
     }
 
+    // The remaining work is in flight on other threads, short work is likely
+    // to complete before it is worth parking.
+    for (size_t i = 0; (i < spin_count) && (*count != 0); i++) {
+      spinPause(i);
+    }
+
     // Now we check if the count has reached zero.
     if (*count != 0) {
-      std::unique_lock<std::mutex> guard(wait_mutex);
-      finished.wait(guard, [count] { return *count == 0; });
+      waiting++;
+      {
+        std::unique_lock<std::mutex> guard(wait_mutex);
+        finished.wait(guard, [count] { return *count == 0; });
+      }
+      waiting--;
     }
   }
 }
@@ -0,0 +1,250 @@
+// Copyright (C) Codeplay Software Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License") with LLVM
+// Exceptions; you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://github.com/codeplaysoftware/oneapi-construction-kit/blob/main/LICENSE.txt
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+//
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+
+#include <array>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "host_fixtures.h"
+
+// When creating the binary of a program with several kernels the host compiler
+// finalizes groups of kernels on up to `CA_HOST_COMPILE_THREADS` threads,
+// while the kernel of a program with only one kernel is always finalized on
+// the calling thread. These tests check each kernel of a program built both
+// ways reports the same metadata and computes the same results.
+struct HostCompileThreadsTest : HostCompilerCommandQueueTest {
+  void TearDown() override {
+    for (cl_kernel kernel : kernels) {
+      EXPECT_SUCCESS(clReleaseKernel(kernel));
+    }
+    for (cl_program program : programs) {
+      EXPECT_SUCCESS(clReleaseProgram(program));
+    }
+    HostCompilerCommandQueueTest::TearDown();
+  }
+
+  // Build a program from source, then build a program from its binary, which
+  // is where kernels are finalized.
+  cl_program buildFromBinary(const std::string &source) {
+    const char *string = source.c_str();
+    const size_t length = source.size();
+    cl_int error = CL_SUCCESS;
+    cl_program program =
+        clCreateProgramWithSource(context, 1, &string, &length, &error);
+    EXPECT_SUCCESS(error);
+    if (!program) {
+      return nullptr;
+    }
+    programs.push_back(program);
+    EXPECT_SUCCESS(
+        clBuildProgram(program, 1, &device, nullptr, nullptr, nullptr));
+
+    size_t binary_size = 0;
+    EXPECT_SUCCESS(clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES,
+                                    sizeof(binary_size), &binary_size,
+                                    nullptr));
+    std::vector<unsigned char> binary(binary_size);
+    unsigned char *binary_data = binary.data();
+    EXPECT_SUCCESS(clGetProgramInfo(program, CL_PROGRAM_BINARIES,
+                                    sizeof(binary_data), &binary_data,
+                                    nullptr));
+    const unsigned char *binaries[] = {binary_data};
+    cl_program binary_program = clCreateProgramWithBinary(
+        context, 1, &device, &binary_size, binaries, nullptr, &error);
+    EXPECT_SUCCESS(error);
+    if (!binary_program) {
+      return nullptr;
+    }
+    programs.push_back(binary_program);
+    EXPECT_SUCCESS(
+        clBuildProgram(binary_program, 1, &device, nullptr, nullptr, nullptr));
+    return binary_program;
+  }
+
+  cl_kernel createKernel(cl_program program, const char *name) {
+    cl_int error = CL_SUCCESS;
+    cl_kernel kernel = clCreateKernel(program, name, &error);
+    EXPECT_SUCCESS(error);
+    if (kernel) {
+      kernels.push_back(kernel);
+    }
+    return kernel;
+  }
+
+  std::vector<cl_uint> run(cl_kernel kernel, const std::vector<cl_uint> &in) {
+    const size_t size = in.size() * sizeof(cl_uint);
+    cl_int error = CL_SUCCESS;
+    cl_mem in_buffer =
+        clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, size,
+                       const_cast<cl_uint *>(in.data()), &error);
+    EXPECT_SUCCESS(error);
+    cl_mem out_buffer =
+        clCreateBuffer(context, CL_MEM_WRITE_ONLY, size, nullptr, &error);
+    EXPECT_SUCCESS(error);
+
+    std::vector<cl_uint> out(in.size());
+    EXPECT_SUCCESS(clSetKernelArg(kernel, 0, sizeof(in_buffer), &in_buffer));
+    EXPECT_SUCCESS(clSetKernelArg(kernel, 1, sizeof(out_buffer), &out_buffer));
+    const size_t global_size = in.size();
+    EXPECT_SUCCESS(clEnqueueNDRangeKernel(command_queue, kernel, 1, nullptr,
+                                          &global_size, &local_size, 0,
+                                          nullptr, nullptr));
+    EXPECT_SUCCESS(clEnqueueReadBuffer(command_queue, out_buffer, CL_TRUE, 0,
+                                       size, out.data(), 0, nullptr, nullptr));
+    EXPECT_SUCCESS(clReleaseMemObject(out_buffer));
+    EXPECT_SUCCESS(clReleaseMemObject(in_buffer));
+    return out;
+  }
+
+  static constexpr size_t local_size = 64;
+
+  std::vector<cl_program> programs;
+  std::vector<cl_kernel> kernels;
+};
+
+constexpr size_t HostCompileThreadsTest::local_size;
+
+TEST_F(HostCompileThreadsTest, SameAsSingleKernel) {
+  // Kernels with different local memory, work-group size attributes and
+  // amounts of code, so they are spread over several groups.
+  const std::array<std::pair<const char *, const char *>, 5> sources = {{
+      {"reverse", R"OpenCLC(
+  __attribute__((reqd_work_group_size(64, 1, 1)))
+  kernel void reverse(global const uint *in, global uint *out) {
+    local uint tmp[64];
+    size_t lid = get_local_id(0);
+    tmp[lid] = in[get_global_id(0)];
+    barrier(CLK_LOCAL_MEM_FENCE);
+    out[get_global_id(0)] = tmp[63 - lid];
+  }
+)OpenCLC"},
+      {"scale", R"OpenCLC(
+  kernel void scale(global const uint *in, global uint *out) {
+    out[get_global_id(0)] = in[get_global_id(0)] * 3;
+  }
+)OpenCLC"},
+      {"mirror", R"OpenCLC(
+  kernel void mirror(global const uint *in, global uint *out) {
+    local uint tmp[128];
+    size_t lid = get_local_id(0);
+    tmp[lid] = in[get_global_id(0)];
+    tmp[lid + 64] = in[get_global_id(0)] * 2;
+    barrier(CLK_LOCAL_MEM_FENCE);
+    out[get_global_id(0)] = tmp[lid] + tmp[127 - lid];
+  }
+)OpenCLC"},
+      {"count", R"OpenCLC(
+  kernel void count(global const uint *in, global uint *out) {
+    size_t gid = get_global_id(0);
+    out[gid] = popcount(in[gid]) + (uint)gid;
+  }
+)OpenCLC"},
+      {"mask", R"OpenCLC(
+  __attribute__((work_group_size_hint(64, 1, 1)))
+  kernel void mask(global const uint *in, global uint *out) {
+    out[get_global_id(0)] = in[get_global_id(0)] ^ 0x5a5au;
+  }
+)OpenCLC"},
+  }};
+
+  std::string all_sources;
+  for (const auto &source : sources) {
+    all_sources += source.second;
+  }
+  cl_program program = buildFromBinary(all_sources);
+  ASSERT_NE(nullptr, program);
+
+  std::vector<cl_uint> in(local_size * 4);
+  for (size_t i = 0; i < in.size(); i++) {
+    in[i] = static_cast<cl_uint>(i * 2654435761u);
+  }
+
+  for (const auto &source : sources) {
+    const char *name = source.first;
+    cl_program single_program = buildFromBinary(source.second);
+    ASSERT_NE(nullptr, single_program) << name;
+    cl_kernel kernel = createKernel(program, name);
+    ASSERT_NE(nullptr, kernel) << name;
+    cl_kernel single_kernel = createKernel(single_program, name);
+    ASSERT_NE(nullptr, single_kernel) << name;
+
+    cl_uint num_args = 0;
+    ASSERT_SUCCESS(clGetKernelInfo(kernel, CL_KERNEL_NUM_ARGS,
+                                   sizeof(num_args), &num_args, nullptr));
+    EXPECT_EQ(2u, num_args) << name;
+
+    const std::array<cl_kernel_work_group_info, 2> size_queries = {
+        {CL_KERNEL_WORK_GROUP_SIZE,
+         CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE}};
+    for (const auto query : size_queries) {
+      size_t value = 0;
+      size_t single_value = 0;
+      ASSERT_SUCCESS(clGetKernelWorkGroupInfo(kernel, device, query,
+                                              sizeof(value), &value, nullptr));
+      ASSERT_SUCCESS(clGetKernelWorkGroupInfo(single_kernel, device, query,
+                                              sizeof(single_value),
+                                              &single_value, nullptr));
+      EXPECT_EQ(single_value, value) << name << " query " << query;
+    }
+
+    const std::array<cl_kernel_work_group_info, 2> mem_queries = {
+        {CL_KERNEL_LOCAL_MEM_SIZE, CL_KERNEL_PRIVATE_MEM_SIZE}};
+    for (const auto query : mem_queries) {
+      cl_ulong value = 0;
+      cl_ulong single_value = 0;
+      ASSERT_SUCCESS(clGetKernelWorkGroupInfo(kernel, device, query,
+                                              sizeof(value), &value, nullptr));
+      ASSERT_SUCCESS(clGetKernelWorkGroupInfo(single_kernel, device, query,
+                                              sizeof(single_value),
+                                              &single_value, nullptr));
+      EXPECT_EQ(single_value, value) << name << " query " << query;
+    }
+
+    std::array<size_t, 3> compile_size = {};
+    std::array<size_t, 3> single_compile_size = {};
+    ASSERT_SUCCESS(clGetKernelWorkGroupInfo(
+        kernel, device, CL_KERNEL_COMPILE_WORK_GROUP_SIZE,
+        sizeof(compile_size), compile_size.data(), nullptr));
+    ASSERT_SUCCESS(clGetKernelWorkGroupInfo(
+        single_kernel, device, CL_KERNEL_COMPILE_WORK_GROUP_SIZE,
+        sizeof(single_compile_size), single_compile_size.data(), nullptr));
+    EXPECT_EQ(single_compile_size, compile_size) << name;
+
+    const std::vector<cl_uint> out = run(kernel, in);
+    const std::vector<cl_uint> single_out = run(single_kernel, in);
+    EXPECT_EQ(single_out, out) << name;
+  }
+
+  // Check the results of the kernels using local memory themselves, which are
+  // the same for both programs if the above passed.
+  const std::vector<cl_uint> reverse =
+      run(createKernel(program, "reverse"), in);
+  const std::vector<cl_uint> mirror = run(createKernel(program, "mirror"), in);
+  const std::vector<cl_uint> count = run(createKernel(program, "count"), in);
+  for (size_t gid = 0; gid < in.size(); gid++) {
+    const size_t group = gid - gid % local_size;
+    const size_t lid = gid % local_size;
+    EXPECT_EQ(in[group + 63 - lid], reverse[gid]) << "index " << gid;
+    EXPECT_EQ(in[gid] + in[group + 63 - lid] * 2, mirror[gid])
+        << "index " << gid;
+    cl_uint bits = 0;
+    for (cl_uint value = in[gid]; value; value &= value - 1) {
+      bits++;
+    }
+    EXPECT_EQ(bits + gid, count[gid]) << "index " << gid;
+  }
+}
@@ -0,0 +1,44 @@
+// Copyright (C) Codeplay Software Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License") with LLVM
+// Exceptions; you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://github.com/codeplaysoftware/oneapi-construction-kit/blob/main/LICENSE.txt
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+//
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+
+#ifndef HOST_UNITCL_HOST_FIXTURES_H_INCLUDED
+#define HOST_UNITCL_HOST_FIXTURES_H_INCLUDED
+
+#include "Common.h"
+#include "Device.h"
+
+/// @brief Fixture for tests of the host device, skipped on other devices.
+struct HostCommandQueueTest : ucl::CommandQueueTest {
+  void SetUp() override {
+    UCL_RETURN_ON_FATAL_FAILURE(CommandQueueTest::SetUp());
+    if (!UCL::isDevice_host(device)) {
+      GTEST_SKIP();
+    }
+  }
+};
+
+/// @brief Fixture for tests which build programs for the host device, also
+/// skipped when the device has no compiler.
+struct HostCompilerCommandQueueTest : HostCommandQueueTest {
+  void SetUp() override {
+    UCL_RETURN_ON_FATAL_FAILURE(HostCommandQueueTest::SetUp());
+    if (!getDeviceCompilerAvailable()) {
+      GTEST_SKIP();
+    }
+  }
+};
+
+#endif  // HOST_UNITCL_HOST_FIXTURES_H_INCLUDED
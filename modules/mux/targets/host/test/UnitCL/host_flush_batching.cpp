@@ -0,0 +1,94 @@
+// Copyright (C) Codeplay Software Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License") with LLVM
+// Exceptions; you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://github.com/codeplaysoftware/oneapi-construction-kit/blob/main/LICENSE.txt
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+//
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "host_fixtures.h"
+
+// When `CA_CL_BATCH_FLUSH_US` is set clFlush may defer dispatching commands
+// while the device is busy. The host device writes CL_MEM_USE_HOST_PTR
+// buffers in place, so the test can watch a kernel's results arrive without
+// making any OpenCL call which would itself dispatch the deferred commands.
+struct HostFlushBatchingTest : HostCompilerCommandQueueTest {};
+
+TEST_F(HostFlushBatchingTest, FlushMakesProgress) {
+  const char *src = R"OpenCLC(
+  kernel void busy(global uint *out, uint iterations) {
+    uint value = get_global_id(0);
+    for (uint i = 0; i < iterations; i++) {
+      value = value * 1664525u + 1013904223u;
+    }
+    out[get_global_id(0)] = value;
+  }
+
+  kernel void flag(global uint *out) { out[get_global_id(0)] = 42; }
+)OpenCLC";
+
+  cl_int errcode = !CL_SUCCESS;
+  cl_program program =
+      clCreateProgramWithSource(context, 1, &src, nullptr, &errcode);
+  EXPECT_TRUE(program);
+  ASSERT_SUCCESS(errcode);
+  ASSERT_SUCCESS(
+      clBuildProgram(program, 0, nullptr, nullptr, nullptr, nullptr));
+  cl_kernel busy = clCreateKernel(program, "busy", &errcode);
+  ASSERT_SUCCESS(errcode);
+  cl_kernel flag = clCreateKernel(program, "flag", &errcode);
+  ASSERT_SUCCESS(errcode);
+
+  const size_t range = 1024;
+  cl_mem scratch = clCreateBuffer(context, CL_MEM_READ_WRITE,
+                                  range * sizeof(cl_uint), nullptr, &errcode);
+  ASSERT_SUCCESS(errcode);
+  std::vector<cl_uint> flags(1, 0);
+  cl_mem flag_buffer =
+      clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR,
+                     sizeof(cl_uint), flags.data(), &errcode);
+  ASSERT_SUCCESS(errcode);
+
+  const cl_uint iterations = 100000;
+  ASSERT_SUCCESS(clSetKernelArg(busy, 0, sizeof(scratch), &scratch));
+  ASSERT_SUCCESS(clSetKernelArg(busy, 1, sizeof(iterations), &iterations));
+  ASSERT_SUCCESS(clSetKernelArg(flag, 0, sizeof(flag_buffer), &flag_buffer));
+
+  // The first flush dispatches the busy kernel, the second may be deferred
+  // while it runs.
+  ASSERT_SUCCESS(clEnqueueNDRangeKernel(command_queue, busy, 1, nullptr,
+                                        &range, nullptr, 0, nullptr, nullptr));
+  ASSERT_SUCCESS(clFlush(command_queue));
+  const size_t one = 1;
+  ASSERT_SUCCESS(clEnqueueNDRangeKernel(command_queue, flag, 1, nullptr, &one,
+                                        nullptr, 0, nullptr, nullptr));
+  ASSERT_SUCCESS(clFlush(command_queue));
+
+  // Far longer than the busy kernel and any batching budget used in testing.
+  const auto timeout =
+      std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  volatile cl_uint *const result = flags.data();
+  while (42 != *result && std::chrono::steady_clock::now() < timeout) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  EXPECT_EQ(42u, *result);
+
+  ASSERT_SUCCESS(clFinish(command_queue));
+  EXPECT_SUCCESS(clReleaseMemObject(flag_buffer));
+  EXPECT_SUCCESS(clReleaseMemObject(scratch));
+  EXPECT_SUCCESS(clReleaseKernel(flag));
+  EXPECT_SUCCESS(clReleaseKernel(busy));
+  EXPECT_SUCCESS(clReleaseProgram(program));
+}
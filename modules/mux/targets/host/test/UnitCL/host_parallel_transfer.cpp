@@ -0,0 +1,139 @@
+// Copyright (C) Codeplay Software Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License") with LLVM
+// Exceptions; you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://github.com/codeplaysoftware/oneapi-construction-kit/blob/main/LICENSE.txt
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+//
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+
+#include <algorithm>
+#include <array>
+#include <utility>
+#include <vector>
+
+#include "host_fixtures.h"
+
+// The host device splits buffer transfers of at least 1MB over its thread
+// pool, on destination page boundaries. These tests transfer more than that at
+// offsets which aren't page aligned and with sizes which don't divide evenly
+// into pages, then check every byte of the buffer.
+struct HostParallelTransferTest : HostCommandQueueTest {
+  void SetUp() override {
+    UCL_RETURN_ON_FATAL_FAILURE(HostCommandQueueTest::SetUp());
+    expected.resize(buffer_size);
+    for (size_t i = 0; i < buffer_size; i++) {
+      expected[i] = static_cast<cl_uchar>(i * 7 + 3);
+    }
+    cl_int error = CL_SUCCESS;
+    buffer = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                            buffer_size, expected.data(), &error);
+    ASSERT_SUCCESS(error);
+  }
+
+  void TearDown() override {
+    if (buffer) {
+      EXPECT_SUCCESS(clReleaseMemObject(buffer));
+    }
+    HostCommandQueueTest::TearDown();
+  }
+
+  // Read the whole buffer back, itself a parallel transfer, and compare it.
+  void checkBuffer() {
+    std::vector<cl_uchar> actual(buffer_size);
+    ASSERT_SUCCESS(clEnqueueReadBuffer(command_queue, buffer, CL_TRUE, 0,
+                                       buffer_size, actual.data(), 0, nullptr,
+                                       nullptr));
+    for (size_t i = 0; i < buffer_size; i++) {
+      ASSERT_EQ(expected[i], actual[i]) << "index " << i;
+    }
+  }
+
+  static constexpr size_t buffer_size = (4 << 20) + 4096 * 3 + 123;
+  // Large enough to be split, not a multiple of the page size or of any
+  // pattern size.
+  static constexpr size_t transfer_size = (3 << 20) + 1234;
+
+  std::vector<cl_uchar> expected;
+  cl_mem buffer = nullptr;
+};
+
+constexpr size_t HostParallelTransferTest::buffer_size;
+constexpr size_t HostParallelTransferTest::transfer_size;
+
+TEST_F(HostParallelTransferTest, Write) {
+  const size_t offset = 37;
+  std::vector<cl_uchar> data(transfer_size);
+  for (size_t i = 0; i < transfer_size; i++) {
+    data[i] = static_cast<cl_uchar>(i * 13 + 1);
+    expected[offset + i] = data[i];
+  }
+  ASSERT_SUCCESS(clEnqueueWriteBuffer(command_queue, buffer, CL_TRUE, offset,
+                                      transfer_size, data.data(), 0, nullptr,
+                                      nullptr));
+  checkBuffer();
+}
+
+TEST_F(HostParallelTransferTest, Read) {
+  const size_t offset = 4096 + 37;
+  // Read into a host pointer which isn't page aligned either, it is the
+  // destination the transfer is split on.
+  const size_t host_offset = 3;
+  std::vector<cl_uchar> data(transfer_size + host_offset + 1, 0x5a);
+  ASSERT_SUCCESS(clEnqueueReadBuffer(command_queue, buffer, CL_TRUE, offset,
+                                     transfer_size, data.data() + host_offset,
+                                     0, nullptr, nullptr));
+  EXPECT_EQ(0x5a, data[host_offset - 1]);
+  EXPECT_EQ(0x5a, data[host_offset + transfer_size]);
+  for (size_t i = 0; i < transfer_size; i++) {
+    ASSERT_EQ(expected[offset + i], data[host_offset + i]) << "index " << i;
+  }
+}
+
+TEST_F(HostParallelTransferTest, Copy) {
+  // The regions can't overlap, so copy less than half the buffer.
+  const size_t src_offset = 5;
+  const size_t dst_offset = (2 << 20) + 37;
+  const size_t size = (3 << 19) + 1234;
+  std::vector<cl_uchar> source(expected.begin() + src_offset,
+                               expected.begin() + src_offset + size);
+  std::copy(source.begin(), source.end(), expected.begin() + dst_offset);
+  ASSERT_SUCCESS(clEnqueueCopyBuffer(command_queue, buffer, buffer, src_offset,
+                                     dst_offset, size, 0, nullptr, nullptr));
+  ASSERT_SUCCESS(clFinish(command_queue));
+  checkBuffer();
+}
+
+TEST_F(HostParallelTransferTest, Fill) {
+  // Offsets must be a multiple of the pattern size, these aren't multiples of
+  // the page size.
+  const std::array<std::pair<size_t, size_t>, 3> fills = {{
+      {16, 48},
+      {2, 6},
+      {128, 128 * 5},
+  }};
+  for (const auto &fill : fills) {
+    const size_t pattern_size = fill.first;
+    const size_t offset = fill.second;
+    const size_t size = transfer_size - transfer_size % pattern_size;
+    std::vector<cl_uchar> pattern(pattern_size);
+    for (size_t i = 0; i < pattern_size; i++) {
+      pattern[i] = static_cast<cl_uchar>(pattern_size + i * 3);
+    }
+    for (size_t i = 0; i < size; i++) {
+      expected[offset + i] = pattern[i % pattern_size];
+    }
+    ASSERT_SUCCESS(clEnqueueFillBuffer(command_queue, buffer, pattern.data(),
+                                       pattern_size, offset, size, 0, nullptr,
+                                       nullptr));
+    ASSERT_SUCCESS(clFinish(command_queue));
+    checkBuffer();
+  }
+}
@@ -0,0 +1,161 @@
+// Copyright (C) Codeplay Software Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License") with LLVM
+// Exceptions; you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://github.com/codeplaysoftware/oneapi-construction-kit/blob/main/LICENSE.txt
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+//
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+
+#include <array>
+#include <cstring>
+#include <vector>
+
+#include "host_fixtures.h"
+
+// The host device compiles kernels for the local sizes they are likely to be
+// enqueued with in the background, and runs a generic kernel in place of one
+// which isn't ready yet. These tests enqueue kernels with many local sizes
+// back to back so most enqueues race the background compiles.
+struct HostSpeculativeJITTest : HostCompilerCommandQueueTest {
+  void TearDown() override {
+    for (cl_mem buffer : buffers) {
+      EXPECT_SUCCESS(clReleaseMemObject(buffer));
+    }
+    if (kernel) {
+      EXPECT_SUCCESS(clReleaseKernel(kernel));
+    }
+    if (program) {
+      EXPECT_SUCCESS(clReleaseProgram(program));
+    }
+    HostCompilerCommandQueueTest::TearDown();
+  }
+
+  void build(const char *source, const char *options, const char *name) {
+    const size_t length = std::strlen(source);
+    cl_int error = CL_SUCCESS;
+    program = clCreateProgramWithSource(context, 1, &source, &length, &error);
+    ASSERT_SUCCESS(error);
+    ASSERT_SUCCESS(
+        clBuildProgram(program, 1, &device, options, nullptr, nullptr));
+    kernel = clCreateKernel(program, name, &error);
+    ASSERT_SUCCESS(error);
+  }
+
+  cl_mem createBuffer(size_t size) {
+    cl_int error = CL_SUCCESS;
+    cl_mem buffer =
+        clCreateBuffer(context, CL_MEM_READ_WRITE, size, nullptr, &error);
+    EXPECT_SUCCESS(error);
+    if (buffer) {
+      buffers.push_back(buffer);
+    }
+    return buffer;
+  }
+
+  static constexpr size_t global_size = 960;
+  static constexpr std::array<size_t, 10> local_sizes = {
+      {1, 2, 3, 4, 5, 8, 15, 16, 32, 64}};
+
+  cl_program program = nullptr;
+  cl_kernel kernel = nullptr;
+  std::vector<cl_mem> buffers;
+};
+
+constexpr size_t HostSpeculativeJITTest::global_size;
+constexpr std::array<size_t, 10> HostSpeculativeJITTest::local_sizes;
+
+TEST_F(HostSpeculativeJITTest, ManyLocalSizes) {
+  const char *source = R"OpenCLC(
+  __kernel void speculate(__global uint *out) {
+    size_t gid = get_global_id(0);
+    out[gid] = (uint)(gid * 2 + get_local_size(0));
+  }
+)OpenCLC";
+  ASSERT_NO_FATAL_FAILURE(build(source, nullptr, "speculate"));
+
+  std::vector<cl_mem> outputs;
+  for (const size_t local_size : local_sizes) {
+    cl_mem out = createBuffer(global_size * sizeof(cl_uint));
+    ASSERT_NE(nullptr, out);
+    outputs.push_back(out);
+    ASSERT_SUCCESS(clSetKernelArg(kernel, 0, sizeof(out), &out));
+    ASSERT_SUCCESS(clEnqueueNDRangeKernel(command_queue, kernel, 1, nullptr,
+                                          &global_size, &local_size, 0,
+                                          nullptr, nullptr));
+  }
+
+  for (size_t i = 0; i < local_sizes.size(); i++) {
+    std::vector<cl_uint> results(global_size);
+    ASSERT_SUCCESS(clEnqueueReadBuffer(command_queue, outputs[i], CL_TRUE, 0,
+                                       global_size * sizeof(cl_uint),
+                                       results.data(), 0, nullptr, nullptr));
+    for (size_t gid = 0; gid < global_size; gid++) {
+      ASSERT_EQ(gid * 2 + local_sizes[i], results[gid])
+          << "local size " << local_sizes[i] << " at index " << gid;
+    }
+  }
+}
+
+// Sub-group sizes depend on the local size a kernel was optimized for, so a
+// kernel using sub-groups must never run in place of another.
+TEST_F(HostSpeculativeJITTest, SubGroupSize) {
+  if (!UCL::isDeviceVersionAtLeast({3, 0})) {
+    GTEST_SKIP();
+  }
+  cl_uint max_num_sub_groups = 0;
+  ASSERT_SUCCESS(clGetDeviceInfo(device, CL_DEVICE_MAX_NUM_SUB_GROUPS,
+                                 sizeof(max_num_sub_groups),
+                                 &max_num_sub_groups, nullptr));
+  if (0 == max_num_sub_groups) {
+    GTEST_SKIP();
+  }
+
+  // The kernel's name doesn't mention sub-groups, and the sub-group builtin is
+  // only called through a helper function.
+  const char *source = R"OpenCLC(
+  uint helper(void) { return get_max_sub_group_size(); }
+
+  __kernel void speculate(__global uint *out) {
+    out[get_global_id(0)] = helper();
+  }
+)OpenCLC";
+  ASSERT_NO_FATAL_FAILURE(build(source, "-cl-std=CL3.0", "speculate"));
+
+  std::vector<cl_mem> outputs;
+  for (const size_t local_size : local_sizes) {
+    cl_mem out = createBuffer(global_size * sizeof(cl_uint));
+    ASSERT_NE(nullptr, out);
+    outputs.push_back(out);
+    ASSERT_SUCCESS(clSetKernelArg(kernel, 0, sizeof(out), &out));
+    ASSERT_SUCCESS(clEnqueueNDRangeKernel(command_queue, kernel, 1, nullptr,
+                                          &global_size, &local_size, 0,
+                                          nullptr, nullptr));
+  }
+  ASSERT_SUCCESS(clFinish(command_queue));
+
+  for (size_t i = 0; i < local_sizes.size(); i++) {
+    const std::array<size_t, 3> local_size = {local_sizes[i], 1, 1};
+    size_t max_sub_group_size = 0;
+    ASSERT_SUCCESS(clGetKernelSubGroupInfo(
+        kernel, device, CL_KERNEL_MAX_SUB_GROUP_SIZE_FOR_NDRANGE,
+        sizeof(local_size), local_size.data(), sizeof(max_sub_group_size),
+        &max_sub_group_size, nullptr));
+
+    std::vector<cl_uint> results(global_size);
+    ASSERT_SUCCESS(clEnqueueReadBuffer(command_queue, outputs[i], CL_TRUE, 0,
+                                       global_size * sizeof(cl_uint),
+                                       results.data(), 0, nullptr, nullptr));
+    for (size_t gid = 0; gid < global_size; gid++) {
+      ASSERT_EQ(max_sub_group_size, results[gid])
+          << "local size " << local_sizes[i] << " at index " << gid;
+    }
+  }
+}
@@ -0,0 +1,30 @@
+// Copyright (C) Codeplay Software Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License") with LLVM
+// Exceptions; you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://github.com/codeplaysoftware/oneapi-construction-kit/blob/main/LICENSE.txt
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+//
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+
+// The 8MiB dst buffer is mapped directly from the operating system when
+// CA_HOST_HUGE_PAGES is set, the results must not depend on it.
+
+// RUN: env CA_HOST_HUGE_PAGES=1 oclc -execute -enqueue huge_pages -print dst,4 -global 2097152 -local 64 %s > %t
+// RUN: FileCheck < %t %s
+// RUN: env CA_HOST_HUGE_PAGES=0 oclc -execute -enqueue huge_pages -print dst,4 -global 2097152 -local 64 %s > %t
+// RUN: FileCheck < %t %s
+
+__kernel void huge_pages(__global uint *dst) {
+	size_t gid = get_global_id(0);
+	dst[gid] = (uint)gid + 7;
+}
+
+// CHECK: dst,7,8,9,10
@@ -0,0 +1,30 @@
+// Copyright (C) Codeplay Software Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License") with LLVM
+// Exceptions; you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://github.com/codeplaysoftware/oneapi-construction-kit/blob/main/LICENSE.txt
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+//
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+
+// The 4MiB dst buffer is large enough to be first touched by the pool threads
+// when CA_HOST_NUMA is honoured, the results must not depend on it.
+
+// RUN: env CA_HOST_NUMA=1 oclc -execute -enqueue numa_first_touch -print dst,4 -global 1048576 -local 64 %s > %t
+// RUN: FileCheck < %t %s
+// RUN: env CA_HOST_NUMA=1 CA_HOST_SCHEDULE=dynamic oclc -execute -enqueue numa_first_touch -print dst,4 -global 1048576 -local 64 %s > %t
+// RUN: FileCheck < %t %s
+
+__kernel void numa_first_touch(__global uint *dst) {
+	size_t gid = get_global_id(0);
+	dst[gid] = (uint)gid * 3;
+}
+
+// CHECK: dst,0,3,6,9
@@ -129,3 +129,33 @@ TEST_P(muxAllocateMemoryTest, DeviceAlignment) {
     muxFreeMemory(device, memory, allocator);
   }
 }
+
+TEST_P(muxAllocateMemoryTest, HugePages) {
+  if (!(device->info->allocation_capabilities &
+        mux_allocation_capabilities_huge_pages)) {
+    GTEST_SKIP();
+  }
+
+  // Large enough for devices to map the allocation directly, the memory must
+  // behave exactly like any other allocation.
+  const size_t size = 16 << 20;
+  const uint32_t align = 4096;
+  mux_memory_t memory;
+  ASSERT_SUCCESS(muxAllocateMemory(
+      device, size, 1, mux_memory_property_host_visible,
+      mux_allocation_type_alloc_device, align, allocator, &memory));
+  EXPECT_EQ(0u, memory->handle % align);
+
+  void *data = nullptr;
+  ASSERT_SUCCESS(muxMapMemory(device, memory, 0, size, &data));
+  auto *const bytes = static_cast<uint8_t *>(data);
+  for (size_t i = 0; i < size; i++) {
+    bytes[i] = static_cast<uint8_t>(i);
+  }
+  for (size_t i = 0; i < size; i++) {
+    ASSERT_EQ(static_cast<uint8_t>(i), bytes[i]) << "at index " << i;
+  }
+  ASSERT_SUCCESS(muxUnmapMemory(device, memory));
+
+  muxFreeMemory(device, memory, allocator);
+}
@@ -14,8 +14,11 @@
 //
 // SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
 
+#include <mux/utils/helpers.h>
+
 #include <atomic>
 #include <cstdint>
+#include <vector>
 
 #include "common.h"
 #include "mux/mux.h"
@@ -236,3 +239,324 @@ TEST_P(muxDispatchTest, DISABLED_MultipleThreadsInteractWithSemaphores) {
     muxDestroySemaphore(device, sem, allocator);
   }
 }
+
+// Commands within a command buffer may be executed concurrently by a device,
+// but the results must be as if they executed in order.
+struct muxDispatchOrderTest : muxDispatchTest {
+  enum { BUFFER_SIZE = 1024 };
+
+  mux_memory_t memory = nullptr;
+  mux_buffer_t buffer_a = nullptr;
+  mux_buffer_t buffer_b = nullptr;
+
+  void SetUp() override {
+    RETURN_ON_FATAL_FAILURE(muxDispatchTest::SetUp());
+
+    ASSERT_SUCCESS(muxCreateBuffer(device, BUFFER_SIZE, allocator, &buffer_a));
+    ASSERT_SUCCESS(muxCreateBuffer(device, BUFFER_SIZE, allocator, &buffer_b));
+
+    const mux_allocation_type_e allocation_type =
+        (mux_allocation_capabilities_alloc_device &
+         device->info->allocation_capabilities)
+            ? mux_allocation_type_alloc_device
+            : mux_allocation_type_alloc_host;
+
+    const uint32_t heap = mux::findFirstSupportedHeap(
+        buffer_a->memory_requirements.supported_heaps);
+
+    ASSERT_SUCCESS(muxAllocateMemory(device, 2 * BUFFER_SIZE, heap,
+                                     mux_memory_property_host_visible,
+                                     allocation_type, 0, allocator, &memory));
+
+    ASSERT_SUCCESS(muxBindBufferMemory(device, memory, buffer_a, 0));
+    ASSERT_SUCCESS(muxBindBufferMemory(device, memory, buffer_b, BUFFER_SIZE));
+  }
+
+  void TearDown() override {
+    if (buffer_a) {
+      muxDestroyBuffer(device, buffer_a, allocator);
+    }
+    if (buffer_b) {
+      muxDestroyBuffer(device, buffer_b, allocator);
+    }
+    if (memory) {
+      muxFreeMemory(device, memory, allocator);
+    }
+    muxDispatchTest::TearDown();
+  }
+
+  void fill(mux_buffer_t buffer, uint64_t offset, uint64_t size,
+            uint8_t value) {
+    ASSERT_SUCCESS(muxCommandFillBuffer(command_buffer, buffer, offset, size,
+                                        &value, sizeof(value), 0, nullptr,
+                                        nullptr));
+  }
+};
+
+INSTANTIATE_DEVICE_TEST_SUITE_P(muxDispatchOrderTest);
+
+TEST_P(muxDispatchOrderTest, IndependentCommands) {
+  RETURN_ON_FATAL_FAILURE(fill(buffer_a, 0, BUFFER_SIZE, 0x0A));
+  RETURN_ON_FATAL_FAILURE(fill(buffer_b, 0, BUFFER_SIZE, 0x0B));
+
+  std::vector<uint8_t> a(BUFFER_SIZE), b(BUFFER_SIZE);
+  ASSERT_SUCCESS(muxCommandReadBuffer(command_buffer, buffer_a, 0, a.data(),
+                                      BUFFER_SIZE, 0, nullptr, nullptr));
+  ASSERT_SUCCESS(muxCommandReadBuffer(command_buffer, buffer_b, 0, b.data(),
+                                      BUFFER_SIZE, 0, nullptr, nullptr));
+
+  ASSERT_SUCCESS(muxDispatch(queue, command_buffer, nullptr, nullptr, 0,
+                             nullptr, 0, nullptr, nullptr));
+  ASSERT_SUCCESS(muxWaitAll(queue));
+
+  for (size_t i = 0; i < BUFFER_SIZE; i++) {
+    ASSERT_EQ(0x0A, a[i]) << "at index " << i;
+    ASSERT_EQ(0x0B, b[i]) << "at index " << i;
+  }
+}
+
+TEST_P(muxDispatchOrderTest, DependentCommands) {
+  // Write after write, read after write and write after read on buffer_a, the
+  // copy must observe the second fill and not the last one.
+  RETURN_ON_FATAL_FAILURE(fill(buffer_a, 0, BUFFER_SIZE, 1));
+  RETURN_ON_FATAL_FAILURE(fill(buffer_a, 0, BUFFER_SIZE, 2));
+  ASSERT_SUCCESS(muxCommandCopyBuffer(command_buffer, buffer_a, 0, buffer_b, 0,
+                                      BUFFER_SIZE, 0, nullptr, nullptr));
+  RETURN_ON_FATAL_FAILURE(fill(buffer_a, 0, BUFFER_SIZE / 2, 3));
+
+  std::vector<uint8_t> a(BUFFER_SIZE), b(BUFFER_SIZE);
+  ASSERT_SUCCESS(muxCommandReadBuffer(command_buffer, buffer_a, 0, a.data(),
+                                      BUFFER_SIZE, 0, nullptr, nullptr));
+  ASSERT_SUCCESS(muxCommandReadBuffer(command_buffer, buffer_b, 0, b.data(),
+                                      BUFFER_SIZE, 0, nullptr, nullptr));
+
+  ASSERT_SUCCESS(muxDispatch(queue, command_buffer, nullptr, nullptr, 0,
+                             nullptr, 0, nullptr, nullptr));
+  ASSERT_SUCCESS(muxWaitAll(queue));
+
+  for (size_t i = 0; i < BUFFER_SIZE; i++) {
+    ASSERT_EQ(i < BUFFER_SIZE / 2 ? 3 : 2, a[i]) << "at index " << i;
+    ASSERT_EQ(2, b[i]) << "at index " << i;
+  }
+}
+
+TEST_P(muxDispatchOrderTest, UserCallbackIsOrdered) {
+  // User callbacks may access any memory, the callback must observe the read
+  // before it and not the fill after it.
+  struct callback_data_s {
+    std::vector<uint8_t> data;
+    bool ordered;
+  } callback_data{std::vector<uint8_t>(BUFFER_SIZE), false};
+
+  RETURN_ON_FATAL_FAILURE(fill(buffer_a, 0, BUFFER_SIZE, 1));
+  ASSERT_SUCCESS(muxCommandReadBuffer(command_buffer, buffer_a, 0,
+                                      callback_data.data.data(), BUFFER_SIZE,
+                                      0, nullptr, nullptr));
+  ASSERT_SUCCESS(muxCommandUserCallback(
+      command_buffer,
+      [](mux_queue_t, mux_command_buffer_t, void *const user_data) {
+        auto *const callback_data = static_cast<callback_data_s *>(user_data);
+        callback_data->ordered = true;
+        for (const uint8_t value : callback_data->data) {
+          callback_data->ordered &= 1 == value;
+        }
+      },
+      &callback_data, 0, nullptr, nullptr));
+  RETURN_ON_FATAL_FAILURE(fill(buffer_a, 0, BUFFER_SIZE, 2));
+
+  ASSERT_SUCCESS(muxDispatch(queue, command_buffer, nullptr, nullptr, 0,
+                             nullptr, 0, nullptr, nullptr));
+  ASSERT_SUCCESS(muxWaitAll(queue));
+
+  ASSERT_TRUE(callback_data.ordered);
+}
+
+TEST_P(muxDispatchOrderTest, ManyCommands) {
+  // Enough commands for a device to have to bound how far back it looks for
+  // dependencies, each byte of buffer_a is written by many fills of which only
+  // the last must be visible.
+  enum { NUM_FILLS = 1024, FILL_SIZE = 16 };
+  for (uint32_t i = 0; i < NUM_FILLS; i++) {
+    const uint64_t offset = (i * FILL_SIZE) % BUFFER_SIZE;
+    RETURN_ON_FATAL_FAILURE(
+        fill(buffer_a, offset, FILL_SIZE, static_cast<uint8_t>(i)));
+    if (0 == i % 7) {
+      // Interleave independent commands.
+      RETURN_ON_FATAL_FAILURE(
+          fill(buffer_b, offset, FILL_SIZE, static_cast<uint8_t>(i)));
+    }
+  }
+
+  std::vector<uint8_t> a(BUFFER_SIZE), b(BUFFER_SIZE);
+  ASSERT_SUCCESS(muxCommandReadBuffer(command_buffer, buffer_a, 0, a.data(),
+                                      BUFFER_SIZE, 0, nullptr, nullptr));
+  ASSERT_SUCCESS(muxCommandReadBuffer(command_buffer, buffer_b, 0, b.data(),
+                                      BUFFER_SIZE, 0, nullptr, nullptr));
+
+  ASSERT_SUCCESS(muxDispatch(queue, command_buffer, nullptr, nullptr, 0,
+                             nullptr, 0, nullptr, nullptr));
+  ASSERT_SUCCESS(muxWaitAll(queue));
+
+  std::vector<uint8_t> expected_a(BUFFER_SIZE), expected_b(BUFFER_SIZE);
+  for (uint32_t i = 0; i < NUM_FILLS; i++) {
+    const uint64_t offset = (i * FILL_SIZE) % BUFFER_SIZE;
+    for (uint64_t j = 0; j < FILL_SIZE; j++) {
+      expected_a[offset + j] = static_cast<uint8_t>(i);
+      if (0 == i % 7) {
+        expected_b[offset + j] = static_cast<uint8_t>(i);
+      }
+    }
+  }
+  ASSERT_EQ(expected_a, a);
+  ASSERT_EQ(expected_b, b);
+}
+
+// A command buffer may be dispatched again before its earlier dispatches have
+// completed when the device supports concurrent dispatch.
+struct muxDispatchConcurrentTest : muxDispatchOrderTest {
+  static constexpr uint32_t NUM_DISPATCHES = 8;
+
+  std::vector<mux_fence_t> fences;
+  std::vector<mux_semaphore_t> semaphores;
+
+  void SetUp() override {
+    RETURN_ON_FATAL_FAILURE(muxDispatchOrderTest::SetUp());
+    if (!device->info->supports_concurrent_dispatch) {
+      GTEST_SKIP();
+    }
+    for (uint32_t i = 0; i < NUM_DISPATCHES; i++) {
+      mux_fence_t fence = nullptr;
+      ASSERT_SUCCESS(muxCreateFence(device, allocator, &fence));
+      fences.push_back(fence);
+      mux_semaphore_t semaphore = nullptr;
+      ASSERT_SUCCESS(muxCreateSemaphore(device, allocator, &semaphore));
+      semaphores.push_back(semaphore);
+    }
+  }
+
+  void TearDown() override {
+    for (auto fence : fences) {
+      muxDestroyFence(device, fence, allocator);
+    }
+    for (auto semaphore : semaphores) {
+      muxDestroySemaphore(device, semaphore, allocator);
+    }
+    muxDispatchOrderTest::TearDown();
+  }
+};
+
+INSTANTIATE_DEVICE_TEST_SUITE_P(muxDispatchConcurrentTest);
+
+TEST_P(muxDispatchConcurrentTest, SameCommandBuffer) {
+  std::atomic<uint32_t> executed(0);
+  RETURN_ON_FATAL_FAILURE(fill(buffer_a, 0, BUFFER_SIZE, 0x0A));
+  ASSERT_SUCCESS(muxCommandUserCallback(
+      command_buffer,
+      [](mux_queue_t, mux_command_buffer_t, void *const user_data) {
+        (*static_cast<std::atomic<uint32_t> *>(user_data))++;
+      },
+      &executed, 0, nullptr, nullptr));
+  ASSERT_SUCCESS(muxFinalizeCommandBuffer(command_buffer));
+
+  // Each dispatch has its own fence, signal semaphore and completion data.
+  std::vector<std::atomic<bool>> completed(NUM_DISPATCHES);
+  for (uint32_t i = 0; i < NUM_DISPATCHES; i++) {
+    ASSERT_SUCCESS(muxDispatch(
+        queue, command_buffer, fences[i], nullptr, 0, &semaphores[i], 1,
+        [](mux_command_buffer_t, mux_result_t, void *const user_data) {
+          *static_cast<std::atomic<bool> *>(user_data) = true;
+        },
+        &completed[i]));
+  }
+  for (uint32_t i = 0; i < NUM_DISPATCHES; i++) {
+    ASSERT_SUCCESS(muxTryWait(queue, UINT64_MAX, fences[i]));
+  }
+  ASSERT_SUCCESS(muxWaitAll(queue));
+
+  EXPECT_EQ(NUM_DISPATCHES, executed.load());
+  for (uint32_t i = 0; i < NUM_DISPATCHES; i++) {
+    EXPECT_TRUE(completed[i].load()) << "dispatch " << i;
+  }
+}
+
+TEST_P(muxDispatchConcurrentTest, SameCommandBufferChained) {
+  // Each dispatch waits on the one before it, so the recorded commands must
+  // observe each other's results in order.
+  struct callback_data_s {
+    std::vector<uint8_t> data;
+    std::vector<uint32_t> order;
+  } callback_data{std::vector<uint8_t>(BUFFER_SIZE), {}};
+
+  ASSERT_SUCCESS(muxCommandReadBuffer(command_buffer, buffer_a, 0,
+                                      callback_data.data.data(), BUFFER_SIZE,
+                                      0, nullptr, nullptr));
+  ASSERT_SUCCESS(muxCommandUserCallback(
+      command_buffer,
+      [](mux_queue_t, mux_command_buffer_t, void *const user_data) {
+        auto *const callback_data = static_cast<callback_data_s *>(user_data);
+        callback_data->order.push_back(callback_data->data.front());
+        // The next dispatch reads what this one wrote.
+        for (auto &value : callback_data->data) {
+          value++;
+        }
+      },
+      &callback_data, 0, nullptr, nullptr));
+  ASSERT_SUCCESS(muxCommandWriteBuffer(command_buffer, buffer_a, 0,
+                                       callback_data.data.data(), BUFFER_SIZE,
+                                       0, nullptr, nullptr));
+  ASSERT_SUCCESS(muxFinalizeCommandBuffer(command_buffer));
+
+  // Zero buffer_a with a separate command buffer the first dispatch waits on.
+  mux_command_buffer_t zero_command_buffer = nullptr;
+  ASSERT_SUCCESS(muxCreateCommandBuffer(device, callback, allocator,
+                                        &zero_command_buffer));
+  const uint8_t zero = 0;
+  ASSERT_SUCCESS(muxCommandFillBuffer(zero_command_buffer, buffer_a, 0,
+                                      BUFFER_SIZE, &zero, sizeof(zero), 0,
+                                      nullptr, nullptr));
+  mux_semaphore_t zero_semaphore = nullptr;
+  ASSERT_SUCCESS(muxCreateSemaphore(device, allocator, &zero_semaphore));
+  ASSERT_SUCCESS(muxDispatch(queue, zero_command_buffer, nullptr, nullptr, 0,
+                             &zero_semaphore, 1, nullptr, nullptr));
+
+  for (uint32_t i = 0; i < NUM_DISPATCHES; i++) {
+    mux_semaphore_t wait = 0 == i ? zero_semaphore : semaphores[i - 1];
+    ASSERT_SUCCESS(muxDispatch(queue, command_buffer, fences[i], &wait, 1,
+                               &semaphores[i], 1, nullptr, nullptr));
+  }
+  ASSERT_SUCCESS(muxWaitAll(queue));
+
+  std::vector<uint32_t> expected_order(NUM_DISPATCHES);
+  for (uint32_t i = 0; i < NUM_DISPATCHES; i++) {
+    expected_order[i] = i;
+  }
+  EXPECT_EQ(expected_order, callback_data.order);
+
+  muxDestroySemaphore(device, zero_semaphore, allocator);
+  muxDestroyCommandBuffer(device, zero_command_buffer, allocator);
+}
+
+TEST_P(muxDispatchConcurrentTest, ResetAfterCompletion) {
+  // Once every dispatch has completed the command buffer can be reset and
+  // recorded again as usual.
+  RETURN_ON_FATAL_FAILURE(fill(buffer_a, 0, BUFFER_SIZE, 1));
+  ASSERT_SUCCESS(muxFinalizeCommandBuffer(command_buffer));
+  for (uint32_t i = 0; i < NUM_DISPATCHES; i++) {
+    ASSERT_SUCCESS(muxDispatch(queue, command_buffer, fences[i], nullptr, 0,
+                               nullptr, 0, nullptr, nullptr));
+  }
+  ASSERT_SUCCESS(muxWaitAll(queue));
+
+  ASSERT_SUCCESS(muxResetCommandBuffer(command_buffer));
+  RETURN_ON_FATAL_FAILURE(fill(buffer_a, 0, BUFFER_SIZE, 2));
+  std::vector<uint8_t> a(BUFFER_SIZE);
+  ASSERT_SUCCESS(muxCommandReadBuffer(command_buffer, buffer_a, 0, a.data(),
+                                      BUFFER_SIZE, 0, nullptr, nullptr));
+  ASSERT_SUCCESS(muxDispatch(queue, command_buffer, nullptr, nullptr, 0,
+                             nullptr, 0, nullptr, nullptr));
+  ASSERT_SUCCESS(muxWaitAll(queue));
+
+  for (size_t i = 0; i < BUFFER_SIZE; i++) {
+    ASSERT_EQ(2, a[i]) << "at index " << i;
+  }
+}
@@ -24,8 +24,9 @@
 #include <CL/cl.h>
 #include <cargo/array_view.h>
 #include <cargo/expected.h>
-#include <cargo/ring_buffer.h>
+#include <cargo/optional.h>
 #include <cargo/small_vector.h>
+#include <cargo/thread.h>
 #include <cl/base.h>
 #include <cl/semaphore.h>
 #ifdef OCL_EXTENSION_cl_khr_command_buffer
@@ -33,7 +34,9 @@
 #endif
 #include <mux/mux.h>
 
-#include <deque>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
 #include <functional>
 #include <map>
 #include <mutex>
@@ -81,13 +84,41 @@ struct _cl_command_queue final : public cl::base<_cl_command_queue> {
 
   /// @brief Flush the command queue.
   ///
-  /// @note This member function is not thread-safe, callers **must** hold a
-  /// lock on `_cl_command_queue->mutex` when calling it.
+  /// Takes a lock on `_cl_command_queue::mutex`, callers **must not** hold it.
+  /// Other command queues with pending dispatches which this command queue's
+  /// dispatches wait on are flushed once the lock has been released, this
+  /// avoids ever holding two command queue locks outside of
+  /// `cl::command_queue_guard`.
+  ///
   /// @return Returns an OpenCL error code.
   /// @retval `CL_SUCCESS` if there are no failures.
   /// @retval `CL_OUT_OF_RESOURCES` if destroying a resource fails.
   cl_int flush();
 
+  /// @brief Flush the command queue, unless flush batching is enabled and the
+  /// flush can be deferred so later commands join the current command buffer.
+  ///
+  /// Used by `clFlush`. When `CA_CL_BATCH_FLUSH_US` is non-zero the flush is
+  /// deferred while the device is still executing earlier command buffers,
+  /// for at most that many microseconds since the current command buffer was
+  /// created. Deferred command buffers are dispatched by the next flush which
+  /// is not deferred, by waiting on or querying their events, and otherwise by
+  /// `batch_thread` once an earlier command buffer completes or the batching
+  /// budget expires.
+  ///
+  /// Takes a lock on `_cl_command_queue::mutex`, callers **must not** hold it.
+  ///
+  /// @return Returns an OpenCL error code, see `flush()`.
+  cl_int flushBatched();
+
+  /// @brief Flush the command queue if a call to `flushBatched()` deferred
+  /// its flush, otherwise do nothing.
+  ///
+  /// Takes a lock on `_cl_command_queue::mutex`, callers **must not** hold it.
+  ///
+  /// @return Returns an OpenCL error code, see `flush()`.
+  cl_int flushDeferred();
+
   /// @brief Wait for a series of events previously pushed to this queue.
   ///
   /// @param num_events The number of events in @p events.
@@ -218,8 +249,53 @@ struct _cl_command_queue final : public cl::base<_cl_command_queue> {
   mux_queue_t mux_queue;
   /// @brief Mux query pool for storing performance counter results.
   mux_query_pool_t counter_queries;
+  /// @brief Mutex guarding the command queue's pending and running state.
+  ///
+  /// Prefer `cl::command_queue_guard` over locking this directly, it also
+  /// locks the command queues of any events in an event wait list.
+  std::mutex mutex;
+  /// @brief Number of mux command buffers, fences and semaphores this command
+  /// queue has created, guarded by `mutex`.
+  ///
+  /// Once the command queue's caches have grown to its in flight depth this
+  /// stops increasing, it is exposed by `CL_QUEUE_MUX_ALLOCATIONS_CODEPLAY` so
+  /// tests can assert steady state enqueues don't allocate.
+  cl_ulong mux_allocation_count = 0;
 
  private:
+  /// @brief Identifies a dispatch tracked by the command queue.
+  ///
+  /// A mux command buffer is only in flight once at a time, except for a user
+  /// command buffer replayed on a device which supports concurrent dispatch.
+  /// Each replay is told apart by a unique `replay` number, which is zero for
+  /// every other dispatch, so command buffers the command queue records into
+  /// convert to the key of their dispatch.
+  struct dispatch_key_t {
+    dispatch_key_t(mux_command_buffer_t command_buffer = nullptr,
+                   uint64_t replay = 0)
+        : command_buffer(command_buffer), replay(replay) {}
+
+    bool operator==(const dispatch_key_t &other) const {
+      return command_buffer == other.command_buffer && replay == other.replay;
+    }
+    bool operator!=(const dispatch_key_t &other) const {
+      return !(*this == other);
+    }
+
+    /// @brief Hash function object for unordered containers of keys.
+    struct hash {
+      size_t operator()(const dispatch_key_t &key) const {
+        return std::hash<mux_command_buffer_t>{}(key.command_buffer) ^
+               std::hash<uint64_t>{}(key.replay);
+      }
+    };
+
+    /// @brief The mux command buffer dispatched.
+    mux_command_buffer_t command_buffer;
+    /// @brief Number of the replay of `command_buffer`, zero if it isn't one.
+    uint64_t replay;
+  };
+
   /// @brief Get the current command buffer, or create one if none exists.
   ///
   /// When `pending_command_buffers` is empty a new command buffer is created,
@@ -230,6 +306,43 @@ struct _cl_command_queue final : public cl::base<_cl_command_queue> {
   [[nodiscard]] cargo::expected<mux_command_buffer_t, cl_int>
   getCurrentCommandBuffer();
 
+  /// @brief Dispatch pending command buffers which don't wait on user events.
+  ///
+  /// @note This member function is not thread-safe, callers **must** hold a
+  /// lock on `_cl_command_queue->mutex` when calling it.
+  ///
+  /// @param[out] cross_queues Other command queues which must also be flushed
+  /// as a dispatched command buffer waits on one of their events, each is
+  /// retained and must be released by the caller once flushed.
+  ///
+  /// @return Returns `CL_SUCCESS` or `CL_OUT_OF_RESOURCES`.
+  [[nodiscard]] cl_int flushPending(
+      cargo::small_vector<cl_command_queue, 4> &cross_queues);
+
+  /// @brief Check whether a flush can be deferred to batch later commands
+  /// into the current command buffer.
+  ///
+  /// @note This member function is not thread-safe, callers **must** hold a
+  /// lock on `_cl_command_queue->mutex` when calling it.
+  ///
+  /// @return Returns `true` if flush batching is enabled, earlier command
+  /// buffers are still running, the batch is younger than the batching budget
+  /// and no pending event has callbacks waiting on it, `false` otherwise.
+  bool canDeferFlush();
+
+  /// @brief Arrange for `batch_thread` to dispatch a deferred flush by
+  /// @p deadline, starting the thread if it is not running yet.
+  ///
+  /// @param deadline When the batching budget of the deferred flush expires.
+  void armBatchTimer(std::chrono::steady_clock::time_point deadline);
+
+  /// @brief Wake `batch_thread` to dispatch a deferred flush early, called
+  /// when a dispatched command buffer completes.
+  void notifyBatchTimer();
+
+  /// @brief The body of `batch_thread`.
+  void runBatchTimer();
+
   /// @brief Get a command buffer suitable for the given wait events.
   ///
   /// @note This member function is not thread-safe, callers **must** hold a
@@ -275,7 +388,7 @@ struct _cl_command_queue final : public cl::base<_cl_command_queue> {
   [[nodiscard]] cargo::expected<mux_command_buffer_t, cl_int>
   getCommandBufferPending(cargo::array_view<const cl_event> event_wait_list);
 
-  /// @brief Dispatch the given command buffers.
+  /// @brief Dispatch the given pending dispatches.
   ///
   /// @note This member function is not thread-safe, callers **must** hold a
   /// lock on `_cl_command_queue->mutex` when calling it.
@@ -285,28 +398,26 @@ struct _cl_command_queue final : public cl::base<_cl_command_queue> {
   /// enters the `CL_COMPLETE` status and calls `dispatchPending()` in the
   /// completion callback.
   ///
-  /// @param[in] command_buffers List of command buffers to dispatch.
+  /// @param[in] dispatches List of pending dispatches to dispatch.
   ///
   /// @return Returns `CL_SUCCESS`, `CL_OUT_OF_RESOURCES`,
   /// `CL_OUT_OF_HOST_MEMORY` or `CL_INVALID_COMMAND_QUEUE`.
-  [[nodiscard]] cl_int dispatch(
-      cargo::array_view<mux_command_buffer_t> command_buffers);
+  [[nodiscard]] cl_int dispatch(cargo::array_view<dispatch_key_t> dispatches);
 
-  /// @brief Remove command buffers no longer pending dispatch.
+  /// @brief Remove dispatches no longer pending.
   ///
   /// @note This member function is not thread-safe, callers **must** hold a
   /// lock on `_cl_command_queue->mutex` when calling it.
   ///
   /// Modifies `pending_command_buffers` and `pending_dispatches` removing all
-  /// references to `command_buffers`. Pointers to command buffer are not
+  /// references to `dispatches`. Pointers to command buffer are not
   /// dereferenced, they are only used as lookup values.
   ///
-  /// @param[in] command_buffers List of command buffers no longer pending
-  /// dispatch.
+  /// @param[in] dispatches List of dispatches no longer pending.
   ///
   /// @return Returns `CL_SUCCESS` or `CL_OUT_OF_RESOURCES`.
   [[nodiscard]] cl_int removeFromPending(
-      cargo::array_view<mux_command_buffer_t> command_buffers);
+      cargo::array_view<dispatch_key_t> dispatches);
 
   /// @brief Dispatch command buffers associated with a user event.
   ///
@@ -355,18 +466,34 @@ struct _cl_command_queue final : public cl::base<_cl_command_queue> {
   /// @return Returns `CL_SUCCESS` or `CL_OUT_OF_RESOURCES`.
   cl_int destroyCommandBuffer(mux_command_buffer_t command_buffer);
 
+  /// @brief Create or get a cached fence.
+  ///
+  /// @note This member function is not thread-safe, callers **must** hold a
+  /// lock on `_cl_command_queue->mutex` when calling it.
+  ///
+  /// @return Returns the expected fence or an OpenCL error code.
+  [[nodiscard]] cargo::expected<mux_fence_t, cl_int> createFence();
+
+  /// @brief Cache or destroy a signaled fence.
+  ///
+  /// @note This member function is not thread-safe, callers **must** hold a
+  /// lock on `_cl_command_queue->mutex` when calling it.
+  ///
+  /// @param fence a mux fence.
+  void destroyFence(mux_fence_t fence);
+
   /// @brief Create or get a cached semaphore.
   ///
   /// @note This member function is not thread-safe, callers **must** hold a
-  /// lock on `context->getCommandQueueMutex()` when calling it.
+  /// lock on `_cl_command_queue->mutex` when calling it.
   ///
   /// @return Returns the expected semaphore or `CL_OUT_OF_RESOURCES`.
   [[nodiscard]] cargo::expected<mux_shared_semaphore, cl_int> createSemaphore();
 
-  /// @brief Drop ref count on  mux semaphore and delete if zero
+  /// @brief Drop ref count on mux semaphore and cache or delete it if zero.
   ///
   /// @note This member function is not thread-safe, callers **must** hold a
-  /// lock on `context->getCommandQueueMutex()` when calling it.
+  /// lock on `_cl_command_queue->mutex` when calling it.
   ///
   /// @param semaphore a mux semaphore.
   /// @return Returns `CL_SUCCESS` or `CL_OUT_OF_RESOURCES`.
@@ -382,6 +509,9 @@ struct _cl_command_queue final : public cl::base<_cl_command_queue> {
                                 void *user_data);
 
   struct dispatch_state_t {
+    /// @brief Reset to the empty state, keeping allocated storage.
+    void reset();
+
     /// @brief Add new wait events to this dispatch.
     ///
     /// @param event_wait_list List of events to wait for.
@@ -425,21 +555,36 @@ struct _cl_command_queue final : public cl::base<_cl_command_queue> {
     /// to destroy  the command buffer. This is true for non-user command
     /// buffers and user command buffers which have been cloned.
     bool should_destroy_command_buffer;
+
+    /// @brief Flag specifying if the command buffer is a replay of a user
+    /// command buffer which may still be executing, it is already finalized
+    /// and must not be modified.
+    bool is_replay = false;
   };
 
-  /// @brief Ordered list of pending command buffers.
-  cargo::small_vector<mux_command_buffer_t, 16> pending_command_buffers;
-  /// @brief Mapping from command buffer to dispatch information.
-  std::unordered_map<mux_command_buffer_t, dispatch_state_t> pending_dispatches;
-  /// @brief Mapping from command buffer to fence.
-  /// TODO: This is probably not the best way to do this. Fences can be reset,
-  /// so we could create a pool of them and reuse them as they are signaled.
-  std::unordered_map<mux_command_buffer_t, mux_fence_t> fences;
+  /// @brief Ordered list of pending dispatches.
+  cargo::small_vector<dispatch_key_t, 16> pending_command_buffers;
+  /// @brief Mapping from dispatch to dispatch information.
+  std::unordered_map<dispatch_key_t, dispatch_state_t, dispatch_key_t::hash>
+      pending_dispatches;
+
+  /// @brief Add an entry for a new dispatch to `pending_dispatches`, reusing a
+  /// cached map node if there is one.
+  ///
+  /// @note This member function is not thread-safe, callers **must** hold a
+  /// lock on `_cl_command_queue->mutex` when calling it.
+  ///
+  /// @param key Dispatch to add dispatch information for.
+  ///
+  /// @return Returns `CL_SUCCESS` or `CL_OUT_OF_HOST_MEMORY`.
+  [[nodiscard]] cl_int addPendingDispatch(dispatch_key_t key);
 
   /// @brief State required for tracking a running command buffer.
   struct running_state_t {
-    /// @brief The command buffer which is currently running.
-    mux_command_buffer_t command_buffer;
+    /// @brief The dispatch which is currently running.
+    dispatch_key_t key;
+    /// @brief The fence signaled when the command buffer completes.
+    mux_fence_t fence;
     /// @brief The list of semaphores this dispatch is waiting for.
     cargo::small_vector<mux_shared_semaphore, 8> wait_semaphores;
     /// @brief The semaphore which signals this dispatch is complete.
@@ -453,8 +598,11 @@ struct _cl_command_queue final : public cl::base<_cl_command_queue> {
     bool should_destroy_command_buffer;
   };
 
-  /// @brief Double ended queue to track currently running command buffers.
-  std::deque<running_state_t> running_command_buffers;
+  /// @brief Ordered list of currently running command buffers.
+  ///
+  /// Only a few command buffers are usually in flight, so removing completed
+  /// ones from the front is cheaper than the allocations a `std::deque` makes.
+  cargo::small_vector<running_state_t, 8> running_command_buffers;
 
   /// @brief State requiring destruction on command buffer dispatch finishing.
   struct finish_state_t {
@@ -474,14 +622,15 @@ struct _cl_command_queue final : public cl::base<_cl_command_queue> {
     /// Takes a lock on the command queue mutex to remove this instance from
     /// the `finish_state` map _if_ the `locked` parameter is `false`.
     ///
-    /// @param command_buffer The command buffer associated with the state.
+    /// @param key The dispatch associated with the state.
     /// @param error The result of the command buffer dispatch.
     /// @param locked Flag to signify is the command queue mutex is locked.
-    void clear(mux_command_buffer_t command_buffer, mux_result_t error,
-               bool locked);
+    void clear(dispatch_key_t key, mux_result_t error, bool locked);
 
     /// @brief The command queue which owns the command buffer.
     cl_command_queue command_queue;
+    /// @brief The dispatch the state is stored under in `finish_state`.
+    dispatch_key_t key;
     /// @brief The list of events associated with the command buffer.
     cargo::small_vector<cl_event, 8> signal_events;
     /// @brief The list of destroy callbacks associated with the command buffer.
@@ -497,27 +646,74 @@ struct _cl_command_queue final : public cl::base<_cl_command_queue> {
   /// pointers and references to elements are not invalidated until they are
   /// removed from the data structure, we rely on this when passing a pointer
   /// to a `muxDispatch`'s callback `user_data` argument.
-  std::unordered_map<mux_command_buffer_t, finish_state_t> finish_state;
-
-  /// @brief A set of command buffers that are idle and ready to use.
-  cargo::ring_buffer<mux_command_buffer_t, 16> cached_command_buffers;
+  std::unordered_map<dispatch_key_t, finish_state_t, dispatch_key_t::hash>
+      finish_state;
+
+  /// @brief Return whether a cache already holds as many objects as the
+  /// command queue has ever had in flight, and so shouldn't grow further.
+  ///
+  /// @param cached Number of objects in the cache.
+  bool isCacheFull(size_t cached) const { return cached >= max_in_flight; }
+
+  /// @brief Record the number of command buffers pending or running, growing
+  /// the limit of the caches below if it is a new maximum.
+  void updateInFlight() {
+    max_in_flight = std::max(
+        max_in_flight,
+        pending_command_buffers.size() + running_command_buffers.size());
+  }
+
+  /// @brief Most command buffers the command queue has had pending or running
+  /// at once, which bounds the size of the caches below.
+  size_t max_in_flight = 0;
+  /// @brief Number of the last replay of a user command buffer, see
+  /// `dispatch_key_t::replay`.
+  uint64_t replay_count = 0;
+
+  /// @brief Whether `flushBatched()` deferred dispatching pending command
+  /// buffers.
+  bool deferred_flush = false;
+  /// @brief When the oldest pending command buffer was created, the start of
+  /// the batch a deferred flush may extend.
+  std::chrono::steady_clock::time_point batch_start;
+  /// @brief Mutex protecting the `batch_thread` state below, never held while
+  /// taking `mutex`.
+  std::mutex batch_mutex;
+  /// @brief Signalled when `batch_deadline` is set, when a command buffer
+  /// completes while a flush is deferred, and on destruction.
+  std::condition_variable batch_condition;
+  /// @brief When `batch_thread` must dispatch a deferred flush, if set.
+  cargo::optional<std::chrono::steady_clock::time_point> batch_deadline;
+  /// @brief Set when a command buffer completes while a flush is deferred.
+  bool batch_completed = false;
+  /// @brief Set on destruction to stop `batch_thread`.
+  bool batch_stop = false;
+  /// @brief Dispatches deferred flushes no other API call dispatches, only
+  /// started by the first deferred flush.
+  cargo::thread batch_thread;
+  /// @brief Command buffers that are idle and ready to use.
+  cargo::small_vector<mux_command_buffer_t, 8> cached_command_buffers;
+  /// @brief Reset fences ready to use.
+  cargo::small_vector<mux_fence_t, 8> cached_fences;
+  /// @brief Reset semaphores ready to use.
+  cargo::small_vector<mux_shared_semaphore, 8> cached_semaphores;
+  /// @brief Map nodes for `pending_dispatches` ready to reuse.
+  cargo::small_vector<decltype(pending_dispatches)::node_type, 8>
+      cached_dispatch_nodes;
+  /// @brief Map nodes for `finish_state` ready to reuse.
+  cargo::small_vector<decltype(finish_state)::node_type, 8> cached_finish_nodes;
 
   /// @brief List of completed signal semaphores which are still being waited
   /// on by running dispatches.
   cargo::small_vector<mux_shared_semaphore, 32> completed_signal_semaphores;
 
 #ifdef OCL_EXTENSION_cl_khr_command_buffer
-  /// @brief A map of mux_command_buffer_t to their associated
-  /// _cl_command_buffer_khrs which have been enqueued to the command queue.
-  std::unordered_map<mux_command_buffer_t, cl_command_buffer_khr>
+  /// @brief A map of dispatches to their associated _cl_command_buffer_khrs
+  /// which have been enqueued to the command queue.
+  std::unordered_map<dispatch_key_t, cl_command_buffer_khr,
+                     dispatch_key_t::hash>
       user_command_buffers;
 #endif
-
-  /// true if we are currently in flush() on this command queue
-  /// This helps us avoid an infinite loop on flushing, as we can
-  /// call flushes on other command queues if there is a cross
-  /// queue event dependency.
-  bool in_flush;
 };
 
 /// @}
@@ -526,6 +722,49 @@ namespace cl {
 /// @addtogroup cl
 /// @{
 
+/// @brief Scoped lock over a command queue and the command queues of the
+/// events it is about to wait on.
+///
+/// Enqueuing a command only touches the state of the command queue it targets,
+/// so in the common case this takes a single uncontended mutex. When the event
+/// wait list contains events from other command queues their pending
+/// dispatches are inspected as well, so those command queues are also locked.
+/// All mutexes are acquired in address order so that two threads enqueuing
+/// with opposing cross queue dependencies can't deadlock.
+class command_queue_guard final {
+ public:
+  /// @brief Lock @p command_queue and the queues of @p event_wait_list.
+  ///
+  /// @param command_queue Command queue which will be enqueued to.
+  /// @param event_wait_list List of events the enqueued command waits on, must
+  /// outlive the guard.
+  command_queue_guard(cl_command_queue command_queue,
+                      cargo::array_view<const cl_event> event_wait_list = {});
+
+  /// @brief Unlock all command queues locked by the constructor.
+  ~command_queue_guard();
+
+  command_queue_guard(const command_queue_guard &) = delete;
+  command_queue_guard &operator=(const command_queue_guard &) = delete;
+
+ private:
+  /// @brief Find the next command queue to lock.
+  ///
+  /// Iterating with this visits each distinct command queue exactly once in
+  /// ascending address order without having to allocate storage for them.
+  ///
+  /// @param previous The previously visited command queue, or `nullptr` to
+  /// get the first.
+  ///
+  /// @return Returns the next command queue, or `nullptr` when there are none.
+  cl_command_queue next(cl_command_queue previous) const;
+
+  /// @brief The command queue being enqueued to.
+  cl_command_queue command_queue;
+  /// @brief Events whose command queues are also locked.
+  cargo::array_view<const cl_event> event_wait_list;
+};
+
 /// @brief Create an OpenCL command queue object.
 ///
 /// @param context Context the command queue belongs to.
@@ -38,6 +38,7 @@
 
 #include <memory>
 #include <mutex>
+#include <shared_mutex>
 #include <unordered_map>
 
 namespace cl {
@@ -213,16 +214,28 @@ struct _cl_context final : public cl::base<_cl_context> {
   /// of usm allocations and queue related activities it is sometimes needed to
   /// stay around beyond just accessing the list. It must not be below the
   /// general context mutex or the queue mutex.
-  std::mutex usm_mutex;
+  ///
+  /// Paths which only look up allocations, such as enqueuing commands, take a
+  /// shared lock so they don't serialize against each other, allocating and
+  /// freeing take an exclusive lock.
+  std::shared_mutex usm_mutex;
 
   /// @brief List of the context's enabled properties.
   cargo::dynamic_array<cl_context_properties> properties;
 #ifdef OCL_EXTENSION_cl_intel_unified_shared_memory
-  /// @brief List of allocations made through the USM extension entry points.
+  /// @brief List of allocations made through the USM extension entry points,
+  /// sorted by base address so lookups can binary search it.
   cargo::small_vector<std::unique_ptr<extension::usm::allocation_info>, 1>
       usm_allocations;
+  /// @brief Freed USM allocations cached for reuse, oldest first.
+  ///
+  /// Entries still have any in flight commands recorded, so they aren't
+  /// reused before those complete. Guarded by `usm_mutex`.
+  cargo::small_vector<std::unique_ptr<extension::usm::allocation_info>, 8>
+      usm_pool;
+  /// @brief Total capacity in bytes of the allocations in `usm_pool`.
+  size_t usm_pool_size = 0;
 #endif
-  std::mutex &getCommandQueueMutex() { return command_queue_mutex; }
 
  private:
   /// @brief Default constructor, made private to enforce use of `create`.
@@ -237,8 +250,6 @@ struct _cl_context final : public cl::base<_cl_context> {
   std::unique_ptr<compiler::Context> compiler_context;
   /// @brief A mutex that guards the compiler_targets map.
   std::mutex compiler_targets_mutex;
-  /// @brief A mutex that guards any command queues.
-  std::mutex command_queue_mutex;
   /// @brief Map of OpenCL devices to compiler targets.
   std::unordered_map<cl_device_id, std::unique_ptr<compiler::Target>>
       compiler_targets;
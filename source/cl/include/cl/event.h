@@ -112,6 +112,11 @@ struct _cl_event final : public cl::base<_cl_event> {
   bool addCallback(const cl_int type, cl::pfn_event_notify_t pfn_event_notify,
                    void *user_data);
 
+  /// @brief Check whether any notification callbacks are yet to be called.
+  ///
+  /// @return Return true if callbacks are registered, false otherwise.
+  bool hasCallbacks();
+
   /// @brief Signal that the event's command has been submitted for execution.
   void submitted();
 
@@ -124,8 +129,21 @@ struct _cl_event final : public cl::base<_cl_event> {
   void complete(const cl_int status = CL_COMPLETE);
 
   /// @brief Wait for the event to complete execution.
+  ///
+  /// Polls the command status for a short time before blocking, since short
+  /// commands often complete before a blocked thread could be woken up.
   void wait();
 
+  /// @brief Wait for a list of events to complete execution.
+  ///
+  /// After polling, rather than waiting on each event in turn the calling
+  /// thread registers a single counter with all incomplete events and blocks
+  /// until the last of them completes, so it is woken at most once.
+  ///
+  /// @param[in] num_events Number of events in @p events.
+  /// @param[in] events List of events to wait for.
+  static void waitAll(cl_uint num_events, const cl_event *events);
+
   /// @brief Context the event belongs to.
   cl_context context;
   /// @brief Command queue the event belongs to.
@@ -149,6 +167,19 @@ struct _cl_event final : public cl::base<_cl_event> {
   _cl_event(const _cl_event &) = delete;
   _cl_event &operator=(const _cl_event &) = delete;
 
+  /// @brief Count of the incomplete events a call to `waitAll` waits on.
+  struct wait_group_t {
+    /// @brief Count down one completed event, waking the waiter on the last.
+    void signal();
+
+    /// @brief Mutex guarding `remaining`.
+    std::mutex mutex;
+    /// @brief Condition variable the waiter blocks on.
+    std::condition_variable condition;
+    /// @brief Number of events yet to complete.
+    cl_uint remaining;
+  };
+
   /// @brief Remove all registered callbacks and call them.
   ///
   /// Function removes all callbacks regardless of if their status has been
@@ -161,6 +192,9 @@ struct _cl_event final : public cl::base<_cl_event> {
   /// @brief Condition variable used for signalling between _cl_event::wait()
   /// and _cl_event::complete() member functions.
   std::condition_variable wait_complete_condition;
+  /// @brief Wait groups to signal on completion, guarded by
+  /// `wait_complete_mutex`.
+  cargo::small_vector<wait_group_t *, 1> wait_groups;
   /// @brief Mutex to protect concurrent access to _cl_event::callbacks.
   ///
   /// The mutex needs to be recursive, as nothing prohibits a callback from
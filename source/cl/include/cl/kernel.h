@@ -32,6 +32,7 @@
 #include <compiler/kernel.h>
 #include <mux/mux.hpp>
 
+#include <mutex>
 #include <unordered_map>
 
 namespace cl {
@@ -124,6 +125,10 @@ class MuxKernelWrapper {
   /// contains a kernel optimized for the specific Mux execution parameters.
   ///
   /// @param specialization_options Mux execution options to specialize for.
+  /// @param single_enqueue Whether the kernel is only used by a single enqueue
+  /// and destroyed once it has run, in which case the compiler may return a
+  /// kernel which isn't specialized yet, see
+  /// `compiler::Kernel::createSpecializedKernelForEnqueue`.
   ///
   /// @return A valid SpecializedKernel object if specialization was successful,
   /// or a status code otherwise.
@@ -132,7 +137,8 @@ class MuxKernelWrapper {
   /// invalid.
   /// @retval `Result::FAILURE` if this kernel is not specializable.
   cargo::expected<SpecializedKernel, compiler::Result> createSpecializedKernel(
-      const mux_ndrange_options_t &specialization_options);
+      const mux_ndrange_options_t &specialization_options,
+      bool single_enqueue);
 
   /// @brief If this kernel does not support specialization, this returns the
   /// generic Mux kernel that is not specialized for any particular config.
@@ -362,6 +368,22 @@ struct _cl_kernel final : public cl::base<_cl_kernel> {
   /// @return A new kernel object.
   cargo::expected<cl_kernel, cl_int> clone() const;
 
+  /// @brief Get the Mux kernel wrapper of this kernel for a device.
+  ///
+  /// In a multi-device context the wrapper, and with it the Mux executable of
+  /// the program for that device, is created the first time the kernel is
+  /// used on the device instead of in clCreateKernel. Wrappers for different
+  /// devices can be created in parallel.
+  ///
+  /// @param[in] device Device to get the kernel wrapper for.
+  ///
+  /// @return Returns the kernel wrapper on success or an error code otherwise.
+  /// @retval `CL_INVALID_PROGRAM_EXECUTABLE` if the program could not be
+  /// built for @p device.
+  /// @retval `CL_OUT_OF_HOST_MEMORY` if an allocation failure occured.
+  cargo::expected<MuxKernelWrapper *, cl_int> getDeviceKernel(
+      cl_device_id device);
+
   /// @brief Query the kernel meta data for argument information.
   ///
   /// @return Return true if the kernel was compiled to a program and the kernel
@@ -459,8 +481,10 @@ struct _cl_kernel final : public cl::base<_cl_kernel> {
   /// @param[in] global_size Global work size.
   /// @param[in] work_dim Work dimensions.
   ///
-  /// @return local work group dimensions.
-  std::array<size_t, cl::max::WORK_ITEM_DIM> getDefaultLocalSize(
+  /// @return Returns the local work group dimensions on success, or an error
+  /// code if the kernel could not be created for @p device.
+  cargo::expected<std::array<size_t, cl::max::WORK_ITEM_DIM>, cl_int>
+  getDefaultLocalSize(
       cl_device_id device, const size_t *global_size, cl_uint work_dim);
 
   /// @brief Program the kernel was constructed from.
@@ -473,9 +497,11 @@ struct _cl_kernel final : public cl::base<_cl_kernel> {
   cargo::dynamic_array<argument> saved_args;
   /// @brief Array of argument information.
   cargo::optional<cargo::dynamic_array<argument::info>> arg_info;
-  /// @brief OpenCL device to kernels map.
+  /// @brief OpenCL device to kernels map, use getDeviceKernel to access.
   std::unordered_map<cl_device_id, std::unique_ptr<MuxKernelWrapper>>
       device_kernel_map;
+  /// @brief Guards `device_kernel_map`.
+  mutable std::mutex device_kernel_mutex;
 #ifdef OCL_EXTENSION_cl_intel_unified_shared_memory
   /// @brief USM allocations set via clSetKernelExecInfo
   cargo::dynamic_array<extension::usm::allocation_info *> indirect_usm_allocs;
@@ -26,6 +26,7 @@
 #include <cargo/expected.h>
 #include <cargo/optional.h>
 #include <cl/base.h>
+#include <cl/printf.h>
 #include <compiler/loader.h>
 #include <mux/mux.h>
 
@@ -77,6 +78,9 @@ struct _cl_platform_id final : cl::base<_cl_platform_id> {
   /// @brief List of devices owned by the platform.
   cargo::dynamic_array<cl_device_id> devices;
 
+  /// @brief Host thread printing the device printf output of all devices.
+  printf_drain_t printf_drain;
+
  private:
   /// @brief Compiler library.
   cargo::expected<std::unique_ptr<compiler::Library>, std::string>
@@ -23,9 +23,15 @@
 
 #include <CL/cl.h>
 #include <builtins/printf.h>
+#include <cargo/thread.h>
+#include <cl/limits.h>
 #include <mux/mux.hpp>
 
 #include <array>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
 #include <vector>
 
 /// @brief Allocate Mux memory and bind buffer for printf output based on local
@@ -62,6 +68,8 @@ struct printf_info_t final {
   std::vector<uint32_t> group_offsets;
   /// @brief Details of printf calls in the kernel program
   std::vector<builtins::printf::descriptor> &printf_calls;
+  /// @brief Program the printf calls belong to
+  cl_program program;
   /// @brief Destructor for freeing mux allocated resources
   ~printf_info_t();
 };
@@ -94,4 +102,91 @@ mux_result_t createPrintfCallback(mux_command_buffer_t command_buffer,
 mux_result_t createPrintfCallback(
     mux_command_buffer_t command_buffer,
     const std::unique_ptr<printf_info_t> &printf_info);
+
+/// @brief Printf data copied out of a device printf buffer, waiting to be
+/// decoded and printed.
+struct printf_job_t final {
+  /// @brief Program the printf calls belong to, retained until printed.
+  cl_program program;
+  /// @brief Details of printf calls in the kernel program.
+  const std::vector<builtins::printf::descriptor> *printf_calls;
+  /// @brief Chunk of `stride` bytes per work-group in the layout of the device
+  /// buffer, holding only the data not yet printed.
+  std::vector<uint8_t> data;
+  /// @brief Size in bytes of each work-group chunk in `data`.
+  size_t stride;
+  /// @brief Number of work-group chunks in `data`.
+  size_t num_groups;
+};
+
+/// @brief Host thread which decodes and prints device printf data.
+///
+/// Printf callbacks only copy the new printf data out of the device buffer and
+/// hand it over, so formatting and writing to stdout does not hold up the
+/// queue. Output is printed in the order it was handed over. The drain is
+/// owned by the platform, its thread is started by the first push and joined
+/// by `stop()` when the platform is torn down.
+class printf_drain_t final {
+ public:
+  /// @brief Destructor, stops the drain if it is still running.
+  ~printf_drain_t();
+
+  /// @brief Queue a job for printing.
+  ///
+  /// Blocks while too much data is waiting to be printed, so a chatty kernel
+  /// is slowed down to the speed of the drain rather than using unbounded
+  /// memory. Once the drain has been stopped the job is printed by the calling
+  /// thread.
+  ///
+  /// @param[in] job Job to print, its program must have been retained.
+  void push(printf_job_t job);
+
+  /// @brief Block until all jobs pushed so far have been printed.
+  void flush();
+
+  /// @brief Print all queued jobs and join the drain thread.
+  void stop();
+
+ private:
+  /// @brief Entry point of the drain thread.
+  void run();
+
+  /// @brief Decode and print a job, then release its program.
+  ///
+  /// @param[in] job Job to print.
+  static void print(printf_job_t &job);
+
+  /// @brief Amount of copied printf data above which pushing blocks.
+  static constexpr size_t max_queued_bytes = 64 * 1024 * 1024;
+
+  /// @brief Mutex protecting all the members below.
+  std::mutex mutex;
+  /// @brief Signalled when a job is pushed or the drain is stopped.
+  std::condition_variable job_condition;
+  /// @brief Signalled when a job has been printed.
+  std::condition_variable printed_condition;
+  /// @brief Jobs waiting to be printed, in order.
+  std::deque<printf_job_t> jobs;
+  /// @brief Total size of the data of `jobs`.
+  size_t queued_bytes = 0;
+  /// @brief Number of jobs pushed.
+  uint64_t pushed = 0;
+  /// @brief Number of jobs printed.
+  uint64_t printed = 0;
+  /// @brief Set by `stop()`, no new thread is started once set.
+  bool stopped = false;
+  /// @brief Drain thread, only joinable once started by `push()`.
+  cargo::thread thread;
+};
+
+/// @brief Block until the printf output of all completed kernels has been
+/// printed.
+///
+/// Printf callbacks only copy the output out of the device buffer, it is
+/// decoded and printed asynchronously by the platform's drain thread, so this
+/// must be called before returning from an entry point which guarantees printf
+/// output has been flushed.
+///
+/// @param[in] platform Platform owning the printf drain.
+void flushPrintfOutput(cl_platform_id platform);
 #endif  // CL_PRINTF_H_INCLUDED
@@ -32,6 +32,7 @@
 #include <cl/kernel.h>
 #include <extension/config.h>
 
+#include <mutex>
 #include <unordered_map>
 
 namespace cl {
@@ -153,8 +154,8 @@ struct device_program {
     std::unique_ptr<compiler::Module> module;
 
     /// @brief An object that manages Mux kernels created from the Mux
-    /// executable created when the module is finalized and deferred compilation
-    /// is not supported.
+    /// executable created from the finalized module when deferred compilation
+    /// is not supported. Populated lazily during getOrCreateKernels.
     cargo::optional<mux_kernel_cache> kernels;
 
     /// @brief Cached copy of an OpenCL binary. Populated lazily during
@@ -170,9 +171,32 @@ struct device_program {
     cargo::expected<cargo::array_view<const uint8_t>, compiler::Result>
     getOrCreateMuxBinary();
 
+    /// @brief This function checks whether the Mux executable for the
+    /// finalized module exists and if so, returns its kernel cache. Otherwise,
+    /// it creates the Mux binary and executable for @p device first.
+    ///
+    /// Creating the executable is the expensive part of building a program
+    /// for a device, it is done the first time a kernel is needed on that
+    /// device instead of for every device in the context during
+    /// clBuildProgram. Each module has its own lock, so executables for
+    /// different devices can be created in parallel.
+    ///
+    /// @param device CL device this module is associated with.
+    ///
+    /// @return A pointer to the kernel cache, or a Mux error if there was an
+    /// error creating the executable.
+    cargo::expected<mux_kernel_cache *, mux_result_t> getOrCreateKernels(
+        cl_device_id device);
+
    private:
     /// @brief Cached copy of a module binary created by Module::createBinary.
     cargo::optional<cargo::dynamic_array<uint8_t>> cached_mux_binary;
+
+    /// @brief Guards lazy creation of `kernels`.
+    std::mutex kernels_mutex;
+
+    /// @brief Guards lazy creation of `cached_mux_binary`.
+    std::mutex mux_binary_mutex;
   };
 
   /// @brief Default constructor.
@@ -210,6 +234,10 @@ struct device_program {
 
   /// @brief Finalizes the device program.
   ///
+  /// For compiler modules which do not support deferred compilation the Mux
+  /// executable is not created here, see
+  /// `CompilerModule::getOrCreateKernels`.
+  ///
   /// @param device CL device this program is associated with.
   /// @return Returns true if finalization was successful.
   bool finalize(cl_device_id device);
@@ -217,7 +245,8 @@ struct device_program {
   /// @brief Creates a MuxKernelWrapper from this device program.
   ///
   /// This will contain either a pre-compiled kernel or a deferred compiled
-  /// kernel depending on the `type` of this device program.
+  /// kernel depending on the `type` of this device program. Creating the first
+  /// pre-compiled kernel of a compiler module creates its Mux executable.
   ///
   /// @param device CL device this program is associated with.
   /// @param kernel_name
@@ -489,13 +518,46 @@ struct _cl_program final : public cl::base<_cl_program> {
   cl_int link(cargo::array_view<const cl_device_id> devices,
               cargo::array_view<const cl_program> input_programs);
 
-  /// @brief Finalize the program and create an executable for each device.
+  /// @brief Finalize the program for each device, and create the executables
+  /// of a single device context.
+  ///
+  /// The compiler module is finalized for every device, as this provides the
+  /// kernel metadata `clCreateKernel` and `clGetProgramInfo` rely on and
+  /// reports compilation errors in the build log of each device. Only the
+  /// creation of the Mux executable is deferred in multi-device contexts.
   ///
   /// @param[in] devices List of device to finalize the program for.
   ///
   /// @return Return true on success, false on failure.
   bool finalize(cargo::array_view<const cl_device_id> devices);
 
+  /// @brief Get the key of a build of this program in the persistent binary
+  /// cache, see `cl::binary::storeCachedBinary`.
+  ///
+  /// Must be called after `setOptions`.
+  ///
+  /// @param[in] device Device the program is being built for.
+  ///
+  /// @return Returns the key, or an empty string if the cache is disabled or
+  /// this build can't be cached.
+  std::string getBinaryCacheKey(cl_device_id device);
+
+  /// @brief Load the program for a device from the persistent binary cache.
+  ///
+  /// @param[in] device Device the program is being built for.
+  /// @param[in] key Key returned by `getBinaryCacheKey`.
+  ///
+  /// @return Returns true if the program was loaded and is executable on
+  /// @p device, false if it still needs to be built.
+  bool loadCachedBinary(cl_device_id device, cargo::string_view key);
+
+  /// @brief Store the program built for a device in the persistent binary
+  /// cache.
+  ///
+  /// @param[in] device Device the program was built for.
+  /// @param[in] key Key returned by `getBinaryCacheKey`.
+  void storeCachedBinary(cl_device_id device, cargo::string_view key);
+
   /// @brief Query the program for a named kernel.
   ///
   /// @param[in] name Name of the kernel to query.
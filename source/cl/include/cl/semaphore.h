@@ -22,21 +22,24 @@
 #include <cargo/expected.h>
 #include <mux/mux.h>
 
+#include <atomic>
+
 #ifndef CL_SEMAPHORE_H_INCLUDED
 #define CL_SEMAPHORE_H_INCLUDED
 
 typedef struct _mux_shared_semaphore *mux_shared_semaphore;
 
 /// @brief A shared wrapper for a semaphore, allowing references across queues
-/// @note This is not thread safe and should only be used when there is a
-/// command queue mutex.
+/// @note The reference count is atomic as a semaphore signalled by one command
+/// queue may be retained and released by other command queues while only
+/// holding their own mutex.
 struct _mux_shared_semaphore final {
  private:
   cl_device_id device;
 
   _mux_shared_semaphore(cl_device_id device, mux_semaphore_t semaphore)
       : device(device), ref_count(1), semaphore(semaphore){};
-  cl_uint ref_count;
+  std::atomic<cl_uint> ref_count;
 
  public:
   mux_semaphore_t semaphore;
@@ -45,8 +48,6 @@ struct _mux_shared_semaphore final {
   ~_mux_shared_semaphore();
 
   /// @brief Increment the semaphore's reference count
-  /// @note This is not thread safe and should only be done inside a command
-  /// buffer mutex.
   /// @return CL_SUCCESS on success, CL_OUT_OF_RESOURCES if retain results in an
   /// overflow.
   cl_int retain();
@@ -58,6 +59,16 @@ struct _mux_shared_semaphore final {
   /// false otherwise.
   bool release();
 
+  /// @brief Reset a semaphore whose reference count dropped to zero so it can
+  /// be reused, leaving it unsignaled with a reference count of one.
+  ///
+  /// @return CL_SUCCESS on success, CL_OUT_OF_RESOURCES if the mux semaphore
+  /// could not be reset.
+  cl_int reset();
+
+  /// @brief return the device the semaphore was created on
+  cl_device_id getDevice() const { return device; }
+
   /// @brief return underlying mux semaphore
   mux_semaphore_t get() const { return semaphore; }
 };
@@ -0,0 +1,78 @@
+// Copyright (C) Codeplay Software Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License") with LLVM
+// Exceptions; you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://github.com/codeplaysoftware/oneapi-construction-kit/blob/main/LICENSE.txt
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+//
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+
+#ifndef CL_BINARY_CACHE_H_INCLUDED
+#define CL_BINARY_CACHE_H_INCLUDED
+
+#include <cargo/array_view.h>
+#include <cargo/dynamic_array.h>
+#include <cargo/optional.h>
+#include <cargo/string_view.h>
+
+#include <cstdint>
+#include <string>
+
+namespace cl {
+namespace binary {
+/// @brief Checks if the persistent binary cache is enabled.
+///
+/// The cache is enabled by setting the `CA_CL_BINARY_CACHE_DIR` environment
+/// variable to an existing directory. Its size is limited to
+/// `CA_CL_BINARY_CACHE_SIZE_MB` megabytes, 512 by default, by removing the
+/// least recently used entries.
+///
+/// @return Returns true if the cache is enabled, false otherwise.
+bool isBinaryCacheEnabled();
+
+/// @brief Get an identifier for the build of the library or executable
+/// containing the code or data at an address.
+///
+/// The identifier is made of the size and modification time of the file the
+/// module was loaded from, so it changes whenever the module is rebuilt, even
+/// in builds which don't know their git commit.
+///
+/// @param[in] address Address of any function or static object in the module.
+///
+/// @return Returns the identifier, or an empty string if the module's file
+/// can't be found.
+std::string getModuleIdentifier(const void *address);
+
+/// @brief Look up a serialized program binary in the persistent cache.
+///
+/// @param[in] key Key the binary was stored with, see `storeCachedBinary`.
+///
+/// @return Returns the cached binary, or `cargo::nullopt` if there is no entry
+/// for @p key or it could not be read.
+cargo::optional<cargo::dynamic_array<uint8_t>> loadCachedBinary(
+    cargo::string_view key);
+
+/// @brief Store a serialized program binary in the persistent cache.
+///
+/// Entries are written to a temporary file which is then renamed into place,
+/// so processes sharing the cache directory never read a partially written
+/// entry. Failing to store an entry is not an error, the binary is simply
+/// built again next time.
+///
+/// @param[in] key Everything the binary was built from, such as the source or
+/// IL, build options, compiler version and device. Entries are named after a
+/// hash of the key and store the full key to detect hash collisions.
+/// @param[in] binary Binary created by `serializeBinary`.
+void storeCachedBinary(cargo::string_view key,
+                       cargo::array_view<const uint8_t> binary);
+}  // namespace binary
+}  // namespace cl
+
+#endif  // CL_BINARY_CACHE_H_INCLUDED
@@ -0,0 +1,374 @@
+// Copyright (C) Codeplay Software Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License") with LLVM
+// Exceptions; you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://github.com/codeplaysoftware/oneapi-construction-kit/blob/main/LICENSE.txt
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+//
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+
+#include <cl/binary/cache.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+#include <process.h>
+#include <sys/types.h>
+#include <sys/utime.h>
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <dlfcn.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+#endif
+
+namespace {
+/// @brief Identifies a cache entry, followed by `entry_version`.
+constexpr char entry_magic[4] = {'C', 'A', 'B', 'C'};
+
+/// @brief Version of the entry layout, bump this if it changes.
+constexpr uint32_t entry_version = 1;
+
+/// @brief Temporary files older than this many seconds are left over from a
+/// process which died while storing an entry, and are removed.
+constexpr int64_t stale_temporary_age = 60 * 60;
+
+struct cache_config {
+  std::string directory;
+  uint64_t max_size = 0;
+};
+
+const cache_config &getConfig() {
+  static const cache_config config = [] {
+    cache_config config;
+    if (const char *env = std::getenv("CA_CL_BINARY_CACHE_DIR")) {
+      config.directory = env;
+    }
+    config.max_size = uint64_t(512) << 20;
+    if (const char *env = std::getenv("CA_CL_BINARY_CACHE_SIZE_MB")) {
+      config.max_size = uint64_t(std::max(0, std::atoi(env))) << 20;
+    }
+    return config;
+  }();
+  return config;
+}
+
+using file_ptr = std::unique_ptr<std::FILE, int (*)(std::FILE *)>;
+
+file_ptr openFile(const std::string &path, const char *mode) {
+  return file_ptr(std::fopen(path.c_str(), mode), &std::fclose);
+}
+
+bool endsWith(const std::string &str, cargo::string_view suffix) {
+  return str.size() >= suffix.size() &&
+         0 == str.compare(str.size() - suffix.size(), suffix.size(),
+                          suffix.data(), suffix.size());
+}
+
+std::string getEntryPath(cargo::string_view key) {
+  // FNV-1a hash
+  uint64_t hash = 0xcbf29ce484222325;
+  for (const char c : key) {
+    hash ^= static_cast<uint8_t>(c);
+    hash *= 0x100000001b3;
+  }
+  char name[32];
+  (void)std::snprintf(name, sizeof(name), "%016" PRIx64 ".bin", hash);
+  return getConfig().directory + "/" + name;
+}
+
+/// @brief Returns a name for a temporary file next to @p path which no other
+/// thread or process is using.
+std::string getTemporaryPath(const std::string &path) {
+  static std::atomic<uint32_t> counter{0};
+#if defined(_WIN32)
+  const int pid = _getpid();
+#else
+  const int pid = static_cast<int>(getpid());
+#endif
+  return path + "." + std::to_string(pid) + "." +
+         std::to_string(counter.fetch_add(1)) + ".tmp";
+}
+
+/// @brief Marks the entry at @p path as the most recently used.
+void touchEntry(const std::string &path) {
+#if defined(_WIN32)
+  (void)_utime(path.c_str(), nullptr);
+#else
+  (void)utime(path.c_str(), nullptr);
+#endif
+}
+
+struct cache_file {
+  std::string path;
+  uint64_t size;
+  /// @brief Last modification time in seconds since the epoch.
+  int64_t time;
+};
+
+/// @brief Lists the entries and temporary files in the cache directory.
+std::vector<cache_file> listCacheFiles() {
+  const std::string &directory = getConfig().directory;
+  std::vector<cache_file> files;
+#if defined(_WIN32)
+  WIN32_FIND_DATAA data;
+  HANDLE find = FindFirstFileA((directory + "/*").c_str(), &data);
+  if (INVALID_HANDLE_VALUE == find) {
+    return files;
+  }
+  do {
+    const std::string name = data.cFileName;
+    if (!endsWith(name, ".bin") && !endsWith(name, ".tmp")) {
+      continue;
+    }
+    const uint64_t size =
+        (uint64_t(data.nFileSizeHigh) << 32) | data.nFileSizeLow;
+    // FILETIME counts 100ns intervals since 1601-01-01.
+    const uint64_t file_time =
+        (uint64_t(data.ftLastWriteTime.dwHighDateTime) << 32) |
+        data.ftLastWriteTime.dwLowDateTime;
+    const int64_t time = int64_t(file_time / 10000000) - 11644473600;
+    files.push_back({directory + "/" + name, size, time});
+  } while (FindNextFileA(find, &data));
+  FindClose(find);
+#else
+  DIR *dir = opendir(directory.c_str());
+  if (!dir) {
+    return files;
+  }
+  while (const dirent *entry = readdir(dir)) {
+    const std::string name = entry->d_name;
+    if (!endsWith(name, ".bin") && !endsWith(name, ".tmp")) {
+      continue;
+    }
+    std::string path = directory + "/" + name;
+    struct stat info;
+    if (0 != stat(path.c_str(), &info)) {
+      continue;  // Removed by another process in the meantime.
+    }
+    files.push_back({std::move(path), uint64_t(info.st_size),
+                     int64_t(info.st_mtime)});
+  }
+  closedir(dir);
+#endif
+  return files;
+}
+
+/// @brief Removes the least recently used entries until the cache fits in its
+/// size limit, and temporary files abandoned by processes that died.
+///
+/// Several processes may do this at once, which at worst removes a few more
+/// entries than needed.
+///
+/// @return Returns the total size of the entries left in the cache.
+uint64_t evictEntries() {
+  auto files = listCacheFiles();
+  const int64_t now = int64_t(std::time(nullptr));
+  uint64_t total_size = 0;
+  std::vector<cache_file> entries;
+  for (auto &file : files) {
+    if (endsWith(file.path, ".tmp")) {
+      if (now - file.time > stale_temporary_age) {
+        (void)std::remove(file.path.c_str());
+      }
+      continue;
+    }
+    total_size += file.size;
+    entries.push_back(std::move(file));
+  }
+  if (total_size <= getConfig().max_size) {
+    return total_size;
+  }
+  std::sort(entries.begin(), entries.end(),
+            [](const cache_file &lhs, const cache_file &rhs) {
+              return lhs.time < rhs.time;
+            });
+  for (const auto &entry : entries) {
+    if (total_size <= getConfig().max_size) {
+      break;
+    }
+    if (0 == std::remove(entry.path.c_str())) {
+      total_size -= entry.size;
+    }
+  }
+  return total_size;
+}
+
+/// @brief Accounts for an entry this process stored, and evicts entries once
+/// the cache is over its size limit.
+///
+/// The directory is only scanned on the first store and when the size is over
+/// the limit. In between the size is tracked by adding up the entries stored
+/// by this process, which underestimates it when other processes share the
+/// cache or entries are replaced. Those processes evict entries too, and any
+/// error is corrected by the next scan.
+///
+/// @param[in] entry_size Size in bytes of the entry which was stored.
+void recordStoredEntry(uint64_t entry_size) {
+  static std::mutex mutex;
+  static cargo::optional<uint64_t> tracked_size;
+  const std::lock_guard<std::mutex> lock(mutex);
+  if (tracked_size) {
+    *tracked_size += entry_size;
+    if (*tracked_size <= getConfig().max_size) {
+      return;
+    }
+  }
+  tracked_size = evictEntries();
+}
+
+template <class T>
+bool readValue(std::FILE *file, T &value) {
+  return 1 == std::fread(&value, sizeof(T), 1, file);
+}
+
+template <class T>
+bool writeValue(std::FILE *file, const T &value) {
+  return 1 == std::fwrite(&value, sizeof(T), 1, file);
+}
+}  // namespace
+
+namespace cl {
+namespace binary {
+bool isBinaryCacheEnabled() { return !getConfig().directory.empty(); }
+
+std::string getModuleIdentifier(const void *address) {
+  uint64_t size = 0;
+  uint64_t time = 0;
+#if defined(_WIN32)
+  HMODULE module = nullptr;
+  if (!GetModuleHandleExA(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS |
+                              GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+                          static_cast<LPCSTR>(address), &module)) {
+    return {};
+  }
+  char path[MAX_PATH];
+  const DWORD length = GetModuleFileNameA(module, path, MAX_PATH);
+  if (0 == length || MAX_PATH == length) {
+    return {};
+  }
+  WIN32_FILE_ATTRIBUTE_DATA data;
+  if (!GetFileAttributesExA(path, GetFileExInfoStandard, &data)) {
+    return {};
+  }
+  size = (uint64_t(data.nFileSizeHigh) << 32) | data.nFileSizeLow;
+  time = (uint64_t(data.ftLastWriteTime.dwHighDateTime) << 32) |
+         data.ftLastWriteTime.dwLowDateTime;
+#else
+  Dl_info dl_info;
+  if (0 == dladdr(address, &dl_info) || nullptr == dl_info.dli_fname) {
+    return {};
+  }
+  struct stat info;
+  if (0 != stat(dl_info.dli_fname, &info)) {
+    return {};
+  }
+  size = uint64_t(info.st_size);
+  time = uint64_t(info.st_mtime);
+#endif
+  return std::to_string(size) + "@" + std::to_string(time);
+}
+
+cargo::optional<cargo::dynamic_array<uint8_t>> loadCachedBinary(
+    cargo::string_view key) {
+  if (!isBinaryCacheEnabled()) {
+    return cargo::nullopt;
+  }
+  const std::string path = getEntryPath(key);
+  auto file = openFile(path, "rb");
+  if (!file) {
+    return cargo::nullopt;
+  }
+
+  char magic[sizeof(entry_magic)];
+  uint32_t version = 0;
+  uint64_t key_size = 0;
+  uint64_t binary_size = 0;
+  if (1 != std::fread(magic, sizeof(magic), 1, file.get()) ||
+      0 != std::memcmp(magic, entry_magic, sizeof(magic)) ||
+      !readValue(file.get(), version) || entry_version != version ||
+      !readValue(file.get(), key_size) || key.size() != key_size ||
+      !readValue(file.get(), binary_size)) {
+    return cargo::nullopt;
+  }
+
+  std::string entry_key(key_size, '\0');
+  if ((key_size &&
+       1 != std::fread(&entry_key[0], key_size, 1, file.get())) ||
+      key != cargo::string_view(entry_key)) {
+    return cargo::nullopt;
+  }
+
+  cargo::dynamic_array<uint8_t> binary;
+  if (cargo::success != binary.alloc(binary_size) ||
+      (binary_size &&
+       1 != std::fread(binary.data(), binary_size, 1, file.get()))) {
+    return cargo::nullopt;
+  }
+  file.reset();
+
+  touchEntry(path);
+  return {std::move(binary)};
+}
+
+void storeCachedBinary(cargo::string_view key,
+                       cargo::array_view<const uint8_t> binary) {
+  if (!isBinaryCacheEnabled()) {
+    return;
+  }
+  const std::string path = getEntryPath(key);
+  const std::string temporary_path = getTemporaryPath(path);
+  {
+    auto file = openFile(temporary_path, "wb");
+    if (!file) {
+      return;
+    }
+    const bool written =
+        1 == std::fwrite(entry_magic, sizeof(entry_magic), 1, file.get()) &&
+        writeValue(file.get(), entry_version) &&
+        writeValue(file.get(), uint64_t(key.size())) &&
+        writeValue(file.get(), uint64_t(binary.size())) &&
+        (key.empty() ||
+         1 == std::fwrite(key.data(), key.size(), 1, file.get())) &&
+        (binary.empty() ||
+         1 == std::fwrite(binary.data(), binary.size(), 1, file.get()));
+    if (!written || 0 != std::fclose(file.release())) {
+      (void)std::remove(temporary_path.c_str());
+      return;
+    }
+  }
+  // Renaming is atomic, so readers see either the old entry or the new one.
+  // An existing entry is only rebuilt if it couldn't be loaded, so replace it.
+#if defined(_WIN32)
+  if (!MoveFileExA(temporary_path.c_str(), path.c_str(),
+                   MOVEFILE_REPLACE_EXISTING)) {
+#else
+  if (0 != std::rename(temporary_path.c_str(), path.c_str())) {
+#endif
+    (void)std::remove(temporary_path.c_str());
+    return;
+  }
+  recordStoredEntry(sizeof(entry_magic) + sizeof(entry_version) +
+                    2 * sizeof(uint64_t) + key.size() + binary.size());
+}
+}  // namespace binary
+}  // namespace cl
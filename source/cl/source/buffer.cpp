@@ -404,8 +404,8 @@ CL_API_ENTRY cl_int CL_API_CALL cl::EnqueueWriteBufferRect(
                                                   cl::ref_count_type::EXTERNAL);
 
   {
-    const std::lock_guard<std::mutex> lock(
-        command_queue->context->getCommandQueueMutex());
+    const cl::command_queue_guard lock(
+        command_queue, {event_wait_list, num_events_in_wait_list});
 
     auto mux_command_buffer = command_queue->getCommandBuffer(
         {event_wait_list, num_events_in_wait_list}, event_release_guard.get());
@@ -549,8 +549,8 @@ CL_API_ENTRY cl_int CL_API_CALL cl::EnqueueReadBufferRect(
                                                   cl::ref_count_type::EXTERNAL);
 
   {
-    const std::lock_guard<std::mutex> lock(
-        command_queue->context->getCommandQueueMutex());
+    const cl::command_queue_guard lock(
+        command_queue, {event_wait_list, num_events_in_wait_list});
 
     auto mux_command_buffer = command_queue->getCommandBuffer(
         {event_wait_list, num_events_in_wait_list}, return_event);
@@ -651,8 +651,8 @@ CL_API_ENTRY cl_int CL_API_CALL cl::EnqueueCopyBufferRect(
     *event = return_event;
   }
 
-  const std::lock_guard<std::mutex> lock(
-      command_queue->context->getCommandQueueMutex());
+  const cl::command_queue_guard lock(
+      command_queue, {event_wait_list, num_events_in_wait_list});
 
   auto mux_command_buffer = command_queue->getCommandBuffer(
       {event_wait_list, num_events_in_wait_list}, return_event);
@@ -864,8 +864,8 @@ cl::EnqueueWriteBuffer(cl_command_queue command_queue, cl_mem buffer,
                                                   cl::ref_count_type::EXTERNAL);
 
   {
-    const std::lock_guard<std::mutex> lock(
-        command_queue->context->getCommandQueueMutex());
+    const cl::command_queue_guard lock(
+        command_queue, {event_wait_list, num_events_in_wait_list});
 
     auto mux_command_buffer = command_queue->getCommandBuffer(
         {event_wait_list, num_events_in_wait_list}, event_release_guard.get());
@@ -951,8 +951,8 @@ CL_API_ENTRY cl_int CL_API_CALL cl::EnqueueReadBuffer(
                                                   cl::ref_count_type::EXTERNAL);
 
   {
-    const std::lock_guard<std::mutex> lock(
-        command_queue->context->getCommandQueueMutex());
+    const cl::command_queue_guard lock(
+        command_queue, {event_wait_list, num_events_in_wait_list});
 
     auto mux_command_buffer = command_queue->getCommandBuffer(
         {event_wait_list, num_events_in_wait_list}, event_release_guard.get());
@@ -1029,8 +1029,8 @@ cl::EnqueueCopyBuffer(cl_command_queue command_queue, cl_mem src_buffer,
     *event = return_event;
   }
 
-  const std::lock_guard<std::mutex> lock(
-      command_queue->context->getCommandQueueMutex());
+  const cl::command_queue_guard lock(
+      command_queue, {event_wait_list, num_events_in_wait_list});
 
   auto mux_command_buffer = command_queue->getCommandBuffer(
       {event_wait_list, num_events_in_wait_list}, return_event);
@@ -1095,8 +1095,8 @@ cl::EnqueueFillBuffer(cl_command_queue command_queue, cl_mem buffer,
     *event = return_event;
   }
 
-  const std::lock_guard<std::mutex> lock(
-      command_queue->context->getCommandQueueMutex());
+  const cl::command_queue_guard lock(
+      command_queue, {event_wait_list, num_events_in_wait_list});
 
   auto mux_command_buffer = command_queue->getCommandBuffer(
       {event_wait_list, num_events_in_wait_list}, return_event);
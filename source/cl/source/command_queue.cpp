@@ -22,6 +22,7 @@
 #include <cl/kernel.h>
 #include <cl/mux.h>
 #include <cl/platform.h>
+#include <cl/printf.h>
 #include <cl/program.h>
 #include <cl/semaphore.h>
 #include <cl/validate.h>
@@ -29,8 +30,27 @@
 #include <tracer/tracer.h>
 #include <utils/system.h>
 
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+
 #include "mux/mux.h"
 
+namespace {
+/// @brief Returns how long `clFlush` may be deferred to batch later commands
+/// into the same command buffer, set with the `CA_CL_BATCH_FLUSH_US`
+/// environment variable. Zero, the default, disables flush batching.
+std::chrono::microseconds getBatchDuration() {
+  static const std::chrono::microseconds duration = [] {
+    if (const char *env = std::getenv("CA_CL_BATCH_FLUSH_US")) {
+      return std::chrono::microseconds(std::max(0, std::atoi(env)));
+    }
+    return std::chrono::microseconds(0);
+  }();
+  return duration;
+}
+}  // namespace
+
 _cl_command_queue::_cl_command_queue(cl_context context, cl_device_id device,
                                      cl_command_queue_properties properties,
                                      mux_queue_t mux_queue)
@@ -48,17 +68,25 @@ _cl_command_queue::_cl_command_queue(cl_context context, cl_device_id device,
       pending_dispatches(),
       running_command_buffers(),
       finish_state(),
-      cached_command_buffers(),
-      in_flush(false) {
+      cached_command_buffers() {
   cl::retainInternal(context);
   cl::retainInternal(device);
 }
 
 _cl_command_queue::~_cl_command_queue() {
+  {
+    const std::lock_guard<std::mutex> lock(batch_mutex);
+    batch_stop = true;
+  }
+  batch_condition.notify_all();
+  if (batch_thread.joinable()) {
+    batch_thread.join();
+  }
+
   muxWaitAll(mux_queue);
 
   {
-    const std::lock_guard<std::mutex> lock(context->getCommandQueueMutex());
+    const std::lock_guard<std::mutex> lock(mutex);
     cleanupCompletedCommandBuffers();
   }
   // Release any completed signal semaphores
@@ -66,21 +94,23 @@ _cl_command_queue::~_cl_command_queue() {
     releaseSemaphore(semaphore);
   }
 
-  for (auto pair : fences) {
-    muxDestroyFence(device->mux_device, pair.second, device->mux_allocator);
+  for (auto &running : running_command_buffers) {
+    muxDestroyFence(device->mux_device, running.fence, device->mux_allocator);
   }
 
-  // Empty our command buffer cache.
-  while (true) {
-    // Can access unlocked because if the destructor is running in parallel to
-    // other method on this object something has gone really wrong anyway.
-    auto command_buffer = cached_command_buffers.dequeue();
-    if (!command_buffer) {
-      break;
-    }
-    muxDestroyCommandBuffer(device->mux_device, *command_buffer,
+  // Empty our caches. Can access unlocked because if the destructor is running
+  // in parallel to other method on this object something has gone really
+  // wrong anyway.
+  for (auto command_buffer : cached_command_buffers) {
+    muxDestroyCommandBuffer(device->mux_device, command_buffer,
                             device->mux_allocator);
   }
+  for (auto fence : cached_fences) {
+    muxDestroyFence(device->mux_device, fence, device->mux_allocator);
+  }
+  for (auto semaphore : cached_semaphores) {
+    delete semaphore;
+  }
 
   if (counter_queries) {
     muxDestroyQueryPool(mux_queue, counter_queries, device->mux_allocator);
@@ -192,66 +222,177 @@ _cl_command_queue::create(cl_context context, cl_device_id device,
 }
 
 cl_int _cl_command_queue::flush() {
-  if (in_flush) {
-    return CL_SUCCESS;
+  cargo::small_vector<cl_command_queue, 4> cross_queues;
+  cl_int error;
+  {
+    const std::lock_guard<std::mutex> lock(mutex);
+    error = flushPending(cross_queues);
   }
-  in_flush = true;
 
-  // Use a raii_wrapper to ensure in_flush is set to false on exit
-  struct raii_wrapper {
-    raii_wrapper(bool &in_flush) : in_flush(in_flush){};
-    ~raii_wrapper() { in_flush = false; }
-    bool &in_flush;
-  };
-  const raii_wrapper wrapper(in_flush);
+  // Flush the command queues our dispatches wait on without holding our own
+  // lock, the command buffers waiting on their semaphores have already been
+  // dispatched and will start once they are signalled.
+  for (auto cross_queue : cross_queues) {
+    if (CL_SUCCESS == error) {
+      error = cross_queue->flush();
+    }
+    cl::releaseInternal(cross_queue);
+  }
+  return error;
+}
+
+cl_int _cl_command_queue::flushBatched() {
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (canDeferFlush()) {
+      deferred_flush = true;
+      const auto deadline = batch_start + getBatchDuration();
+      lock.unlock();
+      // clFlush must guarantee progress even if the application makes no
+      // further API calls.
+      armBatchTimer(deadline);
+      return CL_SUCCESS;
+    }
+  }
+  return flush();
+}
+
+void _cl_command_queue::armBatchTimer(
+    std::chrono::steady_clock::time_point deadline) {
+  {
+    const std::lock_guard<std::mutex> lock(batch_mutex);
+    if (batch_stop) {
+      return;
+    }
+    if (!batch_deadline || deadline < *batch_deadline) {
+      batch_deadline = deadline;
+    }
+    if (!batch_thread.joinable()) {
+      batch_thread = cargo::thread([this] { runBatchTimer(); });
+      batch_thread.set_name("cl:batch-flush");
+    }
+  }
+  batch_condition.notify_all();
+}
+
+void _cl_command_queue::notifyBatchTimer() {
+  {
+    const std::lock_guard<std::mutex> lock(batch_mutex);
+    if (!batch_deadline) {
+      return;
+    }
+    batch_completed = true;
+  }
+  batch_condition.notify_all();
+}
 
+void _cl_command_queue::runBatchTimer() {
+  std::unique_lock<std::mutex> lock(batch_mutex);
+  for (;;) {
+    batch_condition.wait(lock, [&] { return batch_stop || batch_deadline; });
+    if (batch_stop) {
+      return;
+    }
+    // A completed command buffer frees the device for the deferred batch, the
+    // same as an expired budget.
+    batch_condition.wait_until(lock, *batch_deadline, [&] {
+      return batch_stop || batch_completed;
+    });
+    if (batch_stop) {
+      return;
+    }
+    batch_deadline.reset();
+    batch_completed = false;
+
+    lock.unlock();
+    (void)flushDeferred();
+    lock.lock();
+  }
+}
+
+cl_int _cl_command_queue::flushDeferred() {
+  {
+    const std::lock_guard<std::mutex> lock(mutex);
+    if (!deferred_flush) {
+      return CL_SUCCESS;
+    }
+  }
+  return flush();
+}
+
+bool _cl_command_queue::canDeferFlush() {
+  const auto duration = getBatchDuration();
+  if (0 == duration.count() || pending_command_buffers.empty()) {
+    return false;
+  }
+  // Only defer while the device is busy, otherwise deferring leaves it idle.
+  if (CL_SUCCESS != cleanupCompletedCommandBuffers() ||
+      running_command_buffers.empty()) {
+    return false;
+  }
+  if (std::chrono::steady_clock::now() - batch_start >= duration) {
+    return false;
+  }
+  // Nothing else would dispatch the batch if the application is blocked on an
+  // event callback.
+  for (auto &pending : pending_dispatches) {
+    auto &signal_events = pending.second.signal_events;
+    if (std::any_of(signal_events.begin(), signal_events.end(),
+                    [](cl_event event) { return event->hasCallbacks(); })) {
+      return false;
+    }
+  }
+  return true;
+}
+
+cl_int _cl_command_queue::flushPending(
+    cargo::small_vector<cl_command_queue, 4> &cross_queues) {
+  deferred_flush = false;
   if (auto error = cleanupCompletedCommandBuffers()) {
     return error;
   }
 
-  {
-    if (!pending_dispatches.empty()) {
-      cargo::small_vector<mux_command_buffer_t, 16> command_buffers;
-      if (command_buffers.reserve(pending_command_buffers.size())) {
-        return CL_OUT_OF_RESOURCES;
-      }
+  if (pending_dispatches.empty()) {
+    return CL_SUCCESS;
+  }
 
-      // Filter out all pending_dispatches which depend on user events.
-      for (auto &command_buffer : pending_command_buffers) {
-        auto &dispatch = pending_dispatches[command_buffer];
-        if (std::none_of(dispatch.wait_events.begin(),
-                         dispatch.wait_events.end(), cl::isUserEvent)) {
-          for (auto &wait_event : dispatch.wait_events) {
-            // Force a flush if from a different queue
-            if (CL_COMMAND_USER != wait_event->command_type &&
-                wait_event->command_status != CL_COMPLETE) {
-              if (wait_event->queue != this) {
-                wait_event->queue->flush();
-              }
-            }
-          }
-          if (command_buffers.push_back(command_buffer)) {
+  cargo::small_vector<dispatch_key_t, 16> command_buffers;
+  if (command_buffers.reserve(pending_command_buffers.size())) {
+    return CL_OUT_OF_RESOURCES;
+  }
+
+  // Filter out all pending_dispatches which depend on user events.
+  for (auto &command_buffer : pending_command_buffers) {
+    auto &dispatch = pending_dispatches[command_buffer];
+    if (std::none_of(dispatch.wait_events.begin(), dispatch.wait_events.end(),
+                     cl::isUserEvent)) {
+      for (auto &wait_event : dispatch.wait_events) {
+        // Force a flush if from a different queue.
+        if (CL_COMMAND_USER != wait_event->command_type &&
+            wait_event->command_status != CL_COMPLETE &&
+            wait_event->queue != this &&
+            std::find(cross_queues.begin(), cross_queues.end(),
+                      wait_event->queue) == cross_queues.end()) {
+          if (cross_queues.push_back(wait_event->queue)) {
             return CL_OUT_OF_RESOURCES;
           }
+          cl::retainInternal(wait_event->queue);
         }
       }
-
-      // Dispatch the command buffers which don't depend on user events.
-      if (auto error = dispatch(command_buffers)) {
-        return error;
+      if (command_buffers.push_back(command_buffer)) {
+        return CL_OUT_OF_RESOURCES;
       }
     }
   }
 
-  return CL_SUCCESS;
+  // Dispatch the command buffers which don't depend on user events.
+  return dispatch(command_buffers);
 }
 
 cl_int _cl_command_queue::waitForEvents(const cl_uint num_events,
                                         const cl_event *events) {
-  for (cl_uint i = 0; i < num_events; i++) {
-    events[i]->wait();
-  }
-  const std::lock_guard<std::mutex> lock(context->getCommandQueueMutex());
+  _cl_event::waitAll(num_events, events);
+  const std::lock_guard<std::mutex> lock(mutex);
 
   return CL_SUCCESS == cleanupCompletedCommandBuffers()
              ? CL_SUCCESS
@@ -259,7 +400,9 @@ cl_int _cl_command_queue::waitForEvents(const cl_uint num_events,
 }
 
 cl_int _cl_command_queue::getEventStatus(cl_event event) {
-  const std::lock_guard<std::mutex> lock(context->getCommandQueueMutex());
+  // Polling an event is waiting on it, dispatch it if its flush was deferred.
+  flushDeferred();
+  const std::lock_guard<std::mutex> lock(mutex);
   const cl_int error = cleanupCompletedCommandBuffers();
   OCL_UNUSED(error);
   assert(CL_SUCCESS == error);
@@ -275,8 +418,8 @@ cl_int _cl_command_queue::cleanupCompletedCommandBuffers() {
     }
 
     // Check if the first running command buffer has completed.
-    auto fence = fences[running_command_buffers.front().command_buffer];
-    assert(fence && "Missing fence entry for command buffer dispatch!");
+    auto fence = running_command_buffers.front().fence;
+    assert(fence && "Missing fence for command buffer dispatch!");
     const mux_result_t error = muxTryWait(mux_queue, 0, fence);
     OCL_ASSERT(mux_success == error || mux_error_fence_failure == error ||
                    mux_fence_not_ready == error,
@@ -290,11 +433,9 @@ cl_int _cl_command_queue::cleanupCompletedCommandBuffers() {
       return CL_SUCCESS;
     }
 
-    // The command buffer has either failed or completed, so delete the fence
-    // and remove the associated entry from the map.
-    // TODO: We could do better here and reset the fences then reuse them.
-    muxDestroyFence(device->mux_device, fence, device->mux_allocator);
-    fences.erase(running_command_buffers.front().command_buffer);
+    // The command buffer has either failed or completed, so the fence can be
+    // reused.
+    destroyFence(fence);
 
     // Note that by this point 'error' may be either mux_success or
     // mux_error_fence_failure.  This function does not care about
@@ -309,15 +450,15 @@ cl_int _cl_command_queue::cleanupCompletedCommandBuffers() {
     for (auto &s : completed.wait_semaphores) {
       releaseSemaphore(s);
     }
-    running_command_buffers.pop_front();
+    running_command_buffers.erase(running_command_buffers.begin());
 
 #ifdef OCL_EXTENSION_cl_khr_command_buffer
     // We need to release references on any command buffers associated with user
     // command buffers even if they are cloned.
     if (completed.is_user_command_buffer) {
-      user_command_buffers[completed.command_buffer]->execution_refcount--;
-      cl::releaseInternal(user_command_buffers[completed.command_buffer]);
-      user_command_buffers.erase(completed.command_buffer);
+      user_command_buffers[completed.key]->execution_refcount--;
+      cl::releaseInternal(user_command_buffers[completed.key]);
+      user_command_buffers.erase(completed.key);
     }
 #endif
 
@@ -325,7 +466,7 @@ cl_int _cl_command_queue::cleanupCompletedCommandBuffers() {
     // cl_command_buffer_khrs here, they are responsible for their own
     // destruction.
     if (completed.should_destroy_command_buffer) {
-      if (auto error = destroyCommandBuffer(completed.command_buffer)) {
+      if (auto error = destroyCommandBuffer(completed.key.command_buffer)) {
         return error;
       }
     }
@@ -459,7 +600,7 @@ _cl_command_queue::getCurrentCommandBuffer() {
   }
   // Since we only support in-order command queues the most recently created
   // command buffer is the current one.
-  return pending_command_buffers.back();
+  return pending_command_buffers.back().command_buffer;
 }
 
 [[nodiscard]] cargo::expected<mux_command_buffer_t, cl_int>
@@ -468,7 +609,7 @@ _cl_command_queue::getCommandBufferPending(
   // Utility function object adds wait semaphores to a pending dispatch.
   struct add_wait {
     add_wait(cargo::array_view<mux_shared_semaphore> semaphores,
-             std::unordered_map<mux_command_buffer_t, dispatch_state_t>
+             decltype(_cl_command_queue::pending_dispatches)
                  &pending_dispatches)
         : semaphores(semaphores), pending_dispatches(pending_dispatches) {}
 
@@ -505,13 +646,12 @@ _cl_command_queue::getCommandBufferPending(
     }
 
     cargo::array_view<mux_shared_semaphore> semaphores;
-    std::unordered_map<mux_command_buffer_t, dispatch_state_t>
-        &pending_dispatches;
+    decltype(_cl_command_queue::pending_dispatches) &pending_dispatches;
   };
 
   // Storage for the pending dispatches on which this command buffer will
   // depend.
-  using dispatch_pair = std::pair<const mux_command_buffer_t, dispatch_state_t>;
+  using dispatch_pair = decltype(pending_dispatches)::value_type;
   using dispatch_dependency = std::pair<dispatch_pair *, cl_command_queue>;
   cargo::small_vector<dispatch_dependency, 8> dependent_dispatches;
 
@@ -606,7 +746,7 @@ _cl_command_queue::getCommandBufferPending(
   // There is only a single dependent dispatch so return its command buffer.
   // Since there is only one it must be the most recent dispatch.
   if (dependent_dispatches.size() == 1 && can_append_last_dispatch) {
-    return dependent_dispatches.front().first->first;
+    return dependent_dispatches.front().first->first.command_buffer;
   }
 
   // Storage for wait semaphores to set on a pending command buffer.
@@ -660,52 +800,42 @@ _cl_command_queue::getCommandBufferPending(
 }
 
 [[nodiscard]] cl_int _cl_command_queue::dispatch(
-    cargo::array_view<mux_command_buffer_t> command_buffers) {
-  for (auto command_buffer : command_buffers) {
-    auto &dispatch = pending_dispatches[command_buffer];
-
-    if (counter_queries) {
-      if (auto mux_error =
-              muxCommandEndQuery(command_buffer, counter_queries, 0,
-                                 counter_queries->count, 0, nullptr, nullptr)) {
-        return cl::getErrorFrom(mux_error);
+    cargo::array_view<dispatch_key_t> dispatches) {
+  for (auto key : dispatches) {
+    auto &dispatch = pending_dispatches[key];
+    auto command_buffer = key.command_buffer;
+
+    // A replayed command buffer is already finalized and may be executing, it
+    // must not be modified.
+    if (!dispatch.is_replay) {
+      if (counter_queries) {
+        if (auto mux_error = muxCommandEndQuery(command_buffer, counter_queries,
+                                                0, counter_queries->count, 0,
+                                                nullptr, nullptr)) {
+          return cl::getErrorFrom(mux_error);
+        }
       }
-    }
 
-    // Finalize non-user command buffers before dispatch.
-    if (auto error = muxFinalizeCommandBuffer(command_buffer)) {
-      // Make sure we return a valid error code for the calling OpenCL APIs.
-      auto cl_error = cl::getErrorFrom(error);
-      switch (cl_error) {
-        default:
-          return CL_INVALID_COMMAND_QUEUE;
-        case CL_OUT_OF_RESOURCES:
-        case CL_OUT_OF_HOST_MEMORY:
-          return cl_error;
+      // Finalize non-user command buffers before dispatch.
+      if (auto error = muxFinalizeCommandBuffer(command_buffer)) {
+        // Make sure we return a valid error code for the calling OpenCL APIs.
+        auto cl_error = cl::getErrorFrom(error);
+        switch (cl_error) {
+          default:
+            return CL_INVALID_COMMAND_QUEUE;
+          case CL_OUT_OF_RESOURCES:
+          case CL_OUT_OF_HOST_MEMORY:
+            return cl_error;
+        }
       }
     }
 
     // Create a fence that the host can wait on for this command buffer.
-    mux_fence_t fence = nullptr;
-    if (auto error =
-            muxCreateFence(device->mux_device, device->mux_allocator, &fence)) {
-      // Make sure we return a valid error code for the calling OpenCL APIs.
-      auto cl_error = cl::getErrorFrom(error);
-      switch (cl_error) {
-        default:
-          return CL_INVALID_COMMAND_QUEUE;
-        case CL_OUT_OF_RESOURCES:
-        case CL_OUT_OF_HOST_MEMORY:
-          return cl_error;
-      }
+    auto fence = createFence();
+    if (!fence) {
+      return fence.error();
     }
 
-    // Put the fence in the lookup map so we know what fence to wait on for a
-    // given command buffer.
-    assert(fences.find(command_buffer) == std::end(fences) &&
-           "command buffer already has fence entry!");
-    fences[command_buffer] = fence;
-
     // Set all events as submitted.
     for (auto signal_event : dispatch.signal_events) {
       signal_event->submitted();
@@ -718,15 +848,29 @@ _cl_command_queue::getCommandBufferPending(
     dispatch.wait_events.clear();
 
     // Move dispatched pending state to destruction storage.
-    auto &finished = finish_state[command_buffer];
+    assert(finish_state.find(key) == std::end(finish_state) &&
+           "command buffer already has finish state!");
+    if (!cached_finish_nodes.empty()) {
+      auto node = std::move(cached_finish_nodes.back());
+      cached_finish_nodes.pop_back();
+      node.key() = key;
+      finish_state.insert(std::move(node));
+    }
+    auto &finished = finish_state[key];
     finished.addState(this, std::move(dispatch.signal_events),
                       std::move(dispatch.callbacks));
+    finished.key = key;
 
-    // Completion callback to cleanup once the dispatch is complete.
-    auto dispatchComplete = [](mux_command_buffer_t command_buffer,
-                               mux_result_t error, void *const user_data) {
+    // Completion callback to cleanup once the dispatch is complete, mux
+    // reports the dispatched command buffer which for a replay is not enough
+    // to find its state.
+    auto dispatchComplete = [](mux_command_buffer_t, mux_result_t error,
+                               void *const user_data) {
       auto finish_state = static_cast<finish_state_t *>(user_data);
-      finish_state->clear(command_buffer, error, /* locked */ false);
+      // Dispatching from the completion callback could recycle the state of
+      // the command buffer completing, leave it to the batch thread.
+      finish_state->command_queue->notifyBatchTimer();
+      finish_state->clear(finish_state->key, error, /* locked */ false);
     };
 
     // Prepare the dispatch.
@@ -751,37 +895,42 @@ _cl_command_queue::getCommandBufferPending(
     }
 
     if (auto error = muxDispatch(
-            mux_queue, command_buffer, fence,
+            mux_queue, command_buffer, *fence,
             wait_semaphores_storage.empty() ? nullptr
                                             : wait_semaphores_storage.data(),
             dispatch.wait_semaphores.size(), signal_semaphores,
             signal_semaphores_length, dispatchComplete, &finished)) {
-      finished.clear(command_buffer, error, /* locked */ true);
+      finished.clear(key, error, /* locked */ true);
+      muxDestroyFence(device->mux_device, *fence, device->mux_allocator);
       return CL_OUT_OF_RESOURCES;
     }
 
-    // Add to the running double ended queue.
-    running_command_buffers.push_back(
-        {command_buffer, std::move(dispatch.wait_semaphores),
-         dispatch.signal_semaphore, dispatch.is_user_command_buffer,
-         dispatch.should_destroy_command_buffer});
+    // Add to the running list.
+    if (running_command_buffers.push_back(
+            {key, *fence, std::move(dispatch.wait_semaphores),
+             dispatch.signal_semaphore, dispatch.is_user_command_buffer,
+             dispatch.should_destroy_command_buffer})) {
+      return CL_OUT_OF_HOST_MEMORY;
+    }
   }
 
   // Remove dispatched command buffers from pending.
-  return removeFromPending(command_buffers);
+  return removeFromPending(dispatches);
 }
 
 cl_int _cl_command_queue::dispatchPending(cl_event user_event) {
-  const std::lock_guard<std::mutex> lock(context->getCommandQueueMutex());
+  {
+    const std::lock_guard<std::mutex> lock(mutex);
 
-  // Remove the user event from all pending dispatches wait event lists.
-  for (auto &pending : pending_dispatches) {
-    auto &dispatch = pending.second;
-    auto found = std::find(dispatch.wait_events.begin(),
-                           dispatch.wait_events.end(), user_event);
-    if (dispatch.wait_events.end() != found) {
-      cl::releaseInternal(*found);
-      dispatch.wait_events.erase(found);
+    // Remove the user event from all pending dispatches wait event lists.
+    for (auto &pending : pending_dispatches) {
+      auto &dispatch = pending.second;
+      auto found = std::find(dispatch.wait_events.begin(),
+                             dispatch.wait_events.end(), user_event);
+      if (dispatch.wait_events.end() != found) {
+        cl::releaseInternal(*found);
+        dispatch.wait_events.erase(found);
+      }
     }
   }
 
@@ -790,23 +939,26 @@ cl_int _cl_command_queue::dispatchPending(cl_event user_event) {
 }
 
 cl_int _cl_command_queue::removeFromPending(
-    cargo::array_view<mux_command_buffer_t> command_buffers) {
-  if (command_buffers.empty()) {
+    cargo::array_view<dispatch_key_t> dispatches) {
+  if (dispatches.empty()) {
     return CL_SUCCESS;  // GCOVR_EXCL_LINE non-deterministically executed
   }
 
-  // Remove the command buffers dispatch info.
-  for (auto command_buffer : command_buffers) {
-    pending_dispatches.erase(command_buffer);
+  // Remove the command buffers dispatch info, keeping the map nodes for reuse.
+  for (auto key : dispatches) {
+    auto node = pending_dispatches.extract(key);
+    if (node && !isCacheFull(cached_dispatch_nodes.size())) {
+      node.mapped().reset();
+      (void)cached_dispatch_nodes.push_back(std::move(node));
+    }
   }
 
   // Predicate returns `true` if the command buffer should be kept, `false` if
   // it should be removed.
-  auto isRetained = [&command_buffers](mux_command_buffer_t command_buffer) {
-    return std::none_of(command_buffers.begin(), command_buffers.end(),
-                        [command_buffer](mux_command_buffer_t dropped) {
-                          return command_buffer == dropped;
-                        });
+  auto isRetained = [&dispatches](const dispatch_key_t &key) {
+    return std::none_of(
+        dispatches.begin(), dispatches.end(),
+        [&key](const dispatch_key_t &dropped) { return key == dropped; });
   };
 
   // Partition the command buffers whilst maintaining original ordering,
@@ -830,14 +982,14 @@ cl_int _cl_command_queue::removeFromPending(
 
 cl_int _cl_command_queue::dropDispatchesPending(
     cl_event user_event, cl_int event_command_exec_status) {
-  const std::lock_guard<std::mutex> lock(context->getCommandQueueMutex());
+  const std::lock_guard<std::mutex> lock(mutex);
 
-  cargo::small_vector<mux_command_buffer_t, 16> command_buffers;
+  cargo::small_vector<dispatch_key_t, 16> command_buffers;
 
   auto isEvent = [user_event](cl_event event) { return user_event == event; };
 
   for (auto &pending : pending_dispatches) {
-    auto command_buffer = pending.first;
+    auto key = pending.first;
     auto &dispatch = pending.second;
 
     if (std::any_of(dispatch.wait_events.begin(), dispatch.wait_events.end(),
@@ -869,13 +1021,17 @@ cl_int _cl_command_queue::dropDispatchesPending(
       }
       dispatch.wait_semaphores.clear();
       // Add command buffer to removal list.
-      if (command_buffers.push_back(command_buffer)) {
+      if (command_buffers.push_back(key)) {
         return CL_OUT_OF_RESOURCES;
       }
 
       // All uses of command_buffer after this point are only as an address.
-      if (auto error = destroyCommandBuffer(command_buffer)) {
-        return error;
+      // User command buffers which weren't cloned, including replays which
+      // may still be executing, are not owned by the command queue.
+      if (dispatch.should_destroy_command_buffer) {
+        if (auto error = destroyCommandBuffer(key.command_buffer)) {
+          return error;
+        }
       }
     }
   }
@@ -887,9 +1043,10 @@ cl_int _cl_command_queue::dropDispatchesPending(
 [[nodiscard]] cargo::expected<mux_command_buffer_t, cl_int>
 _cl_command_queue::createCommandBuffer() {
   mux_command_buffer_t command_buffer;
-  if (auto cached_command_buffer = cached_command_buffers.dequeue()) {
+  if (!cached_command_buffers.empty()) {
     // We have a cached command buffer we can use.
-    command_buffer = *cached_command_buffer;
+    command_buffer = cached_command_buffers.back();
+    cached_command_buffers.pop_back();
   } else {
     // Otherwise create a new command buffer.
     if (mux_success !=
@@ -897,13 +1054,18 @@ _cl_command_queue::createCommandBuffer() {
                                device->mux_allocator, &command_buffer)) {
       return cargo::make_unexpected(CL_OUT_OF_RESOURCES);
     }
+    mux_allocation_count++;
   }
 
   // Add the command buffer to the list of pending command buffers.
+  if (pending_command_buffers.empty()) {
+    batch_start = std::chrono::steady_clock::now();
+  }
   if (pending_command_buffers.push_back(command_buffer)) {
     destroyCommandBuffer(command_buffer);
     return cargo::make_unexpected(CL_OUT_OF_RESOURCES);
   }
+  updateInFlight();
 
   // Create a semaphore which future command buffers can wait for.
   auto semaphore = createSemaphore();
@@ -911,9 +1073,16 @@ _cl_command_queue::createCommandBuffer() {
     destroyCommandBuffer(command_buffer);
     return cargo::make_unexpected(semaphore.error());
   }
-  pending_dispatches[command_buffer].signal_semaphore = *semaphore;
-  pending_dispatches[command_buffer].is_user_command_buffer = false;
-  pending_dispatches[command_buffer].should_destroy_command_buffer = true;
+  if (auto error = addPendingDispatch(command_buffer)) {
+    destroyCommandBuffer(command_buffer);
+    releaseSemaphore(*semaphore);
+    return cargo::make_unexpected(error);
+  }
+  auto &dispatch = pending_dispatches[command_buffer];
+  dispatch.signal_semaphore = *semaphore;
+  dispatch.is_user_command_buffer = false;
+  dispatch.should_destroy_command_buffer = true;
+  dispatch.is_replay = false;
 
   if (counter_queries) {
     if (auto mux_error =
@@ -938,8 +1107,8 @@ cl_int _cl_command_queue::destroyCommandBuffer(
   }
 
   // Try and cache the command buffer first
-  if (cargo::result::success !=
-      cached_command_buffers.enqueue(command_buffer)) {
+  if (isCacheFull(cached_command_buffers.size()) ||
+      cached_command_buffers.push_back(command_buffer)) {
     // Then if we have no room to cache it, destroy it.
     muxDestroyCommandBuffer(device->mux_device, command_buffer,
                             device->mux_allocator);
@@ -948,8 +1117,43 @@ cl_int _cl_command_queue::destroyCommandBuffer(
   return CL_SUCCESS;
 }
 
+cargo::expected<mux_fence_t, cl_int> _cl_command_queue::createFence() {
+  if (!cached_fences.empty()) {
+    auto fence = cached_fences.back();
+    cached_fences.pop_back();
+    return fence;
+  }
+  mux_fence_t fence = nullptr;
+  if (auto error =
+          muxCreateFence(device->mux_device, device->mux_allocator, &fence)) {
+    // Make sure we return a valid error code for the calling OpenCL APIs.
+    auto cl_error = cl::getErrorFrom(error);
+    switch (cl_error) {
+      default:
+        return cargo::make_unexpected(CL_INVALID_COMMAND_QUEUE);
+      case CL_OUT_OF_RESOURCES:
+      case CL_OUT_OF_HOST_MEMORY:
+        return cargo::make_unexpected(cl_error);
+    }
+  }
+  mux_allocation_count++;
+  return fence;
+}
+
+void _cl_command_queue::destroyFence(mux_fence_t fence) {
+  if (isCacheFull(cached_fences.size()) ||
+      mux_success != muxResetFence(fence) || cached_fences.push_back(fence)) {
+    muxDestroyFence(device->mux_device, fence, device->mux_allocator);
+  }
+}
+
 cargo::expected<mux_shared_semaphore, cl_int>
 _cl_command_queue::createSemaphore() {
+  if (!cached_semaphores.empty()) {
+    auto semaphore = cached_semaphores.back();
+    cached_semaphores.pop_back();
+    return semaphore;
+  }
   mux_semaphore_t mux_semaphore;
   if (mux_success != muxCreateSemaphore(device->mux_device,
                                         device->mux_allocator,
@@ -958,8 +1162,11 @@ _cl_command_queue::createSemaphore() {
   }
   auto sem = _mux_shared_semaphore::create(device, mux_semaphore);
   if (!sem) {
+    muxDestroySemaphore(device->mux_device, mux_semaphore,
+                        device->mux_allocator);
     return cargo::make_unexpected(CL_OUT_OF_HOST_MEMORY);
   }
+  mux_allocation_count++;
 
   return sem;
 }
@@ -967,11 +1174,31 @@ _cl_command_queue::createSemaphore() {
 cl_int _cl_command_queue::releaseSemaphore(mux_shared_semaphore semaphore) {
   const bool should_destroy = semaphore->release();
   if (should_destroy) {
-    delete semaphore;
+    // Semaphores signaled by other command queues may be released here, only
+    // cache those which belong to this command queue's device.
+    if (semaphore->getDevice() != device ||
+        isCacheFull(cached_semaphores.size()) ||
+        CL_SUCCESS != semaphore->reset() ||
+        cached_semaphores.push_back(semaphore)) {
+      delete semaphore;
+    }
   }
   return CL_SUCCESS;
 }
 
+cl_int _cl_command_queue::addPendingDispatch(dispatch_key_t key) {
+  if (cached_dispatch_nodes.empty() ||
+      pending_dispatches.end() != pending_dispatches.find(key)) {
+    pending_dispatches[key];
+    return CL_SUCCESS;
+  }
+  auto node = std::move(cached_dispatch_nodes.back());
+  cached_dispatch_nodes.pop_back();
+  node.key() = key;
+  pending_dispatches.insert(std::move(node));
+  return CL_SUCCESS;
+}
+
 void _cl_command_queue::userEventDispatch(cl_event user_event,
                                           cl_int event_command_exec_status,
                                           void *user_data) {
@@ -984,6 +1211,17 @@ void _cl_command_queue::userEventDispatch(cl_event user_event,
   command_queue->dispatchPending(user_event);
 }
 
+void _cl_command_queue::dispatch_state_t::reset() {
+  wait_events.clear();
+  signal_events.clear();
+  wait_semaphores.clear();
+  signal_semaphore = nullptr;
+  callbacks.clear();
+  is_user_command_buffer = false;
+  should_destroy_command_buffer = false;
+  is_replay = false;
+}
+
 [[nodiscard]] cl_int _cl_command_queue::dispatch_state_t::addWaitEvents(
     cargo::array_view<const cl_event> event_wait_list) {
   if (!event_wait_list.empty()) {
@@ -1037,8 +1275,9 @@ cl_int _cl_command_queue::finish_state_t::addState(
   return cargo::success;
 }
 
-void _cl_command_queue::finish_state_t::clear(
-    mux_command_buffer_t command_buffer, mux_result_t error, bool locked) {
+void _cl_command_queue::finish_state_t::clear(dispatch_key_t key,
+                                              mux_result_t error,
+                                              bool locked) {
   const cl_int cl_error =
       (mux_success == error) ? CL_COMPLETE : CL_OUT_OF_RESOURCES;
   for (auto signal_event : signal_events) {
@@ -1049,15 +1288,59 @@ void _cl_command_queue::finish_state_t::clear(
   std::for_each(callbacks.rbegin(), callbacks.rend(),
                 [](std::function<void()> &callback) { callback(); });
   callbacks.clear();
+  // Keep the map node, and with it this object, for reuse by a future
+  // dispatch.
+  auto recycle = [command_queue = command_queue, key] {
+    auto node = command_queue->finish_state.extract(key);
+    if (!command_queue->isCacheFull(
+            command_queue->cached_finish_nodes.size())) {
+      (void)command_queue->cached_finish_nodes.push_back(std::move(node));
+    }
+  };
   if (locked) {
-    command_queue->finish_state.erase(command_buffer);
+    recycle();
   } else {
-    const std::lock_guard<std::mutex> lock(
-        command_queue->context->getCommandQueueMutex());
-    command_queue->finish_state.erase(command_buffer);
+    const std::lock_guard<std::mutex> lock(command_queue->mutex);
+    recycle();
   }
 }
 
+cl::command_queue_guard::command_queue_guard(
+    cl_command_queue command_queue,
+    cargo::array_view<const cl_event> event_wait_list)
+    : command_queue(command_queue), event_wait_list(event_wait_list) {
+  for (auto queue = next(nullptr); queue; queue = next(queue)) {
+    queue->mutex.lock();
+  }
+}
+
+cl::command_queue_guard::~command_queue_guard() {
+  for (auto queue = next(nullptr); queue; queue = next(queue)) {
+    queue->mutex.unlock();
+  }
+}
+
+cl_command_queue cl::command_queue_guard::next(
+    cl_command_queue previous) const {
+  // Event wait lists are short and rarely span more than one command queue, a
+  // linear scan per visited command queue is cheaper than sorting a copy.
+  const std::less<cl_command_queue> less;
+  auto consider = [&](cl_command_queue candidate, cl_command_queue current) {
+    if (previous && !less(previous, candidate)) {
+      return current;
+    }
+    return (!current || less(candidate, current)) ? candidate : current;
+  };
+  cl_command_queue found = consider(command_queue, nullptr);
+  for (auto wait_event : event_wait_list) {
+    // User events don't belong to a command queue.
+    if (wait_event->queue && CL_COMMAND_USER != wait_event->command_type) {
+      found = consider(wait_event->queue, found);
+    }
+  }
+  return found;
+}
+
 CL_API_ENTRY cl_command_queue CL_API_CALL cl::CreateCommandQueue(
     cl_context context, cl_device_id device_id,
     cl_command_queue_properties properties, cl_int *errcode_ret) {
@@ -1097,9 +1380,6 @@ cl::ReleaseCommandQueue(cl_command_queue command_queue) {
       command_queue->refCountInternal()) {
     command_queue->finish();
   } else {
-    const std::lock_guard<std::mutex> lock(
-        command_queue->context->getCommandQueueMutex());
-
     // releasing a command queue causes an implicit flush
     if (auto error = command_queue->flush()) {
       return error;
@@ -1156,6 +1436,14 @@ CL_API_ENTRY cl_int CL_API_CALL cl::GetCommandQueueInfo(
       }
       break;
 #endif
+    case CL_QUEUE_MUX_ALLOCATIONS_CODEPLAY: {
+      const std::lock_guard<std::mutex> lock(command_queue->mutex);
+      OCL_SET_IF_NOT_NULL(param_value_size_ret, sizeof(cl_ulong));
+      OCL_CHECK(param_value && (param_value_size < sizeof(cl_ulong)),
+                return CL_INVALID_VALUE);
+      OCL_SET_IF_NOT_NULL(static_cast<cl_ulong *>(param_value),
+                          command_queue->mux_allocation_count);
+    } break;
     default: {
       return extension::GetCommandQueueInfo(command_queue, param_name,
                                             param_value_size, param_value,
@@ -1184,8 +1472,8 @@ CL_API_ENTRY cl_int CL_API_CALL cl::EnqueueBarrierWithWaitList(
     }
     *event = *new_event;
 
-    const std::lock_guard<std::mutex> lock(
-        command_queue->context->getCommandQueueMutex());
+    const cl::command_queue_guard lock(
+        command_queue, {event_wait_list, num_events_in_wait_list});
 
     // barriers are implicit in in-order queues, could mostly be a no-op
     // (especially if we don't have a return event!)
@@ -1216,8 +1504,8 @@ CL_API_ENTRY cl_int CL_API_CALL cl::EnqueueMarkerWithWaitList(
     }
     *event = *new_event;
 
-    const std::lock_guard<std::mutex> lock(
-        command_queue->context->getCommandQueueMutex());
+    const cl::command_queue_guard lock(
+        command_queue, {event_wait_list, num_events_in_wait_list});
 
     auto mux_command_buffer = command_queue->getCommandBuffer(
         {event_wait_list, num_events_in_wait_list}, *event);
@@ -1260,27 +1548,26 @@ CL_API_ENTRY cl_int CL_API_CALL cl::EnqueueWaitForEvents(
 CL_API_ENTRY cl_int CL_API_CALL cl::Flush(cl_command_queue command_queue) {
   const tracer::TraceGuard<tracer::OpenCL> guard("clFlush");
   OCL_CHECK(!command_queue, return CL_INVALID_COMMAND_QUEUE);
-  const std::lock_guard<std::mutex> lock(
-      command_queue->context->getCommandQueueMutex());
-  return command_queue->flush();
+  return command_queue->flushBatched();
 }
 
 cl_int _cl_command_queue::finish() {
-  {
-    const std::lock_guard<std::mutex> lock(context->getCommandQueueMutex());
-    flush();
-  }
+  flush();
 
   if (mux_success != muxWaitAll(mux_queue)) {
     return CL_OUT_OF_RESOURCES;
   }
 
   {
-    const std::lock_guard<std::mutex> lock(context->getCommandQueueMutex());
+    const std::lock_guard<std::mutex> lock(mutex);
     if (CL_SUCCESS != cleanupCompletedCommandBuffers()) {
       return CL_OUT_OF_RESOURCES;
     }
   }
+
+  // Printf output of the completed kernels is printed asynchronously, make
+  // sure it has all been printed before returning.
+  flushPrintfOutput(device->platform);
   return CL_SUCCESS;
 }
 
@@ -1302,13 +1589,7 @@ CL_API_ENTRY cl_int CL_API_CALL cl::Finish(cl_command_queue command_queue) {
 
   event_release_guard->complete();
 
-  cl_int result;
-  {
-    const std::lock_guard<std::mutex> lock(
-        command_queue->context->getCommandQueueMutex());
-    result = command_queue->flush();
-  }
-
+  const cl_int result = command_queue->flush();
   if (CL_SUCCESS != result) {
     return result;
   }
@@ -1338,8 +1619,7 @@ cl::EnqueueMarker(cl_command_queue command_queue, cl_event *event) {
     }
     *event = *new_event;
 
-    const std::lock_guard<std::mutex> lock(
-        command_queue->context->getCommandQueueMutex());
+    const cl::command_queue_guard lock(command_queue);
 
     auto mux_command_buffer = command_queue->getCommandBuffer({}, *event);
     if (!mux_command_buffer) {
@@ -1355,7 +1635,8 @@ cl::EnqueueMarker(cl_command_queue command_queue, cl_event *event) {
     cl_command_buffer_khr command_buffer, cl_uint num_events_in_wait_list,
     const cl_event *event_wait_list, cl_event *return_event) {
   // Lock both queue and command-buffer
-  std::lock_guard<std::mutex> lock_queue(context->getCommandQueueMutex());
+  const cl::command_queue_guard lock_queue(
+      this, {event_wait_list, num_events_in_wait_list});
   std::lock_guard<std::mutex> lock_command_buffer(command_buffer->mutex);
 
   // Create the signal event if caller asks for it.
@@ -1382,31 +1663,40 @@ cl::EnqueueMarker(cl_command_queue command_queue, cl_event *event) {
   // We need to check if the mux_command_buffer associated with the
   // cl_command_buffer_khr object has already been enqueued to a command
   // queue. If it has, then we need to clone the underlying mux_command_buffer_t
-  // since mux_command_buffer_ts are single use.
+  // since mux_command_buffer_ts are single use, unless the device can dispatch
+  // it again while the earlier dispatches are still executing.
   auto command_queue_should_destroy_command_buffer = false;
-  if (command_buffer->execution_refcount > 0) {
+  dispatch_key_t key = mux_command_buffer;
+  auto device = command_buffer->command_queue->device;
+  bool can_replay = device->mux_device->info->supports_concurrent_dispatch;
+#ifdef OCL_EXTENSION_cl_khr_command_buffer_mutable_dispatch
+  // Pending updates would modify the commands of the in flight dispatches.
+  can_replay = can_replay && command_buffer->updated_commands.empty();
+#endif
+  if (command_buffer->execution_refcount > 0 && can_replay) {
+    // The mux command buffer is already tracked by this queue, the replay is
+    // tracked separately.
+    key = dispatch_key_t{mux_command_buffer, ++replay_count};
+  } else if (command_buffer->execution_refcount > 0) {
     mux_command_buffer_t cloned_mux_command_buffer;
-    auto device = command_buffer->command_queue->device;
     if (auto error = muxCloneCommandBuffer(
             device->mux_device, device->mux_allocator, mux_command_buffer,
             &cloned_mux_command_buffer)) {
       return cl::getErrorFrom(error);
     }
     mux_command_buffer = cloned_mux_command_buffer;
+    key = mux_command_buffer;
     command_queue_should_destroy_command_buffer = true;
   }
 
 #ifdef OCL_EXTENSION_cl_khr_command_buffer_mutable_dispatch
-  for (_cl_command_buffer_khr::UpdateInfo &update : command_buffer->updates) {
-    const unsigned num_args = update.indices.size();
-    auto mux_error =
-        muxUpdateDescriptors(mux_command_buffer, update.id, num_args,
-                             update.indices.data(), update.descriptors.data());
-    if (mux_error) {
-      return cl::getErrorFrom(mux_error);
+  for (auto *mutable_command : command_buffer->updated_commands) {
+    if (auto error =
+            mutable_command->applyArgumentUpdates(mux_command_buffer)) {
+      return error;
     }
   }
-  command_buffer->updates.clear();
+  command_buffer->updated_commands.clear();
 #endif
 
   // Since we can't do any batching with user command buffers we can just wait
@@ -1414,10 +1704,13 @@ cl::EnqueueMarker(cl_command_queue command_queue, cl_event *event) {
   // an in order queue). Since the queue is in order, we know that any event
   // dependencies requested by the user will still be respected. This will not
   // work for cross queue event dependencies (see CA-3276).
+  if (auto error = addPendingDispatch(key)) {
+    return error;
+  }
   if (!pending_command_buffers.empty()) {
     auto &signal_semaphore =
         pending_dispatches[pending_command_buffers.back()].signal_semaphore;
-    if (pending_dispatches[mux_command_buffer].wait_semaphores.push_back(
+    if (pending_dispatches[key].wait_semaphores.push_back(
             signal_semaphore)) {
       return CL_OUT_OF_RESOURCES;
     } else {
@@ -1427,11 +1720,15 @@ cl::EnqueueMarker(cl_command_queue command_queue, cl_event *event) {
 
   // Add the underlying mux_command_buffer associated to the
   // cl_command_buffer_khr to the list of pending command buffers.
-  if (pending_command_buffers.push_back(mux_command_buffer)) {
+  if (pending_command_buffers.empty()) {
+    batch_start = std::chrono::steady_clock::now();
+  }
+  if (pending_command_buffers.push_back(key)) {
     // We won't destroy the mux_command_buffer here since that is the
     // responsibility of the command buffer.
     return CL_OUT_OF_HOST_MEMORY;
   }
+  updateInFlight();
 
   // Create a semaphore which future command buffers can wait for.
   auto semaphore = createSemaphore();
@@ -1441,11 +1738,12 @@ cl::EnqueueMarker(cl_command_queue command_queue, cl_event *event) {
 
   // Add the signal semaphore and wait/signal events to the pending dispatch
   // object used to track this command buffer before it is dispatched.
-  auto &dispatch = pending_dispatches[mux_command_buffer];
+  auto &dispatch = pending_dispatches[key];
   dispatch.signal_semaphore = *semaphore;
   dispatch.is_user_command_buffer = true;
   dispatch.should_destroy_command_buffer =
       command_queue_should_destroy_command_buffer;
+  dispatch.is_replay = 0 != key.replay;
 
   if (auto error =
           dispatch.addWaitEvents({event_wait_list, num_events_in_wait_list})) {
@@ -1475,7 +1773,7 @@ cl::EnqueueMarker(cl_command_queue command_queue, cl_event *event) {
 
   // We need to wait on all running commands to enforce ordering.
   for (auto &running_command_buffer : running_command_buffers) {
-    if (pending_dispatches[mux_command_buffer].wait_semaphores.push_back(
+    if (pending_dispatches[key].wait_semaphores.push_back(
             running_command_buffer.signal_semaphore)) {
       releaseSemaphore(*semaphore);
       return CL_OUT_OF_HOST_MEMORY;
@@ -1489,7 +1787,7 @@ cl::EnqueueMarker(cl_command_queue command_queue, cl_event *event) {
 
   // Release the reference once the dispatch completes.
   guard.dismiss();
-  user_command_buffers[mux_command_buffer] = command_buffer;
+  user_command_buffers[key] = command_buffer;
 
   return CL_SUCCESS;
 }
@@ -373,6 +373,16 @@ CL_API_ENTRY cl_int CL_API_CALL cl::ReleaseContext(cl_context context) {
   const tracer::TraceGuard<tracer::OpenCL> guard("clReleaseContext");
   OCL_CHECK(!context, return CL_INVALID_CONTEXT);
 
+#ifdef OCL_EXTENSION_cl_intel_unified_shared_memory
+  // Allocations cached in the USM pool hold internal references to the
+  // context, drop them with the last external reference so it can be
+  // destroyed.
+  if (1 == context->refCountExternal()) {
+    const std::lock_guard<std::shared_mutex> lock(context->usm_mutex);
+    extension::usm::clearPool(context);
+  }
+#endif
+
   return cl::releaseExternal(context);
 }
 
@@ -20,10 +20,61 @@
 #include <cl/event.h>
 #include <cl/macros.h>
 #include <cl/mux.h>
+#include <cl/printf.h>
 #include <cl/validate.h>
 #include <tracer/tracer.h>
 #include <utils/system.h>
 
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <thread>
+
+namespace {
+/// @brief Default time a waiting thread polls before blocking.
+constexpr std::chrono::microseconds default_spin_duration{20};
+
+/// @brief Returns how long a waiting thread polls for events to complete
+/// before blocking, set with the `CA_CL_EVENT_SPIN_US` environment variable.
+std::chrono::microseconds getSpinDuration() {
+  static const std::chrono::microseconds duration = [] {
+    if (const char *env = std::getenv("CA_CL_EVENT_SPIN_US")) {
+      return std::chrono::microseconds(std::max(0, std::atoi(env)));
+    }
+    return default_spin_duration;
+  }();
+  return duration;
+}
+
+/// @brief Polls a predicate until it holds or the spin duration elapses.
+///
+/// Yields between polls so a spinning thread doesn't starve the threads which
+/// are executing the commands being waited on.
+///
+/// @return True if the predicate holds, false if the caller should block.
+template <class Predicate>
+bool spinUntil(Predicate done) {
+  const auto duration = getSpinDuration();
+  if (done()) {
+    return true;
+  }
+  if (0 == duration.count()) {
+    return false;
+  }
+  const auto deadline = std::chrono::steady_clock::now() + duration;
+  do {
+    // Checking the clock costs more than checking the predicate.
+    for (int i = 0; i < 16; i++) {
+      std::this_thread::yield();
+      if (done()) {
+        return true;
+      }
+    }
+  } while (std::chrono::steady_clock::now() < deadline);
+  return false;
+}
+}  // namespace
+
 cargo::expected<cl_event, cl_int> _cl_event::create(
     cl_command_queue queue, const cl_command_type type) {
   OCL_ASSERT(queue != nullptr, "queue must not be null");
@@ -108,6 +159,11 @@ bool _cl_event::addCallback(const cl_int type,
   return true;
 }
 
+bool _cl_event::hasCallbacks() {
+  const std::lock_guard<std::mutex> callback_lock(callback_mutex);
+  return !callbacks.empty();
+}
+
 void _cl_event::submitted() {
   if (profiling.enabled) {
     profiling.submit = utils::timestampNanoSeconds();
@@ -127,15 +183,71 @@ void _cl_event::complete(const cl_int status) {
   clear();
 
   wait_complete_condition.notify_all();
+  for (auto group : wait_groups) {
+    group->signal();
+  }
+  wait_groups.clear();
 }
 
 void _cl_event::wait() {
+  if (spinUntil([this] { return CL_COMPLETE >= command_status; })) {
+    // complete() publishes the status before running the callbacks under the
+    // mutex, don't return until they have run.
+    const std::lock_guard<std::mutex> signal_lock(wait_complete_mutex);
+    return;
+  }
   std::unique_lock<std::mutex> signal_lock(wait_complete_mutex);
   while (CL_COMPLETE < command_status) {
     wait_complete_condition.wait(signal_lock);
   }
 }
 
+void _cl_event::waitAll(cl_uint num_events, const cl_event *events) {
+  const auto all_complete = [num_events, events] {
+    return std::all_of(events, events + num_events, [](cl_event event) {
+      return CL_COMPLETE >= event->command_status;
+    });
+  };
+  if (spinUntil(all_complete)) {
+    // As in wait(), don't return until the events' callbacks have run.
+    for (cl_uint i = 0; i < num_events; i++) {
+      const std::lock_guard<std::mutex> signal_lock(
+          events[i]->wait_complete_mutex);
+    }
+    return;
+  }
+
+  wait_group_t group;
+  group.remaining = num_events;
+  for (cl_uint i = 0; i < num_events; i++) {
+    const cl_event event = events[i];
+    std::unique_lock<std::mutex> signal_lock(event->wait_complete_mutex);
+    if (CL_COMPLETE < event->command_status) {
+      if (cargo::success == event->wait_groups.push_back(&group)) {
+        continue;
+      }
+      // Out of memory, fall back to waiting on the event directly.
+      while (CL_COMPLETE < event->command_status) {
+        event->wait_complete_condition.wait(signal_lock);
+      }
+    }
+    signal_lock.unlock();
+    group.signal();
+  }
+
+  // Events signal the group under its mutex, so once the count is observed
+  // to reach zero under the same mutex no event will touch the group again.
+  std::unique_lock<std::mutex> lock(group.mutex);
+  group.condition.wait(lock, [&group] { return 0 == group.remaining; });
+}
+
+void _cl_event::wait_group_t::signal() {
+  const std::lock_guard<std::mutex> lock(mutex);
+  if (0 == --remaining) {
+    condition.notify_all();
+  }
+}
+
 void _cl_event::clear() {
   OCL_ASSERT(cl::isUserEvent(this) || CL_COMPLETE >= command_status.load(),
              "Function removes all callbacks regardless of if their status has "
@@ -239,8 +351,6 @@ CL_API_ENTRY cl_int CL_API_CALL cl::WaitForEvents(cl_uint num_events,
   for (cl_uint i = 0; i < num_events; i++) {
     // if the event belonged to a queue
     if (nullptr != event_list[i]->queue) {
-      const std::lock_guard<std::mutex> lock(
-          event_list[i]->queue->context->getCommandQueueMutex());
       const cl_int result = event_list[i]->queue->flush();
 
       if (CL_SUCCESS != result) {
@@ -256,8 +366,10 @@ CL_API_ENTRY cl_int CL_API_CALL cl::WaitForEvents(cl_uint num_events,
   }
 
   // if we are waiting on more than one queue we have to wait on each event
-  // separately
+  // separately, but block until they are all complete first so this thread is
+  // only woken once
   if (moreThanOneQueue || userEventInList) {
+    _cl_event::waitAll(num_events, event_list);
     for (cl_uint i = 0; i < num_events; i++) {
       // if the event did not belong to a queue
       if (nullptr == event_list[i]->queue) {
@@ -279,6 +391,10 @@ CL_API_ENTRY cl_int CL_API_CALL cl::WaitForEvents(cl_uint num_events,
     }
   }
 
+  // Printf output of the completed kernels is printed asynchronously, make
+  // sure it has all been printed before returning.
+  flushPrintfOutput(event_list[0]->context->devices[0]->platform);
+
   for (cl_uint i = 0; i < num_events; i++) {
     OCL_CHECK(0 > (event_list[i]->command_status),
               return CL_EXEC_STATUS_ERROR_FOR_EVENTS_IN_WAIT_LIST);
@@ -353,6 +469,11 @@ cl::SetEventCallback(cl_event event, cl_int command_exec_callback_type,
                                           pfn_event_notify, user_data);
   OCL_CHECK(!success, return CL_OUT_OF_HOST_MEMORY);
 
+  // The callback may be what the application waits on, so don't leave the
+  // event's command behind a batched flush.
+  if (event->queue) {
+    return event->queue->flushDeferred();
+  }
   return CL_SUCCESS;
 }
 
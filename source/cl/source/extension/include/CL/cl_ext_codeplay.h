@@ -140,6 +140,26 @@ typedef struct cl_performance_counter_result_codeplay {
   };
 } cl_performance_counter_result_codeplay;
 
+/*************************
+ * cl_codeplay_usm_pool *
+ *************************/
+
+/// @brief Accepted as a property by the `cl_intel_unified_shared_memory`
+/// allocation entry points, taking a `cl_bool` value. When `CL_FALSE` the
+/// allocation is neither served from nor returned to the context's pool of
+/// freed allocations. Defaults to `CL_TRUE`.
+#define CL_MEM_ALLOC_POOLED_CODEPLAY 0x4263
+
+/**************************
+ * cl_codeplay_queue_debug *
+ *************************/
+
+/// @brief Accepted as `param_name` parameter to `clGetCommandQueueInfo`,
+/// returns a `cl_ulong` count of the mux command buffers, fences and
+/// semaphores the command queue has created over its lifetime. Objects
+/// recycled from the command queue's caches are not counted.
+#define CL_QUEUE_MUX_ALLOCATIONS_CODEPLAY 0x4264
+
 /******************
  * cl_codeplay_wfv *
  ******************/
@@ -28,6 +28,7 @@
 #include <extension/extension.h>
 #include <mux/mux.h>
 
+#include <memory>
 #include <mutex>
 
 namespace extension {
@@ -132,6 +133,12 @@ class allocation_info {
   const cl_context context;
   /// @brief Size in bytes of the requested device allocation.
   size_t size;
+  /// @brief Size in bytes of the memory backing the allocation, larger than
+  /// `size` when the allocation was rounded up to a pool size class.
+  size_t capacity;
+  /// @brief Whether the allocation is returned to the context's USM pool
+  /// rather than destroyed when freed.
+  bool pooled;
   /// @brief Pointer returned by USM allocation entry points
   void *base_ptr;
   /// @brief Properties set on allocation
@@ -339,6 +346,14 @@ class shared_allocation_info final : public allocation_info {
   mux_buffer_t mux_buffer;
 };
 
+/// @brief Properties passed to the USM allocation entry points.
+struct alloc_properties_t final {
+  /// @brief Bitfield of flags set for the CL_MEM_ALLOC_FLAGS_INTEL property.
+  cl_mem_alloc_flags_intel flags = 0;
+  /// @brief Value of the CL_MEM_ALLOC_POOLED_CODEPLAY property.
+  bool pooled = true;
+};
+
 /// @brief Validates properties passed to the USM allocation entry points for
 /// correctness, returning memory allocation flags so they can be stored for
 /// later user queries.
@@ -346,22 +361,88 @@ class shared_allocation_info final : public allocation_info {
 /// @param[in] properties NULL terminated list of properties passed to
 /// allocation entry points.
 ///
-/// @return Bitfield of flags set for CL_MEM_ALLOC_FLAGS_INTEL property, or
-/// an OpenCL error code if properties are malformed according to extension
-/// spec.
-cargo::expected<cl_mem_alloc_flags_intel, cl_int> parseProperties(
+/// @return Parsed properties, or an OpenCL error code if properties are
+/// malformed according to extension spec.
+cargo::expected<alloc_properties_t, cl_int> parseProperties(
     const cl_mem_properties_intel *properties, bool is_shared);
 
 /// @brief Finds if a pointer belongs to the memory addresses of any USM memory
 /// allocations existing in the context.
 ///
+/// USM allocations never overlap and `_cl_context::usm_allocations` is kept
+/// sorted by base address, so this is a binary search for the last allocation
+/// starting at or before @p ptr.
+///
 /// @param[in] context Context containing list of USM allocations to search.
 /// @param[in] ptr Pointer to find an owning USM allocation for.
 ///
-/// @note this is not thread safe and a USM mutex should be used above it.
+/// @note this is not thread safe and a USM mutex should be used above it, a
+/// shared lock is sufficient.
 /// @return Pointer to matching allocation on success, or nullptr on failure.
 allocation_info *findAllocation(const cl_context context, const void *ptr);
 
+/// @brief Adds a USM allocation to the context, maintaining address order.
+///
+/// @param[in] context Context to add the USM allocation to.
+/// @param[in] usm_alloc Allocation to take ownership of.
+///
+/// @note this is not thread safe and an exclusive lock on the USM mutex should
+/// be held above it.
+/// @return The base pointer of the allocation, or nullptr if out of memory.
+void *insertAllocation(const cl_context context,
+                       std::unique_ptr<allocation_info> usm_alloc);
+
+/// @brief Removes a USM allocation owned by the context.
+///
+/// Pooled allocations are moved to `_cl_context::usm_pool` for reuse by a
+/// later allocation of the same size class, all others are destroyed.
+///
+/// @param[in] context Context owning @p usm_alloc.
+/// @param[in] usm_alloc Allocation previously returned by `findAllocation`.
+///
+/// @note this is not thread safe and an exclusive lock on the USM mutex should
+/// be held above it.
+void eraseAllocation(const cl_context context,
+                     const allocation_info *usm_alloc);
+
+/// @brief Rounds an allocation size up to the size class it is pooled in.
+///
+/// Size classes are powers of two, sizes too large to be pooled are returned
+/// unchanged.
+///
+/// @param[in] size Size in bytes of the requested allocation.
+///
+/// @return Size in bytes of the memory backing a pooled allocation.
+size_t getPoolSizeClass(size_t size);
+
+/// @brief Takes a free allocation out of the context's USM pool.
+///
+/// Freed allocations are only reused once every command recorded against them
+/// has completed, so a free while commands are in flight never hands their
+/// memory to a new allocation.
+///
+/// @param[in] context Context owning the pool.
+/// @param[in] type Memory type the allocation must have.
+/// @param[in] device Device the allocation must be associated with, may be
+/// null for host and shared allocations without a device.
+/// @param[in] size Size in bytes of the requested allocation.
+/// @param[in] alignment Minimum alignment in bytes of the allocation.
+///
+/// @note Takes an exclusive lock on the USM mutex, which must not be held by
+/// the caller.
+/// @return The reused allocation, or nullptr if the pool has no match.
+std::unique_ptr<allocation_info> takePooledAllocation(
+    const cl_context context, cl_unified_shared_memory_type_intel type,
+    const cl_device_id device, size_t size, cl_uint alignment);
+
+/// @brief Destroys all allocations cached in the context's USM pool.
+///
+/// @param[in] context Context owning the pool.
+///
+/// @note this is not thread safe and an exclusive lock on the USM mutex should
+/// be held above it.
+void clearPool(const cl_context context);
+
 /// @brief Checks if an OpenCL device can support device USM allocations, a
 /// mandatory feature of the extension specification.
 ///
@@ -23,7 +23,6 @@
 #define CL_EXTENSION_KHR_COMMAND_BUFFER_H_INCLUDED
 
 #include <CL/cl_ext.h>
-#include <cargo/dynamic_array.h>
 #include <cargo/small_vector.h>
 #include <cl/base.h>
 #include <cl/command_queue.h>
@@ -127,6 +126,42 @@ struct _cl_mutable_command_khr final {
   std::array<size_t, 3> global_size = {0, 0, 0};
   /// @brief Local work size used on mutable-dispatch creation
   std::array<size_t, 3> local_size = {0, 0, 0};
+
+  /// @brief Record an update of a kernel argument, to be applied to the mux
+  /// command buffer on the next enqueue.
+  ///
+  /// An earlier pending update of the same argument is overwritten in place, so
+  /// each argument is patched at most once per enqueue. Plain old data values
+  /// are copied, the descriptor need not outlive this call.
+  ///
+  /// @param[in] index Index of the kernel argument to update.
+  /// @param[in] descriptor New descriptor of the kernel argument.
+  ///
+  /// @return CL_SUCCESS or CL_OUT_OF_HOST_MEMORY.
+  cl_int setArgumentUpdate(uint64_t index, mux_descriptor_info_s descriptor);
+
+  /// @brief Patch the pending argument updates into a mux command buffer and
+  /// clear them.
+  ///
+  /// The storage of the pending updates is kept for reuse by the next update.
+  ///
+  /// @param[in] mux_command_buffer Command buffer to patch.
+  ///
+  /// @return CL_SUCCESS or appropriate OpenCL error code.
+  cl_int applyArgumentUpdates(mux_command_buffer_t mux_command_buffer);
+
+  /// @brief Returns true if there are argument updates waiting to be applied.
+  bool hasArgumentUpdates() const { return !update_indices.empty(); }
+
+ private:
+  /// @brief Indices of the kernel arguments with a pending update.
+  cargo::small_vector<uint64_t, 4> update_indices;
+  /// @brief New descriptor of each argument in `update_indices`.
+  cargo::small_vector<mux_descriptor_info_s, 4> update_descriptors;
+  /// @brief Offset into `update_data` of each plain old data argument value.
+  cargo::small_vector<size_t, 4> update_offsets;
+  /// @brief Storage for the plain old data argument values.
+  cargo::small_vector<uint8_t, 64> update_data;
 };
 
 /// @brief Definition of the OpenCL cl_command_buffer_khr object.
@@ -232,17 +267,10 @@ struct _cl_command_buffer_khr final : public cl::base<_cl_command_buffer_khr> {
   cargo::small_vector<std::unique_ptr<_cl_mutable_command_khr>, 2>
       command_handles;
 
-  struct UpdateInfo final {
-    // Storage for descriptors of each argument that is getting updated.
-    cargo::dynamic_array<mux_descriptor_info_s> descriptors;
-    // Storage for the indices of each arguments that is getting updated.
-    cargo::dynamic_array<uint64_t> indices;
-    // Storage for any pointers referenced by descriptors.
-    cargo::dynamic_array<const void *> pointers;
-    // ID of mutable command
-    cl_uint id;
-  };
-  cargo::small_vector<UpdateInfo, 1> updates;
+  /// @brief Mutable commands with argument updates waiting to be applied on
+  /// the next enqueue, each command is listed once however often it is
+  /// updated.
+  cargo::small_vector<_cl_mutable_command_khr *, 8> updated_commands;
 
   /// @brief Mutex to protect the state of the command-buffer.
   std::mutex mutex;
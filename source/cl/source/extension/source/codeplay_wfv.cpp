@@ -115,6 +115,12 @@ cl_int CL_API_CALL clGetKernelWFVInfoCODEPLAY(
     return error;
   }
 
+  // Create the kernel for the device if this is its first use there.
+  auto device_kernel = kernel->getDeviceKernel(device);
+  if (!device_kernel) {
+    return device_kernel.error();
+  }
+
   if (auto error = kernel->checkWorkSizes(device, work_dim, nullptr,
                                           global_work_size, local_work_size)) {
     return error;
@@ -126,8 +132,12 @@ cl_int CL_API_CALL clGetKernelWFVInfoCODEPLAY(
   if (local_work_size) {
     std::copy_n(local_work_size, work_dim, std::begin(final_local_work_size));
   } else {
-    final_local_work_size =
+    auto default_local_size =
         kernel->getDefaultLocalSize(device, global_work_size, work_dim);
+    if (!default_local_size) {
+      return default_local_size.error();
+    }
+    final_local_work_size = *default_local_size;
   }
 
   size_t size;
@@ -159,7 +169,7 @@ cl_int CL_API_CALL clGetKernelWFVInfoCODEPLAY(
     // remainder of this function.
     const uint32_t max_work_width = [&] {
       const std::lock_guard<std::mutex> context_guard(context->mutex);
-      return kernel->device_kernel_map[device]->getDynamicWorkWidth(
+      return (*device_kernel)->getDynamicWorkWidth(
           final_local_work_size[0], final_local_work_size[1],
           final_local_work_size[2]);
     }();
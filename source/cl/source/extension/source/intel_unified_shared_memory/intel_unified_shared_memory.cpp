@@ -19,9 +19,13 @@
 #include <cl/device.h>
 #include <cl/event.h>
 #include <cl/kernel.h>
+#include <cl/macros.h>
 #include <cl/program.h>
 #include <extension/intel_unified_shared_memory.h>
 
+#include <algorithm>
+#include <functional>
+
 namespace extension {
 #ifdef OCL_EXTENSION_cl_intel_unified_shared_memory
 namespace usm {
@@ -39,16 +43,25 @@ constexpr bool areMultipleBitsSet(T value) {
   return value && (value & (value - 1)) != 0;
 };
 
-cargo::expected<cl_mem_alloc_flags_intel, cl_int> parseProperties(
+cargo::expected<alloc_properties_t, cl_int> parseProperties(
     const cl_mem_properties_intel *properties, bool is_shared) {
-  cl_mem_alloc_flags_intel alloc_flags = 0;
+  alloc_properties_t alloc_properties;
   if (properties && properties[0] != 0) {
     auto current = properties;
     cl_mem_properties_intel seen = 0;
+    bool seen_pooled = false;
     do {
       const cl_mem_properties_intel property = current[0];
       const cl_mem_properties_intel value = current[1];
       switch (property) {
+        case CL_MEM_ALLOC_POOLED_CODEPLAY: {
+          if (seen_pooled || (value != CL_TRUE && value != CL_FALSE)) {
+            return cargo::make_unexpected(CL_INVALID_PROPERTY);
+          }
+          seen_pooled = true;
+          alloc_properties.pooled = CL_TRUE == value;
+          break;
+        }
         case CL_MEM_ALLOC_FLAGS_INTEL: {
           if (0 == (seen & CL_MEM_ALLOC_FLAGS_INTEL)) {
             constexpr auto PLACEMENT =
@@ -70,7 +83,7 @@ cargo::expected<cl_mem_alloc_flags_intel, cl_int> parseProperties(
             }
 
             seen |= property;
-            alloc_flags = value;
+            alloc_properties.flags = value;
             break;
           }
           // Fallthrough to error if we've seen property already
@@ -82,22 +95,199 @@ cargo::expected<cl_mem_alloc_flags_intel, cl_int> parseProperties(
       current += 2;
     } while (current[0] != 0);
   }
-  return alloc_flags;
+  return alloc_properties;
 }
 
+namespace {
+/// @brief Smallest size class of the USM pool.
+constexpr size_t pool_min_size_class = 256;
+/// @brief Largest size class of the USM pool, bigger allocations are made
+/// directly since their allocation cost is dwarfed by their use.
+constexpr size_t pool_max_size_class = 1024 * 1024;
+/// @brief Maximum number of bytes a context's USM pool caches.
+constexpr size_t pool_max_size = 64 * 1024 * 1024;
+/// @brief Maximum number of allocations a context's USM pool caches, bounding
+/// the cost of searching it.
+constexpr size_t pool_max_entries = 256;
+
+/// @brief Checks whether all commands recorded against an allocation have
+/// completed, releasing the events of those which have.
+///
+/// @return True if the allocation has no commands in flight, false otherwise.
+bool pruneCompletedCommands(allocation_info &usm_alloc) {
+  const std::lock_guard<std::mutex> guard(usm_alloc.mutex);
+  auto &events = usm_alloc.queued_commands;
+  auto in_flight = std::stable_partition(
+      events.begin(), events.end(),
+      [](cl_event event) { return event->command_status > CL_COMPLETE; });
+  for (auto event = in_flight; event != events.end(); ++event) {
+    cl::releaseInternal(*event);
+  }
+  events.erase(in_flight, events.end());
+  return events.empty();
+}
+
+/// @brief Orders USM allocations by base address.
+///
+/// Compares via `std::less` since relational operators on unrelated pointers
+/// are unspecified.
+struct base_ptr_less {
+  bool operator()(const void *ptr,
+                  const std::unique_ptr<allocation_info> &usm_alloc) const {
+    return std::less<const void *>{}(ptr, usm_alloc->base_ptr);
+  }
+  bool operator()(const std::unique_ptr<allocation_info> &usm_alloc,
+                  const void *ptr) const {
+    return std::less<const void *>{}(usm_alloc->base_ptr, ptr);
+  }
+};
+}  // namespace
+
 allocation_info *findAllocation(const cl_context context, const void *ptr) {
   // Note this is not thread safe and the usm mutex should be locked above this.
-  auto ownsUsmPtr = [ptr](const std::unique_ptr<allocation_info> &usm_alloc) {
-    return usm_alloc->isOwnerOf(ptr);
-  };
+  auto &usm_allocations = context->usm_allocations;
+
+  // Find the first allocation starting after ptr, the only candidate owner is
+  // the one immediately before it.
+  auto usm_alloc_itr = std::upper_bound(
+      usm_allocations.begin(), usm_allocations.end(), ptr, base_ptr_less{});
+  if (usm_alloc_itr == usm_allocations.begin()) {
+    return nullptr;
+  }
+  --usm_alloc_itr;
+  return (*usm_alloc_itr)->isOwnerOf(ptr) ? usm_alloc_itr->get() : nullptr;
+}
 
-  auto usm_alloc_itr = std::find_if(context->usm_allocations.begin(),
-                                    context->usm_allocations.end(), ownsUsmPtr);
+void *insertAllocation(const cl_context context,
+                       std::unique_ptr<allocation_info> usm_alloc) {
+  auto &usm_allocations = context->usm_allocations;
+  void *base_ptr = usm_alloc->base_ptr;
+  auto position = std::upper_bound(usm_allocations.begin(),
+                                   usm_allocations.end(), base_ptr,
+                                   base_ptr_less{});
+  if (!usm_allocations.insert(position, std::move(usm_alloc))) {
+    return nullptr;
+  }
+  return base_ptr;
+}
 
-  const bool found = usm_alloc_itr != context->usm_allocations.end();
-  return found ? usm_alloc_itr->get() : nullptr;
+void eraseAllocation(const cl_context context,
+                     const allocation_info *usm_alloc) {
+  auto &usm_allocations = context->usm_allocations;
+  auto usm_alloc_itr =
+      std::lower_bound(usm_allocations.begin(), usm_allocations.end(),
+                       usm_alloc->base_ptr, base_ptr_less{});
+  OCL_ASSERT(usm_alloc_itr != usm_allocations.end() &&
+                 usm_alloc_itr->get() == usm_alloc,
+             "USM allocation is not owned by the context");
+
+  if (usm_alloc->pooled) {
+    auto &usm_pool = context->usm_pool;
+    // Make room by evicting the oldest idle allocations, if that isn't
+    // possible the allocation being freed is destroyed instead.
+    auto full = [&] {
+      return usm_pool.size() >= pool_max_entries ||
+             context->usm_pool_size + usm_alloc->capacity > pool_max_size;
+    };
+    for (auto pooled = usm_pool.begin(); full() && pooled != usm_pool.end();) {
+      if (pruneCompletedCommands(**pooled)) {
+        context->usm_pool_size -= (*pooled)->capacity;
+        pooled = usm_pool.erase(pooled);
+      } else {
+        ++pooled;
+      }
+    }
+    if (!full() && usm_pool.push_back(std::move(*usm_alloc_itr)) ==
+                       cargo::success) {
+      context->usm_pool_size += usm_alloc->capacity;
+    }
+  }
+  usm_allocations.erase(usm_alloc_itr);
 }
 
+size_t getPoolSizeClass(size_t size) {
+  if (size > pool_max_size_class) {
+    return size;
+  }
+  size_t size_class = pool_min_size_class;
+  while (size_class < size) {
+    size_class <<= 1;
+  }
+  return size_class;
+}
+
+std::unique_ptr<allocation_info> takePooledAllocation(
+    const cl_context context, cl_unified_shared_memory_type_intel type,
+    const cl_device_id device, size_t size, cl_uint alignment) {
+  const size_t capacity = getPoolSizeClass(size);
+  if (capacity > pool_max_size_class) {
+    return nullptr;
+  }
+
+  const std::lock_guard<std::shared_mutex> guard(context->usm_mutex);
+  auto &usm_pool = context->usm_pool;
+  // Search most recently freed first, they are the most likely to be idle and
+  // still in cache.
+  for (auto pooled = usm_pool.end(); pooled != usm_pool.begin();) {
+    --pooled;
+    allocation_info &usm_alloc = **pooled;
+    const auto address = reinterpret_cast<uintptr_t>(usm_alloc.base_ptr);
+    if (usm_alloc.capacity != capacity || usm_alloc.getMemoryType() != type ||
+        usm_alloc.getDevice() != device ||
+        (alignment && (address & (alignment - 1)) != 0)) {
+      continue;
+    }
+    if (!pruneCompletedCommands(usm_alloc)) {
+      continue;
+    }
+    std::unique_ptr<allocation_info> reused = std::move(*pooled);
+    usm_pool.erase(pooled);
+    context->usm_pool_size -= capacity;
+    reused->size = size;
+    return reused;
+  }
+  return nullptr;
+}
+
+void clearPool(const cl_context context) {
+  context->usm_pool.clear();
+  context->usm_pool_size = 0;
+}
+
+namespace {
+/// @brief Reuses an allocation from the context's USM pool if permitted by
+/// the allocation properties.
+///
+/// @tparam T Derived allocation type matching @p type.
+///
+/// @return The reused allocation, or nullptr if a new one must be made.
+template <class T>
+std::unique_ptr<T> reusePooledAllocation(
+    cl_context context, cl_unified_shared_memory_type_intel type,
+    cl_device_id device, const alloc_properties_t &alloc_properties,
+    size_t size, cl_uint alignment) {
+  if (!alloc_properties.pooled) {
+    return nullptr;
+  }
+  auto reused = takePooledAllocation(context, type, device, size, alignment);
+  if (!reused) {
+    return nullptr;
+  }
+  reused->alloc_flags = alloc_properties.flags;
+  return std::unique_ptr<T>(static_cast<T *>(reused.release()));
+}
+
+/// @brief Rounds a new allocation up to its pool size class if it may be
+/// returned to the context's USM pool once freed.
+void setPooled(allocation_info &usm_alloc,
+               const alloc_properties_t &alloc_properties) {
+  if (alloc_properties.pooled && usm_alloc.size <= pool_max_size_class) {
+    usm_alloc.pooled = true;
+    usm_alloc.capacity = getPoolSizeClass(usm_alloc.size);
+  }
+}
+}  // namespace
+
 bool deviceSupportsDeviceAllocations(cl_device_id device) {
   const auto device_info = device->mux_device->info;
   return device_info->allocation_capabilities &
@@ -183,7 +373,12 @@ cl_int createBlockingEventForKernel(cl_command_queue queue, cl_kernel kernel,
 }
 
 allocation_info::allocation_info(const cl_context context, const size_t size)
-    : context(context), size(size), base_ptr(nullptr), alloc_flags(0) {
+    : context(context),
+      size(size),
+      capacity(size),
+      pooled(false),
+      base_ptr(nullptr),
+      alloc_flags(0) {
   cl::retainInternal(context);
 }
 
@@ -258,6 +453,12 @@ host_allocation_info::create(cl_context context,
     return cargo::make_unexpected(alloc_properties.error());
   }
 
+  if (auto reused = reusePooledAllocation<host_allocation_info>(
+          context, CL_MEM_TYPE_HOST_INTEL, nullptr, *alloc_properties, size,
+          alignment)) {
+    return reused;
+  }
+
   auto usm_alloc = std::unique_ptr<host_allocation_info>(
       new (std::nothrow) host_allocation_info(context, size));
   OCL_CHECK(!usm_alloc, return cargo::make_unexpected(CL_OUT_OF_HOST_MEMORY));
@@ -265,16 +466,17 @@ host_allocation_info::create(cl_context context,
   OCL_CHECK(nullptr == usm_alloc,
             return cargo::make_unexpected(CL_OUT_OF_HOST_MEMORY));
 
+  setPooled(*usm_alloc, *alloc_properties);
   const cl_int error = usm_alloc->allocate(alignment);
   OCL_CHECK(error != CL_SUCCESS, return cargo::make_unexpected(error));
 
-  usm_alloc->alloc_flags = alloc_properties.value();
+  usm_alloc->alloc_flags = alloc_properties->flags;
 
   return usm_alloc;
 }
 
 cl_int host_allocation_info::allocate(cl_uint alignment) {
-  base_ptr = cargo::alloc(size, alignment);
+  base_ptr = cargo::alloc(capacity, alignment);
   if (base_ptr == nullptr) {
     return CL_OUT_OF_HOST_MEMORY;
   }
@@ -297,13 +499,13 @@ cl_int host_allocation_info::allocate(cl_uint alignment) {
     }
 
     // Initialize the Mux objects needed by each device
-    if (muxCreateBuffer(device->mux_device, size, device->mux_allocator,
+    if (muxCreateBuffer(device->mux_device, capacity, device->mux_allocator,
                         &mux_buffers[index])) {
       return CL_OUT_OF_HOST_MEMORY;
     }
 
     mux_result_t mux_error =
-        muxCreateMemoryFromHost(device->mux_device, size, base_ptr,
+        muxCreateMemoryFromHost(device->mux_device, capacity, base_ptr,
                                 device->mux_allocator, &mux_memories[index]);
     if (mux_error) {
       return CL_OUT_OF_RESOURCES;
@@ -374,14 +576,21 @@ device_allocation_info::create(cl_context context, cl_device_id device,
     alignment = device_align;
   }
 
+  if (auto reused = reusePooledAllocation<device_allocation_info>(
+          context, CL_MEM_TYPE_DEVICE_INTEL, device, *alloc_properties, size,
+          alignment)) {
+    return reused;
+  }
+
   auto usm_alloc = std::unique_ptr<device_allocation_info>(
       new (std::nothrow) device_allocation_info(context, device, size));
   OCL_CHECK(!usm_alloc, return cargo::make_unexpected(CL_OUT_OF_HOST_MEMORY));
 
+  setPooled(*usm_alloc, *alloc_properties);
   const cl_int error = usm_alloc->allocate(alignment);
   OCL_CHECK(error != CL_SUCCESS, return cargo::make_unexpected(error));
 
-  usm_alloc->alloc_flags = alloc_properties.value();
+  usm_alloc->alloc_flags = alloc_properties->flags;
 
   return usm_alloc;
 }
@@ -390,15 +599,15 @@ cl_int device_allocation_info::allocate(cl_uint alignment) {
   // Allocation device local memory
   const uint32_t heap = 1;
   mux_result_t mux_error = muxAllocateMemory(
-      device->mux_device, size, heap, mux_memory_property_device_local,
+      device->mux_device, capacity, heap, mux_memory_property_device_local,
       mux_allocation_type_alloc_device, alignment, device->mux_allocator,
       &mux_memory);
   if (mux_error) {
     return CL_OUT_OF_RESOURCES;
   }
 
-  mux_error = muxCreateBuffer(device->mux_device, size, device->mux_allocator,
-                              &mux_buffer);
+  mux_error = muxCreateBuffer(device->mux_device, capacity,
+                              device->mux_allocator, &mux_buffer);
   if (mux_error) {
     return CL_OUT_OF_RESOURCES;
   }
@@ -510,6 +719,12 @@ shared_allocation_info::create(cl_context context, cl_device_id device,
     return cargo::make_unexpected(alloc_properties.error());
   }
 
+  if (auto reused = reusePooledAllocation<shared_allocation_info>(
+          context, CL_MEM_TYPE_SHARED_INTEL, device, *alloc_properties, size,
+          alignment)) {
+    return reused;
+  }
+
   auto usm_alloc = std::unique_ptr<shared_allocation_info>(
       new (std::nothrow) shared_allocation_info(context, device, size));
   OCL_CHECK(!usm_alloc, return cargo::make_unexpected(CL_OUT_OF_HOST_MEMORY));
@@ -518,21 +733,22 @@ shared_allocation_info::create(cl_context context, cl_device_id device,
   // NOTE: The specification says these are only hints, so we ignore them for
   // now
   bool prefers_host = true;
-  if (*alloc_properties & CL_MEM_ALLOC_INITIAL_PLACEMENT_DEVICE_INTEL) {
+  if (alloc_properties->flags & CL_MEM_ALLOC_INITIAL_PLACEMENT_DEVICE_INTEL) {
     prefers_host = false;
   }
   (void)prefers_host;
 
+  setPooled(*usm_alloc, *alloc_properties);
   const cl_int error = usm_alloc->allocate(alignment);
   OCL_CHECK(error != CL_SUCCESS, return cargo::make_unexpected(error));
 
-  usm_alloc->alloc_flags = alloc_properties.value();
+  usm_alloc->alloc_flags = alloc_properties->flags;
 
   return usm_alloc;
 }
 
 cl_int shared_allocation_info::allocate(cl_uint alignment) {
-  base_ptr = cargo::alloc(size, alignment);
+  base_ptr = cargo::alloc(capacity, alignment);
   if (base_ptr == nullptr) {
     return CL_OUT_OF_HOST_MEMORY;
   }
@@ -543,13 +759,14 @@ cl_int shared_allocation_info::allocate(cl_uint alignment) {
     }
 
     // Initialize the Mux objects needed by each device
-    if (muxCreateBuffer(device->mux_device, size, device->mux_allocator,
+    if (muxCreateBuffer(device->mux_device, capacity, device->mux_allocator,
                         &mux_buffer)) {
       return CL_OUT_OF_HOST_MEMORY;
     }
 
-    mux_result_t mux_error = muxCreateMemoryFromHost(
-        device->mux_device, size, base_ptr, device->mux_allocator, &mux_memory);
+    mux_result_t mux_error =
+        muxCreateMemoryFromHost(device->mux_device, capacity, base_ptr,
+                                device->mux_allocator, &mux_memory);
     if (mux_error) {
       return CL_OUT_OF_RESOURCES;
     }
@@ -659,7 +876,8 @@ cl_int intel_unified_shared_memory::SetKernelExecInfo(
       }
 
       const cl_context context = kernel->program->context;
-      const std::lock_guard<std::mutex> context_guard(context->usm_mutex);
+      const std::shared_lock<std::shared_mutex> context_guard(
+          context->usm_mutex);
       for (size_t i = 0; i < num_pointers; i++) {
         indirect_allocs[i] = usm::findAllocation(context, usm_pointers[i]);
       }
@@ -198,16 +198,17 @@ void *clHostMemAllocINTEL(cl_context context,
     return nullptr;
   }
 
-  // Lock context for pushing to list of usm allocations
-  const std::lock_guard<std::mutex> context_guard(context->usm_mutex);
-  if (context->usm_allocations.push_back(
-          std::move(new_usm_allocation.value()))) {
+  // Lock context for inserting into the list of usm allocations
+  const std::lock_guard<std::shared_mutex> context_guard(context->usm_mutex);
+  void *base_ptr = extension::usm::insertAllocation(
+      context, std::move(new_usm_allocation.value()));
+  if (!base_ptr) {
     OCL_SET_IF_NOT_NULL(errcode_ret, CL_OUT_OF_HOST_MEMORY);
     return nullptr;
   }
 
   OCL_SET_IF_NOT_NULL(errcode_ret, CL_SUCCESS);
-  return context->usm_allocations.back()->base_ptr;
+  return base_ptr;
 }
 
 CL_API_ENTRY
@@ -231,15 +232,16 @@ void *clDeviceMemAllocINTEL(cl_context context, cl_device_id device,
     return nullptr;
   }
 
-  // Lock context for pushing to list of usm allocations
-  const std::lock_guard<std::mutex> context_guard(context->usm_mutex);
-  if (context->usm_allocations.push_back(
-          std::move(new_usm_allocation.value()))) {
+  // Lock context for inserting into the list of usm allocations
+  const std::lock_guard<std::shared_mutex> context_guard(context->usm_mutex);
+  void *base_ptr = extension::usm::insertAllocation(
+      context, std::move(new_usm_allocation.value()));
+  if (!base_ptr) {
     OCL_SET_IF_NOT_NULL(errcode_ret, CL_OUT_OF_HOST_MEMORY);
     return nullptr;
   }
   OCL_SET_IF_NOT_NULL(errcode_ret, CL_SUCCESS);
-  return context->usm_allocations.back()->base_ptr;
+  return base_ptr;
 }
 
 CL_API_ENTRY
@@ -283,15 +285,16 @@ void *clSharedMemAllocINTEL(cl_context context, cl_device_id device,
     return nullptr;
   }
 
-  // Lock context for pushing to list of usm allocations
-  const std::lock_guard<std::mutex> context_guard(context->usm_mutex);
-  if (context->usm_allocations.push_back(
-          std::move(new_usm_allocation.value()))) {
+  // Lock context for inserting into the list of usm allocations
+  const std::lock_guard<std::shared_mutex> context_guard(context->usm_mutex);
+  void *base_ptr = extension::usm::insertAllocation(
+      context, std::move(new_usm_allocation.value()));
+  if (!base_ptr) {
     OCL_SET_IF_NOT_NULL(errcode_ret, CL_OUT_OF_HOST_MEMORY);
     return nullptr;
   }
   OCL_SET_IF_NOT_NULL(errcode_ret, CL_SUCCESS);
-  return context->usm_allocations.back()->base_ptr;
+  return base_ptr;
 }
 
 CL_API_ENTRY
@@ -302,20 +305,12 @@ cl_int clMemFreeINTEL(cl_context context, void *ptr) {
   OCL_CHECK(ptr == NULL, return CL_SUCCESS);
 
   // Lock context to ensure usm allocation iterators are valid
-  const std::lock_guard<std::mutex> context_guard(context->usm_mutex);
+  const std::lock_guard<std::shared_mutex> context_guard(context->usm_mutex);
 
-  auto isUsmPtr =
-      [ptr](const std::unique_ptr<extension::usm::allocation_info> &usm_alloc) {
-        return usm_alloc->base_ptr == ptr;
-      };
-
-  auto usm_alloc_iterator =
-      std::find_if(context->usm_allocations.begin(),
-                   context->usm_allocations.end(), isUsmPtr);
-
-  if (context->usm_allocations.end() != usm_alloc_iterator) {
+  auto usm_alloc = extension::usm::findAllocation(context, ptr);
+  if (usm_alloc && usm_alloc->base_ptr == ptr) {
     // Remove now empty shared pointer from list
-    context->usm_allocations.erase(usm_alloc_iterator);
+    extension::usm::eraseAllocation(context, usm_alloc);
   }
 
   return CL_SUCCESS;
@@ -329,24 +324,16 @@ cl_int clMemBlockingFreeINTEL(cl_context context, void *ptr) {
   OCL_CHECK(ptr == NULL, return CL_SUCCESS);
 
   // Lock context to ensure usm allocation iterators are valid
-  const std::lock_guard<std::mutex> context_guard(context->usm_mutex);
-
-  auto isUsmPtr =
-      [ptr](const std::unique_ptr<extension::usm::allocation_info> &usm_alloc) {
-        return usm_alloc->base_ptr == ptr;
-      };
+  const std::lock_guard<std::shared_mutex> context_guard(context->usm_mutex);
 
-  auto usm_alloc_iterator =
-      std::find_if(context->usm_allocations.begin(),
-                   context->usm_allocations.end(), isUsmPtr);
-
-  if (context->usm_allocations.end() == usm_alloc_iterator) {
+  auto usm_alloc = extension::usm::findAllocation(context, ptr);
+  if (!usm_alloc || usm_alloc->base_ptr != ptr) {
     return CL_SUCCESS;
   }
 
   // Implicitly flush all the queues that the events belong to
   std::unordered_set<_cl_command_queue *> flushed_queues;
-  auto &events = (*usm_alloc_iterator)->queued_commands;
+  auto &events = usm_alloc->queued_commands;
   for (auto &event : events) {
     auto queue = event->queue;
 
@@ -354,9 +341,6 @@ cl_int clMemBlockingFreeINTEL(cl_context context, void *ptr) {
     if (event->command_status == CL_QUEUED) {
       // Don't repeatedly flush queues we've already seen
       if (flushed_queues.count(queue) == 0) {
-        const std::lock_guard<std::mutex> lock(
-            queue->context->getCommandQueueMutex());
-
         const cl_int result = queue->flush();
 
         if (CL_SUCCESS != result) {
@@ -381,7 +365,7 @@ cl_int clMemBlockingFreeINTEL(cl_context context, void *ptr) {
   }
 
   // Remove now empty unique pointer from list
-  context->usm_allocations.erase(usm_alloc_iterator);
+  extension::usm::eraseAllocation(context, usm_alloc);
   return CL_SUCCESS;
 }
 
@@ -393,7 +377,7 @@ cl_int clGetMemAllocInfoINTEL(cl_context context, const void *ptr,
   const tracer::TraceGuard<tracer::OpenCL> trace(__func__);
 
   OCL_CHECK(!context, return CL_INVALID_CONTEXT);
-  const std::lock_guard<std::mutex> context_guard(context->usm_mutex);
+  const std::shared_lock<std::shared_mutex> context_guard(context->usm_mutex);
 
   const extension::usm::allocation_info *const usm_alloc =
       extension::usm::findAllocation(context, ptr);
@@ -503,7 +487,7 @@ cl_int MemFillImpl(cl_command_queue command_queue, void *dst_ptr,
   }
   cl_event return_event = *new_event;
 
-  const std::lock_guard<std::mutex> context_guard(
+  const std::shared_lock<std::shared_mutex> context_guard(
       command_queue->context->usm_mutex);
 
   // Find USM allocation from pointer
@@ -539,8 +523,8 @@ cl_int MemFillImpl(cl_command_queue command_queue, void *dst_ptr,
     // USM allocation device is not the same as command queue device
     OCL_CHECK(mux_buffer == nullptr, return CL_INVALID_COMMAND_QUEUE);
 
-    const std::lock_guard<std::mutex> lock(
-        command_queue->context->getCommandQueueMutex());
+    const cl::command_queue_guard lock(
+        command_queue, {event_wait_list, num_events_in_wait_list});
 
     auto mux_command_buffer = command_queue->getCommandBuffer(
         {event_wait_list, num_events_in_wait_list}, return_event);
@@ -668,7 +652,7 @@ cl_int clEnqueueMemcpyINTEL(cl_command_queue command_queue, cl_bool blocking,
     return new_event.error();
   }
   cl_event return_event = *new_event;
-  const std::lock_guard<std::mutex> context_guard(
+  const std::shared_lock<std::shared_mutex> context_guard(
       command_queue->context->usm_mutex);
   cl::release_guard<cl_event> event_release_guard(return_event,
                                                   cl::ref_count_type::EXTERNAL);
@@ -681,8 +665,8 @@ cl_int clEnqueueMemcpyINTEL(cl_command_queue command_queue, cl_bool blocking,
     extension::usm::allocation_info *usm_src_alloc =
         extension::usm::findAllocation(command_queue->context, src_ptr);
 
-    const std::lock_guard<std::mutex> lock(
-        command_queue->context->getCommandQueueMutex());
+    const cl::command_queue_guard lock(
+        command_queue, {event_wait_list, num_events_in_wait_list});
 
     auto mux_command_buffer = command_queue->getCommandBuffer(
         {event_wait_list, num_events_in_wait_list}, return_event);
@@ -834,7 +818,7 @@ cl_int clEnqueueMigrateMemINTEL(cl_command_queue command_queue, const void *ptr,
   cl::release_guard<cl_event> event_release_guard(return_event,
                                                   cl::ref_count_type::EXTERNAL);
   {
-    const std::lock_guard<std::mutex> context_guard(
+    const std::shared_lock<std::shared_mutex> context_guard(
         command_queue->context->usm_mutex);
     const cl_context context = command_queue->context;
     extension::usm::allocation_info *const usm_alloc =
@@ -847,8 +831,8 @@ cl_int clEnqueueMigrateMemINTEL(cl_command_queue command_queue, const void *ptr,
     const intptr_t bytes_till_end = usm_alloc->size - ptr_offset;
     OCL_CHECK(intptr_t(size) > bytes_till_end, return CL_INVALID_VALUE);
 
-    const std::lock_guard<std::mutex> lock(
-        command_queue->context->getCommandQueueMutex());
+    const cl::command_queue_guard lock(
+        command_queue, {event_wait_list, num_events_in_wait_list});
 
     auto mux_command_buffer = command_queue->getCommandBuffer(
         {event_wait_list, num_events_in_wait_list}, return_event);
@@ -891,15 +875,15 @@ cl_int clEnqueueMemAdviseINTEL(cl_command_queue command_queue, const void *ptr,
   cl::release_guard<cl_event> event_release_guard(return_event,
                                                   cl::ref_count_type::EXTERNAL);
   {
-    const std::lock_guard<std::mutex> context_guard(
+    const std::shared_lock<std::shared_mutex> context_guard(
         command_queue->context->usm_mutex);
     const cl_context context = command_queue->context;
     extension::usm::allocation_info *const usm_alloc =
         extension::usm::findAllocation(context, ptr);
     OCL_CHECK(nullptr == usm_alloc, return CL_INVALID_VALUE);
 
-    const std::lock_guard<std::mutex> lock(
-        command_queue->context->getCommandQueueMutex());
+    const cl::command_queue_guard lock(
+        command_queue, {event_wait_list, num_events_in_wait_list});
 
     auto mux_command_buffer = command_queue->getCommandBuffer(
         {event_wait_list, num_events_in_wait_list}, return_event);
@@ -29,6 +29,7 @@
 #include <tracer/tracer.h>
 
 #include <algorithm>
+#include <cstring>
 
 extension::khr_command_buffer::khr_command_buffer()
     : extension(
@@ -99,7 +100,8 @@ cl_int extension::khr_command_buffer::GetDeviceInfo(
       result = CL_COMMAND_BUFFER_CAPABILITY_KERNEL_PRINTF_KHR;
 
       const auto device_info = device->mux_device->info;
-      if (device_info->can_clone_command_buffers) {
+      if (device_info->can_clone_command_buffers ||
+          device_info->supports_concurrent_dispatch) {
         result |= CL_COMMAND_BUFFER_CAPABILITY_SIMULTANEOUS_USE_KHR;
       }
     } break;
@@ -148,6 +150,65 @@ _cl_mutable_command_khr::create(cl_uint id, cl_kernel kernel) {
   return mutable_command;
 }
 
+cl_int _cl_mutable_command_khr::setArgumentUpdate(
+    uint64_t index, mux_descriptor_info_s descriptor) {
+  // Kernels have few arguments, a linear search is cheaper than a map.
+  const auto found =
+      std::find(update_indices.begin(), update_indices.end(), index);
+  const size_t position = std::distance(update_indices.begin(), found);
+  bool reuse_data = false;
+  if (found == update_indices.end()) {
+    if (update_indices.reserve(position + 1) ||
+        update_descriptors.reserve(position + 1) ||
+        update_offsets.reserve(position + 1)) {
+      return CL_OUT_OF_HOST_MEMORY;
+    }
+    (void)update_indices.push_back(index);
+    (void)update_descriptors.push_back(descriptor);
+    (void)update_offsets.push_back(0);
+  } else {
+    // The size of an argument can't change, so the storage of an earlier plain
+    // old data value can be overwritten.
+    reuse_data = update_descriptors[position].type ==
+                 mux_descriptor_info_type_plain_old_data;
+    update_descriptors[position] = descriptor;
+  }
+
+  if (descriptor.type == mux_descriptor_info_type_plain_old_data) {
+    const auto &info = descriptor.plain_old_data_descriptor;
+    if (!reuse_data) {
+      update_offsets[position] = update_data.size();
+      if (update_data.resize(update_data.size() + info.length)) {
+        return CL_OUT_OF_HOST_MEMORY;
+      }
+    }
+    std::memcpy(update_data.data() + update_offsets[position], info.data,
+                info.length);
+  }
+  return CL_SUCCESS;
+}
+
+cl_int _cl_mutable_command_khr::applyArgumentUpdates(
+    mux_command_buffer_t mux_command_buffer) {
+  // Point plain old data descriptors at their values now that the storage can
+  // no longer move.
+  for (size_t i = 0; i < update_descriptors.size(); i++) {
+    auto &descriptor = update_descriptors[i];
+    if (descriptor.type == mux_descriptor_info_type_plain_old_data) {
+      descriptor.plain_old_data_descriptor.data =
+          update_data.data() + update_offsets[i];
+    }
+  }
+  const auto mux_error = muxUpdateDescriptors(
+      mux_command_buffer, id, update_indices.size(), update_indices.data(),
+      update_descriptors.data());
+  update_indices.clear();
+  update_descriptors.clear();
+  update_offsets.clear();
+  update_data.clear();
+  return mux_error ? cl::getErrorFrom(mux_error) : CL_SUCCESS;
+}
+
 _cl_command_buffer_khr::_cl_command_buffer_khr(cl_command_queue queue)
     : base(cl::ref_count_type::EXTERNAL),
       next_command_index(0u),
@@ -239,9 +300,11 @@ _cl_command_buffer_khr::create(
             }
 
             // simultaneous-use is not possible on all devices, support for
-            // cloning command-buffers is required.
+            // cloning or concurrently dispatching command-buffers is
+            // required.
             const auto device_info = command_queue->device->mux_device->info;
             if (!device_info->can_clone_command_buffers &&
+                !device_info->supports_concurrent_dispatch &&
                 (value & CL_COMMAND_BUFFER_SIMULTANEOUS_USE_KHR)) {
               return cargo::make_unexpected(CL_INVALID_PROPERTY);
             }
@@ -776,6 +839,12 @@ cl_int _cl_command_buffer_khr::commandNDRangeKernel(
     return error;
   }
 
+  // Create the kernel for the device if this is its first use there.
+  auto device_kernel = kernel->getDeviceKernel(command_queue->device);
+  if (!device_kernel) {
+    return device_kernel.error();
+  }
+
   // Check the local and global work sizes are correct.
   if (auto error = kernel->checkWorkSizes(command_queue->device, work_dim,
                                           global_work_offset, global_work_size,
@@ -789,8 +858,12 @@ cl_int _cl_command_buffer_khr::commandNDRangeKernel(
   if (local_work_size) {
     std::copy_n(local_work_size, work_dim, std::begin(final_local_work_size));
   } else {
-    final_local_work_size = kernel->getDefaultLocalSize(
+    auto default_local_size = kernel->getDefaultLocalSize(
         command_queue->device, global_work_size, work_dim);
+    if (!default_local_size) {
+      return default_local_size.error();
+    }
+    final_local_work_size = *default_local_size;
   }
 
   // If the user passed a NULL pointer as the global offset then this means that
@@ -846,9 +919,12 @@ cl_int _cl_command_buffer_khr::commandNDRangeKernel(
   mux_result_t mux_error;
   mux_kernel_t mux_kernel;
 
-  if (kernel->device_kernel_map[device]->supportsDeferredCompilation()) {
-    auto result = kernel->device_kernel_map[device]->createSpecializedKernel(
-        mux_execution_options);
+  if ((*device_kernel)->supportsDeferredCompilation()) {
+    // The kernel is kept for every enqueue of the command buffer, so it must
+    // be specialized now.
+    auto result = (*device_kernel)
+                      ->createSpecializedKernel(mux_execution_options,
+                                                /* single_enqueue */ false);
     if (!result.has_value()) {
       if (printf_buffer) {
         muxDestroyBuffer(device->mux_device, printf_buffer,
@@ -868,7 +944,7 @@ cl_int _cl_command_buffer_khr::commandNDRangeKernel(
     }
   } else {
     // Execute the kernel loaded from the pre-compiled binary instead.
-    mux_kernel = kernel->device_kernel_map[device]->getPrecompiledKernel();
+    mux_kernel = (*device_kernel)->getPrecompiledKernel();
   }
 
   auto command_wait_list = convertWaitList(cl_wait_list);
@@ -907,7 +983,8 @@ cl_int _cl_command_buffer_khr::commandNDRangeKernel(
   if (device_program.printf_calls.size() != 0) {
     std::unique_ptr<printf_info_t> printf_info(new printf_info_t{
         device, printf_memory, printf_buffer, buffer_group_size,
-        std::vector<uint32_t>(num_groups, 0), device_program.printf_calls});
+        std::vector<uint32_t>(num_groups, 0), device_program.printf_calls,
+        kernel->program});
 
     mux_error = createPrintfCallback(mux_command_buffer, printf_info);
     OCL_ASSERT(mux_success == mux_error, "muxCommand failed!");
@@ -1097,51 +1174,39 @@ cargo::expected<mux_descriptor_info_s, cl_int> createArgumentDescriptor(
         return CL_INVALID_OPERATION);
   }
 
-  for (auto config : mutable_dispatch_configs) {
-    unsigned update_index = 0;
-    const unsigned num_args = config.num_args + config.num_svm_args;
-    UpdateInfo update_info;
-    if (update_info.descriptors.alloc(num_args)) {
-      return CL_OUT_OF_HOST_MEMORY;
-    }
-
-    if (update_info.indices.alloc(num_args)) {
-      return CL_OUT_OF_HOST_MEMORY;
-    }
-
-    if (update_info.pointers.alloc(config.num_svm_args)) {
-      return CL_OUT_OF_HOST_MEMORY;
-    }
+  // Every argument is validated before any update is recorded, so a failing
+  // call leaves the pending updates of all commands unchanged.
+  struct staged_update_t {
+    _cl_mutable_command_khr *mutable_command;
+    uint64_t arg_index;
+    mux_descriptor_info_s descriptor;
+  };
+  cargo::small_vector<staged_update_t, 8> staged_updates;
 
+  for (const auto &config : mutable_dispatch_configs) {
     const auto mutable_command = config.command;
-    update_info.id = mutable_command->id;
     cargo::array_view<const cl_mutable_dispatch_arg_khr> args(config.arg_list,
                                                               config.num_args);
 
-    for (unsigned i = 0; i < config.num_args; ++i) {
-      auto arg = args[i];
-      update_info.indices[update_index] = arg.arg_index;
+    for (const auto &arg : args) {
       auto descriptor =
           createArgumentDescriptor(arg, mutable_command->kernel, device);
       if (!descriptor) {
         return descriptor.error();
       }
-
-      // Add the new descriptors to the storage.
-      update_info.descriptors[update_index] = descriptor.value();
-      update_index++;
+      if (staged_updates.push_back(
+              {mutable_command, arg.arg_index, *descriptor})) {
+        return CL_OUT_OF_HOST_MEMORY;
+      }
     }
 
 #ifdef OCL_EXTENSION_cl_intel_unified_shared_memory
     cargo::array_view<const cl_mutable_dispatch_arg_khr> svm_args(
         config.arg_svm_list, config.num_svm_args);
 
-    for (unsigned i = 0; i < config.num_svm_args; ++i) {
+    for (const auto &arg : svm_args) {
       // Unpack the argument.
-      const auto arg = svm_args[i];
       const auto arg_index = arg.arg_index;
-      update_info.indices[update_index] = arg_index;
-      const void *arg_value = arg.arg_value;
       auto arg_type = mutable_command->kernel->GetArgType(arg_index);
       OCL_CHECK(!arg_type, return arg_type.error());
 
@@ -1151,19 +1216,33 @@ cargo::expected<mux_descriptor_info_s, cl_int> createArgumentDescriptor(
                   arg_type->address_space == compiler::AddressSpace::CONSTANT),
                 return CL_INVALID_ARG_VALUE);
 
-      // Construct Descriptor
+      // Construct Descriptor, the pointer value lives in the caller's argument
+      // list until it is copied by setArgumentUpdate below.
       mux_descriptor_info_s descriptor;
       descriptor.type =
           mux_descriptor_info_type_e::mux_descriptor_info_type_plain_old_data;
-      descriptor.plain_old_data_descriptor.data = &update_info.pointers[i];
-      descriptor.plain_old_data_descriptor.length =
-          sizeof update_info.pointers[i];
-      update_info.pointers[i] = arg_value;
-      update_info.descriptors[update_index] = descriptor;
-      update_index++;
+      descriptor.plain_old_data_descriptor.data = &arg.arg_value;
+      descriptor.plain_old_data_descriptor.length = sizeof arg.arg_value;
+      if (staged_updates.push_back({mutable_command, arg_index, descriptor})) {
+        return CL_OUT_OF_HOST_MEMORY;
+      }
     }
 #endif  // OCL_EXTENSION_cl_intel_unified_shared_memory
-    if (updates.push_back(std::move(update_info))) {
+  }
+
+  // Updates are recorded against each mutable command and patched into the
+  // mux command buffer when it is next enqueued, so a command updated many
+  // times between enqueues is only patched once. A command is listed when its
+  // first argument update is recorded, so commands without updates are never
+  // listed and none is listed twice.
+  for (const auto &update : staged_updates) {
+    const auto mutable_command = update.mutable_command;
+    const bool first_update = !mutable_command->hasArgumentUpdates();
+    if (auto error = mutable_command->setArgumentUpdate(update.arg_index,
+                                                        update.descriptor)) {
+      return error;
+    }
+    if (first_update && updated_commands.push_back(mutable_command)) {
       return CL_OUT_OF_HOST_MEMORY;
     }
   }
@@ -446,8 +446,8 @@ CL_API_ENTRY cl_int CL_API_CALL cl::EnqueueReadImage(
                                                   cl::ref_count_type::EXTERNAL);
 
   {
-    const std::lock_guard<std::mutex> lock(
-        command_queue->context->getCommandQueueMutex());
+    const cl::command_queue_guard lock(
+        command_queue, {event_wait_list, num_events_in_wait_list});
 
     auto mux_command_buffer = command_queue->getCommandBuffer(
         {event_wait_list, num_events_in_wait_list}, event_release_guard.get());
@@ -547,8 +547,8 @@ CL_API_ENTRY cl_int CL_API_CALL cl::EnqueueWriteImage(
                                                   cl::ref_count_type::EXTERNAL);
 
   {
-    const std::lock_guard<std::mutex> lock(
-        command_queue->context->getCommandQueueMutex());
+    const cl::command_queue_guard lock(
+        command_queue, {event_wait_list, num_events_in_wait_list});
 
     auto mux_command_buffer = command_queue->getCommandBuffer(
         {event_wait_list, num_events_in_wait_list}, event_release_guard.get());
@@ -621,8 +621,8 @@ CL_API_ENTRY cl_int CL_API_CALL cl::EnqueueFillImage(
     *event = return_event;
   }
 
-  const std::lock_guard<std::mutex> lock(
-      command_queue->context->getCommandQueueMutex());
+  const cl::command_queue_guard lock(
+      command_queue, {event_wait_list, num_events_in_wait_list});
 
   auto mux_command_buffer = command_queue->getCommandBuffer(
       {event_wait_list, num_events_in_wait_list}, return_event);
@@ -681,8 +681,8 @@ CL_API_ENTRY cl_int CL_API_CALL cl::EnqueueCopyImage(
     *event = return_event;
   }
 
-  const std::lock_guard<std::mutex> lock(
-      command_queue->context->getCommandQueueMutex());
+  const cl::command_queue_guard lock(
+      command_queue, {event_wait_list, num_events_in_wait_list});
 
   auto mux_command_buffer = command_queue->getCommandBuffer(
       {event_wait_list, num_events_in_wait_list}, return_event);
@@ -752,8 +752,8 @@ CL_API_ENTRY cl_int CL_API_CALL cl::EnqueueCopyImageToBuffer(
     *event = return_event;
   }
 
-  const std::lock_guard<std::mutex> lock(
-      command_queue->context->getCommandQueueMutex());
+  const cl::command_queue_guard lock(
+      command_queue, {event_wait_list, num_events_in_wait_list});
 
   auto mux_command_buffer = command_queue->getCommandBuffer(
       {event_wait_list, num_events_in_wait_list}, return_event);
@@ -820,8 +820,8 @@ CL_API_ENTRY cl_int CL_API_CALL cl::EnqueueCopyBufferToImage(
     *event = return_event;
   }
 
-  const std::lock_guard<std::mutex> lock(
-      command_queue->context->getCommandQueueMutex());
+  const cl::command_queue_guard lock(
+      command_queue, {event_wait_list, num_events_in_wait_list});
 
   auto mux_command_buffer = command_queue->getCommandBuffer(
       {event_wait_list, num_events_in_wait_list}, return_event);
@@ -238,8 +238,8 @@ cl_int PushExecuteKernel(
     const std::array<size_t, cl::max::WORK_ITEM_DIM> &local_work_size,
     const cl_uint num_events_in_wait_list,
     const cl_event *const event_wait_list, cl_event return_event) {
-  const std::lock_guard<std::mutex> lock(
-      command_queue->context->getCommandQueueMutex());
+  const cl::command_queue_guard lock(
+      command_queue, {event_wait_list, num_events_in_wait_list});
   auto mux_command_buffer = command_queue->getCommandBuffer(
       {event_wait_list, num_events_in_wait_list}, return_event);
   if (!mux_command_buffer) {
@@ -266,6 +266,17 @@ cl_int PushExecuteKernel(
   cl_device_id device = command_queue->device;
   mux_device_t mux_device = device->mux_device;
 
+  // The kernel was created for this device when the enqueue was validated, so
+  // this only fails if creating it failed.
+  auto device_kernel_result = kernel->getDeviceKernel(device);
+  if (!device_kernel_result) {
+    if (nullptr != return_event) {
+      return_event->complete(device_kernel_result.error());
+    }
+    return device_kernel_result.error();
+  }
+  MuxKernelWrapper *device_kernel = *device_kernel_result;
+
   auto &device_program = kernel->program->programs[command_queue->device];
 
   const mux_allocator_info_t mux_allocator =
@@ -299,9 +310,10 @@ cl_int PushExecuteKernel(
   mux_kernel_t mux_specialized_kernel = nullptr;
   mux_executable_t mux_specialized_executable = nullptr;
   mux_kernel_t kernel_to_execute = nullptr;
-  if (kernel->device_kernel_map[device]->supportsDeferredCompilation()) {
-    auto result = kernel->device_kernel_map[device]->createSpecializedKernel(
-        mux_execution_options);
+  if (device_kernel->supportsDeferredCompilation()) {
+    // The specialized kernel is destroyed once this enqueue completes.
+    auto result = device_kernel->createSpecializedKernel(
+        mux_execution_options, /* single_enqueue */ true);
     if (!result.has_value()) {
       if (printf_buffer) {
         muxDestroyBuffer(mux_device, printf_buffer, mux_allocator);
@@ -317,8 +329,7 @@ cl_int PushExecuteKernel(
     kernel_to_execute = mux_specialized_kernel;
   } else {
     // Execute the precompiled kernel.
-    kernel_to_execute =
-        kernel->device_kernel_map[device]->getPrecompiledKernel();
+    kernel_to_execute = device_kernel->getPrecompiledKernel();
   }
 
   mux_result_t mux_error =
@@ -347,7 +358,8 @@ cl_int PushExecuteKernel(
                           printf_buffer,
                           buffer_group_size,
                           std::vector<uint32_t>(num_groups, 0),
-                          device_program.printf_calls};
+                          device_program.printf_calls,
+                          kernel->program};
 
     mux_error = createPrintfCallback(*mux_command_buffer, printf_info);
     OCL_ASSERT(mux_success == mux_error, "muxCommand failed!");
@@ -445,13 +457,16 @@ uint32_t MuxKernelWrapper::getDynamicWorkWidth(size_t local_size_x,
 
 cargo::expected<MuxKernelWrapper::SpecializedKernel, compiler::Result>
 MuxKernelWrapper::createSpecializedKernel(
-    const mux_ndrange_options_t &specialization_options) {
+    const mux_ndrange_options_t &specialization_options, bool single_enqueue) {
   if (!deferred_kernel) {
     return cargo::make_unexpected(compiler::Result::FAILURE);
   }
 
   auto specialized_kernel =
-      deferred_kernel->createSpecializedKernel(specialization_options);
+      single_enqueue ? deferred_kernel->createSpecializedKernelForEnqueue(
+                           specialization_options)
+                     : deferred_kernel->createSpecializedKernel(
+                           specialization_options);
   if (!specialized_kernel.has_value()) {
     return cargo::make_unexpected(specialized_kernel.error());
   }
@@ -606,13 +621,14 @@ cargo::expected<cl_kernel, cl_int> _cl_kernel::create(
   if (kernel->saved_args.alloc(info->getNumArguments()) != cargo::success) {
     return cargo::make_unexpected(CL_OUT_OF_HOST_MEMORY);
   }
-  for (auto device : program->context->devices) {
-    auto kernel_wrapper_result =
-        program->programs[device].createKernel(device, kernel->name);
-    if (!kernel_wrapper_result.has_value()) {
-      return cargo::make_unexpected(kernel_wrapper_result.error());
+  // With a single device there is nothing to gain from deferring, so create
+  // the kernel now and report any errors from clCreateKernel.
+  if (program->context->devices.size() == 1) {
+    auto device_kernel =
+        kernel->getDeviceKernel(program->context->devices.front());
+    if (!device_kernel) {
+      return cargo::make_unexpected(device_kernel.error());
     }
-    kernel->device_kernel_map[device] = std::move(*kernel_wrapper_result);
   }
   return kernel.release();
 }
@@ -626,6 +642,7 @@ cargo::expected<cl_kernel, cl_int> _cl_kernel::clone() const {
     return cargo::make_unexpected(CL_OUT_OF_HOST_MEMORY);
   }
   std::copy(saved_args.begin(), saved_args.end(), kernel->saved_args.begin());
+  const std::lock_guard<std::mutex> lock(device_kernel_mutex);
   for (const auto &entry : device_kernel_map) {
     auto *kernel_wrapper_copy = new MuxKernelWrapper(*entry.second);
     if (!kernel_wrapper_copy) {
@@ -636,6 +653,63 @@ cargo::expected<cl_kernel, cl_int> _cl_kernel::clone() const {
   return kernel.release();
 }
 
+cargo::expected<MuxKernelWrapper *, cl_int> _cl_kernel::getDeviceKernel(
+    cl_device_id device) {
+  cl::device_program *device_program_ptr = nullptr;
+  {
+    const std::lock_guard<std::mutex> lock(device_kernel_mutex);
+    auto found = device_kernel_map.find(device);
+    if (found != device_kernel_map.end()) {
+      return found->second.get();
+    }
+    // The program was built for every device in its context, look it up
+    // rather than inserting an empty one if it somehow wasn't.
+    auto found_program = program->programs.find(device);
+    if (found_program == program->programs.end()) {
+      return cargo::make_unexpected(CL_INVALID_PROGRAM_EXECUTABLE);
+    }
+    device_program_ptr = &found_program->second;
+  }
+
+  // The lock is not held while creating the kernel so other devices are not
+  // blocked by a build for this one. If another thread creates the kernel for
+  // this device in the meantime, its kernel is used and this one discarded.
+  auto &device_program = *device_program_ptr;
+  auto kernel_wrapper_result = device_program.createKernel(device, name);
+  if (!kernel_wrapper_result.has_value()) {
+    return cargo::make_unexpected(kernel_wrapper_result.error());
+  }
+  auto &kernel_wrapper = *kernel_wrapper_result;
+
+  // If we had any local sizes specified with the -cl-precache-local-sizes flag
+  // or the reqd_work_group_size kernel attribute, we can compile the kernel for
+  // those sizes here.
+  if (kernel_wrapper->supportsDeferredCompilation()) {
+    for (auto &size : device_program.compiler_module.module->getOptions()
+                          .precache_local_sizes) {
+      auto result =
+          kernel_wrapper->precacheLocalSize(size[0], size[1], size[2]);
+      if (compiler::Result::SUCCESS != result) {
+        return cargo::make_unexpected(CL_INVALID_PROGRAM_EXECUTABLE);
+      }
+    }
+    if (auto reqd_wg_size = info->reqd_work_group_size) {
+      auto result = kernel_wrapper->precacheLocalSize(
+          (*reqd_wg_size)[0], (*reqd_wg_size)[1], (*reqd_wg_size)[2]);
+      if (compiler::Result::SUCCESS != result) {
+        return cargo::make_unexpected(CL_INVALID_PROGRAM_EXECUTABLE);
+      }
+    }
+  }
+
+  const std::lock_guard<std::mutex> lock(device_kernel_mutex);
+  auto &device_kernel = device_kernel_map[device];
+  if (!device_kernel) {
+    device_kernel = std::move(kernel_wrapper);
+  }
+  return device_kernel.get();
+}
+
 bool _cl_kernel::GetArgInfo() {
   if (arg_info) {
     return true;
@@ -828,36 +902,6 @@ CL_API_ENTRY cl_kernel CL_API_CALL cl::CreateKernel(cl_program program,
     return nullptr;
   }
 
-  // If we had any local sizes specified with the -cl-precache-local-sizes flag
-  // or the reqd_work_group_size kernel attribute, we can compile the kernel for
-  // those sizes here.
-  for (auto device_program_entry = program->programs.begin();
-       device_program_entry != program->programs.end();
-       device_program_entry++) {
-    auto device = device_program_entry->first;
-    auto &device_program = device_program_entry->second;
-    auto &device_kernel = kernel.value()->device_kernel_map[device];
-    if (device_kernel->supportsDeferredCompilation()) {
-      for (auto &size : device_program.compiler_module.module->getOptions()
-                            .precache_local_sizes) {
-        auto result =
-            device_kernel->precacheLocalSize(size[0], size[1], size[2]);
-        if (compiler::Result::SUCCESS != result) {
-          OCL_SET_IF_NOT_NULL(errcode_ret, CL_INVALID_PROGRAM_EXECUTABLE);
-          return nullptr;
-        }
-      }
-      if (auto reqd_wg_size = kernel.value()->info->reqd_work_group_size) {
-        auto result = device_kernel->precacheLocalSize(
-            (*reqd_wg_size)[0], (*reqd_wg_size)[1], (*reqd_wg_size)[2]);
-        if (compiler::Result::SUCCESS != result) {
-          OCL_SET_IF_NOT_NULL(errcode_ret, CL_INVALID_PROGRAM_EXECUTABLE);
-          return nullptr;
-        }
-      }
-    }
-  }
-
   OCL_SET_IF_NOT_NULL(errcode_ret, CL_SUCCESS);
   return kernel.value();
 }
@@ -1363,17 +1407,25 @@ CL_API_ENTRY cl_int CL_API_CALL cl::GetKernelWorkGroupInfo(
                 return CL_INVALID_VALUE);
 
       OCL_ASSERT(device, "No device was provided");
+      auto device_kernel = kernel->getDeviceKernel(device);
+      if (!device_kernel) {
+        return device_kernel.error();
+      }
       OCL_SET_IF_NOT_NULL((reinterpret_cast<cl_ulong *>(param_value)),
-                          kernel->device_kernel_map[device]->local_memory_size);
+                          (*device_kernel)->local_memory_size);
     } break;
     case CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE: {
       OCL_SET_IF_NOT_NULL(param_value_size_ret, sizeof(size_t));
       OCL_CHECK(param_value && param_value_size < sizeof(size_t),
                 return CL_INVALID_VALUE);
+      auto device_kernel = kernel->getDeviceKernel(device);
+      if (!device_kernel) {
+        return device_kernel.error();
+      }
       const size_t preferred_work_group_size_multiple =
-          kernel->device_kernel_map[device]->preferred_local_size_x *
-          kernel->device_kernel_map[device]->preferred_local_size_y *
-          kernel->device_kernel_map[device]->preferred_local_size_z;
+          (*device_kernel)->preferred_local_size_x *
+          (*device_kernel)->preferred_local_size_y *
+          (*device_kernel)->preferred_local_size_z;
       OCL_SET_IF_NOT_NULL((reinterpret_cast<size_t *>(param_value)),
                           preferred_work_group_size_multiple);
     } break;
@@ -1459,13 +1511,20 @@ cl_int _cl_kernel::checkWorkSizes(cl_device_id device, cl_uint work_dim,
   return CL_SUCCESS;
 }
 
-std::array<size_t, cl::max::WORK_ITEM_DIM> _cl_kernel::getDefaultLocalSize(
-    cl_device_id device, const size_t *global_work_size, cl_uint work_dim) {
+cargo::expected<std::array<size_t, cl::max::WORK_ITEM_DIM>, cl_int>
+_cl_kernel::getDefaultLocalSize(cl_device_id device,
+                                const size_t *global_work_size,
+                                cl_uint work_dim) {
   std::array<size_t, cl::max::WORK_ITEM_DIM> local_sizes{1, 1, 1};
+  auto device_kernel_result = getDeviceKernel(device);
+  if (!device_kernel_result) {
+    return cargo::make_unexpected(device_kernel_result.error());
+  }
+  MuxKernelWrapper *device_kernel = *device_kernel_result;
   const std::array<size_t, cl::max::WORK_ITEM_DIM> prefered_sizes{
-      device_kernel_map[device]->preferred_local_size_x,
-      device_kernel_map[device]->preferred_local_size_y,
-      device_kernel_map[device]->preferred_local_size_z};
+      device_kernel->preferred_local_size_x,
+      device_kernel->preferred_local_size_y,
+      device_kernel->preferred_local_size_z};
 
   if (global_work_size == nullptr) {
     return prefered_sizes;
@@ -1524,6 +1583,12 @@ CL_API_ENTRY cl_int CL_API_CALL cl::EnqueueNDRangeKernel(
     return error;
   }
 
+  // Create the kernel for the device if this is its first use there.
+  auto device_kernel = kernel->getDeviceKernel(command_queue->device);
+  if (!device_kernel) {
+    return device_kernel.error();
+  }
+
   // Check the local and global work sizes are correct.
   if (auto error = kernel->checkWorkSizes(command_queue->device, work_dim,
                                           global_work_offset, global_work_size,
@@ -1537,8 +1602,12 @@ CL_API_ENTRY cl_int CL_API_CALL cl::EnqueueNDRangeKernel(
   if (local_work_size) {
     std::copy_n(local_work_size, work_dim, std::begin(final_local_work_size));
   } else {
-    final_local_work_size = kernel->getDefaultLocalSize(
+    auto default_local_size = kernel->getDefaultLocalSize(
         command_queue->device, global_work_size, work_dim);
+    if (!default_local_size) {
+      return default_local_size.error();
+    }
+    final_local_work_size = *default_local_size;
   }
 
   // If the user passed a NULL pointer as the global offset then this means that
@@ -1574,7 +1643,7 @@ CL_API_ENTRY cl_int CL_API_CALL cl::EnqueueNDRangeKernel(
   // ensure any blocking operations such clMemBlockingFreeINTEL are entirely in
   // sync as createBlockingEventForKernel adds to USM lists assuming that they
   // reflect already queued events.
-  const std::lock_guard<std::mutex> context_guard(
+  const std::shared_lock<std::shared_mutex> context_guard(
       command_queue->context->usm_mutex);
   error = extension::usm::createBlockingEventForKernel(
       command_queue, kernel, CL_COMMAND_NDRANGE_KERNEL, return_event);
@@ -1637,6 +1706,12 @@ CL_API_ENTRY cl_int CL_API_CALL cl::EnqueueTask(cl_command_queue command_queue,
         return CL_INVALID_KERNEL_ARGS);
   }
 
+  // Create the kernel for the device if this is its first use there.
+  auto device_kernel = kernel->getDeviceKernel(command_queue->device);
+  if (!device_kernel) {
+    return device_kernel.error();
+  }
+
   // Error check reqd_work_group_size attribute if present
   if (auto reqd_wg_size = kernel->info->reqd_work_group_size) {
     for (uint32_t i = 0; i < 3; ++i) {
@@ -1655,7 +1730,7 @@ CL_API_ENTRY cl_int CL_API_CALL cl::EnqueueTask(cl_command_queue command_queue,
   // ensure any blocking operations such clMemBlockingFreeINTEL are entirely in
   // sync as createBlockingEventForKernel adds to USM lists assuming that they
   // reflect already queued events.
-  const std::lock_guard<std::mutex> context_guard(
+  const std::shared_lock<std::shared_mutex> context_guard(
       command_queue->context->usm_mutex);
   error = extension::usm::createBlockingEventForKernel(
       command_queue, kernel, CL_COMMAND_TASK, return_event);
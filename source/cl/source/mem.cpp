@@ -230,8 +230,7 @@ cl_int _cl_mem::pushMapMemory(cl_command_queue command_queue,
     }
   }
 
-  const std::lock_guard<std::mutex> lock(
-      command_queue->context->getCommandQueueMutex());
+  const cl::command_queue_guard lock(command_queue, event_wait_list);
 
   auto mux_command_buffer =
       command_queue->getCommandBuffer(event_wait_list, return_event);
@@ -507,8 +506,8 @@ cl::EnqueueUnmapMemObject(cl_command_queue command_queue, cl_mem memobj,
     it->second.is_active = false;
   }
 
-  const std::lock_guard<std::mutex> lock(
-      command_queue->context->getCommandQueueMutex());
+  const cl::command_queue_guard lock(
+      command_queue, {event_wait_list, num_events_in_wait_list});
 
   auto mux_command_buffer = command_queue->getCommandBuffer(
       {event_wait_list, num_events_in_wait_list}, return_event);
@@ -317,15 +317,19 @@ CL_API_ENTRY cl_int CL_API_CALL cl::GetKernelSubGroupInfo(
   // If the list of devices associated with kernel is a single device, device
   // can be a NULL value.
   if (!device) {
-    OCL_CHECK(kernel->device_kernel_map.size() > 1, return CL_INVALID_DEVICE);
-    device = kernel->device_kernel_map.begin()->first;
-  } else {
-    OCL_CHECK(std::end(kernel->device_kernel_map) ==
-                  kernel->device_kernel_map.find(device),
+    OCL_CHECK(kernel->program->context->devices.size() > 1,
               return CL_INVALID_DEVICE);
+    device = kernel->program->context->devices.front();
+  } else {
+    OCL_CHECK(!kernel->program->hasDevice(device), return CL_INVALID_DEVICE);
   }
   OCL_CHECK(0 == device->max_num_sub_groups, return CL_INVALID_OPERATION);
 
+  auto device_kernel = kernel->getDeviceKernel(device);
+  if (!device_kernel) {
+    return device_kernel.error();
+  }
+
   switch (param_name) {
     case CL_KERNEL_MAX_SUB_GROUP_SIZE_FOR_NDRANGE: {
       OCL_CHECK(param_value && (param_value_size < sizeof(size_t)),
@@ -346,7 +350,7 @@ CL_API_ENTRY cl_int CL_API_CALL cl::GetKernelSubGroupInfo(
         size_t local_size[]{1, 1, 1};
         std::memcpy(local_size, input_value, input_value_size);
         const auto expected_sub_group_size =
-            kernel->device_kernel_map[device]->getSubGroupSizeForLocalSize(
+            (*device_kernel)->getSubGroupSizeForLocalSize(
                 local_size[0], local_size[1], local_size[2]);
         if (!expected_sub_group_size) {
           return expected_sub_group_size.error();
@@ -374,7 +378,7 @@ CL_API_ENTRY cl_int CL_API_CALL cl::GetKernelSubGroupInfo(
         size_t local_size[]{1, 1, 1};
         std::memcpy(local_size, input_value, input_value_size);
         const auto expected_sub_group_count =
-            kernel->device_kernel_map[device]->getSubGroupCountForLocalSize(
+            (*device_kernel)->getSubGroupCountForLocalSize(
                 local_size[0], local_size[1], local_size[2]);
         if (!expected_sub_group_count) {
           return expected_sub_group_count.error();
@@ -393,7 +397,7 @@ CL_API_ENTRY cl_int CL_API_CALL cl::GetKernelSubGroupInfo(
         auto *out_local_size = static_cast<size_t *>(param_value);
         const auto sub_group_count = *static_cast<const size_t *>(input_value);
         auto expected_local_sizes =
-            kernel->device_kernel_map[device]->getLocalSizeForSubGroupCount(
+            (*device_kernel)->getLocalSizeForSubGroupCount(
                 sub_group_count);
         if (!expected_local_sizes) {
           return expected_local_sizes.error();
@@ -410,7 +414,7 @@ CL_API_ENTRY cl_int CL_API_CALL cl::GetKernelSubGroupInfo(
                 return CL_INVALID_VALUE);
       if (param_value) {
         const auto expected_max_num_sub_groups =
-            kernel->device_kernel_map[device]->getMaxNumSubGroups();
+            (*device_kernel)->getMaxNumSubGroups();
         if (!expected_max_num_sub_groups) {
           return expected_max_num_sub_groups.error();
         }
@@ -134,6 +134,9 @@ cargo::expected<cl_platform_id, cl_int> _cl_platform_id::getInstance() {
     // when atexit handlers are invoked, the advice given by Microsoft is not
     // to perform any tear down at all.
     atexit([]() {
+      // Print any outstanding printf output while the devices and programs it
+      // refers to still exist.
+      platform.value()->printf_drain.stop();
       for (auto device : platform.value()->devices) {
         cl::releaseInternal(device);
       }
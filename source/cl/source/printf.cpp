@@ -15,11 +15,16 @@
 // SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
 
 #include <cl/device.h>
+#include <cl/platform.h>
 #include <cl/printf.h>
+#include <cl/program.h>
+
+#include <algorithm>
+#include <cstring>
 
 namespace {
-// Callback function for reading printf buffer data from device, unpacking
-// it, and printing it from host to stdout
+// Callback function for copying the printf data written since the last call
+// out of the device buffer and handing it to the drain thread to be printed.
 void PerformPrintf(mux_queue_t, mux_command_buffer_t, void *const user_data) {
   auto printf_info = static_cast<printf_info_t *>(user_data);
   uint8_t *pack{};
@@ -34,10 +39,53 @@ void PerformPrintf(mux_queue_t, mux_command_buffer_t, void *const user_data) {
   OCL_ASSERT(mux_success == error, "muxFlushMappedMemoryFromDevice failed!");
   OCL_UNUSED(error);
 
-  // Unpack and print the data
-  builtins::printf::print(pack, printf_info->buffer_group_size,
-                          printf_info->printf_calls,
-                          printf_info->group_offsets);
+  // Each work-group chunk starts with the length written, including the 8
+  // header bytes and any overflow, followed by the length of the overflow.
+  constexpr uint32_t header_size = 8;
+  const size_t buffer_group_size = printf_info->buffer_group_size;
+  auto &group_offsets = printf_info->group_offsets;
+  const auto dataEnd = [&](size_t group) -> uint32_t {
+    uint32_t header[2];
+    std::memcpy(header, pack + group * buffer_group_size, sizeof(header));
+    const bool corrupt =
+        header[0] < header[1] || header[0] - header[1] > buffer_group_size;
+    OCL_ASSERT(!corrupt, "The printf buffer is likely to be corrupt.");
+    return corrupt ? 0 : header[0] - header[1];
+  };
+  const auto dataStart = [&](size_t group) {
+    return std::max(header_size, group_offsets[group]);
+  };
+
+  // Only copy what hasn't been printed by an earlier dispatch, in chunks big
+  // enough for the work-group which wrote the most.
+  size_t max_new_bytes = 0;
+  for (size_t group = 0; group < group_offsets.size(); group++) {
+    const uint32_t end = dataEnd(group);
+    const uint32_t start = dataStart(group);
+    if (end > start) {
+      max_new_bytes = std::max<size_t>(max_new_bytes, end - start);
+    }
+  }
+
+  if (max_new_bytes) {
+    printf_job_t job{printf_info->program, &printf_info->printf_calls,
+                     std::vector<uint8_t>(), header_size + max_new_bytes,
+                     group_offsets.size()};
+    job.data.resize(job.stride * job.num_groups);
+    for (size_t group = 0; group < group_offsets.size(); group++) {
+      const uint32_t end = dataEnd(group);
+      const uint32_t start = dataStart(group);
+      const uint32_t new_bytes = end > start ? end - start : 0;
+      uint8_t *chunk = job.data.data() + group * job.stride;
+      const uint32_t header[2] = {header_size + new_bytes, 0};
+      std::memcpy(chunk, header, sizeof(header));
+      std::memcpy(chunk + header_size,
+                  pack + group * buffer_group_size + start, new_bytes);
+      group_offsets[group] = std::max(start, end);
+    }
+    cl::retainInternal(job.program);
+    printf_info->device->platform->printf_drain.push(std::move(job));
+  }
 
   error = muxUnmapMemory(mux_device, printf_info->memory);
   OCL_ASSERT(mux_success == error, "muxUnmapMemory failed!");
@@ -58,6 +106,78 @@ void PrintfAndFree(mux_queue_t queue, mux_command_buffer_t command_buffer,
 };
 }  // namespace
 
+printf_drain_t::~printf_drain_t() { stop(); }
+
+void printf_drain_t::push(printf_job_t job) {
+  std::unique_lock<std::mutex> lock(mutex);
+  if (stopped) {
+    lock.unlock();
+    print(job);
+    return;
+  }
+  if (!thread.joinable()) {
+    thread = cargo::thread(&printf_drain_t::run, this);
+    // Naming the thread is best effort.
+    (void)thread.set_name("cl:printf");
+  }
+  printed_condition.wait(lock, [this] {
+    return jobs.empty() || queued_bytes < max_queued_bytes;
+  });
+  queued_bytes += job.data.size();
+  jobs.push_back(std::move(job));
+  pushed++;
+  lock.unlock();
+  job_condition.notify_one();
+}
+
+void printf_drain_t::flush() {
+  std::unique_lock<std::mutex> lock(mutex);
+  const uint64_t target = pushed;
+  printed_condition.wait(lock, [this, target] { return printed >= target; });
+}
+
+void printf_drain_t::stop() {
+  {
+    const std::lock_guard<std::mutex> lock(mutex);
+    stopped = true;
+  }
+  job_condition.notify_one();
+  if (thread.joinable()) {
+    thread.join();
+  }
+}
+
+void printf_drain_t::run() {
+  std::unique_lock<std::mutex> lock(mutex);
+  for (;;) {
+    job_condition.wait(lock, [this] { return stopped || !jobs.empty(); });
+    if (jobs.empty()) {
+      return;
+    }
+    auto job = std::move(jobs.front());
+    jobs.pop_front();
+    lock.unlock();
+
+    print(job);
+
+    lock.lock();
+    queued_bytes -= job.data.size();
+    printed++;
+    printed_condition.notify_all();
+  }
+}
+
+void printf_drain_t::print(printf_job_t &job) {
+  std::vector<uint32_t> group_offsets(job.num_groups, 0);
+  builtins::printf::print(job.data.data(), job.stride, *job.printf_calls,
+                          group_offsets);
+  cl::releaseInternal(job.program);
+}
+
+void flushPrintfOutput(cl_platform_id platform) {
+  platform->printf_drain.flush();
+}
+
 printf_info_t::~printf_info_t() {
   if (buffer) {
     muxDestroyBuffer(device->mux_device, buffer, device->mux_allocator);
@@ -17,6 +17,7 @@
 #include <CL/cl_ext.h>
 #include <cargo/small_vector.h>
 #include <cargo/string_algorithm.h>
+#include <cl/binary/cache.h>
 #include <cl/config.h>
 #include <cl/context.h>
 #include <cl/device.h>
@@ -47,6 +48,48 @@ cl_int convertModuleStateToCL(compiler::ModuleState state) {
       return CL_PROGRAM_BINARY_TYPE_NONE;
   }
 }
+
+/// @brief Checks if OpenCL C source may read other files while compiling.
+///
+/// Looks for `#include` and `#import` directives, also spelled with the `%:`
+/// digraph or with whitespace after the `#`, and for `__has_include`. Mentions
+/// of these elsewhere in a line, such as in a string, are ignored, but a
+/// directive inside a block comment still counts, erring on the side of not
+/// caching.
+bool mayReadFiles(const std::string &source) {
+  if (source.find("__has_include") != std::string::npos) {
+    return true;
+  }
+  const auto isSpace = [](char c) { return ' ' == c || '\t' == c; };
+  const auto startsWith = [&source](size_t pos, cargo::string_view prefix) {
+    return 0 == source.compare(pos, prefix.size(), prefix.data(),
+                               prefix.size());
+  };
+  size_t pos = 0;
+  while (pos < source.size()) {
+    while (pos < source.size() && isSpace(source[pos])) {
+      pos++;
+    }
+    if (startsWith(pos, "#") || startsWith(pos, "%:")) {
+      pos += '#' == source[pos] ? 1 : 2;
+      while (pos < source.size() && isSpace(source[pos])) {
+        pos++;
+      }
+      // Rather than parsing a comment or line continuation between the `#`
+      // and the directive name, assume it hides an include.
+      if (startsWith(pos, "include") || startsWith(pos, "import") ||
+          startsWith(pos, "/*") || startsWith(pos, "\\")) {
+        return true;
+      }
+    }
+    pos = source.find('\n', pos);
+    if (pos == std::string::npos) {
+      break;
+    }
+    pos++;
+  }
+  return false;
+}
 }  // namespace
 
 cl::mux_kernel_cache::mux_kernel_cache()
@@ -164,27 +207,9 @@ bool cl::device_program::finalize(cl_device_id device) {
     }
     program_info = std::move(program_info_to_populate);
 
-    // If the compiler does not support deferred compilation, we get the final
-    // binary from the module and initialize a mux_kernel_cache.
-    if (!device->compiler_info->supports_deferred_compilation) {
-      // Get the Mux binary.
-      auto binary_result = compiler_module.getOrCreateMuxBinary();
-      if (!binary_result) {
-        return false;
-      }
-
-      // Create the Mux executable and set up the mux_kernel_cache.
-      cargo::array_view<const uint8_t> binary = *binary_result;
-      mux_executable_t mux_executable = nullptr;
-      if (mux_success !=
-          muxCreateExecutable(device->mux_device, binary.data(), binary.size(),
-                              device->mux_allocator, &mux_executable)) {
-        reportError("Failed to create Mux executable.");
-        return false;
-      }
-      compiler_module.kernels.emplace(mux::unique_ptr<mux_executable_t>{
-          mux_executable, {device->mux_device, device->mux_allocator}});
-    }
+    // If the compiler does not support deferred compilation the final binary
+    // and mux_kernel_cache are created from the module when the first kernel
+    // is created on this device, see CompilerModule::getOrCreateKernels.
   }
   return true;
 }
@@ -234,8 +259,14 @@ cl::device_program::createKernel(cl_device_id device,
           return cargo::make_unexpected(CL_OUT_OF_HOST_MEMORY);
         }
       } else {
+        // This can run on any thread enqueueing the kernel, so the failure is
+        // only reported through the error code and not the build log.
+        auto kernels = compiler_module.getOrCreateKernels(device);
+        if (!kernels) {
+          return cargo::make_unexpected(CL_INVALID_PROGRAM_EXECUTABLE);
+        }
         auto mux_kernel_result =
-            compiler_module.kernels->getOrCreateKernel(device, kernel_name);
+            (*kernels)->getOrCreateKernel(device, kernel_name);
         if (!mux_kernel_result) {
           return cargo::make_unexpected(
               cl::getErrorFrom(mux_kernel_result.error()));
@@ -396,10 +427,12 @@ void cl::device_program::CompilerModule::clear() {
   module->clear();
   cached_binary = cargo::optional<cargo::dynamic_array<uint8_t>>();
   cached_mux_binary = cargo::optional<cargo::dynamic_array<uint8_t>>();
+  kernels = cargo::nullopt;
 }
 
 cargo::expected<cargo::array_view<const uint8_t>, compiler::Result>
 cl::device_program::CompilerModule::getOrCreateMuxBinary() {
+  const std::lock_guard<std::mutex> lock(mux_binary_mutex);
   if (cached_mux_binary.has_value()) {
     return {*cached_mux_binary};
   }
@@ -417,6 +450,31 @@ cl::device_program::CompilerModule::getOrCreateMuxBinary() {
   return {*cached_mux_binary};
 }
 
+cargo::expected<cl::mux_kernel_cache *, mux_result_t>
+cl::device_program::CompilerModule::getOrCreateKernels(cl_device_id device) {
+  const std::lock_guard<std::mutex> lock(kernels_mutex);
+  if (kernels.has_value()) {
+    return &*kernels;
+  }
+
+  auto binary_result = getOrCreateMuxBinary();
+  if (!binary_result) {
+    return cargo::make_unexpected(mux_error_failure);
+  }
+
+  cargo::array_view<const uint8_t> binary = *binary_result;
+  mux_executable_t mux_executable = nullptr;
+  const auto error =
+      muxCreateExecutable(device->mux_device, binary.data(), binary.size(),
+                          device->mux_allocator, &mux_executable);
+  if (mux_success != error) {
+    return cargo::make_unexpected(error);
+  }
+  kernels.emplace(mux::unique_ptr<mux_executable_t>{
+      mux_executable, {device->mux_device, device->mux_allocator}});
+  return &*kernels;
+}
+
 cl_program_binary_type cl::device_program::getCLProgramBinaryType() const {
   switch (type) {
     case cl::device_program_type::BINARY:
@@ -846,13 +904,175 @@ bool _cl_program::finalize(cargo::array_view<const cl_device_id> devices) {
     if (hasOption(device, "-create-library")) {
       continue;  // don't finalize a library, it's only used for linking.
     }
-    if (!programs[device].finalize(device)) {
+    // Finalizing isn't deferred even for devices which may never be used, as
+    // kernel metadata and compilation errors are needed now.
+    auto &device_program = programs[device];
+    if (!device_program.finalize(device)) {
+      return false;
+    }
+    // In a multi-device context the Mux executable of each device is created
+    // when it is first needed, as most applications only use some of the
+    // devices. There is nothing to gain from deferring it with a single
+    // device, so create it now and report backend errors in the build log.
+    if (context->devices.size() == 1 &&
+        device_program.type == cl::device_program_type::COMPILER_MODULE &&
+        !device->compiler_info->supports_deferred_compilation &&
+        !device_program.compiler_module.getOrCreateKernels(device)) {
+      device_program.reportError("Failed to create Mux executable.");
       return false;
     }
   }
   return true;
 }
 
+std::string _cl_program::getBinaryCacheKey(cl_device_id device) {
+  // Storing a lazily finalized program would finalize every kernel in it.
+  if (!cl::binary::isBinaryCacheEnabled() ||
+      hasOption(device, "-create-library") ||
+      hasOption(device, "-cl-lazy-finalize")) {
+    return {};
+  }
+
+  cargo::string_view input;
+  switch (type) {
+    case cl::program_type::OPENCLC:
+      // Headers included from the file system aren't part of the key, so
+      // changes to them would go unnoticed.
+      if (mayReadFiles(openclc.source)) {
+        return {};
+      }
+      input = openclc.source;
+      break;
+#if defined(OCL_EXTENSION_cl_khr_il_program) || defined(CL_VERSION_3_0)
+    case cl::program_type::SPIRV:
+      // Specialization constants aren't part of the key.
+      if (spirv.getSpecInfo()) {
+        return {};
+      }
+      input = {reinterpret_cast<const char *>(spirv.code.data()),
+               spirv.code.size() * sizeof(uint32_t)};
+      break;
+#endif
+    default:
+      return {};
+  }
+
+  // Fields are prefixed with their size so that they can't run into each
+  // other.
+  std::string key;
+  auto append = [&key](cargo::string_view field) {
+    key += std::to_string(field.size());
+    key += ':';
+    key.append(field.data(), field.size());
+    key += '\n';
+  };
+  auto appendEnv = [&append](const char *name) {
+    const char *value = std::getenv(name);
+    append(value ? value : "");
+  };
+  // The git commit is only known when configuring a git checkout and doesn't
+  // change with local modifications, so also identify the files the runtime
+  // and the compiler were loaded from. Don't cache anything if they can't be
+  // found, as binaries from different builds could be mixed up.
+  static const char runtime_anchor = 0;
+  const std::string runtime_build =
+      cl::binary::getModuleIdentifier(&runtime_anchor);
+  const std::string compiler_build =
+      cl::binary::getModuleIdentifier(device->compiler_info);
+  if (runtime_build.empty() || compiler_build.empty()) {
+    return {};
+  }
+  // The device name doesn't say which CPU a host device generates code for
+  // when it is chosen at runtime, or the features of that CPU.
+  compiler::Target *target = context->getCompilerTarget(device);
+  if (!target) {
+    return {};
+  }
+
+  append(CA_VERSION);
+  append(CA_GIT_COMMIT);
+  append(runtime_build);
+  append(compiler_build);
+  append(device->mux_device->info->device_name);
+  append(target->getTargetIdentifier());
+  append(device->profile);
+  append(programs[device].options);
+  appendEnv("CA_EXTRA_COMPILE_OPTS");
+  appendEnv("CA_EXTRA_LINK_OPTS");
+  // Environment variables read by the compiler targets which change the code
+  // they generate.
+  appendEnv("CODEPLAY_VECZ_CHOICES");
+  appendEnv("CA_RISCV_VF");
+#if !defined(NDEBUG) || defined(CA_ENABLE_LLVM_OPTIONS_IN_RELEASE)
+  appendEnv("CA_LLVM_OPTIONS");
+#endif
+  append(input);
+  return key;
+}
+
+bool _cl_program::loadCachedBinary(cl_device_id device,
+                                   cargo::string_view key) {
+  auto binary = cl::binary::loadCachedBinary(key);
+  if (!binary) {
+    return false;
+  }
+
+  // Check the entry holds an executable before replacing the compiler module
+  // set up by setOptions, so the program can still be built if it doesn't.
+  {
+    std::vector<builtins::printf::descriptor> printf_calls;
+    compiler::ProgramInfo program_info;
+    cargo::dynamic_array<uint8_t> executable;
+    bool is_executable = false;
+    if (!cl::binary::deserializeBinary(*binary, printf_calls, program_info,
+                                       executable, is_executable) ||
+        !is_executable) {
+      return false;
+    }
+  }
+
+  auto &device_program = programs[device];
+  device_program.printf_calls.clear();
+  if (!device_program.binaryDeserialize(
+          device, context->getCompilerTarget(device), *binary)) {
+    device_program.printf_calls.clear();
+    device_program.program_info = cargo::nullopt;
+    device_program.num_errors = 0;
+    device_program.compiler_log.clear();
+    return false;
+  }
+  return true;
+}
+
+void _cl_program::storeCachedBinary(cl_device_id device,
+                                    cargo::string_view key) {
+  auto &device_program = programs[device];
+  if (device_program.type != cl::device_program_type::COMPILER_MODULE ||
+      !device_program.isExecutable()) {
+    return;
+  }
+  // This doesn't use binarySerialize, failing to store a binary in the cache
+  // must not add errors to the build log.
+  //
+  // Creating the mux binary generates code for every kernel in the program
+  // now, which a device deferring compilation to kernel creation or enqueue
+  // would otherwise only do for the kernels it runs. This is the price of a
+  // cache miss, which a later build of the program doesn't pay again.
+  auto mux_binary = device_program.compiler_module.getOrCreateMuxBinary();
+  if (!mux_binary) {
+    return;
+  }
+  cargo::dynamic_array<uint8_t> binary;
+  if (!cl::binary::serializeBinary(
+          binary, *mux_binary, device_program.printf_calls,
+          *device_program.program_info,
+          device_program.compiler_module.module->getOptions().kernel_arg_info,
+          nullptr)) {
+    return;
+  }
+  cl::binary::storeCachedBinary(key, binary);
+}
+
 cargo::optional<const compiler::KernelInfo *> _cl_program::getKernelInfo(
     cargo::string_view name) const {
   for (auto device : context->devices) {
@@ -1336,13 +1556,37 @@ CL_API_ENTRY cl_int CL_API_CALL cl::BuildProgram(
                                          compiler::Options::Mode::BUILD)) {
       return error;
     }
-    if (auto error = program->compile(devices, {})) {
+
+    // Only build for the devices whose binaries aren't in the persistent
+    // binary cache, then add them to it.
+    cargo::small_vector<cl_device_id, 4> build_devices;
+    cargo::small_vector<std::string, 4> cache_keys;
+    for (auto device : devices) {
+      auto key = program->getBinaryCacheKey(device);
+      if (!key.empty() && program->loadCachedBinary(device, key)) {
+        continue;
+      }
+      if (build_devices.push_back(device) ||
+          cache_keys.push_back(std::move(key))) {
+        return CL_OUT_OF_HOST_MEMORY;
+      }
+    }
+    if (build_devices.empty()) {
+      return CL_SUCCESS;
+    }
+
+    if (auto error = program->compile(build_devices, {})) {
       return error == CL_COMPILE_PROGRAM_FAILURE ? CL_BUILD_PROGRAM_FAILURE
                                                  : error;
     }
-    if (!program->finalize(devices)) {
+    if (!program->finalize(build_devices)) {
       return CL_BUILD_PROGRAM_FAILURE;
     }
+    for (size_t i = 0; i < build_devices.size(); i++) {
+      if (!cache_keys[i].empty()) {
+        program->storeCachedBinary(build_devices[i], cache_keys[i]);
+      }
+    }
   }
 
   return CL_SUCCESS;
@@ -35,28 +35,37 @@ _mux_shared_semaphore::~_mux_shared_semaphore() {
 }
 
 cl_int _mux_shared_semaphore::retain() {
-  const cl_uint last_ref_count = ref_count;
+  cl_uint last_ref_count = ref_count.load(std::memory_order_relaxed);
   cl_uint next_ref_count;
-  OCL_ASSERT(0u != last_ref_count,
-             "Cannot retain object with internal reference count of zero.");
-  next_ref_count = last_ref_count + 1;
-  // Check for overflow.
-  if (next_ref_count < last_ref_count) {
-    return CL_OUT_OF_RESOURCES;
-  }
-  ref_count = next_ref_count;
+  do {
+    OCL_ASSERT(0u != last_ref_count,
+               "Cannot retain object with internal reference count of zero.");
+    next_ref_count = last_ref_count + 1;
+    // Check for overflow.
+    if (next_ref_count < last_ref_count) {
+      return CL_OUT_OF_RESOURCES;
+    }
+  } while (!ref_count.compare_exchange_weak(last_ref_count, next_ref_count,
+                                            std::memory_order_relaxed));
   return CL_SUCCESS;
 }
 
 bool _mux_shared_semaphore::release() {
-  const cl_uint last_ref_count = ref_count;
+  const cl_uint last_ref_count =
+      ref_count.fetch_sub(1, std::memory_order_acq_rel);
 
   OCL_ASSERT(0u < last_ref_count,
              "Cannot release object with internal reference count of zero.");
-  ref_count = last_ref_count - 1;
 
-  if (0u == ref_count) {
-    return true;
+  return 1u == last_ref_count;
+}
+
+cl_int _mux_shared_semaphore::reset() {
+  OCL_ASSERT(0u == ref_count.load(std::memory_order_relaxed),
+             "Cannot reset a semaphore which is still referenced.");
+  if (mux_success != muxResetSemaphore(semaphore)) {
+    return CL_OUT_OF_RESOURCES;
   }
-  return false;
+  ref_count.store(1, std::memory_order_relaxed);
+  return CL_SUCCESS;
 }
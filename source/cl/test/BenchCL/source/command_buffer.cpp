@@ -0,0 +1,206 @@
+// Copyright (C) Codeplay Software Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License") with LLVM
+// Exceptions; you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://github.com/codeplaysoftware/oneapi-construction-kit/blob/main/LICENSE.txt
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+//
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+
+#include <BenchCL/environment.h>
+#include <BenchCL/error.h>
+#include <CL/cl.h>
+#include <CL/cl_ext.h>
+#include <benchmark/benchmark.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+namespace {
+/// @brief Entry points of cl_khr_command_buffer_mutable_dispatch and the
+/// cl_khr_command_buffer functions it is used with.
+struct MutableDispatchFunctions {
+  MutableDispatchFunctions() {
+    auto env = benchcl::env::get();
+    size_t size = 0;
+    auto status = clGetDeviceInfo(env->device, CL_DEVICE_EXTENSIONS, 0,
+                                  nullptr, &size);
+    ASSERT_EQ_ERRCODE(CL_SUCCESS, status);
+    std::string extensions(size, '\0');
+    status = clGetDeviceInfo(env->device, CL_DEVICE_EXTENSIONS, size,
+                             &extensions[0], nullptr);
+    ASSERT_EQ_ERRCODE(CL_SUCCESS, status);
+    if (std::string::npos ==
+        extensions.find("cl_khr_command_buffer_mutable_dispatch")) {
+      return;
+    }
+
+    auto platform = env->platform;
+    createCommandBuffer = reinterpret_cast<clCreateCommandBufferKHR_fn>(
+        clGetExtensionFunctionAddressForPlatform(platform,
+                                                 "clCreateCommandBufferKHR"));
+    commandNDRangeKernel = reinterpret_cast<clCommandNDRangeKernelKHR_fn>(
+        clGetExtensionFunctionAddressForPlatform(platform,
+                                                 "clCommandNDRangeKernelKHR"));
+    finalizeCommandBuffer = reinterpret_cast<clFinalizeCommandBufferKHR_fn>(
+        clGetExtensionFunctionAddressForPlatform(platform,
+                                                 "clFinalizeCommandBufferKHR"));
+    enqueueCommandBuffer = reinterpret_cast<clEnqueueCommandBufferKHR_fn>(
+        clGetExtensionFunctionAddressForPlatform(platform,
+                                                 "clEnqueueCommandBufferKHR"));
+    releaseCommandBuffer = reinterpret_cast<clReleaseCommandBufferKHR_fn>(
+        clGetExtensionFunctionAddressForPlatform(platform,
+                                                 "clReleaseCommandBufferKHR"));
+    updateMutableCommands = reinterpret_cast<clUpdateMutableCommandsKHR_fn>(
+        clGetExtensionFunctionAddressForPlatform(platform,
+                                                 "clUpdateMutableCommandsKHR"));
+  }
+
+  bool supported() const {
+    return createCommandBuffer && commandNDRangeKernel &&
+           finalizeCommandBuffer && enqueueCommandBuffer &&
+           releaseCommandBuffer && updateMutableCommands;
+  }
+
+  clCreateCommandBufferKHR_fn createCommandBuffer = nullptr;
+  clCommandNDRangeKernelKHR_fn commandNDRangeKernel = nullptr;
+  clFinalizeCommandBufferKHR_fn finalizeCommandBuffer = nullptr;
+  clEnqueueCommandBufferKHR_fn enqueueCommandBuffer = nullptr;
+  clReleaseCommandBufferKHR_fn releaseCommandBuffer = nullptr;
+  clUpdateMutableCommandsKHR_fn updateMutableCommands = nullptr;
+};
+
+// Measures a frame of a recorded pipeline of state.range(0) kernel commands,
+// every command has an argument updated with a single
+// clUpdateMutableCommandsKHR call before the command buffer is enqueued again,
+// as a renderer updating per-object constants each frame would.
+void CommandBufferMutableDispatchUpdate(benchmark::State &state) {
+  const MutableDispatchFunctions functions;
+  if (!functions.supported()) {
+    state.SkipWithError("cl_khr_command_buffer_mutable_dispatch not supported");
+    return;
+  }
+
+  auto env = benchcl::env::get();
+  cl_int err = CL_SUCCESS;
+  cl_context context =
+      clCreateContext(nullptr, 1, &env->device, nullptr, nullptr, &err);
+  ASSERT_EQ_ERRCODE(CL_SUCCESS, err);
+
+  const char *source = R"CL(
+    __kernel void store(__global int *data, int value) {
+      data[get_global_id(0)] = value;
+    }
+  )CL";
+  cl_program program =
+      clCreateProgramWithSource(context, 1, &source, nullptr, &err);
+  ASSERT_EQ_ERRCODE(CL_SUCCESS, err);
+  ASSERT_EQ_ERRCODE(CL_SUCCESS, clBuildProgram(program, 0, nullptr, nullptr,
+                                               nullptr, nullptr));
+
+  cl_kernel kernel = clCreateKernel(program, "store", &err);
+  ASSERT_EQ_ERRCODE(CL_SUCCESS, err);
+
+  cl_mem buffer = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_int),
+                                 nullptr, &err);
+  ASSERT_EQ_ERRCODE(CL_SUCCESS, err);
+  cl_int value = 0;
+  ASSERT_EQ_ERRCODE(CL_SUCCESS,
+                    clSetKernelArg(kernel, 0, sizeof(buffer), &buffer));
+  ASSERT_EQ_ERRCODE(CL_SUCCESS,
+                    clSetKernelArg(kernel, 1, sizeof(value), &value));
+
+  cl_command_queue queue = clCreateCommandQueue(context, env->device, 0, &err);
+  ASSERT_EQ_ERRCODE(CL_SUCCESS, err);
+
+  const cl_command_buffer_properties_khr properties[] = {
+      CL_COMMAND_BUFFER_FLAGS_KHR, CL_COMMAND_BUFFER_MUTABLE_KHR, 0};
+  cl_command_buffer_khr command_buffer =
+      functions.createCommandBuffer(1, &queue, properties, &err);
+  ASSERT_EQ_ERRCODE(CL_SUCCESS, err);
+
+  const size_t command_count = state.range(0);
+  const size_t global_size = 1;
+  const cl_ndrange_kernel_command_properties_khr command_properties[] = {
+      CL_MUTABLE_DISPATCH_UPDATABLE_FIELDS_KHR,
+      CL_MUTABLE_DISPATCH_ARGUMENTS_KHR, 0};
+  std::vector<cl_mutable_command_khr> commands(command_count);
+  for (auto &command : commands) {
+    ASSERT_EQ_ERRCODE(CL_SUCCESS,
+                      functions.commandNDRangeKernel(
+                          command_buffer, nullptr, command_properties, kernel,
+                          1, nullptr, &global_size, nullptr, 0, nullptr,
+                          nullptr, &command));
+  }
+  ASSERT_EQ_ERRCODE(CL_SUCCESS,
+                    functions.finalizeCommandBuffer(command_buffer));
+
+  std::vector<cl_mutable_dispatch_arg_khr> args(command_count);
+  std::vector<cl_mutable_dispatch_config_khr> configs(command_count);
+  for (size_t i = 0; i < command_count; i++) {
+    args[i] = {1, sizeof(value), &value};
+    configs[i] = {CL_STRUCTURE_TYPE_MUTABLE_DISPATCH_CONFIG_KHR,
+                  nullptr,
+                  commands[i],
+                  1,
+                  0,
+                  0,
+                  0,
+                  &args[i],
+                  nullptr,
+                  nullptr,
+                  nullptr,
+                  nullptr,
+                  nullptr};
+  }
+  const cl_mutable_base_config_khr base_config = {
+      CL_STRUCTURE_TYPE_MUTABLE_BASE_CONFIG_KHR, nullptr,
+      static_cast<cl_uint>(command_count), configs.data()};
+
+  // Early enqueue so that kernel compilation isn't measured.
+  ASSERT_EQ_ERRCODE(CL_SUCCESS,
+                    functions.enqueueCommandBuffer(0, nullptr, command_buffer,
+                                                   0, nullptr, nullptr));
+  ASSERT_EQ_ERRCODE(CL_SUCCESS, clFinish(queue));
+
+  for (auto _ : state) {
+    (void)_;
+    namespace chrono = std::chrono;
+    auto start = chrono::high_resolution_clock::now();
+
+    value++;
+    ASSERT_EQ_ERRCODE(CL_SUCCESS, functions.updateMutableCommands(
+                                      command_buffer, &base_config));
+    ASSERT_EQ_ERRCODE(CL_SUCCESS,
+                      functions.enqueueCommandBuffer(
+                          0, nullptr, command_buffer, 0, nullptr, nullptr));
+    ASSERT_EQ_ERRCODE(CL_SUCCESS, clFinish(queue));
+
+    auto end = chrono::high_resolution_clock::now();
+    auto elapsed = chrono::duration_cast<chrono::duration<double>>(end - start);
+
+    state.SetIterationTime(elapsed.count());
+  }
+  state.SetItemsProcessed(state.iterations() * command_count);
+
+  ASSERT_EQ_ERRCODE(CL_SUCCESS, functions.releaseCommandBuffer(command_buffer));
+  ASSERT_EQ_ERRCODE(CL_SUCCESS, clReleaseCommandQueue(queue));
+  ASSERT_EQ_ERRCODE(CL_SUCCESS, clReleaseMemObject(buffer));
+  ASSERT_EQ_ERRCODE(CL_SUCCESS, clReleaseKernel(kernel));
+  ASSERT_EQ_ERRCODE(CL_SUCCESS, clReleaseProgram(program));
+  ASSERT_EQ_ERRCODE(CL_SUCCESS, clReleaseContext(context));
+}
+}  // namespace
+
+BENCHMARK(CommandBufferMutableDispatchUpdate)
+    ->Arg(100)
+    ->Arg(10000)
+    ->UseManualTime();
@@ -206,6 +206,192 @@ void KernelEnqueueEmpty(benchmark::State &state) {
 }
 BENCHMARK(KernelEnqueueEmpty)->UseManualTime();
 
+// Measures the round trip latency of dispatching a tiny kernel split into
+// state.range(0) work-groups, i.e. how quickly a device can hand out and
+// collect small amounts of work across its execution units. On host the number
+// of threads sharing the work-groups can be varied with CA_HOST_NUM_THREADS.
+void KernelDispatchLatency(benchmark::State &state) {
+  const std::string source = R"CL(
+    __kernel void increment(__global int *data) {
+      data[get_global_id(0)] += 1;
+    }
+  )CL";
+  const CreateData cd = create_data_from_source(source);
+
+  const size_t local_size = 1;
+  const size_t global_size = state.range(0) * local_size;
+
+  cl_int err = CL_SUCCESS;
+  cl_mem buffer = clCreateBuffer(cd.context, CL_MEM_READ_WRITE,
+                                 sizeof(cl_int) * global_size, nullptr, &err);
+  ASSERT_EQ_ERRCODE(CL_SUCCESS, err);
+
+  cl_command_queue queue = clCreateCommandQueue(cd.context, cd.device, 0, &err);
+  ASSERT_EQ_ERRCODE(CL_SUCCESS, err);
+
+  cl_kernel kernel = clCreateKernel(cd.program, "increment", &err);
+  ASSERT_EQ_ERRCODE(CL_SUCCESS, err);
+  ASSERT_EQ_ERRCODE(CL_SUCCESS,
+                    clSetKernelArg(kernel, 0, sizeof(buffer), &buffer));
+
+  // Early enqueue so that kernel compilation isn't measured.
+  ASSERT_EQ_ERRCODE(CL_SUCCESS, clEnqueueNDRangeKernel(
+                                    queue, kernel, 1, nullptr, &global_size,
+                                    &local_size, 0, nullptr, nullptr));
+  ASSERT_EQ_ERRCODE(CL_SUCCESS, clFinish(queue));
+
+  for (auto _ : state) {
+    (void)_;
+    namespace chrono = std::chrono;
+    auto start = chrono::high_resolution_clock::now();
+
+    ASSERT_EQ_ERRCODE(CL_SUCCESS, clEnqueueNDRangeKernel(
+                                      queue, kernel, 1, nullptr, &global_size,
+                                      &local_size, 0, nullptr, nullptr));
+    ASSERT_EQ_ERRCODE(CL_SUCCESS, clFinish(queue));
+
+    auto end = chrono::high_resolution_clock::now();
+    auto elapsed = chrono::duration_cast<chrono::duration<double>>(end - start);
+
+    state.SetIterationTime(elapsed.count());
+  }
+
+  ASSERT_EQ_ERRCODE(CL_SUCCESS, clReleaseKernel(kernel));
+  ASSERT_EQ_ERRCODE(CL_SUCCESS, clReleaseCommandQueue(queue));
+  ASSERT_EQ_ERRCODE(CL_SUCCESS, clReleaseMemObject(buffer));
+}
+BENCHMARK(KernelDispatchLatency)
+    ->Arg(1)
+    ->Arg(4)
+    ->Arg(16)
+    ->Arg(64)
+    ->Arg(256)
+    ->UseManualTime();
+
+// Measures state.range(0) tiny kernels each followed by clFlush, as runtimes
+// layered on OpenCL often issue them. Flush batching, which merges the kernels
+// into fewer command buffers, can be enabled with CA_CL_BATCH_FLUSH_US.
+void KernelFlushEach(benchmark::State &state) {
+  const std::string source = R"CL(
+    __kernel void increment(__global int *data) {
+      data[get_global_id(0)] += 1;
+    }
+  )CL";
+  const CreateData cd = create_data_from_source(source);
+
+  const size_t global_size = 1;
+
+  cl_int err = CL_SUCCESS;
+  cl_mem buffer = clCreateBuffer(cd.context, CL_MEM_READ_WRITE, sizeof(cl_int),
+                                 nullptr, &err);
+  ASSERT_EQ_ERRCODE(CL_SUCCESS, err);
+
+  cl_command_queue queue = clCreateCommandQueue(cd.context, cd.device, 0, &err);
+  ASSERT_EQ_ERRCODE(CL_SUCCESS, err);
+
+  cl_kernel kernel = clCreateKernel(cd.program, "increment", &err);
+  ASSERT_EQ_ERRCODE(CL_SUCCESS, err);
+  ASSERT_EQ_ERRCODE(CL_SUCCESS,
+                    clSetKernelArg(kernel, 0, sizeof(buffer), &buffer));
+
+  // Early enqueue so that kernel compilation isn't measured.
+  ASSERT_EQ_ERRCODE(CL_SUCCESS, clEnqueueNDRangeKernel(
+                                    queue, kernel, 1, nullptr, &global_size,
+                                    nullptr, 0, nullptr, nullptr));
+  ASSERT_EQ_ERRCODE(CL_SUCCESS, clFinish(queue));
+
+  for (auto _ : state) {
+    (void)_;
+    namespace chrono = std::chrono;
+    auto start = chrono::high_resolution_clock::now();
+
+    for (int64_t i = 0; i < state.range(0); i++) {
+      ASSERT_EQ_ERRCODE(CL_SUCCESS, clEnqueueNDRangeKernel(
+                                        queue, kernel, 1, nullptr,
+                                        &global_size, nullptr, 0, nullptr,
+                                        nullptr));
+      ASSERT_EQ_ERRCODE(CL_SUCCESS, clFlush(queue));
+    }
+    ASSERT_EQ_ERRCODE(CL_SUCCESS, clFinish(queue));
+
+    auto end = chrono::high_resolution_clock::now();
+    auto elapsed = chrono::duration_cast<chrono::duration<double>>(end - start);
+
+    state.SetIterationTime(elapsed.count());
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+
+  ASSERT_EQ_ERRCODE(CL_SUCCESS, clReleaseKernel(kernel));
+  ASSERT_EQ_ERRCODE(CL_SUCCESS, clReleaseCommandQueue(queue));
+  ASSERT_EQ_ERRCODE(CL_SUCCESS, clReleaseMemObject(buffer));
+}
+BENCHMARK(KernelFlushEach)->Arg(16)->Arg(256)->Arg(4096)->UseManualTime();
+
+// Measures an nd-range whose work-groups have very irregular costs, only the
+// work-groups in the first 1/state.range(0) of the range do any real work. On
+// host the static and dynamic work-group schedules can be compared with
+// CA_HOST_SCHEDULE=static and CA_HOST_SCHEDULE=dynamic.
+void KernelIrregularWorkGroups(benchmark::State &state) {
+  const std::string source = R"CL(
+    __kernel void irregular(__global uint *data, uint heavy_groups) {
+      uint value = data[get_global_id(0)];
+      uint iterations = get_group_id(0) < heavy_groups ? 4096 : 1;
+      for (uint i = 0; i < iterations; i++) {
+        value = value * 1664525u + 1013904223u;
+      }
+      data[get_global_id(0)] = value;
+    }
+  )CL";
+  const CreateData cd = create_data_from_source(source);
+
+  const size_t local_size = 16;
+  const size_t num_groups = 4096;
+  const size_t global_size = num_groups * local_size;
+  const cl_uint heavy_groups = num_groups / state.range(0);
+
+  cl_int err = CL_SUCCESS;
+  cl_mem buffer = clCreateBuffer(cd.context, CL_MEM_READ_WRITE,
+                                 sizeof(cl_uint) * global_size, nullptr, &err);
+  ASSERT_EQ_ERRCODE(CL_SUCCESS, err);
+
+  cl_command_queue queue = clCreateCommandQueue(cd.context, cd.device, 0, &err);
+  ASSERT_EQ_ERRCODE(CL_SUCCESS, err);
+
+  cl_kernel kernel = clCreateKernel(cd.program, "irregular", &err);
+  ASSERT_EQ_ERRCODE(CL_SUCCESS, err);
+  ASSERT_EQ_ERRCODE(CL_SUCCESS,
+                    clSetKernelArg(kernel, 0, sizeof(buffer), &buffer));
+  ASSERT_EQ_ERRCODE(CL_SUCCESS, clSetKernelArg(kernel, 1, sizeof(heavy_groups),
+                                               &heavy_groups));
+
+  // Early enqueue so that kernel compilation isn't measured.
+  ASSERT_EQ_ERRCODE(CL_SUCCESS, clEnqueueNDRangeKernel(
+                                    queue, kernel, 1, nullptr, &global_size,
+                                    &local_size, 0, nullptr, nullptr));
+  ASSERT_EQ_ERRCODE(CL_SUCCESS, clFinish(queue));
+
+  for (auto _ : state) {
+    (void)_;
+    namespace chrono = std::chrono;
+    auto start = chrono::high_resolution_clock::now();
+
+    ASSERT_EQ_ERRCODE(CL_SUCCESS, clEnqueueNDRangeKernel(
+                                      queue, kernel, 1, nullptr, &global_size,
+                                      &local_size, 0, nullptr, nullptr));
+    ASSERT_EQ_ERRCODE(CL_SUCCESS, clFinish(queue));
+
+    auto end = chrono::high_resolution_clock::now();
+    auto elapsed = chrono::duration_cast<chrono::duration<double>>(end - start);
+
+    state.SetIterationTime(elapsed.count());
+  }
+
+  ASSERT_EQ_ERRCODE(CL_SUCCESS, clReleaseKernel(kernel));
+  ASSERT_EQ_ERRCODE(CL_SUCCESS, clReleaseCommandQueue(queue));
+  ASSERT_EQ_ERRCODE(CL_SUCCESS, clReleaseMemObject(buffer));
+}
+BENCHMARK(KernelIrregularWorkGroups)->Arg(1)->Arg(4)->Arg(32)->UseManualTime();
+
 void KernelTiledEnqueue(benchmark::State &state) {
   const std::string source = R"CL(
     __kernel void vector_addition(__global int *src1, __global int *src2,
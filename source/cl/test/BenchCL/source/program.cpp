@@ -269,6 +269,32 @@ static void BuildSingleStringProgram(benchmark::State &state) {
   clReleaseProgram(program);
 }
 
+// Measures build throughput with state.threads() threads each building
+// independent programs in their own context, as a service building many
+// programs at startup would.
+template <InputType::Type TYPE>
+static void BuildProgramThroughput(benchmark::State &state) {
+  CreateProgramData cpd;
+
+  std::vector<const char *> data(cpd.generate<TYPE>(state.range(0)));
+
+  for (auto _ : state) {
+    cl_int status = CL_SUCCESS;
+    cl_program program = clCreateProgramWithSource(
+        cpd.context, data.size(), data.data(), nullptr, &status);
+    ASSERT_EQ_ERRCODE(CL_SUCCESS, status);
+    ASSERT_EQ_ERRCODE(CL_SUCCESS, clBuildProgram(program, 0, nullptr, nullptr,
+                                                 nullptr, nullptr));
+    clReleaseProgram(program);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK_TEMPLATE(BuildProgramThroughput, InputType::MATHBUILTINS)
+    ->Arg(64)
+    ->ThreadRange(1, 16)
+    ->UseRealTime();
+
 #define TEMPLATE_ARGS() Arg(1)->Arg(1024)->Arg(8192)
 
 #define TEMPLATE_FOREACH(type)                                           \
@@ -19,6 +19,8 @@
 #include <CL/cl.h>
 #include <benchmark/benchmark.h>
 
+#include <memory>
+#include <mutex>
 #include <string>
 #include <thread>
 
@@ -251,3 +253,107 @@ BENCHMARK(MultiThreadMultiQueue)
     ->Arg(256)
     ->Arg(1024)
     ->Threads(std::thread::hardware_concurrency());
+
+/// @brief Share one `CreateData` between all threads of a benchmark run.
+///
+/// The multi-queue benchmarks above construct a context per thread, so they
+/// never contend on context wide state. These benchmarks instead give each
+/// thread its own command queue in a single shared context, which is how
+/// multi-threaded applications usually submit work.
+struct SharedCreateData {
+  SharedCreateData() {
+    const std::lock_guard<std::mutex> lock(mutex);
+    if (0 == users++) {
+      data.reset(new CreateData);
+    }
+  }
+
+  ~SharedCreateData() {
+    const std::lock_guard<std::mutex> lock(mutex);
+    if (0 == --users) {
+      data.reset();
+    }
+  }
+
+  const CreateData &get() const { return *data; }
+
+  static std::mutex mutex;
+  static unsigned users;
+  static std::unique_ptr<CreateData> data;
+};
+
+std::mutex SharedCreateData::mutex;
+unsigned SharedCreateData::users = 0;
+std::unique_ptr<CreateData> SharedCreateData::data;
+
+void MultiThreadSharedContextNoDependencies(benchmark::State &state) {
+  const SharedCreateData shared;
+  const CreateData &cd = shared.get();
+
+  cl_int status = CL_SUCCESS;
+  cl_command_queue queue =
+      clCreateCommandQueue(cd.context, cd.device, 0, &status);
+  ASSERT_EQ_ERRCODE(CL_SUCCESS, status);
+
+  for (auto _ : state) {
+    (void)_;
+    for (unsigned i = 0; i < state.range(0); i++) {
+      const size_t size = CreateData::BUFFER_LENGTH;
+      clEnqueueNDRangeKernel(queue, cd.kernel, 1, nullptr, &size, nullptr, 0,
+                             nullptr, nullptr);
+    }
+
+    clFinish(queue);
+  }
+
+  ASSERT_EQ_ERRCODE(CL_SUCCESS, clReleaseCommandQueue(queue));
+
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(MultiThreadSharedContextNoDependencies)
+    ->Arg(1)
+    ->Arg(256)
+    ->Arg(1024)
+    ->ThreadRange(1, std::thread::hardware_concurrency())
+    ->UseRealTime();
+
+void MultiThreadSharedContext(benchmark::State &state) {
+  const SharedCreateData shared;
+  const CreateData &cd = shared.get();
+
+  cl_int status = CL_SUCCESS;
+  cl_command_queue queue =
+      clCreateCommandQueue(cd.context, cd.device, 0, &status);
+  ASSERT_EQ_ERRCODE(CL_SUCCESS, status);
+
+  for (auto _ : state) {
+    (void)_;
+    const size_t size = CreateData::BUFFER_LENGTH;
+
+    cl_event event;
+    clEnqueueNDRangeKernel(queue, cd.kernel, 1, nullptr, &size, nullptr, 0,
+                           nullptr, &event);
+
+    for (unsigned i = 1; i < state.range(0); i++) {
+      cl_event next;
+      clEnqueueNDRangeKernel(queue, cd.kernel, 1, nullptr, &size, nullptr, 1,
+                             &event, &next);
+      clReleaseEvent(event);
+      event = next;
+    }
+
+    clFinish(queue);
+
+    clReleaseEvent(event);
+  }
+
+  ASSERT_EQ_ERRCODE(CL_SUCCESS, clReleaseCommandQueue(queue));
+
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(MultiThreadSharedContext)
+    ->Arg(1)
+    ->Arg(256)
+    ->Arg(1024)
+    ->ThreadRange(1, std::thread::hardware_concurrency())
+    ->UseRealTime();
@@ -0,0 +1,170 @@
+// Copyright (C) Codeplay Software Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License") with LLVM
+// Exceptions; you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://github.com/codeplaysoftware/oneapi-construction-kit/blob/main/LICENSE.txt
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+//
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+
+#include <BenchCL/environment.h>
+#include <BenchCL/error.h>
+#include <CL/cl.h>
+#include <CL/cl_ext.h>
+#include <benchmark/benchmark.h>
+
+#if __has_include(<CL/cl_ext_codeplay.h>)
+#include <CL/cl_ext_codeplay.h>
+#endif
+
+#include <string>
+#include <vector>
+
+namespace {
+/// @brief Context and USM entry points shared by the USM benchmarks.
+struct USMData {
+  USMData() {
+    auto env = benchcl::env::get();
+    size_t size = 0;
+    auto status = clGetDeviceInfo(env->device, CL_DEVICE_EXTENSIONS, 0,
+                                  nullptr, &size);
+    ASSERT_EQ_ERRCODE(CL_SUCCESS, status);
+    std::string extensions(size, '\0');
+    status = clGetDeviceInfo(env->device, CL_DEVICE_EXTENSIONS, size,
+                             &extensions[0], nullptr);
+    ASSERT_EQ_ERRCODE(CL_SUCCESS, status);
+    if (std::string::npos ==
+        extensions.find("cl_intel_unified_shared_memory")) {
+      return;
+    }
+
+    deviceMemAlloc = reinterpret_cast<clDeviceMemAllocINTEL_fn>(
+        clGetExtensionFunctionAddressForPlatform(env->platform,
+                                                 "clDeviceMemAllocINTEL"));
+    cl_device_unified_shared_memory_capabilities_intel host_capabilities = 0;
+    status = clGetDeviceInfo(env->device, CL_DEVICE_HOST_MEM_CAPABILITIES_INTEL,
+                             sizeof(host_capabilities), &host_capabilities,
+                             nullptr);
+    ASSERT_EQ_ERRCODE(CL_SUCCESS, status);
+    if (host_capabilities) {
+      hostMemAlloc = reinterpret_cast<clHostMemAllocINTEL_fn>(
+          clGetExtensionFunctionAddressForPlatform(env->platform,
+                                                   "clHostMemAllocINTEL"));
+    }
+    memFree = reinterpret_cast<clMemFreeINTEL_fn>(
+        clGetExtensionFunctionAddressForPlatform(env->platform,
+                                                 "clMemFreeINTEL"));
+
+    ctx = clCreateContext(nullptr, 1, &env->device, nullptr, nullptr, &status);
+    ASSERT_EQ_ERRCODE(CL_SUCCESS, status);
+  }
+
+  ~USMData() {
+    if (ctx) {
+      ASSERT_EQ_ERRCODE(CL_SUCCESS, clReleaseContext(ctx));
+    }
+  }
+
+  /// @brief Allocates @p size bytes of device memory if @p host is false,
+  /// otherwise host memory, optionally opting out of the USM pool.
+  void *alloc(bool host, size_t size, bool pooled) const {
+    const cl_mem_properties_intel *properties = nullptr;
+#ifdef CL_MEM_ALLOC_POOLED_CODEPLAY
+    const cl_mem_properties_intel unpooled[] = {CL_MEM_ALLOC_POOLED_CODEPLAY,
+                                                CL_FALSE, 0};
+    if (!pooled) {
+      properties = unpooled;
+    }
+#else
+    (void)pooled;
+#endif
+    auto status = CL_SUCCESS;
+    void *ptr =
+        host ? hostMemAlloc(ctx, properties, size, 0, &status)
+             : deviceMemAlloc(ctx, benchcl::env::get()->device, properties,
+                              size, 0, &status);
+    ASSERT_EQ_ERRCODE(CL_SUCCESS, status);
+    return ptr;
+  }
+
+  bool supported(bool host) const {
+    return ctx && memFree &&
+           (host ? nullptr != hostMemAlloc : nullptr != deviceMemAlloc);
+  }
+
+  cl_context ctx = nullptr;
+  clDeviceMemAllocINTEL_fn deviceMemAlloc = nullptr;
+  clHostMemAllocINTEL_fn hostMemAlloc = nullptr;
+  clMemFreeINTEL_fn memFree = nullptr;
+};
+
+/// @brief Allocates and frees a single USM block per iteration.
+///
+/// Arguments are the allocation size in bytes and whether it may use the USM
+/// pool.
+void USMAllocFree(benchmark::State &state, bool host) {
+  const USMData data;
+  if (!data.supported(host)) {
+    state.SkipWithError("cl_intel_unified_shared_memory not supported");
+    return;
+  }
+
+  const size_t size = static_cast<size_t>(state.range(0));
+  const bool pooled = 0 != state.range(1);
+
+  for (auto _ : state) {
+    (void)_;
+    void *ptr = data.alloc(host, size, pooled);
+    ASSERT_EQ_ERRCODE(CL_SUCCESS, data.memFree(data.ctx, ptr));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+/// @brief Allocates a batch of USM blocks then frees them all per iteration,
+/// as SYCL applications do around each kernel submission.
+///
+/// Arguments are the allocation size in bytes and whether it may use the USM
+/// pool.
+void USMAllocFreeBatch(benchmark::State &state, bool host) {
+  const USMData data;
+  if (!data.supported(host)) {
+    state.SkipWithError("cl_intel_unified_shared_memory not supported");
+    return;
+  }
+
+  const size_t size = static_cast<size_t>(state.range(0));
+  const bool pooled = 0 != state.range(1);
+  std::vector<void *> ptrs(64);
+
+  for (auto _ : state) {
+    (void)_;
+    for (auto &ptr : ptrs) {
+      ptr = data.alloc(host, size, pooled);
+    }
+    for (auto ptr : ptrs) {
+      ASSERT_EQ_ERRCODE(CL_SUCCESS, data.memFree(data.ctx, ptr));
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * ptrs.size());
+}
+
+void USMArgs(benchmark::internal::Benchmark *benchmark) {
+  for (const int64_t size : {64, 4096, 256 * 1024}) {
+    for (const int64_t pooled : {1, 0}) {
+      benchmark->Args({size, pooled});
+    }
+  }
+}
+}  // namespace
+
+BENCHMARK_CAPTURE(USMAllocFree, Device, false)->Apply(USMArgs);
+BENCHMARK_CAPTURE(USMAllocFree, Host, true)->Apply(USMArgs);
+BENCHMARK_CAPTURE(USMAllocFreeBatch, Device, false)->Apply(USMArgs);
+BENCHMARK_CAPTURE(USMAllocFreeBatch, Host, true)->Apply(USMArgs);
@@ -14,8 +14,23 @@
 //
 // SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
 
+#include <CL/cl_ext.h>
+
 #include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <string>
 #include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
 
 #include "Common.h"
 
@@ -833,3 +848,218 @@ kernel void f(global float *param_must_exist_for_crash) {
 )cl";
   Build(source);
 }
+
+// These tests only run when the persistent binary cache is enabled by setting
+// `CA_CL_BINARY_CACHE_DIR`. The directory outlives the test run, so sources
+// are made unique to each run to start from a cache miss.
+class clBuildProgramBinaryCacheTest : public ucl::CommandQueueTest {
+ protected:
+  void SetUp() override {
+    UCL_RETURN_ON_FATAL_FAILURE(CommandQueueTest::SetUp());
+    if (!getDeviceCompilerAvailable()) {
+      GTEST_SKIP();
+    }
+    const char *directory = std::getenv("CA_CL_BINARY_CACHE_DIR");
+    if (!directory || !*directory) {
+      GTEST_SKIP();
+    }
+    cache_directory = directory;
+    unique_id = std::to_string(
+        std::chrono::system_clock::now().time_since_epoch().count());
+  }
+
+  /// @brief List the sizes of the entries in the cache directory by name.
+  std::map<std::string, size_t> listEntries() const {
+    std::map<std::string, size_t> entries;
+#if defined(_WIN32)
+    WIN32_FIND_DATAA data;
+    HANDLE find =
+        FindFirstFileA((cache_directory + "/*.bin").c_str(), &data);
+    if (INVALID_HANDLE_VALUE == find) {
+      return entries;
+    }
+    do {
+      entries[data.cFileName] = data.nFileSizeLow;
+    } while (FindNextFileA(find, &data));
+    FindClose(find);
+#else
+    DIR *dir = opendir(cache_directory.c_str());
+    if (!dir) {
+      return entries;
+    }
+    while (const dirent *entry = readdir(dir)) {
+      const std::string name = entry->d_name;
+      if (name.size() < 4 || name.compare(name.size() - 4, 4, ".bin")) {
+        continue;
+      }
+      struct stat info;
+      if (0 == stat((cache_directory + "/" + name).c_str(), &info)) {
+        entries[name] = size_t(info.st_size);
+      }
+    }
+    closedir(dir);
+#endif
+    return entries;
+  }
+
+  /// @brief Get the names of the entries in @p after but not in @p before.
+  static std::vector<std::string> newEntries(
+      const std::map<std::string, size_t> &before,
+      const std::map<std::string, size_t> &after) {
+    std::vector<std::string> names;
+    for (const auto &entry : after) {
+      if (!before.count(entry.first)) {
+        names.push_back(entry.first);
+      }
+    }
+    return names;
+  }
+
+  /// @brief Replace the contents of the entry @p name with @p contents.
+  void writeEntry(const std::string &name, const std::string &contents,
+                  const char *mode) const {
+    std::FILE *file = std::fopen((cache_directory + "/" + name).c_str(), mode);
+    ASSERT_NE(nullptr, file);
+    EXPECT_EQ(contents.size(),
+              std::fwrite(contents.data(), 1, contents.size(), file));
+    EXPECT_EQ(0, std::fclose(file));
+  }
+
+  /// @brief Source of a kernel writing @p value, unique to this test run.
+  std::string getSource(int value) const {
+    return "// " + unique_id + "\n" +
+           "kernel void store(global int *out) {\n"
+           "  out[get_global_id(0)] = " +
+           std::to_string(value) + ";\n}\n";
+  }
+
+  /// @brief Build @p source with @p options, then run it and check it writes
+  /// @p value.
+  void buildAndRun(const std::string &source, const char *options,
+                   cl_int value) {
+    const char *source_ptr = source.c_str();
+    cl_int error = CL_SUCCESS;
+    cl_program program =
+        clCreateProgramWithSource(context, 1, &source_ptr, nullptr, &error);
+    ASSERT_SUCCESS(error);
+    EXPECT_SUCCESS(
+        clBuildProgram(program, 1, &device, options, nullptr, nullptr));
+    cl_kernel kernel = clCreateKernel(program, "store", &error);
+    EXPECT_SUCCESS(error);
+    cl_mem buffer = clCreateBuffer(context, CL_MEM_WRITE_ONLY, sizeof(cl_int),
+                                   nullptr, &error);
+    EXPECT_SUCCESS(error);
+    EXPECT_SUCCESS(clSetKernelArg(kernel, 0, sizeof(cl_mem), &buffer));
+    const size_t global_size = 1;
+    EXPECT_SUCCESS(clEnqueueNDRangeKernel(command_queue, kernel, 1, nullptr,
+                                          &global_size, nullptr, 0, nullptr,
+                                          nullptr));
+    cl_int result = 0;
+    EXPECT_SUCCESS(clEnqueueReadBuffer(command_queue, buffer, CL_TRUE, 0,
+                                       sizeof(cl_int), &result, 0, nullptr,
+                                       nullptr));
+    EXPECT_EQ(value, result);
+    EXPECT_SUCCESS(clReleaseMemObject(buffer));
+    EXPECT_SUCCESS(clReleaseKernel(kernel));
+    EXPECT_SUCCESS(clReleaseProgram(program));
+  }
+
+  std::string cache_directory;
+  std::string unique_id;
+};
+
+TEST_F(clBuildProgramBinaryCacheTest, HitAndMiss) {
+  const auto initial = listEntries();
+  ASSERT_NO_FATAL_FAILURE(buildAndRun(getSource(1), nullptr, 1));
+  const auto after_miss = listEntries();
+  const auto stored = newEntries(initial, after_miss);
+  ASSERT_EQ(1u, stored.size());
+
+  // Loading an entry ignores anything after the binary, but storing it again
+  // would drop the marker.
+  ASSERT_NO_FATAL_FAILURE(writeEntry(stored[0], "marker", "ab"));
+  ASSERT_NO_FATAL_FAILURE(buildAndRun(getSource(1), nullptr, 1));
+  const auto after_hit = listEntries();
+  EXPECT_TRUE(newEntries(after_miss, after_hit).empty());
+  EXPECT_EQ(after_miss.at(stored[0]) + 6, after_hit.at(stored[0]));
+
+  // Different source is a different entry.
+  ASSERT_NO_FATAL_FAILURE(buildAndRun(getSource(2), nullptr, 2));
+  EXPECT_EQ(1u, newEntries(after_hit, listEntries()).size());
+}
+
+TEST_F(clBuildProgramBinaryCacheTest, InvalidatedByOptions) {
+  const auto initial = listEntries();
+  ASSERT_NO_FATAL_FAILURE(buildAndRun(getSource(3), nullptr, 3));
+  const auto after_default = listEntries();
+  EXPECT_EQ(1u, newEntries(initial, after_default).size());
+  ASSERT_NO_FATAL_FAILURE(
+      buildAndRun(getSource(3), "-cl-fast-relaxed-math", 3));
+  const auto after_options = listEntries();
+  EXPECT_EQ(1u, newEntries(after_default, after_options).size());
+  ASSERT_NO_FATAL_FAILURE(
+      buildAndRun(getSource(3), "-cl-fast-relaxed-math", 3));
+  EXPECT_TRUE(newEntries(after_options, listEntries()).empty());
+}
+
+TEST_F(clBuildProgramBinaryCacheTest, CorruptEntry) {
+  const auto initial = listEntries();
+  ASSERT_NO_FATAL_FAILURE(buildAndRun(getSource(4), nullptr, 4));
+  const auto stored = newEntries(initial, listEntries());
+  ASSERT_EQ(1u, stored.size());
+  const size_t entry_size = listEntries().at(stored[0]);
+
+  // A truncated entry is rebuilt and stored again.
+  ASSERT_NO_FATAL_FAILURE(
+      writeEntry(stored[0], std::string(entry_size / 2, 'x'), "wb"));
+  ASSERT_NO_FATAL_FAILURE(buildAndRun(getSource(4), nullptr, 4));
+  EXPECT_EQ(entry_size, listEntries().at(stored[0]));
+
+  // So is one which isn't an entry at all.
+  ASSERT_NO_FATAL_FAILURE(
+      writeEntry(stored[0], std::string(entry_size, 'x'), "wb"));
+  ASSERT_NO_FATAL_FAILURE(buildAndRun(getSource(4), nullptr, 4));
+  EXPECT_EQ(entry_size, listEntries().at(stored[0]));
+}
+
+TEST_F(clBuildProgramBinaryCacheTest, IncludeInComment) {
+  // Only preprocessing directives can include headers.
+  const std::string source = "// Does not #include anything.\n" + getSource(5);
+  const auto initial = listEntries();
+  ASSERT_NO_FATAL_FAILURE(buildAndRun(source, nullptr, 5));
+  EXPECT_EQ(1u, newEntries(initial, listEntries()).size());
+}
+
+// clSetProgramSpecializationConstantSuccessTest checks that each value of the
+// constants is used, which would fail if the cache mixed them up. Programs
+// with specialization constants are never stored.
+TEST_F(clBuildProgramBinaryCacheTest, SpecializationConstants) {
+  if (!UCL::isDeviceVersionAtLeast({3, 0})) {
+    GTEST_SKIP();
+  }
+  std::string name = "clSetProgramSpecializationConstant";
+  if (UCL::hasDeviceExtensionSupport(device, "cl_khr_fp64")) {
+    name += ".fp64";
+  }
+  if (UCL::hasDeviceExtensionSupport(device, "cl_khr_fp16")) {
+    name += ".fp16";
+  }
+  auto code = getDeviceSpirvFromFile(name);
+  auto clCreateProgramWithILKHR = reinterpret_cast<clCreateProgramWithILKHR_fn>(
+      clGetExtensionFunctionAddressForPlatform(platform,
+                                               "clCreateProgramWithILKHR"));
+  ASSERT_NE(nullptr, clCreateProgramWithILKHR);
+
+  const auto initial = listEntries();
+  cl_int error = CL_SUCCESS;
+  cl_program program = clCreateProgramWithILKHR(
+      context, code.data(), code.size() * sizeof(uint32_t), &error);
+  ASSERT_SUCCESS(error);
+  const cl_int value = 42;
+  ASSERT_SUCCESS(
+      clSetProgramSpecializationConstant(program, 3, sizeof(value), &value));
+  EXPECT_SUCCESS(
+      clBuildProgram(program, 1, &device, nullptr, nullptr, nullptr));
+  EXPECT_SUCCESS(clReleaseProgram(program));
+  EXPECT_TRUE(newEntries(initial, listEntries()).empty());
+}
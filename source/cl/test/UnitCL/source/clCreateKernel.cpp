@@ -15,6 +15,7 @@
 // SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
 
 #include <thread>
+#include <vector>
 
 #include "Common.h"
 
@@ -186,3 +187,108 @@ TEST_F(clCreateKernelTest, ConcurrentBuildAndCreate) {
     workers[i].join();
   }
 }
+
+// In a context with several devices the kernel for each device is only created
+// the first time it is used on that device, which may be on several threads at
+// once. Each thread queries a shared kernel, whose first use on a device races
+// the other threads, and enqueues a kernel of its own, whose first use races
+// the other threads' kernels sharing the same device program.
+TEST_F(clCreateKernelTest, ConcurrentFirstUse) {
+  cl_uint num_devices = 0;
+  ASSERT_SUCCESS(clGetDeviceIDs(platform, CL_DEVICE_TYPE_ALL, 0, nullptr,
+                                &num_devices));
+  UCL::vector<cl_device_id> devices(num_devices);
+  ASSERT_SUCCESS(clGetDeviceIDs(platform, CL_DEVICE_TYPE_ALL, num_devices,
+                                devices.data(), nullptr));
+  for (cl_device_id device : devices) {
+    if (!UCL::hasCompilerSupport(device)) {
+      GTEST_SKIP();
+    }
+  }
+
+  cl_int error = !CL_SUCCESS;
+  cl_context multi_context = clCreateContext(
+      nullptr, num_devices, devices.data(), nullptr, nullptr, &error);
+  ASSERT_SUCCESS(error);
+  const char *src = R"OpenCLC(
+  kernel void square(global uint *out) {
+    uint gid = get_global_id(0);
+    out[gid] = gid * gid;
+  }
+)OpenCLC";
+  cl_program multi_program =
+      clCreateProgramWithSource(multi_context, 1, &src, nullptr, &error);
+  ASSERT_SUCCESS(error);
+  ASSERT_SUCCESS(
+      clBuildProgram(multi_program, 0, nullptr, nullptr, nullptr, nullptr));
+  cl_kernel shared_kernel = clCreateKernel(multi_program, "square", &error);
+  ASSERT_SUCCESS(error);
+
+  const size_t threads = 4 * num_devices;
+  const size_t global_size = 256;
+  UCL::vector<cl_command_queue> queues(threads);
+  UCL::vector<cl_kernel> kernels(threads);
+  UCL::vector<cl_mem> buffers(threads);
+  for (size_t i = 0; i < threads; i++) {
+    queues[i] = clCreateCommandQueue(multi_context, devices[i % num_devices],
+                                     0, &error);
+    ASSERT_SUCCESS(error);
+    kernels[i] = clCreateKernel(multi_program, "square", &error);
+    ASSERT_SUCCESS(error);
+    buffers[i] = clCreateBuffer(multi_context, CL_MEM_WRITE_ONLY,
+                                global_size * sizeof(cl_uint), nullptr, &error);
+    ASSERT_SUCCESS(error);
+    ASSERT_SUCCESS(
+        clSetKernelArg(kernels[i], 0, sizeof(cl_mem), &buffers[i]));
+  }
+
+  UCL::vector<cl_int> errors(threads, CL_SUCCESS);
+  UCL::vector<size_t> multiples(threads, 0);
+  UCL::vector<std::vector<cl_uint>> results(
+      threads, std::vector<cl_uint>(global_size, 0));
+  auto worker = [&](size_t i) {
+    cl_device_id device = devices[i % num_devices];
+    errors[i] = clGetKernelWorkGroupInfo(
+        shared_kernel, device, CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE,
+        sizeof(size_t), &multiples[i], nullptr);
+    if (CL_SUCCESS != errors[i]) {
+      return;
+    }
+    errors[i] = clEnqueueNDRangeKernel(queues[i], kernels[i], 1, nullptr,
+                                       &global_size, nullptr, 0, nullptr,
+                                       nullptr);
+    if (CL_SUCCESS != errors[i]) {
+      return;
+    }
+    errors[i] = clEnqueueReadBuffer(queues[i], buffers[i], CL_TRUE, 0,
+                                    global_size * sizeof(cl_uint),
+                                    results[i].data(), 0, nullptr, nullptr);
+  };
+
+  UCL::vector<std::thread> workers(threads);
+  for (size_t i = 0; i < threads; i++) {
+    workers[i] = std::thread(worker, i);
+  }
+  for (size_t i = 0; i < threads; i++) {
+    workers[i].join();
+  }
+
+  for (size_t i = 0; i < threads; i++) {
+    EXPECT_SUCCESS(errors[i]) << "thread " << i;
+    // Every thread using the same device must see the same kernel.
+    EXPECT_EQ(multiples[i % num_devices], multiples[i]) << "thread " << i;
+    for (cl_uint gid = 0; gid < global_size; gid++) {
+      ASSERT_EQ(gid * gid, results[i][gid])
+          << "thread " << i << " at index " << gid;
+    }
+  }
+
+  for (size_t i = 0; i < threads; i++) {
+    EXPECT_SUCCESS(clReleaseMemObject(buffers[i]));
+    EXPECT_SUCCESS(clReleaseKernel(kernels[i]));
+    EXPECT_SUCCESS(clReleaseCommandQueue(queues[i]));
+  }
+  EXPECT_SUCCESS(clReleaseKernel(shared_kernel));
+  EXPECT_SUCCESS(clReleaseProgram(multi_program));
+  EXPECT_SUCCESS(clReleaseContext(multi_context));
+}
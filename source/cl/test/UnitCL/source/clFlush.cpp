@@ -15,6 +15,7 @@
 // SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
 
 #include <thread>
+#include <vector>
 
 #include "Common.h"
 
@@ -229,3 +230,75 @@ TEST_F(clFlushTest, EnqueueFlushCallback) {
   clReleaseKernel(kernel);
   clReleaseProgram(program);
 }
+
+// clFlush must guarantee the flushed commands are issued to the device even if
+// the application makes no further calls which would dispatch them, such as
+// clFinish, here it only polls the status of the last command's event.
+TEST_F(clFlushTest, FlushThenPollEventStatus) {
+  if (!getDeviceCompilerAvailable()) {
+    GTEST_SKIP();
+  }
+  // The first kernel keeps the device busy, so that the flush after the
+  // second kernel may be deferred when flush batching is enabled.
+  const char *src = R"OpenCLC(
+  kernel void busy(global uint *out, uint iterations) {
+    uint value = get_global_id(0);
+    for (uint i = 0; i < iterations; i++) {
+      value = value * 1664525u + 1013904223u;
+    }
+    out[get_global_id(0)] = value;
+  }
+
+  kernel void last(global uint *out) { out[get_global_id(0)] = 42; }
+)OpenCLC";
+
+  cl_int errcode = !CL_SUCCESS;
+  cl_program program =
+      clCreateProgramWithSource(context, 1, &src, nullptr, &errcode);
+  EXPECT_TRUE(program);
+  ASSERT_SUCCESS(errcode);
+  ASSERT_SUCCESS(
+      clBuildProgram(program, 0, nullptr, nullptr, nullptr, nullptr));
+  cl_kernel busy = clCreateKernel(program, "busy", &errcode);
+  ASSERT_SUCCESS(errcode);
+  cl_kernel last = clCreateKernel(program, "last", &errcode);
+  ASSERT_SUCCESS(errcode);
+
+  const size_t range = 1024;
+  cl_mem buffer = clCreateBuffer(context, CL_MEM_READ_WRITE,
+                                 range * sizeof(cl_uint), nullptr, &errcode);
+  ASSERT_SUCCESS(errcode);
+  const cl_uint iterations = 100000;
+  ASSERT_SUCCESS(clSetKernelArg(busy, 0, sizeof(buffer), &buffer));
+  ASSERT_SUCCESS(clSetKernelArg(busy, 1, sizeof(iterations), &iterations));
+  ASSERT_SUCCESS(clSetKernelArg(last, 0, sizeof(buffer), &buffer));
+
+  ASSERT_SUCCESS(clEnqueueNDRangeKernel(command_queue, busy, 1, nullptr,
+                                        &range, nullptr, 0, nullptr, nullptr));
+  ASSERT_SUCCESS(clFlush(command_queue));
+  cl_event event = nullptr;
+  ASSERT_SUCCESS(clEnqueueNDRangeKernel(command_queue, last, 1, nullptr,
+                                        &range, nullptr, 0, nullptr, &event));
+  ASSERT_SUCCESS(clFlush(command_queue));
+
+  cl_int status = CL_QUEUED;
+  do {
+    ASSERT_SUCCESS(clGetEventInfo(event, CL_EVENT_COMMAND_EXECUTION_STATUS,
+                                  sizeof(status), &status, nullptr));
+    ASSERT_GE(status, CL_COMPLETE);
+  } while (CL_COMPLETE != status);
+
+  std::vector<cl_uint> results(range);
+  ASSERT_SUCCESS(clEnqueueReadBuffer(command_queue, buffer, CL_TRUE, 0,
+                                     range * sizeof(cl_uint), results.data(),
+                                     0, nullptr, nullptr));
+  for (size_t i = 0; i < range; i++) {
+    ASSERT_EQ(42u, results[i]) << "at index " << i;
+  }
+
+  EXPECT_SUCCESS(clReleaseEvent(event));
+  EXPECT_SUCCESS(clReleaseMemObject(buffer));
+  EXPECT_SUCCESS(clReleaseKernel(last));
+  EXPECT_SUCCESS(clReleaseKernel(busy));
+  EXPECT_SUCCESS(clReleaseProgram(program));
+}
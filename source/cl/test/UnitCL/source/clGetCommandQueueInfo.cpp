@@ -14,6 +14,8 @@
 //
 // SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
 
+#include <CL/cl_ext_codeplay.h>
+
 #include "Common.h"
 
 class clGetCommandQueueInfoTest : public ucl::ContextTest {
@@ -203,3 +205,42 @@ TEST_F(clGetCommandQueueInfoTest, QueueDeviceDeviceInvalidValue) {
                             sizeof(commandQueue) - 1, &commandQueue, nullptr));
 }
 #endif
+
+TEST_F(clGetCommandQueueInfoTest, QueueMuxAllocationsSteadyState) {
+  size_t size;
+  ASSERT_SUCCESS(clGetCommandQueueInfo(queue, CL_QUEUE_MUX_ALLOCATIONS_CODEPLAY,
+                                       0, nullptr, &size));
+  ASSERT_EQ(sizeof(cl_ulong), size);
+
+  cl_int errcode;
+  cl_mem buffer = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_int),
+                                 nullptr, &errcode);
+  ASSERT_SUCCESS(errcode);
+  const cl_int pattern = 42;
+  auto enqueueAndFinish = [&] {
+    ASSERT_SUCCESS(clEnqueueFillBuffer(queue, buffer, &pattern,
+                                       sizeof(pattern), 0, sizeof(pattern), 0,
+                                       nullptr, nullptr));
+    ASSERT_SUCCESS(clFinish(queue));
+  };
+
+  // Let the command queue's caches grow to the in flight depth.
+  for (int i = 0; i < 10; i++) {
+    enqueueAndFinish();
+  }
+  cl_ulong warm = 0;
+  ASSERT_SUCCESS(clGetCommandQueueInfo(queue, CL_QUEUE_MUX_ALLOCATIONS_CODEPLAY,
+                                       sizeof(warm), &warm, nullptr));
+  EXPECT_LT(0u, warm);
+
+  // Once warm, enqueues must recycle mux objects instead of creating them.
+  for (int i = 0; i < 100; i++) {
+    enqueueAndFinish();
+  }
+  cl_ulong steady = 0;
+  ASSERT_SUCCESS(clGetCommandQueueInfo(queue, CL_QUEUE_MUX_ALLOCATIONS_CODEPLAY,
+                                       sizeof(steady), &steady, nullptr));
+  EXPECT_EQ(warm, steady);
+
+  ASSERT_SUCCESS(clReleaseMemObject(buffer));
+}
@@ -14,6 +14,11 @@
 //
 // SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
 
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <thread>
+
 #include "Common.h"
 
 class clWaitForEventsTest : public ucl::CommandQueueTest {
@@ -107,4 +112,36 @@ TEST_F(clWaitForEventsTest, DependentEventFailed) {
   ASSERT_SUCCESS(clReleaseEvent(userEvent));
 }
 
+// Completes the events after the waiting thread has stopped polling them and
+// blocked, in a different order to the wait list which repeats an event.
+TEST_F(clWaitForEventsTest, UserEventsCompletedLater) {
+  std::array<cl_event, 8> events;
+  for (auto &event : events) {
+    cl_int errorcode = !CL_SUCCESS;
+    event = clCreateUserEvent(context, &errorcode);
+    EXPECT_TRUE(event);
+    ASSERT_SUCCESS(errorcode);
+  }
+  std::array<cl_event, events.size() + 1> wait_list;
+  std::copy(events.begin(), events.end(), wait_list.begin());
+  wait_list.back() = events.front();
+
+  std::thread completer([&events] {
+    for (auto event = events.rbegin(); event != events.rend(); ++event) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      EXPECT_SUCCESS(clSetUserEventStatus(*event, CL_COMPLETE));
+    }
+  });
+  EXPECT_SUCCESS(clWaitForEvents(wait_list.size(), wait_list.data()));
+  completer.join();
+
+  for (auto event : events) {
+    cl_int status = !CL_COMPLETE;
+    EXPECT_SUCCESS(clGetEventInfo(event, CL_EVENT_COMMAND_EXECUTION_STATUS,
+                                  sizeof(status), &status, nullptr));
+    EXPECT_EQ(CL_COMPLETE, status);
+    ASSERT_SUCCESS(clReleaseEvent(event));
+  }
+}
+
 // Redmine #5147: test contexts are the same
@@ -14,6 +14,9 @@
 //
 // SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
 
+#include <utility>
+#include <vector>
+
 #include "Common.h"
 
 class cl_codeplay_extra_build_options_BuildFlags : public ucl::ContextTest {
@@ -167,3 +170,85 @@ TEST_F(cl_codeplay_extra_build_options_BuildFlags,
   ASSERT_SUCCESS(
       clBuildProgram(program, 0, nullptr, "-cl-llvm-stats", nullptr, nullptr));
 }
+
+TEST_F(cl_codeplay_extra_build_options_BuildFlags, clBuildLazyFinalizeTest) {
+  // A kernel with loops, vector code and a helper function, so the deferred
+  // optimizations have something to do, and a second kernel which is never
+  // created.
+  const char *source = R"OpenCLC(
+  uint scramble(uint value, uint rounds) {
+    for (uint i = 0; i < rounds; i++) {
+      value = (value ^ (value >> 7)) * 0x9e3779b1u + i;
+    }
+    return value;
+  }
+
+  kernel void lazy(global const uint *in, global uint *out, uint rounds) {
+    size_t gid = get_global_id(0);
+    uint4 acc = (uint4)(in[gid]);
+    for (uint i = 0; i < 4; i++) {
+      acc = acc * (uint4)(1, 3, 5, 7) + (uint4)(scramble(in[gid], rounds + i));
+    }
+    out[gid] = acc.x ^ acc.y ^ acc.z ^ acc.w;
+  }
+
+  kernel void unused(global uint *out) { out[get_global_id(0)] = 42; }
+)OpenCLC";
+
+  cl_int errorcode = CL_SUCCESS;
+  cl_command_queue command_queue =
+      clCreateCommandQueue(context, device, 0, &errorcode);
+  ASSERT_TRUE(nullptr != command_queue);
+  EXPECT_SUCCESS(errorcode);
+
+  const size_t work_size = 256;
+  std::vector<cl_uint> input(work_size);
+  for (size_t i = 0; i < work_size; i++) {
+    input[i] = static_cast<cl_uint>(i * 2654435761u);
+  }
+  cl_mem in_buffer =
+      clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                     work_size * sizeof(cl_uint), input.data(), &errorcode);
+  ASSERT_TRUE(nullptr != in_buffer);
+  EXPECT_SUCCESS(errorcode);
+  cl_mem out_buffer = clCreateBuffer(context, CL_MEM_WRITE_ONLY,
+                                     work_size * sizeof(cl_uint), nullptr,
+                                     &errorcode);
+  ASSERT_TRUE(nullptr != out_buffer);
+  EXPECT_SUCCESS(errorcode);
+
+  // Build and run the kernel lazily finalized, then eagerly finalized.
+  std::vector<std::vector<cl_uint>> results;
+  for (const char *options : {"-cl-lazy-finalize", ""}) {
+    cl_program built_program =
+        clCreateProgramWithSource(context, 1, &source, nullptr, &errorcode);
+    ASSERT_TRUE(nullptr != built_program);
+    EXPECT_SUCCESS(errorcode);
+    ASSERT_SUCCESS(
+        clBuildProgram(built_program, 0, nullptr, options, nullptr, nullptr));
+    cl_kernel kernel = clCreateKernel(built_program, "lazy", &errorcode);
+    ASSERT_TRUE(nullptr != kernel);
+    ASSERT_SUCCESS(errorcode);
+
+    const cl_uint rounds = 5;
+    EXPECT_SUCCESS(clSetKernelArg(kernel, 0, sizeof(cl_mem), &in_buffer));
+    EXPECT_SUCCESS(clSetKernelArg(kernel, 1, sizeof(cl_mem), &out_buffer));
+    EXPECT_SUCCESS(clSetKernelArg(kernel, 2, sizeof(rounds), &rounds));
+    ASSERT_SUCCESS(clEnqueueNDRangeKernel(command_queue, kernel, 1, nullptr,
+                                          &work_size, nullptr, 0, nullptr,
+                                          nullptr));
+    std::vector<cl_uint> output(work_size);
+    ASSERT_SUCCESS(clEnqueueReadBuffer(
+        command_queue, out_buffer, CL_TRUE, 0, work_size * sizeof(cl_uint),
+        output.data(), 0, nullptr, nullptr));
+    results.push_back(std::move(output));
+
+    EXPECT_SUCCESS(clReleaseKernel(kernel));
+    EXPECT_SUCCESS(clReleaseProgram(built_program));
+  }
+  EXPECT_EQ(results[1], results[0]);
+
+  EXPECT_SUCCESS(clReleaseMemObject(in_buffer));
+  EXPECT_SUCCESS(clReleaseMemObject(out_buffer));
+  EXPECT_SUCCESS(clReleaseCommandQueue(command_queue));
+}
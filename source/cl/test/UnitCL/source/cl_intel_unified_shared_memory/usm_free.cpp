@@ -110,6 +110,70 @@ TEST_F(USMTests, MemFree_ValidUsage) {
   }
 }
 
+// Test that freed allocations are reused by the pool without changing the
+// reported size, and never while commands using them are still in flight
+TEST_F(USMTests, MemFree_PooledReuse) {
+  const size_t bytes = 100;
+  const cl_uint align = 4;
+  cl_int err;
+
+  void *device_ptr =
+      clDeviceMemAllocINTEL(context, device, nullptr, bytes, align, &err);
+  ASSERT_SUCCESS(err);
+  ASSERT_TRUE(device_ptr != nullptr);
+  EXPECT_SUCCESS(clMemFreeINTEL(context, device_ptr));
+
+  device_ptr =
+      clDeviceMemAllocINTEL(context, device, nullptr, bytes, align, &err);
+  ASSERT_SUCCESS(err);
+  ASSERT_TRUE(device_ptr != nullptr);
+
+  size_t alloc_size = 0;
+  EXPECT_SUCCESS(clGetMemAllocInfoINTEL(context, device_ptr,
+                                        CL_MEM_ALLOC_SIZE_INTEL,
+                                        sizeof(alloc_size), &alloc_size,
+                                        nullptr));
+  EXPECT_EQ(bytes, alloc_size);
+
+  // Keep a fill of the allocation waiting on a user event across the free
+  cl_command_queue queue = clCreateCommandQueue(context, device, 0, &err);
+  ASSERT_SUCCESS(err);
+  cl_event user_event = clCreateUserEvent(context, &err);
+  ASSERT_SUCCESS(err);
+  const cl_uint pattern = 42;
+  EXPECT_SUCCESS(clEnqueueMemFillINTEL(queue, device_ptr, &pattern,
+                                       sizeof(pattern), sizeof(pattern), 1,
+                                       &user_event, nullptr));
+  EXPECT_SUCCESS(clMemFreeINTEL(context, device_ptr));
+
+  void *other_ptr =
+      clDeviceMemAllocINTEL(context, device, nullptr, bytes, align, &err);
+  ASSERT_SUCCESS(err);
+  ASSERT_TRUE(other_ptr != nullptr);
+  EXPECT_NE(device_ptr, other_ptr);
+
+  EXPECT_SUCCESS(clSetUserEventStatus(user_event, CL_COMPLETE));
+  EXPECT_SUCCESS(clFinish(queue));
+  EXPECT_SUCCESS(clMemBlockingFreeINTEL(context, other_ptr));
+  EXPECT_SUCCESS(clReleaseEvent(user_event));
+  EXPECT_SUCCESS(clReleaseCommandQueue(queue));
+
+  // Opting out of the pool
+  cl_mem_properties_intel unpooled[] = {CL_MEM_ALLOC_POOLED_CODEPLAY, CL_FALSE,
+                                        0};
+  device_ptr =
+      clDeviceMemAllocINTEL(context, device, unpooled, bytes, align, &err);
+  ASSERT_SUCCESS(err);
+  ASSERT_TRUE(device_ptr != nullptr);
+  EXPECT_SUCCESS(clMemFreeINTEL(context, device_ptr));
+
+  cl_mem_properties_intel invalid[] = {CL_MEM_ALLOC_POOLED_CODEPLAY, 2, 0};
+  device_ptr =
+      clDeviceMemAllocINTEL(context, device, invalid, bytes, align, &err);
+  EXPECT_EQ_ERRCODE(err, CL_INVALID_PROPERTY);
+  EXPECT_EQ(device_ptr, nullptr);
+}
+
 namespace {
 // Fixture to help testing of clMemBlockingFreeINTEL
 struct USMBlockingFreeTest : public cl_intel_unified_shared_memory_Test {
@@ -911,6 +911,66 @@ TEST_F(CommandBufferUpdateNDKernel, NoMutablePropertiesSet) {
   EXPECT_SUCCESS(clReleaseMemObject(updated_dst_buffer));
 }
 
+// Test that an update failing on its second argument doesn't apply the valid
+// update of its first argument either.
+TEST_F(CommandBufferUpdateNDKernel, InvalidSecondArgument) {
+  // Create a new input buffer to update to.
+  cl_int error = CL_SUCCESS;
+  cl_mem updated_src_buffer = clCreateBuffer(
+      context, CL_MEM_READ_ONLY, data_size_in_bytes, nullptr, &error);
+  EXPECT_SUCCESS(error);
+
+  const cl_int pattern = 7;
+  EXPECT_SUCCESS(clEnqueueFillBuffer(command_queue, updated_src_buffer,
+                                     &pattern, sizeof(pattern), 0,
+                                     data_size_in_bytes, 0, nullptr, nullptr));
+
+  // Record a mutable dispatch to the command buffer.
+  cl_ndrange_kernel_command_properties_khr mutable_properties[3] = {
+      CL_MUTABLE_DISPATCH_UPDATABLE_FIELDS_KHR,
+      CL_MUTABLE_DISPATCH_ARGUMENTS_KHR, 0};
+  EXPECT_SUCCESS(clCommandNDRangeKernelKHR(
+      command_buffer, nullptr, mutable_properties, kernel, 1, nullptr,
+      &global_size, nullptr, 0, nullptr, nullptr, &command_handle));
+
+  // Finalize the command buffer.
+  EXPECT_SUCCESS(clFinalizeCommandBufferKHR(command_buffer));
+
+  // Update the input buffer, and the output buffer with an invalid size.
+  const cl_mutable_dispatch_arg_khr args[2] = {
+      {0, sizeof(cl_mem), &updated_src_buffer},
+      {1, 2 /* arg_size */, &dst_buffer}};
+  cl_mutable_dispatch_config_khr dispatch_config{
+      CL_STRUCTURE_TYPE_MUTABLE_DISPATCH_CONFIG_KHR,
+      nullptr,
+      command_handle,
+      2,
+      0,
+      0,
+      0,
+      args,
+      nullptr,
+      nullptr,
+      nullptr,
+      nullptr,
+      nullptr};
+  cl_mutable_base_config_khr mutable_config{
+      CL_STRUCTURE_TYPE_MUTABLE_BASE_CONFIG_KHR, nullptr, 1, &dispatch_config};
+  EXPECT_EQ_ERRCODE(CL_INVALID_ARG_SIZE, clUpdateMutableCommandsKHR(
+                                             command_buffer, &mutable_config));
+
+  // Enqueue the command buffer, it must still copy from the original input.
+  EXPECT_SUCCESS(clEnqueueCommandBufferKHR(0, nullptr, command_buffer, 0,
+                                           nullptr, nullptr));
+  EXPECT_SUCCESS(clEnqueueReadBuffer(command_queue, dst_buffer, CL_TRUE, 0,
+                                     data_size_in_bytes, output_data.data(), 0,
+                                     nullptr, nullptr));
+  EXPECT_EQ(input_data, output_data);
+
+  // Cleanup.
+  EXPECT_SUCCESS(clReleaseMemObject(updated_src_buffer));
+}
+
 // Fixture for testing updating command-buffer enqueued simultaneously
 class CommandBufferSimultaneousUpdate : public CommandBufferUpdateNDKernel {
  protected:
@@ -14,7 +14,11 @@
 //
 // SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
 
+#include <cstdio>
+#include <string>
+
 #include "Common.h"
+#include "kts/stdout_capture.h"
 
 struct printfBuiltinTest : ucl::CommandQueueTest,
                            testing::WithParamInterface<const char *> {
@@ -229,3 +233,111 @@ INSTANTIATE_TEST_CASE_P(ValidKernels, printfBuiltinValidTest,
 
 INSTANTIATE_TEST_CASE_P(InvalidKernels, printfBuiltinInvalidTest,
                         ::testing::ValuesIn(invalid_kernels));
+
+// Device printf output is printed asynchronously by a host thread, but must
+// have been printed by the time a blocking command enqueued after the kernel
+// returns, ahead of anything the host prints afterwards.
+struct printfOrderingTest : ucl::CommandQueueTest {
+  void SetUp() override {
+    UCL_RETURN_ON_FATAL_FAILURE(CommandQueueTest::SetUp());
+    if (!getDeviceCompilerAvailable()) {
+      GTEST_SKIP();
+    }
+    const char *source = R"OpenCLC(
+  void kernel foo(global int *out, int value) {
+    for (int i = 0; i < 4; i++) {
+      printf("device %d %d\n", value, i);
+    }
+    *out = value;
+  }
+)OpenCLC";
+    cl_int errorcode;
+    program =
+        clCreateProgramWithSource(context, 1, &source, nullptr, &errorcode);
+    ASSERT_TRUE(program);
+    ASSERT_SUCCESS(errorcode);
+    ASSERT_SUCCESS(
+        clBuildProgram(program, 1, &device, nullptr, nullptr, nullptr));
+    kernel = clCreateKernel(program, "foo", &errorcode);
+    ASSERT_SUCCESS(errorcode);
+    outMem = clCreateBuffer(context, 0, sizeof(cl_int), nullptr, &errorcode);
+    ASSERT_SUCCESS(errorcode);
+    ASSERT_SUCCESS(clSetKernelArg(kernel, 0, sizeof(cl_mem), &outMem));
+  }
+
+  void TearDown() override {
+    if (outMem) {
+      EXPECT_SUCCESS(clReleaseMemObject(outMem));
+    }
+    if (kernel) {
+      EXPECT_SUCCESS(clReleaseKernel(kernel));
+    }
+    if (program) {
+      EXPECT_SUCCESS(clReleaseProgram(program));
+    }
+    CommandQueueTest::TearDown();
+  }
+
+  /// @brief Enqueue the kernel once for each value, without waiting.
+  void enqueueKernels(cl_int count) {
+    const size_t global_size = 1;
+    for (cl_int value = 0; value < count; value++) {
+      ASSERT_SUCCESS(clSetKernelArg(kernel, 1, sizeof(cl_int), &value));
+      ASSERT_SUCCESS(clEnqueueNDRangeKernel(command_queue, kernel, 1, nullptr,
+                                            &global_size, nullptr, 0, nullptr,
+                                            nullptr));
+    }
+  }
+
+  /// @brief Output expected from `enqueueKernels` followed by a host print.
+  static std::string expectedOutput(cl_int count) {
+    std::string expected;
+    for (cl_int value = 0; value < count; value++) {
+      for (int i = 0; i < 4; i++) {
+        expected += "device " + std::to_string(value) + " " +
+                    std::to_string(i) + "\n";
+      }
+    }
+    return expected + "host\n";
+  }
+
+  static constexpr cl_int num_kernels = 8;
+
+  cl_program program = nullptr;
+  cl_kernel kernel = nullptr;
+  cl_mem outMem = nullptr;
+  kts::StdoutCapture stdout_capture;
+};
+
+TEST_F(printfOrderingTest, BlockingRead) {
+  stdout_capture.CaptureStdout();
+  ASSERT_NO_FATAL_FAILURE(enqueueKernels(num_kernels));
+  cl_int result = -1;
+  const cl_int error =
+      clEnqueueReadBuffer(command_queue, outMem, CL_TRUE, 0, sizeof(cl_int),
+                          &result, 0, nullptr, nullptr);
+  std::printf("host\n");
+  stdout_capture.RestoreStdout();
+  const std::string output = stdout_capture.ReadBuffer();
+  ASSERT_SUCCESS(error);
+  EXPECT_EQ(num_kernels - 1, result);
+  EXPECT_EQ(expectedOutput(num_kernels), output);
+}
+
+TEST_F(printfOrderingTest, BlockingMap) {
+  stdout_capture.CaptureStdout();
+  ASSERT_NO_FATAL_FAILURE(enqueueKernels(num_kernels));
+  cl_int error = CL_SUCCESS;
+  auto *mapped = static_cast<cl_int *>(
+      clEnqueueMapBuffer(command_queue, outMem, CL_TRUE, CL_MAP_READ, 0,
+                         sizeof(cl_int), 0, nullptr, nullptr, &error));
+  std::printf("host\n");
+  stdout_capture.RestoreStdout();
+  const std::string output = stdout_capture.ReadBuffer();
+  ASSERT_SUCCESS(error);
+  EXPECT_EQ(num_kernels - 1, *mapped);
+  EXPECT_EQ(expectedOutput(num_kernels), output);
+  ASSERT_SUCCESS(clEnqueueUnmapMemObject(command_queue, outMem, mapped, 0,
+                                         nullptr, nullptr));
+  ASSERT_SUCCESS(clFinish(command_queue));
+}
@@ -22,7 +22,9 @@
 #define UR_CONTEXT_H_INCLUDED
 
 #include <cassert>
+#include <memory>
 #include <mutex>
+#include <shared_mutex>
 
 #include "cargo/array_view.h"
 #include "cargo/dynamic_array.h"
@@ -203,17 +205,41 @@ struct ur_context_handle_t_ : ur::base {
     return std::distance(std::begin(devices), it);
   }
 
-  ur::allocation_info *findUSMAllocation(const void *base_ptr);
+  /// @brief Find the USM allocation containing a pointer.
+  ///
+  /// `usm_allocations` is kept sorted by base address and allocations never
+  /// overlap, so this is a binary search taking a shared lock on `mutex`.
+  ///
+  /// @param[in] ptr Pointer anywhere inside a USM allocation.
+  ///
+  /// @return The owning allocation, or `nullptr` if there is none.
+  ur::allocation_info *findUSMAllocation(const void *ptr);
+
+  /// @brief Take ownership of a USM allocation, maintaining address order.
+  ///
+  /// @param[in] usm_alloc Allocation to insert, must already be allocated.
+  ///
+  /// @return `UR_RESULT_SUCCESS` or `UR_RESULT_ERROR_OUT_OF_HOST_MEMORY`.
+  ur_result_t insertUSMAllocation(
+      std::unique_ptr<ur::allocation_info> usm_alloc);
+
+  /// @brief Destroy the USM allocation starting at @p base_ptr.
+  ///
+  /// @param[in] base_ptr Pointer returned when the allocation was made.
+  ///
+  /// @return `UR_RESULT_SUCCESS` or `UR_RESULT_ERROR_INVALID_MEM_OBJECT`.
+  ur_result_t eraseUSMAllocation(const void *base_ptr);
 
   /// @brief The platform to which this context belongs.
   ur_platform_handle_t platform = nullptr;
   /// @brief The Devices in this context, the order of these is important and
   /// must remain invariant since it is used to lookup device specific buffers.
   cargo::small_vector<ur_device_handle_t, 4> devices;
-  /// @brief List of allocations made through the USM extension entry points.
+  /// @brief List of allocations made through the USM extension entry points,
+  /// sorted by base address.
   cargo::small_vector<std::unique_ptr<ur::allocation_info>, 1> usm_allocations;
-  /// @brief Mutex to lock when pushing to queued_commands
-  std::mutex mutex;
+  /// @brief Mutex guarding `usm_allocations`, lookups take a shared lock.
+  std::shared_mutex mutex;
 };
 
 #endif  // UR_CONTEXT_H_INCLUDED
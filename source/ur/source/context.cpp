@@ -18,6 +18,7 @@
 
 #include <algorithm>
 #include <cassert>
+#include <functional>
 
 #include "ur/device.h"
 #include "ur/platform.h"
@@ -197,24 +198,66 @@ cargo::expected<ur_context_handle_t, ur_result_t> ur_context_handle_t_::create(
   return context.release();
 }
 
-ur::allocation_info *ur_context_handle_t_::findUSMAllocation(
-    const void *base_ptr) {
-  if (!base_ptr) {
+namespace {
+/// @brief Orders USM allocations by base address.
+struct base_ptr_less {
+  bool operator()(const void *ptr,
+                  const std::unique_ptr<ur::allocation_info> &usm_alloc) const {
+    return std::less<const void *>{}(ptr, usm_alloc->base_ptr);
+  }
+  bool operator()(const std::unique_ptr<ur::allocation_info> &usm_alloc,
+                  const void *ptr) const {
+    return std::less<const void *>{}(usm_alloc->base_ptr, ptr);
+  }
+};
+}  // namespace
+
+ur::allocation_info *ur_context_handle_t_::findUSMAllocation(const void *ptr) {
+  if (!ptr) {
     return nullptr;
   }
 
-  std::lock_guard<std::mutex> lock(mutex);
-  auto result =
-      std::find_if(usm_allocations.begin(), usm_allocations.end(),
-                   [base_ptr](std::unique_ptr<ur::allocation_info> &ptr) {
-                     return ptr->base_ptr == base_ptr;
-                   });
-  if (result == usm_allocations.end()) {
+  std::shared_lock<std::shared_mutex> lock(mutex);
+  // The only allocation which can contain ptr is the last one starting at or
+  // before it.
+  auto result = std::upper_bound(usm_allocations.begin(),
+                                 usm_allocations.end(), ptr, base_ptr_less{});
+  if (result == usm_allocations.begin()) {
+    return nullptr;
+  }
+  --result;
+  auto offset = reinterpret_cast<uintptr_t>(ptr) -
+                reinterpret_cast<uintptr_t>((*result)->base_ptr);
+  if (offset >= (*result)->size) {
     return nullptr;
   }
   return result->get();
 }
 
+ur_result_t ur_context_handle_t_::insertUSMAllocation(
+    std::unique_ptr<ur::allocation_info> usm_alloc) {
+  std::lock_guard<std::shared_mutex> lock(mutex);
+  auto position =
+      std::upper_bound(usm_allocations.begin(), usm_allocations.end(),
+                       usm_alloc->base_ptr, base_ptr_less{});
+  if (!usm_allocations.insert(position, std::move(usm_alloc))) {
+    return UR_RESULT_ERROR_OUT_OF_HOST_MEMORY;
+  }
+  return UR_RESULT_SUCCESS;
+}
+
+ur_result_t ur_context_handle_t_::eraseUSMAllocation(const void *base_ptr) {
+  std::lock_guard<std::shared_mutex> lock(mutex);
+  auto result = std::lower_bound(usm_allocations.begin(),
+                                 usm_allocations.end(), base_ptr,
+                                 base_ptr_less{});
+  if (result == usm_allocations.end() || (*result)->base_ptr != base_ptr) {
+    return UR_RESULT_ERROR_INVALID_MEM_OBJECT;
+  }
+  usm_allocations.erase(result);
+  return UR_RESULT_SUCCESS;
+}
+
 UR_APIEXPORT ur_result_t UR_APICALL
 urContextCreate(uint32_t DeviceCount, const ur_device_handle_t *phDevices,
                 const ur_context_properties_t *pProperties,
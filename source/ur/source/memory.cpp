@@ -244,16 +244,16 @@ UR_APIEXPORT ur_result_t UR_APICALL urUSMHostAlloc(ur_context_handle_t hContext,
     flags = pUSMDesc->flags;
   }
 
-  std::lock_guard<std::mutex> lock_guard(hContext->mutex);
   auto host_allocation =
       std::make_unique<ur::host_allocation_info>(hContext, flags, size, align);
   if (host_allocation->allocate()) {
     return UR_RESULT_ERROR_OUT_OF_HOST_MEMORY;
   }
-  if (hContext->usm_allocations.push_back(std::move(host_allocation))) {
-    return UR_RESULT_ERROR_OUT_OF_HOST_MEMORY;
+  void *base_ptr = host_allocation->base_ptr;
+  if (auto error = hContext->insertUSMAllocation(std::move(host_allocation))) {
+    return error;
   }
-  *pptr = hContext->usm_allocations.back()->base_ptr;
+  *pptr = base_ptr;
 
   return UR_RESULT_SUCCESS;
 }
@@ -268,21 +268,7 @@ UR_APIEXPORT ur_result_t UR_APICALL urUSMFree(ur_context_handle_t hContext,
     return UR_RESULT_ERROR_INVALID_NULL_POINTER;
   }
 
-  auto is_usm_ptr = [&](const std::unique_ptr<ur::allocation_info> &usm_alloc) {
-    return usm_alloc->base_ptr == ptr;
-  };
-
-  std::lock_guard<std::mutex> lock_guard(hContext->mutex);
-  auto usm_alloc_iterator =
-      std::find_if(hContext->usm_allocations.begin(),
-                   hContext->usm_allocations.end(), is_usm_ptr);
-  if (usm_alloc_iterator == hContext->usm_allocations.end()) {
-    return UR_RESULT_ERROR_INVALID_MEM_OBJECT;
-  }
-
-  hContext->usm_allocations.erase(usm_alloc_iterator);
-
-  return UR_RESULT_SUCCESS;
+  return hContext->eraseUSMAllocation(ptr);
 }
 
 UR_APIEXPORT ur_result_t UR_APICALL
@@ -325,17 +311,18 @@ urUSMDeviceAlloc(ur_context_handle_t hContext, ur_device_handle_t device,
     flags = pUSMDesc->flags;
   }
 
-  std::lock_guard<std::mutex> lock_guard(hContext->mutex);
   auto device_allocation = std::make_unique<ur::device_allocation_info>(
       hContext, device, flags, size, align);
   if (device_allocation->allocate()) {
     return UR_RESULT_ERROR_OUT_OF_HOST_MEMORY;
   }
 
-  if (hContext->usm_allocations.push_back(std::move(device_allocation))) {
-    return UR_RESULT_ERROR_OUT_OF_HOST_MEMORY;
+  void *base_ptr = device_allocation->base_ptr;
+  if (auto error =
+          hContext->insertUSMAllocation(std::move(device_allocation))) {
+    return error;
   }
-  *pptr = hContext->usm_allocations.back()->base_ptr;
+  *pptr = base_ptr;
 
   return UR_RESULT_SUCCESS;
 }
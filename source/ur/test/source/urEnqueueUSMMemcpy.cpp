@@ -74,6 +74,40 @@ TEST_P(urEnqueueUSMMemcpyTest, Success) {
   ASSERT_SUCCESS(urUSMFree(context, device_src));
 }
 
+TEST_P(urEnqueueUSMMemcpyTest, SuccessOffset) {
+  // Pointers into the middle of an allocation must resolve to the allocation
+  // containing them and copy at the correct offset.
+  constexpr size_t count = 4;
+  int *device_dst = nullptr, *device_src = nullptr;
+  ASSERT_SUCCESS(urUSMDeviceAlloc(context, device, nullptr, nullptr,
+                                  sizeof(int) * count, 0,
+                                  reinterpret_cast<void **>(&device_dst)));
+  ASSERT_SUCCESS(urUSMDeviceAlloc(context, device, nullptr, nullptr,
+                                  sizeof(int) * count, 0,
+                                  reinterpret_cast<void **>(&device_src)));
+
+  ur_event_handle_t event = nullptr;
+  int zero_val = 0, one_val = 1;
+  ASSERT_SUCCESS(urEnqueueUSMFill(queue, device_dst, sizeof(zero_val),
+                                  &zero_val, sizeof(int) * count, 0, nullptr,
+                                  nullptr));
+  ASSERT_SUCCESS(urEnqueueUSMFill(queue, device_src + 1, sizeof(one_val),
+                                  &one_val, sizeof(int), 0, nullptr, nullptr));
+  ASSERT_SUCCESS(urEnqueueUSMMemcpy(queue, false, device_dst + 2,
+                                    device_src + 1, sizeof(int), 0, nullptr,
+                                    &event));
+  EXPECT_SUCCESS(urQueueFlush(queue));
+  EXPECT_SUCCESS(urEventWait(1, &event));
+  EXPECT_SUCCESS(urEventRelease(event));
+
+  ASSERT_EQ(0, device_dst[1]);
+  ASSERT_EQ(1, device_dst[2]);
+  ASSERT_EQ(0, device_dst[3]);
+
+  ASSERT_SUCCESS(urUSMFree(context, device_dst));
+  ASSERT_SUCCESS(urUSMFree(context, device_src));
+}
+
 TEST_P(urEnqueueUSMMemcpyTest, InvalidNullQueueHandle) {
   int *dst = nullptr, *src = nullptr;
   ASSERT_SUCCESS(urUSMDeviceAlloc(context, device, nullptr, nullptr,